@@ -0,0 +1,77 @@
+//
+// Asynchronous pricing: jobs submitted to a worker pool, answered by futures, with cancellation and deadlines.
+//
+
+#ifndef ACADIA_INTERVIEW_ASYNCPRICER_H
+#define ACADIA_INTERVIEW_ASYNCPRICER_H
+
+#include <chrono>
+#include <future>
+#include <utility>
+#include "Cancellation.h"
+#include "Parallel.h"
+#include "PricingEngine.h"
+
+/**
+ * A pricing to run asynchronously: trade, market data, dividends and the number of steps (0 for the engine default).
+ */
+struct PricingJob{
+    Environment env;
+    Option option;
+    DividendSchedule dividends;
+    unsigned steps{0};
+    bool greeks{true}; // price only when false: the result has no Greeks and no standard error
+};
+
+/**
+ * Handle of a submitted job: the future result, which holds a PricingCancelled once the job was cancelled or its
+ * deadline passed, and the token cancelling it.
+ */
+struct PricingTicket{
+    std::future<PricingResult> result;
+    CancellationToken token;
+    void cancel() const {token.cancel();}
+};
+
+/**
+ * Runs pricing jobs on its own worker pool. Every job runs in the CancellationScope of its token: the induction loops
+ * of the engines check it every cancellationInterval levels, so a cancelled or expired job stops within a few levels
+ * and frees its worker, and a job cancelled or expired while queued does not start. Jobs are answered in any order.
+ */
+class AsyncPricer{
+private:
+    WorkerPool pool;
+public:
+    /**
+     * @param threads number of workers, 0 for all the cores.
+     */
+    explicit AsyncPricer(unsigned threads = 0): pool(threads){}
+    /**
+     * Queues a job priced by engine, which must outlive the job.
+     * @param token cancels the job, and gives its deadline if any.
+     */
+    PricingTicket submit(PricingEngine const& engine, PricingJob job, CancellationToken token = CancellationToken()){
+        auto result = pool.submit([&engine, job = std::move(job), token]{
+            token.check();
+            CancellationScope scope(&token);
+            if (job.greeks) return engine.priceWithGreeks(job.env, job.option, job.dividends, job.steps);
+            auto start = std::chrono::steady_clock::now();
+            PricingResult res;
+            res.steps = job.steps>0 ? job.steps : engine.defaultSteps(job.option);
+            res.price = engine.price(job.env, job.option, job.dividends, res.steps);
+            res.engine = engine.info().name;
+            res.elapsedMicroseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now()-start).count();
+            return res;
+        });
+        return {std::move(result), std::move(token)};
+    }
+    /**
+     * Queues a job that expires timeout after its submission.
+     */
+    PricingTicket submit(PricingEngine const& engine, PricingJob job, std::chrono::nanoseconds timeout){
+        return submit(engine, std::move(job), CancellationToken(CancellationToken::Clock::now()+timeout));
+    }
+    [[nodiscard]] std::size_t threads() const {return pool.size();}
+};
+
+#endif //ACADIA_INTERVIEW_ASYNCPRICER_H
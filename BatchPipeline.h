@@ -0,0 +1,885 @@
+//
+// Streaming batch pricing of trade files: parse -> price -> write stages over bounded queues.
+//
+
+#ifndef ACADIA_INTERVIEW_BATCHPIPELINE_H
+#define ACADIA_INTERVIEW_BATCHPIPELINE_H
+
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <charconv>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <istream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "ConfigParser.h"
+#include "CostModel.h"
+#include "NumaMemory.h"
+#include "Parallel.h"
+#include "PricingEngine.h"
+
+/**
+ * Blocking FIFO queue holding at most capacity items: producers wait while it is full (backpressure), consumers wait
+ * while it is empty. Once closed, pushes fail and pops drain the remaining items.
+ */
+template<class T>
+class BoundedQueue{
+private:
+    std::deque<T> items;
+    std::size_t capacity;
+    bool closed{false};
+    std::mutex mutex;
+    std::condition_variable notFull, notEmpty;
+public:
+    explicit BoundedQueue(std::size_t capacity): capacity(std::max<std::size_t>(capacity, 1)){}
+    /**
+     * @return false if the queue was closed, the item is then dropped.
+     */
+    bool push(T item){
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this]{return closed || items.size()<capacity;});
+        if (closed) return false;
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+    /**
+     * @return the oldest item, nothing once the queue is closed and empty.
+     */
+    std::optional<T> pop(){
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this]{return closed || !items.empty();});
+        if (items.empty()) return std::nullopt;
+        T item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return item;
+    }
+    void close(){
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+};
+
+enum class TradeFileFormat{Csv, Jsonl};
+
+constexpr std::uint32_t noEnvironment = std::numeric_limits<std::uint32_t>::max();
+
+/**
+ * One trade of a batch file, with its market data. The field names are the keys of the single-trade input file
+ * (S-T0-Price, volatility, risk-free-rate, average-dividends-per-year, continuously-yield-dividend, strike,
+ * days-to-maturity, callput, european), plus the optional id, engine (a registry name), steps and dividends (a sparse
+ * dividend schedule, blank-separated day:count pairs such as "180:1 545:1"). The market data may instead come from a
+ * named environment of the file, referenced by the environment field.
+ */
+struct BatchTrade{
+    std::size_t index{0}; // position in the file, 0-based
+    std::string id;
+    Environment env;
+    std::uint32_t environment{noEnvironment}; // index of the named environment of env, noEnvironment if given inline
+    Option option;
+    std::string engine; // empty for the default engine of the batch
+    unsigned steps{0};
+    std::vector<DividendEvent> dividends; // empty to draw the dividends from the stream of the trade
+    std::string error; // set when the row could not be parsed
+};
+
+/**
+ * Checks the fields of a trade that no engine can price, for every trade file format.
+ * @throw std::invalid_argument naming the first invalid field.
+ */
+inline void checkTradeFields(BatchTrade const& trade){
+    if (trade.option.getTimeToMaturity()<1) throw std::invalid_argument("days-to-maturity must be positive.");
+    if (!(trade.option.getStrike()>0)) throw std::invalid_argument("strike must be positive.");
+    if (!(trade.env.underlyingT0Price>0)) throw std::invalid_argument("S-T0-Price must be positive.");
+}
+
+/**
+ * @return the dividend schedule of a trade, or the structure drawn from the stream (seed, index) if it has none.
+ */
+inline DividendSchedule batchDividends(BatchTrade const& trade, std::uint64_t seed){
+    if (!trade.dividends.empty()) return DividendSchedule(trade.dividends);
+    PhiloxStream rng(seed, static_cast<std::uint32_t>(trade.index));
+    return sampleDividendStructure(trade.env, trade.option.getTimeToMaturity(), rng, nullptr);
+}
+
+/**
+ * Trades priced together: same engine, steps, maturity, market data and dividend schedule, so that they share one
+ * lattice geometry and power table and, with the binomial engines, one backward induction per bump of the Greeks
+ * (PricingEngine::priceGroupWithGreeks). A trade that failed to parse is alone in its group.
+ */
+struct BatchGroup{
+    std::vector<BatchTrade> trades;
+    DividendSchedule dividends;
+};
+
+/**
+ * Splits trades into groups of at most maxGroupSize trades, in the order of their first trade; trades keep their
+ * order within a group. Trades on the same named environment, or on equal inline market data, can be grouped.
+ */
+inline std::vector<BatchGroup> groupTrades(std::vector<BatchTrade>&& trades, std::string const& defaultEngine,
+                                           unsigned defaultSteps, std::uint64_t seed, std::size_t maxGroupSize){
+    struct Key{
+        std::string engine;
+        unsigned steps, days;
+        Environment env;
+        DividendSchedule dividends;
+        bool operator==(Key const& other) const {
+            return engine==other.engine && steps==other.steps && days==other.days &&
+                   env.underlyingT0Price==other.env.underlyingT0Price && env.volatility==other.env.volatility &&
+                   env.riskFreeRate==other.env.riskFreeRate && env.q==other.env.q &&
+                   env.averageDividendsPerYear==other.env.averageDividendsPerYear && dividends==other.dividends;
+        }
+    };
+    struct KeyHash{
+        std::size_t operator()(Key const& key) const {
+            std::size_t res = key.dividends.hash();
+            hashCombine(res, std::hash<std::string>()(key.engine));
+            hashCombine(res, key.steps);
+            hashCombine(res, key.days);
+            for (double field : {key.env.underlyingT0Price, key.env.volatility, key.env.riskFreeRate, key.env.q,
+                                 key.env.averageDividendsPerYear}) hashCombine(res, field);
+            return res;
+        }
+    };
+    std::vector<BatchGroup> groups;
+    std::unordered_map<Key, std::size_t, KeyHash> open; // last group of every key
+    for (auto& trade : trades){
+        if (!trade.error.empty()){
+            groups.push_back({{}, {}});
+            groups.back().trades.push_back(std::move(trade));
+            continue;
+        }
+        Key key{trade.engine.empty() ? defaultEngine : trade.engine, trade.steps>0 ? trade.steps : defaultSteps,
+                trade.option.getTimeToMaturity(), trade.env, batchDividends(trade, seed)};
+        auto found = open.find(key);
+        if (found==open.end() || groups[found->second].trades.size()>=maxGroupSize){
+            groups.push_back({{}, key.dividends});
+            found = open.insert_or_assign(std::move(key), groups.size()-1).first;
+        }
+        groups[found->second].trades.push_back(std::move(trade));
+    }
+    return groups;
+}
+
+/**
+ * Prices a trade with Greeks with the engine of the trade, or the default one, on the given dividends.
+ */
+inline PricingResult priceBatchTrade(BatchTrade const& trade, DividendSchedule const& dividends,
+                                     EngineRegistry const& registry, std::string const& defaultEngine,
+                                     unsigned defaultSteps){
+    auto const& engine = registry.get(trade.engine.empty() ? defaultEngine : trade.engine);
+    return engine.priceWithGreeks(trade.env, trade.option, dividends, trade.steps>0 ? trade.steps : defaultSteps);
+}
+
+/**
+ * Prices a group with Greeks with the engine of its trades, or the default one.
+ * @param results receives one result per trade.
+ */
+inline void priceBatchGroup(BatchGroup const& group, EngineRegistry const& registry, std::string const& defaultEngine,
+                            unsigned defaultSteps, std::vector<PricingResult>& results){
+    auto const& first = group.trades.front();
+    auto const& engine = registry.get(first.engine.empty() ? defaultEngine : first.engine);
+    std::vector<Option> options;
+    for (auto const& trade : group.trades) options.push_back(trade.option);
+    results.resize(options.size());
+    engine.priceGroupWithGreeks(first.env, options.data(), options.size(), group.dividends,
+                                first.steps>0 ? first.steps : defaultSteps, results.data());
+}
+
+/**
+ * Sequential reader of the trades of a CSV file (first row: field names, no quoted fields) or of a JSONL file (one
+ * flat JSON object per line). Blank lines and lines starting with # are skipped.
+ * Rows with a market field define named environment blocks (market data: S-T0-Price, volatility, risk-free-rate and
+ * optionally average-dividends-per-year and continuously-yield-dividend) that the trades after them reference with
+ * their environment field instead of repeating the market data. In a CSV file a line starting with @ is a new header,
+ * so a table of environments can precede the table of trades. Rows are tokenized in place: field
+ * names are resolved with the perfect hash of the configuration keys and numbers with std::from_chars, so reading a
+ * trade does not allocate beyond its id. An unknown field name in the CSV header fails the file; a malformed row
+ * yields a trade with an error rather than stopping the batch.
+ */
+class TradeFileReader{
+private:
+    std::istream& in;
+    TradeFileFormat format;
+    std::vector<ConfigKey> columns;
+    std::size_t index{0};
+    std::string line;
+    std::vector<std::pair<ConfigKey, std::string_view>> fields; // views of line
+    std::vector<std::pair<std::string, Environment>> environments;
+    std::unordered_map<std::string, std::uint32_t> environmentIndex;
+public:
+    TradeFileReader(std::istream& in, TradeFileFormat format): in(in), format(format){}
+    /**
+     * @return false at the end of the file.
+     */
+    bool next(BatchTrade& trade){
+        while (std::getline(in, line)){
+            auto text = trimBlanks(line);
+            if (text.empty() || text.front()=='#') continue;
+            if (format==TradeFileFormat::Csv && (columns.empty() || text.front()=='@')){
+                readHeader(text.front()=='@' ? text.substr(1) : text);
+                continue;
+            }
+            trade.id.clear();
+            trade.engine.clear();
+            trade.error.clear();
+            trade.steps = 0;
+            trade.dividends.clear();
+            trade.env = Environment();
+            trade.environment = noEnvironment;
+            std::size_t count{0};
+            try {
+                count = format==TradeFileFormat::Csv ? csvFields(text) : jsonFields(text);
+            } catch (std::exception const& error) {
+                fields.clear();
+                trade.error = error.what();
+            }
+            bool market{false};
+            for (auto const& [key, value] : fields) market |= key==ConfigKey::Market;
+            if (market){
+                checkFieldCount(count);
+                defineEnvironment();
+                continue;
+            }
+            try {
+                for (auto const& [key, value] : fields) if (key==ConfigKey::Id) trade.id = value; // reported with any error
+                if (trade.error.empty()){
+                    checkFieldCount(count);
+                    parseTrade(trade);
+                }
+            } catch (std::exception const& error) {
+                trade.error = error.what();
+            }
+            trade.index = index++;
+            if (trade.id.empty()) trade.id = std::to_string(trade.index);
+            return true;
+        }
+        return false;
+    }
+    /**
+     * @return the environments defined so far, in the order of the file: trade.environment indexes them.
+     */
+    [[nodiscard]] std::vector<std::pair<std::string, Environment>> const& getEnvironments() const {return environments;}
+    /**
+     * @return the format of a file name: JSONL for the .jsonl and .json extensions, CSV otherwise.
+     */
+    static TradeFileFormat formatOf(std::string const& fileName){
+        auto dot = fileName.rfind('.');
+        auto extension = dot==std::string::npos ? std::string() : fileName.substr(dot);
+        return extension==".jsonl" || extension==".json" ? TradeFileFormat::Jsonl : TradeFileFormat::Csv;
+    }
+private:
+    /**
+     * Calls field for every comma-separated field of text, trimmed.
+     * @return number of fields.
+     */
+    template<class Field>
+    static std::size_t forEachCsvField(std::string_view text, Field&& field){
+        std::size_t count{0};
+        while (true){
+            auto comma = text.find(',');
+            field(count++, trimBlanks(text.substr(0, comma)));
+            if (comma==std::string_view::npos) return count;
+            text.remove_prefix(comma+1);
+        }
+    }
+    void readHeader(std::string_view text){
+        columns.clear();
+        forEachCsvField(text, [this](std::size_t, std::string_view name){
+            auto key = findConfigKey(name);
+            if (!key) throw std::invalid_argument("Unknown field " + std::string(name) + " in the CSV header.");
+            columns.push_back(*key);
+        });
+    }
+    /**
+     * Fills fields with the values of a row, the values beyond the last column are counted but dropped.
+     * @return number of values.
+     */
+    std::size_t csvFields(std::string_view text){
+        fields.clear();
+        return forEachCsvField(text, [this](std::size_t k, std::string_view value){
+            if (k<columns.size()) fields.emplace_back(columns[k], value);
+        });
+    }
+    /**
+     * Fills fields with the members of a flat JSON object of strings, numbers and booleans. Escaped strings are
+     * unescaped in place, in line.
+     * @return number of members.
+     */
+    std::size_t jsonFields(std::string_view text){
+        fields.clear();
+        char* base = line.data() + (text.data()-line.data());
+        std::size_t pos{0};
+        auto skip = [&]{while (pos<text.size() && std::isspace(static_cast<unsigned char>(text[pos]))) pos++;};
+        auto expect = [&](char c){
+            skip();
+            if (pos>=text.size() || text[pos]!=c) throw std::invalid_argument(std::string("Expected '") + c + "' in JSON.");
+            pos++;
+        };
+        auto string = [&]{
+            expect('"');
+            std::size_t begin{pos}, end{pos};
+            while (pos<text.size() && text[pos]!='"'){
+                if (text[pos]=='\\' && pos+1<text.size()) pos++;
+                base[end++] = text[pos++];
+            }
+            if (pos>=text.size()) throw std::invalid_argument("Unterminated string in JSON.");
+            pos++;
+            return std::string_view(base+begin, end-begin);
+        };
+        expect('{');
+        skip();
+        if (pos<text.size() && text[pos]=='}') return 0;
+        while (true){
+            auto name = string();
+            auto key = findConfigKey(name);
+            if (!key) throw std::invalid_argument("Unknown field " + std::string(name) + ".");
+            expect(':');
+            skip();
+            if (pos<text.size() && text[pos]=='"'){
+                fields.emplace_back(*key, string());
+            } else {
+                auto end = text.find_first_of(",} \t", pos);
+                if (end==std::string_view::npos || end==pos)
+                    throw std::invalid_argument("Missing value of " + std::string(name) + " in JSON.");
+                fields.emplace_back(*key, text.substr(pos, end-pos));
+                pos = end;
+            }
+            skip();
+            if (pos<text.size() && text[pos]==','){
+                pos++;
+                continue;
+            }
+            expect('}');
+            return fields.size();
+        }
+    }
+    static double number(ConfigKey key, std::string_view value){
+        double res{0};
+        if (!parseNumber(value, res))
+            throw std::invalid_argument("Invalid value '" + std::string(value) + "' of " +
+                                        std::string(configKeyNames[static_cast<std::size_t>(key)]) + ".");
+        return res;
+    }
+    /**
+     * Parses blank-separated day:count pairs.
+     */
+    static void parseDividends(std::string_view text, std::vector<DividendEvent>& events){
+        text = trimBlanks(text);
+        while (!text.empty()){
+            auto end = text.find_first_of(" \t");
+            auto pair = text.substr(0, end);
+            auto colon = pair.find(':');
+            DividendEvent event;
+            bool valid = colon!=std::string_view::npos;
+            if (valid){
+                auto day = std::from_chars(pair.data(), pair.data()+colon, event.day);
+                auto count = std::from_chars(pair.data()+colon+1, pair.data()+pair.size(), event.count);
+                valid = day.ec==std::errc() && day.ptr==pair.data()+colon && count.ec==std::errc() &&
+                        count.ptr==pair.data()+pair.size();
+            }
+            if (!valid) throw std::invalid_argument("Invalid dividend '" + std::string(pair) + "', expected day:count.");
+            events.push_back(event);
+            text = trimBlanks(text.substr(pair.size()));
+        }
+    }
+    void checkFieldCount(std::size_t count) const {
+        if (format==TradeFileFormat::Csv && count!=columns.size())
+            throw std::invalid_argument("Expected " + std::to_string(columns.size()) + " fields, found " +
+                                        std::to_string(count) + ".");
+    }
+    /**
+     * Defines the environment of a row with a market field, an environment block: its name and market data. A
+     * malformed block fails the file, as all the trades referencing it would fail.
+     */
+    void defineEnvironment(){
+        std::string name;
+        std::array<double, configKeyCount> values{};
+        std::bitset<configKeyCount> present;
+        for (auto const& [key, value] : fields){
+            if (key==ConfigKey::Market) name = value;
+        }
+        auto fail = [&name](std::string const& message){
+            throw std::invalid_argument("Environment " + name + ": " + message);
+        };
+        for (auto const& [key, value] : fields){
+            switch (key){
+                case ConfigKey::Market: break;
+                case ConfigKey::RiskFreeRate: case ConfigKey::SpotPrice: case ConfigKey::Volatility:
+                case ConfigKey::AverageDividendsPerYear: case ConfigKey::DividendYield:
+                    if (!parseNumber(value, values[static_cast<std::size_t>(key)]))
+                        fail("invalid value '" + std::string(value) + "' of " +
+                             std::string(configKeyNames[static_cast<std::size_t>(key)]) + ".");
+                    present.set(static_cast<std::size_t>(key));
+                    break;
+                default:
+                    fail(std::string(configKeyNames[static_cast<std::size_t>(key)]) + " is not a field of an environment.");
+            }
+        }
+        if (name.empty()) fail("the market field must name the environment.");
+        for (auto key : {ConfigKey::SpotPrice, ConfigKey::Volatility, ConfigKey::RiskFreeRate}){
+            if (!present.test(static_cast<std::size_t>(key)))
+                fail("missing " + std::string(configKeyNames[static_cast<std::size_t>(key)]) + ".");
+        }
+        Environment env;
+        env.underlyingT0Price = values[static_cast<std::size_t>(ConfigKey::SpotPrice)];
+        env.volatility = values[static_cast<std::size_t>(ConfigKey::Volatility)];
+        env.riskFreeRate = values[static_cast<std::size_t>(ConfigKey::RiskFreeRate)];
+        env.averageDividendsPerYear = values[static_cast<std::size_t>(ConfigKey::AverageDividendsPerYear)];
+        env.q = values[static_cast<std::size_t>(ConfigKey::DividendYield)];
+        if (!environmentIndex.emplace(name, static_cast<std::uint32_t>(environments.size())).second)
+            fail("defined twice.");
+        environments.emplace_back(name, env);
+    }
+    void parseTrade(BatchTrade& trade) const {
+        std::array<double, configKeyCount> values{};
+        std::bitset<configKeyCount> present;
+        std::string_view environment;
+        for (auto const& [key, value] : fields){
+            switch (key){
+                case ConfigKey::Id: break;
+                case ConfigKey::Engine: trade.engine = value; break;
+                case ConfigKey::Dividends: parseDividends(value, trade.dividends); break;
+                case ConfigKey::EnvironmentName: environment = value; break;
+                case ConfigKey::RiskFreeRate: case ConfigKey::SpotPrice: case ConfigKey::Volatility:
+                case ConfigKey::AverageDividendsPerYear: case ConfigKey::DividendYield: case ConfigKey::CallPut:
+                case ConfigKey::European: case ConfigKey::Strike: case ConfigKey::DaysToMaturity: case ConfigKey::Steps:
+                    values[static_cast<std::size_t>(key)] = number(key, value);
+                    present.set(static_cast<std::size_t>(key));
+                    break;
+                default:
+                    throw std::invalid_argument(std::string(configKeyNames[static_cast<std::size_t>(key)]) +
+                                                " is not a field of a trade.");
+            }
+        }
+        std::string missing;
+        auto require = [&](ConfigKey key){
+            if (!present.test(static_cast<std::size_t>(key)))
+                missing += (missing.empty() ? "" : ", ") + std::string(configKeyNames[static_cast<std::size_t>(key)]);
+        };
+        if (environment.empty()){
+            for (auto key : {ConfigKey::SpotPrice, ConfigKey::Volatility, ConfigKey::RiskFreeRate}) require(key);
+        }
+        for (auto key : {ConfigKey::Strike, ConfigKey::DaysToMaturity}) require(key);
+        if (!missing.empty()) throw std::invalid_argument("Missing fields: " + missing + ".");
+        auto value = [&](ConfigKey key){return values[static_cast<std::size_t>(key)];};
+        if (value(ConfigKey::DaysToMaturity)<1) throw std::invalid_argument("days-to-maturity must be positive.");
+        trade.steps = static_cast<unsigned>(value(ConfigKey::Steps));
+        if (!environment.empty()){
+            for (auto key : {ConfigKey::SpotPrice, ConfigKey::Volatility, ConfigKey::RiskFreeRate,
+                             ConfigKey::AverageDividendsPerYear, ConfigKey::DividendYield}){
+                if (present.test(static_cast<std::size_t>(key)))
+                    throw std::invalid_argument(std::string(configKeyNames[static_cast<std::size_t>(key)]) +
+                                                " is given by environment " + std::string(environment) + ".");
+            }
+            auto found = environmentIndex.find(std::string(environment));
+            if (found==environmentIndex.end())
+                throw std::invalid_argument("Unknown environment " + std::string(environment) + ".");
+            trade.environment = found->second;
+            trade.env = environments[found->second].second;
+        } else {
+            trade.env.underlyingT0Price = value(ConfigKey::SpotPrice);
+            trade.env.volatility = value(ConfigKey::Volatility);
+            trade.env.riskFreeRate = value(ConfigKey::RiskFreeRate);
+            trade.env.averageDividendsPerYear = value(ConfigKey::AverageDividendsPerYear);
+            trade.env.q = value(ConfigKey::DividendYield);
+        }
+        trade.option = Option(value(ConfigKey::Strike), static_cast<unsigned>(value(ConfigKey::DaysToMaturity)),
+                              value(ConfigKey::European)>0. ? TradeType::European : TradeType::American,
+                              value(ConfigKey::CallPut)>0. ? CallPut::Call : CallPut::Put);
+        checkTradeFields(trade);
+    }
+};
+
+/**
+ * @return the result line of a trade: a CSV row (id,engine,steps,price,standard-error,delta,gamma,theta,vega,rho,error)
+ * or a JSON object, with the error instead of the results when result is null.
+ */
+inline std::string formatBatchResult(TradeFileFormat format, BatchTrade const& trade, PricingResult const* result,
+                                     std::string const& error){
+    std::ostringstream line;
+    line << std::setprecision(std::numeric_limits<double>::max_digits10);
+    if (format==TradeFileFormat::Csv){
+        line << trade.id << ",";
+        if (result){
+            line << result->engine << "," << result->steps << "," << result->price << "," << result->standardError
+                 << "," << result->greeks.delta << "," << result->greeks.gamma << "," << result->greeks.theta << ","
+                 << result->greeks.vega << "," << result->greeks.rho << ",";
+        } else {
+            line << ",,,,,,,,,";
+        }
+        for (char c : error) line << (c==',' || c=='\n' ? ' ' : c);
+    } else {
+        auto quoted = [](std::string const& text){
+            std::string res = "\"";
+            for (char c : text){
+                if (c=='"' || c=='\\') res += '\\';
+                res += c=='\n' ? ' ' : c;
+            }
+            return res + "\"";
+        };
+        line << "{\"id\":" << quoted(trade.id);
+        if (result){
+            line << ",\"engine\":" << quoted(result->engine) << ",\"steps\":" << result->steps << ",\"price\":"
+                 << result->price << ",\"standard-error\":" << result->standardError << ",\"delta\":"
+                 << result->greeks.delta << ",\"gamma\":" << result->greeks.gamma << ",\"theta\":"
+                 << result->greeks.theta << ",\"vega\":" << result->greeks.vega << ",\"rho\":" << result->greeks.rho;
+        } else {
+            line << ",\"error\":" << quoted(error);
+        }
+        line << "}";
+    }
+    return line.str();
+}
+
+struct BatchSettings{
+    std::string engine{"binomial-crr"}; // engine of the trades without an engine field
+    unsigned steps{0}; // steps of the trades without a steps field, 0 for the engine default
+    std::uint64_t seed{defaultRngSeed}; // trade k draws its dividends from the stream (seed, k)
+    unsigned threads{0}; // pricing workers, 0 for all the cores
+    std::size_t queueCapacity{256}; // trades buffered between two stages
+    std::size_t window{4096}; // trades read but not written yet, the bound of the reorder buffer
+    std::size_t groupSize{64}; // trades priced together at most (see BatchGroup), 1 to price them one by one
+    std::shared_ptr<CostModel const> costModel; // predicts the runtime of the groups, null for CostModel::defaults()
+    bool pin{false}; // pins the workers round-robin to the CPUs of the NUMA nodes
+    HugePages hugePages{HugePages::Off}; // pages of the lattices and workspaces of the workers
+};
+
+/**
+ * Worker threads of a batch: a WorkStealingPool of settings.threads threads, pinned to the NUMA nodes with
+ * settings.pin, whose lattices and workspaces come from a HugePageResource of the batch with settings.hugePages
+ * (numaWorkerStart). Their memory is first touched by the worker using it, hence local to its node. Only the workers
+ * use the resource: the other threads, and other batches, keep their own.
+ */
+struct BatchWorkers{
+    std::unique_ptr<HugePageResource> memory; // before the pool: outlives its threads, null with HugePages::Off
+    WorkStealingPool pool;
+    explicit BatchWorkers(BatchSettings const& settings):
+            memory(settings.hugePages==HugePages::Off
+                   ? nullptr : std::make_unique<HugePageResource>(HugePageSettings{settings.hugePages})),
+            pool(settings.threads, numaWorkerStart(settings.pin, memory.get())){}
+};
+
+/**
+ * @return the predicted runtime of a group with Greeks, in microseconds (CostModel::predictJobMicroseconds), 0 for a
+ * group that cannot be priced.
+ */
+inline double predictGroupMicroseconds(BatchGroup const& group, PricingEngine const* engine, unsigned defaultSteps,
+                                       CostModel const& model){
+    if (!engine || !group.trades.front().error.empty()) return 0.;
+    double res{0};
+    for (auto const& trade : group.trades){
+        res += model.predictJobMicroseconds(*engine, trade.option, trade.steps>0 ? trade.steps : defaultSteps, true);
+    }
+    return res;
+}
+
+/**
+ * @return the cost model of a batch: settings.costModel, or the defaults.
+ */
+inline CostModel const& batchCostModel(BatchSettings const& settings){
+    static const CostModel defaults = CostModel::defaults();
+    return settings.costModel ? *settings.costModel : defaults;
+}
+
+/**
+ * Groups submitted to a WorkStealingPool by submitBatchGroups.
+ */
+struct BatchSubmission{
+    std::future<void> priced; // ready once every trade was passed to done, holds the exception thrown by done if any
+    std::size_t splits{0}; // groups split into their bumps
+};
+
+/**
+ * Prices groups with Greeks on the threads of pool with the work-stealing scheduler, longest predicted first
+ * (predictGroupMicroseconds with the cost model of the settings). On more than one thread, a group predicted to cost
+ * more than half the mean load of a thread is split into the bumps of its Greeks (PricingEngine::priceBump), priced as
+ * separate tasks and combined by the last of them, so a long-dated trade does not leave the other threads idle.
+ * Results are those of priceBatchGroup. A group that fails is priced again trade by trade, for the error of every
+ * trade. The tasks own the groups and done; registry and settings must outlive them.
+ * @param done called for every trade with its result, or null and the error, from the pricing threads.
+ */
+template<class Done>
+BatchSubmission submitBatchGroups(WorkStealingPool& pool, std::vector<BatchGroup> groups,
+                                  EngineRegistry const& registry, BatchSettings const& settings, Done done){
+    constexpr unsigned whole = PricingEngine::finiteDifferenceBumps; // bump of a task pricing its whole group
+    struct Split{
+        std::vector<Option> options;
+        std::vector<double> prices; // bump b of option k at b*count+k
+        std::atomic<unsigned> left{PricingEngine::finiteDifferenceBumps};
+        std::atomic<bool> failed{false};
+        std::atomic<long long> nanoseconds{0};
+    };
+    struct Chunk{
+        std::vector<BatchGroup> groups;
+        std::vector<PricingEngine const*> engines;
+        std::vector<std::pair<std::size_t, unsigned>> tasks; // group and bump
+        std::vector<std::unique_ptr<Split>> splits;
+        Done done;
+    };
+    auto chunk = std::make_shared<Chunk>(Chunk{std::move(groups), {}, {}, {}, std::move(done)});
+    auto const& model = batchCostModel(settings);
+    chunk->engines.resize(chunk->groups.size(), nullptr);
+    std::vector<double> groupCosts(chunk->groups.size());
+    double total{0};
+    for (std::size_t g = 0; g < chunk->groups.size(); g++){
+        auto const& first = chunk->groups[g].trades.front();
+        chunk->engines[g] = registry.find(first.engine.empty() ? settings.engine : first.engine);
+        total += groupCosts[g] = predictGroupMicroseconds(chunk->groups[g], chunk->engines[g], settings.steps, model);
+    }
+    auto threads = pool.size();
+    std::vector<double> costs;
+    BatchSubmission res;
+    chunk->splits.resize(chunk->groups.size());
+    for (std::size_t g = 0; g < chunk->groups.size(); g++){
+        bool split = threads>1 && groupCosts[g]>0.5*total/threads && chunk->engines[g]->bumpCount()==whole;
+        if (!split){
+            chunk->tasks.emplace_back(g, whole);
+            costs.push_back(groupCosts[g]);
+            continue;
+        }
+        auto& state = chunk->splits[g] = std::make_unique<Split>();
+        for (auto const& trade : chunk->groups[g].trades) state->options.push_back(trade.option);
+        state->prices.resize(whole*chunk->groups[g].trades.size());
+        for (unsigned bump = 0; bump < whole; bump++){
+            chunk->tasks.emplace_back(g, bump);
+            costs.push_back(groupCosts[g]/whole);
+        }
+        res.splits++;
+    }
+    res.priced = pool.submit(costs, [chunk, &registry, &settings](std::size_t t){
+        auto oneByOne = [&](BatchGroup const& group){
+            for (auto const& trade : group.trades){
+                PricingResult result;
+                std::string error;
+                try {
+                    if (!trade.error.empty()) throw std::invalid_argument(trade.error);
+                    result = priceBatchTrade(trade, group.dividends, registry, settings.engine, settings.steps);
+                } catch (std::exception const& failure) {
+                    error = failure.what();
+                }
+                chunk->done(trade, error.empty() ? &result : nullptr, error);
+            }
+        };
+        auto [g, bump] = chunk->tasks[t];
+        auto const& group = chunk->groups[g];
+        auto const& first = group.trades.front();
+        if (bump==whole){
+            std::vector<PricingResult> results;
+            bool priced{false};
+            if (first.error.empty()){
+                try {
+                    priceBatchGroup(group, registry, settings.engine, settings.steps, results);
+                    priced = true;
+                } catch (std::exception const&) {
+                    // priced again trade by trade below, for the error of every trade
+                }
+            }
+            if (!priced) return oneByOne(group);
+            for (std::size_t k = 0; k < results.size(); k++) chunk->done(group.trades[k], &results[k], std::string());
+            return;
+        }
+        auto& split = *chunk->splits[g];
+        auto const& engine = *chunk->engines[g];
+        auto count = split.options.size();
+        unsigned steps = first.steps>0 ? first.steps : settings.steps;
+        auto start = std::chrono::steady_clock::now();
+        try {
+            engine.priceBump(first.env, split.options.data(), count, group.dividends, steps, bump,
+                             split.prices.data() + bump*count);
+        } catch (std::exception const&) {
+            split.failed = true;
+        }
+        split.nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-start).count();
+        if (--split.left>0) return;
+        if (split.failed) return oneByOne(group);
+        std::array<double const*, whole> bumps{};
+        for (unsigned b = 0; b < whole; b++) bumps[b] = split.prices.data() + b*count;
+        std::vector<PricingResult> results(count);
+        engine.combineBumps(first.env, split.options.data(), count, steps, bumps, results.data());
+        for (std::size_t k = 0; k < count; k++){
+            results[k].elapsedMicroseconds = 1e-3*static_cast<double>(split.nanoseconds.load())/count;
+            chunk->done(group.trades[k], &results[k], std::string());
+        }
+    });
+    return res;
+}
+
+/**
+ * Prices groups as submitBatchGroups on BatchWorkers of its own, and waits for them.
+ * @return number of groups split.
+ */
+template<class Done>
+std::size_t priceBatchGroups(std::vector<BatchGroup> const& groups, EngineRegistry const& registry,
+                             BatchSettings const& settings, Done&& done){
+    BatchWorkers workers(settings);
+    auto submission = submitBatchGroups(workers.pool, groups, registry, settings, std::ref(done));
+    submission.priced.get();
+    return submission.splits;
+}
+
+struct BatchStatistics{
+    std::size_t trades{0};
+    std::size_t errors{0};
+    double elapsedSeconds{0};
+};
+
+/**
+ * Prices every trade of a trade file and writes one result per trade, in the order of the file.
+ *
+ * The reader (one thread), the pricing stage and the writer (the calling thread) are pipeline stages connected by
+ * BoundedQueues, so parsing and writing overlap with pricing and a slow stage blocks the previous ones. Trades are
+ * priced out of order: the writer keeps them in a reorder buffer of window slots, and the reader does not read trade k
+ * before trade k-window has been written. Memory is therefore bounded by the window and the queues, whatever the size
+ * of the file.
+ *
+ * The reader groups the trades of every half window (groupTrades), so trades on the same environment, maturity and
+ * dividends share their lattices and inductions. The pricing stage submits the groups of every half window to the
+ * BatchWorkers that live as long as the batch (submitBatchGroups): longest first, long-dated groups split into
+ * their bumps, and threads done with one half window steal the groups of the next one instead of waiting for its
+ * slowest group.
+ *
+ * Every trade without a dividend schedule is priced with Greeks on a dividend structure drawn from the stream (seed,
+ * k): the results depend neither on the number of workers nor on the grouping. A trade that fails to parse or to
+ * price is written with its error.
+ * The output follows the format of the input: CSV with a header row, or one JSON object per line.
+ */
+inline BatchStatistics runBatch(std::istream& in, std::ostream& out, TradeFileFormat format,
+                                EngineRegistry const& registry, BatchSettings const& settings = {}){
+    if (settings.window==0) throw std::invalid_argument("The reorder window must hold at least one trade.");
+    auto start = std::chrono::steady_clock::now();
+    struct Row{
+        std::size_t index{0};
+        std::string text;
+        bool failed{false};
+    };
+    BoundedQueue<std::vector<BatchGroup>> chunks(1);
+    BoundedQueue<Row> rows(settings.queueCapacity);
+    std::mutex windowMutex;
+    std::condition_variable windowFree;
+    std::size_t written{0};
+    bool cancelled{false};
+    std::exception_ptr readError, priceError;
+    auto cancel = [&]{
+        {
+            std::lock_guard<std::mutex> lock(windowMutex);
+            cancelled = true;
+        }
+        windowFree.notify_all();
+        chunks.close();
+        rows.close();
+    };
+    // before the threads: a pool or memory that cannot be set up fails the batch with nothing to join
+    BatchWorkers workers(settings);
+    std::thread reader([&]{
+        try {
+            TradeFileReader file(in, format);
+            std::size_t chunkSize = std::max<std::size_t>(settings.window/2, 1);
+            std::vector<BatchTrade> chunk;
+            BatchTrade trade;
+            bool more{true};
+            while (more){
+                more = file.next(trade);
+                if (more){
+                    std::unique_lock<std::mutex> lock(windowMutex);
+                    windowFree.wait(lock, [&]{return cancelled || trade.index < written + settings.window;});
+                    if (cancelled) break;
+                    chunk.push_back(std::move(trade));
+                }
+                if (chunk.size()==chunkSize || (!more && !chunk.empty())){
+                    if (!chunks.push(groupTrades(std::move(chunk), settings.engine, settings.steps, settings.seed,
+                                                 settings.groupSize))) break;
+                    chunk.clear();
+                }
+            }
+        } catch (...) {
+            readError = std::current_exception();
+        }
+        chunks.close();
+    });
+    auto write = [&](BatchTrade const& trade, PricingResult const* result, std::string const& error){
+        Row row{trade.index, formatBatchResult(format, trade, result, error), result==nullptr};
+        if (!rows.push(std::move(row))) throw std::runtime_error("The batch was cancelled.");
+    };
+    auto price = [&]{
+        std::deque<std::future<void>> pending; // half windows being priced, oldest first
+        try {
+            while (auto groups = chunks.pop()){
+                pending.push_back(submitBatchGroups(workers.pool, std::move(*groups), registry, settings, write).priced);
+                while (pending.front().wait_for(std::chrono::seconds(0))==std::future_status::ready){
+                    pending.front().get();
+                    pending.pop_front();
+                    if (pending.empty()) break;
+                }
+            }
+            for (; !pending.empty(); pending.pop_front()) pending.front().get();
+        } catch (...) {
+            priceError = std::current_exception(); // when the writer cancelled the batch, its own error is reported
+            cancel();
+            for (auto& chunk : pending) chunk.wait();
+        }
+        rows.close();
+    };
+    BatchStatistics statistics;
+    std::thread pricer;
+    try {
+        pricer = std::thread(price);
+        if (format==TradeFileFormat::Csv) out << "id,engine,steps,price,standard-error,delta,gamma,theta,vega,rho,error\n";
+        std::vector<std::optional<Row>> pending(settings.window); // slot k%window holds trade k
+        while (auto row = rows.pop()){
+            pending[row->index%settings.window] = std::move(row);
+            std::size_t next = written;
+            while (pending[next%settings.window] && pending[next%settings.window]->index==next){
+                auto& ready = *pending[next%settings.window];
+                out << ready.text << "\n";
+                statistics.errors += ready.failed;
+                pending[next%settings.window].reset();
+                next++;
+            }
+            if (next!=written){
+                if (!out) throw std::runtime_error("Cannot write the batch results.");
+                {
+                    std::lock_guard<std::mutex> lock(windowMutex);
+                    written = next;
+                }
+                windowFree.notify_all();
+            }
+        }
+        out.flush();
+    } catch (...) {
+        cancel();
+        reader.join();
+        if (pricer.joinable()) pricer.join();
+        throw;
+    }
+    reader.join();
+    pricer.join();
+    if (readError) std::rethrow_exception(readError);
+    if (priceError) std::rethrow_exception(priceError);
+    statistics.trades = written;
+    statistics.elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    return statistics;
+}
+
+#endif //ACADIA_INTERVIEW_BATCHPIPELINE_H
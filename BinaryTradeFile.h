@@ -0,0 +1,489 @@
+//
+// Fixed-layout binary trade and result files, read and written through memory mappings.
+//
+
+#ifndef ACADIA_INTERVIEW_BINARYTRADEFILE_H
+#define ACADIA_INTERVIEW_BINARYTRADEFILE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include "BatchPipeline.h"
+#include "ConfigParser.h"
+#include "MappedFile.h"
+#include "Parallel.h"
+
+/*
+ * Layout, native byte order (little-endian on the supported platforms):
+ *   header           64 bytes, BinaryHeader
+ *   records          recordCount records of recordSize bytes
+ *   dividend section dividendCount BinaryDividendRecords at dividendOffset (trade files only, optional)
+ *   environments     environmentCount BinaryEnvironmentRecords at environmentOffset (trade files only, optional)
+ * A reader rejects a file whose magic, version or record size differs from its own, so the layout can evolve by
+ * bumping binaryFormatVersion.
+ */
+constexpr std::uint32_t binaryFormatVersion = 2;
+inline constexpr char binaryTradeMagic[8] = {'B', 'T', 'W', 'E', 'T', 'R', 'D', 'E'};
+inline constexpr char binaryResultMagic[8] = {'B', 'T', 'W', 'E', 'R', 'E', 'S', 'U'};
+
+struct BinaryHeader{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t recordSize;
+    std::uint64_t recordCount;
+    std::uint64_t dividendOffset; // byte offset of the dividend section, 0 without one
+    std::uint64_t dividendCount;
+    std::uint64_t environmentOffset; // byte offset of the environment section, 0 without one
+    std::uint64_t environmentCount;
+    std::uint64_t reserved[1];
+};
+static_assert(sizeof(BinaryHeader)==64 && std::is_trivially_copyable_v<BinaryHeader>);
+
+/**
+ * One trade with its market data, or a reference to a named environment. Strings are NUL-padded; call and european
+ * are 0 or 1.
+ */
+struct BinaryTradeRecord{
+    char id[24];
+    char engine[24]; // empty for the default engine of the batch
+    double spot; // market data, unused if environment is set
+    double volatility;
+    double riskFreeRate;
+    double averageDividendsPerYear;
+    double q;
+    double strike;
+    std::uint32_t daysToMaturity;
+    std::uint32_t steps; // 0 for the default steps of the batch
+    std::uint32_t dividendBegin; // dividends of the trade: [dividendBegin, dividendBegin+dividendCount) of the
+    std::uint32_t dividendCount; // dividend section, none to draw them from the stream of the trade
+    std::uint32_t environment; // index in the environment section, noEnvironment for the market data of the record
+    std::uint8_t call;
+    std::uint8_t european;
+    std::uint8_t reserved[10];
+};
+static_assert(sizeof(BinaryTradeRecord)==128 && std::is_trivially_copyable_v<BinaryTradeRecord>);
+
+struct BinaryDividendRecord{
+    std::uint32_t day;
+    std::int32_t count;
+};
+static_assert(sizeof(BinaryDividendRecord)==8);
+
+/**
+ * Named market data shared by the trades referencing it.
+ */
+struct BinaryEnvironmentRecord{
+    char name[24];
+    double spot;
+    double volatility;
+    double riskFreeRate;
+    double averageDividendsPerYear;
+    double q;
+};
+static_assert(sizeof(BinaryEnvironmentRecord)==64 && std::is_trivially_copyable_v<BinaryEnvironmentRecord>);
+
+/**
+ * Result of the trade with the same position in the trade file.
+ */
+struct BinaryResultRecord{
+    char id[24];
+    char engine[24];
+    std::uint32_t steps;
+    std::uint32_t failed; // 1 if the trade could not be priced, see error
+    double price;
+    double standardError;
+    double delta;
+    double gamma;
+    double theta;
+    double vega;
+    double rho;
+    char error[80]; // truncated
+};
+static_assert(sizeof(BinaryResultRecord)==192 && std::is_trivially_copyable_v<BinaryResultRecord>);
+
+namespace detail{
+    template<std::size_t N>
+    void copyName(char (&field)[N], std::string_view text, char const* what){
+        if (text.size()>=N) throw std::invalid_argument(std::string(what) + " '" + std::string(text) + "' is longer than " +
+                                                        std::to_string(N-1) + " characters.");
+        std::memset(field, 0, N);
+        std::memcpy(field, text.data(), text.size());
+    }
+    template<std::size_t N>
+    std::string_view nameOf(char const (&field)[N]){
+        return {field, strnlen(field, N)};
+    }
+    /**
+     * Checks the header of a mapped file and the bounds of its sections. Counts are compared with the bytes left
+     * after their section starts rather than multiplied out, so that a corrupt header cannot wrap the bounds.
+     * @param kind name of the file kind in the error messages.
+     */
+    inline BinaryHeader const& checkHeader(std::string_view file, char const (&magic)[8], char const* kind,
+                                           std::size_t recordSize, std::string const& path){
+        if (file.size()<sizeof(BinaryHeader) || std::memcmp(file.data(), magic, 8)!=0)
+            throw std::invalid_argument(path + " is not a binary " + kind + " file.");
+        auto const& header = *reinterpret_cast<BinaryHeader const*>(file.data());
+        if (header.version!=binaryFormatVersion)
+            throw std::invalid_argument(path + " has format version " + std::to_string(header.version) + ", expected " +
+                                        std::to_string(binaryFormatVersion) + ".");
+        if (header.recordSize!=recordSize) throw std::invalid_argument(path + " has records of an unexpected size.");
+        std::uint64_t end = sizeof(BinaryHeader);
+        auto section = [&](std::uint64_t offset, std::uint64_t count, std::size_t size, std::size_t alignment,
+                           char const* name){
+            if (offset<end || offset%alignment!=0)
+                throw std::invalid_argument(path + " has a misplaced " + name + " section.");
+            if (offset>file.size() || count>(file.size()-offset)/size) throw std::invalid_argument(path + " is truncated.");
+            end = offset + count*size;
+        };
+        section(end, header.recordCount, recordSize, 1, "record");
+        if (header.dividendCount>0)
+            section(header.dividendOffset, header.dividendCount, sizeof(BinaryDividendRecord),
+                    alignof(BinaryDividendRecord), "dividend");
+        if (header.environmentCount>0)
+            section(header.environmentOffset, header.environmentCount, sizeof(BinaryEnvironmentRecord),
+                    alignof(BinaryEnvironmentRecord), "environment");
+        return header;
+    }
+}
+
+/**
+ * Checks the magic of a file.
+ * @return true for a binary trade file.
+ */
+inline bool isBinaryTradeFile(std::string const& path){
+    std::ifstream in(path, std::ios::binary);
+    char magic[8]{};
+    return in.read(magic, 8) && std::memcmp(magic, binaryTradeMagic, 8)==0;
+}
+
+/**
+ * Binary trade file mapped read-only: records are read in place, with no parsing.
+ */
+class BinaryTradeFile{
+private:
+    MappedFile file;
+    BinaryHeader const* header;
+    BinaryTradeRecord const* records;
+    BinaryDividendRecord const* dividends;
+    BinaryEnvironmentRecord const* environments;
+public:
+    explicit BinaryTradeFile(std::string const& path): file(path),
+            header(&detail::checkHeader(file.view(), binaryTradeMagic, "trade", sizeof(BinaryTradeRecord), path)),
+            records(reinterpret_cast<BinaryTradeRecord const*>(file.data() + sizeof(BinaryHeader))),
+            dividends(reinterpret_cast<BinaryDividendRecord const*>(file.data() + header->dividendOffset)),
+            environments(reinterpret_cast<BinaryEnvironmentRecord const*>(file.data() + header->environmentOffset)){
+        for (std::size_t k = 0; k < size(); k++){
+            if (std::uint64_t(records[k].dividendBegin) + records[k].dividendCount > header->dividendCount)
+                throw std::invalid_argument(path + ": the dividends of trade " + std::to_string(k) + " are out of range.");
+            if (records[k].environment!=noEnvironment && records[k].environment>=header->environmentCount)
+                throw std::invalid_argument(path + ": trade " + std::to_string(k) + " references a missing environment.");
+        }
+    }
+    [[nodiscard]] std::size_t size() const {return header->recordCount;}
+    [[nodiscard]] BinaryTradeRecord const& operator[](std::size_t k) const {return records[k];}
+    [[nodiscard]] std::size_t environmentCount() const {return header->environmentCount;}
+    [[nodiscard]] BinaryEnvironmentRecord const& environment(std::size_t k) const {return environments[k];}
+    /**
+     * Fills trade with record k, and the market data of its environment if it references one.
+     */
+    void read(std::size_t k, BatchTrade& trade) const {
+        auto const& record = records[k];
+        trade.index = k;
+        trade.id = detail::nameOf(record.id);
+        if (trade.id.empty()) trade.id = std::to_string(k);
+        trade.engine = detail::nameOf(record.engine);
+        trade.env = Environment();
+        trade.environment = record.environment;
+        if (record.environment!=noEnvironment){
+            auto const& env = environments[record.environment];
+            trade.env.underlyingT0Price = env.spot;
+            trade.env.volatility = env.volatility;
+            trade.env.riskFreeRate = env.riskFreeRate;
+            trade.env.averageDividendsPerYear = env.averageDividendsPerYear;
+            trade.env.q = env.q;
+        } else {
+            trade.env.underlyingT0Price = record.spot;
+            trade.env.volatility = record.volatility;
+            trade.env.riskFreeRate = record.riskFreeRate;
+            trade.env.averageDividendsPerYear = record.averageDividendsPerYear;
+            trade.env.q = record.q;
+        }
+        trade.option = Option(record.strike, record.daysToMaturity, record.european ? TradeType::European : TradeType::American,
+                              record.call ? CallPut::Call : CallPut::Put);
+        trade.steps = record.steps;
+        trade.dividends.clear();
+        for (std::uint32_t d = 0; d < record.dividendCount; d++){
+            auto const& dividend = dividends[record.dividendBegin + d];
+            trade.dividends.push_back({dividend.day, dividend.count});
+        }
+        trade.error.clear();
+        try {
+            checkTradeFields(trade);
+        } catch (std::exception const& error) {
+            trade.error = error.what(); // written as the result of the trade, as a trade of a text file that fails
+        }
+    }
+};
+
+/**
+ * Streams trades into a binary trade file. The dividend and environment sections and the header are written by
+ * finish(). Trades referencing an environment (trade.environment) index the environments given to setEnvironments().
+ */
+class BinaryTradeWriter{
+private:
+    std::string path;
+    std::ofstream out;
+    std::vector<BinaryDividendRecord> dividends;
+    std::vector<BinaryEnvironmentRecord> environments;
+    std::uint32_t referenced{0}; // environments referenced by the trades written so far
+    std::uint64_t count{0};
+public:
+    explicit BinaryTradeWriter(std::string path): path(std::move(path)),
+            out(this->path, std::ios::binary | std::ios::trunc){
+        if (!out.is_open()) throw std::runtime_error("Couldn't open " + this->path + " for writing.");
+        BinaryHeader header{};
+        out.write(reinterpret_cast<char const*>(&header), sizeof(header)); // placeholder until finish()
+    }
+    void add(BatchTrade const& trade){
+        if (!trade.error.empty()) throw std::invalid_argument("Trade " + trade.id + ": " + trade.error);
+        BinaryTradeRecord record{};
+        detail::copyName(record.id, trade.id, "Trade id");
+        detail::copyName(record.engine, trade.engine, "Engine name");
+        record.environment = trade.environment;
+        if (trade.environment!=noEnvironment){
+            referenced = std::max(referenced, trade.environment+1);
+        } else {
+            record.spot = trade.env.underlyingT0Price;
+            record.volatility = trade.env.volatility;
+            record.riskFreeRate = trade.env.riskFreeRate;
+            record.averageDividendsPerYear = trade.env.averageDividendsPerYear;
+            record.q = trade.env.q;
+        }
+        record.strike = trade.option.getStrike();
+        record.daysToMaturity = trade.option.getTimeToMaturity();
+        record.steps = trade.steps;
+        record.dividendBegin = static_cast<std::uint32_t>(dividends.size());
+        record.dividendCount = static_cast<std::uint32_t>(trade.dividends.size());
+        record.call = trade.option.getCallPut()==CallPut::Call;
+        record.european = trade.option.getType()==TradeType::European;
+        for (auto const& event : trade.dividends) dividends.push_back({event.day, event.count});
+        out.write(reinterpret_cast<char const*>(&record), sizeof(record));
+        count++;
+    }
+    void setEnvironments(std::vector<std::pair<std::string, Environment>> const& named){
+        environments.clear();
+        for (auto const& [name, env] : named){
+            BinaryEnvironmentRecord record{};
+            detail::copyName(record.name, name, "Environment name");
+            record.spot = env.underlyingT0Price;
+            record.volatility = env.volatility;
+            record.riskFreeRate = env.riskFreeRate;
+            record.averageDividendsPerYear = env.averageDividendsPerYear;
+            record.q = env.q;
+            environments.push_back(record);
+        }
+    }
+    /**
+     * @return number of trades written.
+     */
+    std::uint64_t finish(){
+        if (referenced>environments.size()) throw std::invalid_argument("Trades reference undefined environments.");
+        BinaryHeader header{};
+        std::memcpy(header.magic, binaryTradeMagic, 8);
+        header.version = binaryFormatVersion;
+        header.recordSize = sizeof(BinaryTradeRecord);
+        header.recordCount = count;
+        header.dividendCount = dividends.size();
+        auto end = sizeof(BinaryHeader) + count*sizeof(BinaryTradeRecord);
+        header.dividendOffset = dividends.empty() ? 0 : end;
+        end += dividends.size()*sizeof(BinaryDividendRecord);
+        header.environmentCount = environments.size();
+        header.environmentOffset = environments.empty() ? 0 : end;
+        out.write(reinterpret_cast<char const*>(dividends.data()),
+                  static_cast<std::streamsize>(dividends.size()*sizeof(BinaryDividendRecord)));
+        out.write(reinterpret_cast<char const*>(environments.data()),
+                  static_cast<std::streamsize>(environments.size()*sizeof(BinaryEnvironmentRecord)));
+        out.seekp(0);
+        out.write(reinterpret_cast<char const*>(&header), sizeof(header));
+        out.close();
+        if (!out) throw std::runtime_error("Couldn't write " + path + ".");
+        return count;
+    }
+};
+
+/**
+ * Binary result file mapped read-only, for the jobs consuming the results of a binary batch.
+ */
+class BinaryResultFile{
+private:
+    MappedFile file;
+    BinaryHeader const* header;
+    BinaryResultRecord const* records;
+public:
+    explicit BinaryResultFile(std::string const& path): file(path),
+            header(&detail::checkHeader(file.view(), binaryResultMagic, "result", sizeof(BinaryResultRecord), path)),
+            records(reinterpret_cast<BinaryResultRecord const*>(file.data() + sizeof(BinaryHeader))){}
+    [[nodiscard]] std::size_t size() const {return header->recordCount;}
+    [[nodiscard]] BinaryResultRecord const& operator[](std::size_t k) const {return records[k];}
+};
+
+/**
+ * @return the trade of a single-trade input file (data.txt), with id "0". The engine is left to the batch default
+ * unless the engine or tree-parameterization key is given.
+ */
+inline BatchTrade tradeFromConfig(Config const& config){
+    config.require({ConfigKey::RiskFreeRate, ConfigKey::SpotPrice, ConfigKey::Volatility,
+                    ConfigKey::AverageDividendsPerYear, ConfigKey::DividendYield, ConfigKey::CallPut,
+                    ConfigKey::European, ConfigKey::Strike, ConfigKey::DaysToMaturity});
+    BatchTrade trade;
+    trade.id = "0";
+    trade.env.riskFreeRate = config.get(ConfigKey::RiskFreeRate);
+    trade.env.underlyingT0Price = config.get(ConfigKey::SpotPrice);
+    trade.env.volatility = config.get(ConfigKey::Volatility);
+    trade.env.averageDividendsPerYear = config.get(ConfigKey::AverageDividendsPerYear);
+    trade.env.q = config.get(ConfigKey::DividendYield);
+    trade.option = Option(config.get(ConfigKey::Strike), static_cast<unsigned>(config.get(ConfigKey::DaysToMaturity)),
+                          config.get(ConfigKey::European)>0. ? TradeType::European : TradeType::American,
+                          config.get(ConfigKey::CallPut)>0. ? CallPut::Call : CallPut::Put);
+    trade.steps = static_cast<unsigned>(config.get(ConfigKey::Steps));
+    if (config.has(ConfigKey::Engine) || config.has(ConfigKey::TreeParameterization))
+        trade.engine = engineName(static_cast<int>(config.get(ConfigKey::Engine)),
+                                  static_cast<int>(config.get(ConfigKey::TreeParameterization)));
+    return trade;
+}
+
+/**
+ * Converts a single-trade input file (.txt) or a CSV/JSONL trade file to a binary trade file. A row that does not
+ * parse fails the conversion.
+ * @return number of trades converted.
+ */
+inline std::uint64_t convertToBinary(std::string const& input, std::string const& output){
+    BinaryTradeWriter writer(output);
+    auto dot = input.rfind('.');
+    if (dot!=std::string::npos && input.substr(dot)==".txt"){
+        writer.add(tradeFromConfig(Config::load(input)));
+    } else {
+        std::ifstream in(input);
+        if (!in.is_open()) throw std::runtime_error("Couldn't open trade file " + input + " for reading.");
+        TradeFileReader reader(in, TradeFileReader::formatOf(input));
+        BatchTrade trade;
+        while (reader.next(trade)) writer.add(trade);
+        writer.setEnvironments(reader.getEnvironments());
+    }
+    return writer.finish();
+}
+
+/**
+ * Prices trades [begin, end) of a binary trade file into their records of a result file (see runBinaryBatch), which
+ * are overwritten whole: a range can be priced again after a partial run.
+ * @return number of trades that failed.
+ */
+inline std::size_t priceBinaryRange(BinaryTradeFile const& trades, BinaryResultRecord* results, std::size_t begin,
+                                    std::size_t end, EngineRegistry const& registry, BatchSettings const& settings){
+    if (settings.window==0) throw std::invalid_argument("The grouping window must hold at least one trade.");
+    auto write = [](BinaryResultRecord& result, PricingResult const& priced){
+        detail::copyName(result.engine, priced.engine, "Engine name");
+        result.steps = priced.steps;
+        result.price = priced.price;
+        result.standardError = priced.standardError;
+        result.delta = priced.greeks.delta;
+        result.gamma = priced.greeks.gamma;
+        result.theta = priced.greeks.theta;
+        result.vega = priced.greeks.vega;
+        result.rho = priced.greeks.rho;
+    };
+    auto fail = [](BinaryResultRecord& result, char const* error){
+        result.failed = 1;
+        std::strncpy(result.error, error, sizeof(result.error)-1);
+    };
+    std::atomic<std::size_t> errors{0};
+    std::memset(static_cast<void*>(results+begin), 0, (end-begin)*sizeof(BinaryResultRecord));
+    auto done = [&](BatchTrade const& trade, PricingResult const* priced, std::string const& error){
+        if (priced){
+            write(results[trade.index], *priced);
+        } else {
+            fail(results[trade.index], error.c_str());
+            errors++;
+        }
+    };
+    BatchWorkers workers(settings);
+    // a block is read while the previous one is priced, and threads done with a block steal from the next one
+    std::deque<std::future<void>> pending;
+    for (std::size_t first = begin; first < end; first += settings.window){
+        std::vector<BatchTrade> block(std::min(settings.window, end-first));
+        for (std::size_t k = 0; k < block.size(); k++){
+            trades.read(first+k, block[k]);
+            detail::copyName(results[first+k].id, block[k].id, "Trade id");
+        }
+        auto groups = groupTrades(std::move(block), settings.engine, settings.steps, settings.seed, settings.groupSize);
+        pending.push_back(submitBatchGroups(workers.pool, std::move(groups), registry, settings, done).priced);
+        if (pending.size()>2){
+            pending.front().get();
+            pending.pop_front();
+        }
+    }
+    for (; !pending.empty(); pending.pop_front()) pending.front().get();
+    return errors;
+}
+
+/**
+ * Creates the result file of a binary trade file: the header, followed by zeroed records.
+ */
+inline void createBinaryResultFile(MappedOutputFile const& file, std::size_t count){
+    if (file.getSize()!=sizeof(BinaryHeader) + count*sizeof(BinaryResultRecord))
+        throw std::invalid_argument("The result file does not fit its records.");
+    auto& header = *reinterpret_cast<BinaryHeader*>(file.data());
+    std::memcpy(header.magic, binaryResultMagic, 8);
+    header.version = binaryFormatVersion;
+    header.recordSize = sizeof(BinaryResultRecord);
+    header.recordCount = count;
+}
+
+/**
+ * Prices every trade of a binary trade file into a binary result file of the same length, record k holding the
+ * result of trade k. Trades are read in place, grouped and scheduled as in runBatch (submitBatchGroups) over blocks of
+ * settings.window trades, and the pricing threads write the results of their groups straight into the mapped result
+ * file, so there is neither parsing nor formatting nor reordering. Results equal those of runBatch on the same trades.
+ */
+inline BatchStatistics runBinaryBatch(BinaryTradeFile const& trades, std::string const& resultPath,
+                                      EngineRegistry const& registry, BatchSettings const& settings = {}){
+    auto start = std::chrono::steady_clock::now();
+    MappedOutputFile file(resultPath, sizeof(BinaryHeader) + trades.size()*sizeof(BinaryResultRecord));
+    createBinaryResultFile(file, trades.size());
+    auto results = reinterpret_cast<BinaryResultRecord*>(file.data() + sizeof(BinaryHeader));
+    BatchStatistics statistics;
+    statistics.errors = priceBinaryRange(trades, results, 0, trades.size(), registry, settings);
+    file.sync();
+    statistics.trades = trades.size();
+    statistics.elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    return statistics;
+}
+
+/**
+ * Worker side of a sharded batch (see ShardedBatch.h): prices trades [begin, end) of a binary trade file into the
+ * existing result file created by the coordinator, which other workers fill concurrently.
+ * @return number of trades that failed.
+ */
+inline std::size_t runShard(BinaryTradeFile const& trades, std::string const& resultPath, std::size_t begin,
+                            std::size_t end, EngineRegistry const& registry, BatchSettings const& settings = {}){
+    MappedOutputFile file(resultPath);
+    auto const& header = detail::checkHeader({file.data(), file.getSize()}, binaryResultMagic, "result",
+                                             sizeof(BinaryResultRecord), resultPath);
+    if (header.recordCount!=trades.size()) throw std::invalid_argument(resultPath + " is not the result file of the trades.");
+    if (begin>end || end>trades.size()) throw std::invalid_argument("The shard is out of the trade file.");
+    auto results = reinterpret_cast<BinaryResultRecord*>(file.data() + sizeof(BinaryHeader));
+    auto errors = priceBinaryRange(trades, results, begin, end, registry, settings);
+    file.sync();
+    return errors;
+}
+
+#endif //ACADIA_INTERVIEW_BINARYTRADEFILE_H
@@ -0,0 +1,104 @@
+//
+// Cooperative cancellation and deadlines of pricings.
+//
+
+#ifndef ACADIA_INTERVIEW_CANCELLATION_H
+#define ACADIA_INTERVIEW_CANCELLATION_H
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+
+/**
+ * Thrown out of a pricing that was cancelled or whose deadline passed.
+ */
+class PricingCancelled : public std::runtime_error{
+private:
+    bool expired;
+public:
+    explicit PricingCancelled(bool expired)
+            : std::runtime_error(expired ? "The pricing deadline expired." : "The pricing was cancelled."),
+              expired(expired){}
+    /**
+     * @return true if the deadline passed, false if the pricing was cancelled.
+     */
+    [[nodiscard]] bool deadlineExpired() const {return expired;}
+};
+
+/**
+ * Shared flag requesting the end of a pricing, with an optional deadline. Copies of a token share their state, so the
+ * caller keeps one to cancel the pricing that runs with another.
+ */
+class CancellationToken{
+public:
+    using Clock = std::chrono::steady_clock;
+private:
+    struct State{
+        std::atomic<bool> cancelled{false};
+        Clock::time_point deadline{Clock::time_point::max()};
+    };
+    std::shared_ptr<State> state;
+public:
+    CancellationToken(): state(std::make_shared<State>()){}
+    explicit CancellationToken(Clock::time_point deadline): CancellationToken(){
+        state->deadline = deadline;
+    }
+    void cancel() const {state->cancelled.store(true, std::memory_order_relaxed);}
+    [[nodiscard]] bool cancelled() const {return state->cancelled.load(std::memory_order_relaxed);}
+    [[nodiscard]] Clock::time_point deadline() const {return state->deadline;}
+    [[nodiscard]] bool expired() const {
+        return state->deadline!=Clock::time_point::max() && Clock::now()>=state->deadline;
+    }
+    /**
+     * Throws PricingCancelled if the token was cancelled or its deadline passed.
+     */
+    void check() const {
+        if (cancelled()) throw PricingCancelled(false);
+        if (expired()) throw PricingCancelled(true);
+    }
+};
+
+namespace detail{
+    inline CancellationToken const*& currentCancellation(){
+        thread_local CancellationToken const* token{nullptr};
+        return token;
+    }
+}
+
+/**
+ * Makes token the cancellation token of the pricings run by the current thread for the lifetime of the scope. Scopes
+ * nest, and parallelFor carries the token of the caller to its workers.
+ */
+class CancellationScope{
+private:
+    CancellationToken const* previous;
+public:
+    explicit CancellationScope(CancellationToken const* token): previous(detail::currentCancellation()){
+        detail::currentCancellation() = token;
+    }
+    CancellationScope(CancellationScope const&) = delete;
+    CancellationScope& operator=(CancellationScope const&) = delete;
+    ~CancellationScope(){
+        detail::currentCancellation() = previous;
+    }
+};
+
+/**
+ * @return the cancellation token of the current thread, null outside a CancellationScope.
+ */
+inline CancellationToken const* currentCancellation(){
+    return detail::currentCancellation();
+}
+
+/**
+ * Cancellation point of the induction loops: every cancellationInterval levels, throws PricingCancelled if the token of
+ * the current thread was cancelled or expired. Without a token it costs a thread-local load per interval.
+ */
+constexpr unsigned cancellationInterval = 16;
+inline void checkCancellation(long level){
+    if (level%cancellationInterval!=0) return;
+    if (auto const* token = detail::currentCancellation()) token->check();
+}
+
+#endif //ACADIA_INTERVIEW_CANCELLATION_H
@@ -0,0 +1,190 @@
+//
+// Allocation-free parsing of the key=value input files and of the fields of batch trade files.
+//
+
+#ifndef ACADIA_INTERVIEW_CONFIGPARSER_H
+#define ACADIA_INTERVIEW_CONFIGPARSER_H
+
+#include <array>
+#include <bitset>
+#include <charconv>
+#include <cstdint>
+#include <initializer_list>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include "MappedFile.h"
+
+/**
+ * Keys of the input files. The batch trade files use the same names for their fields, plus id, dividends, market (the
+ * name of an environment block) and environment (a reference to one).
+ */
+enum class ConfigKey : unsigned char{
+    RiskFreeRate, SpotPrice, Volatility, AverageDividendsPerYear, DividendYield, CallPut, European, Strike,
+    DaysToMaturity, Steps, RngSeed, RngStream, DividendScenarios, Engine, TreeParameterization, Tolerance,
+    LatencyBudget, Id, Dividends, Market, EnvironmentName, Progressive, ProgressiveTolerance, Count
+};
+constexpr std::size_t configKeyCount = static_cast<std::size_t>(ConfigKey::Count);
+constexpr std::array<std::string_view, configKeyCount> configKeyNames = {
+        "risk-free-rate", "S-T0-Price", "volatility", "average-dividends-per-year", "continuously-yield-dividend",
+        "callput", "european", "strike", "days-to-maturity", "steps", "rng-seed", "rng-stream", "dividend-scenarios",
+        "engine", "tree-parameterization", "tolerance", "latency-budget-us", "id",
+        "dividends", "market", "environment", "progressive", "progressive-tolerance"};
+
+namespace detail{
+    constexpr std::uint64_t keyHash(std::string_view key, std::uint64_t seed){
+        std::uint64_t res = 0xCBF29CE484222325ull ^ (seed*0x9E3779B97F4A7C15ull);
+        for (char c : key) res = (res ^ static_cast<unsigned char>(c))*0x100000001B3ull;
+        return res ^ (res>>29);
+    }
+    /**
+     * Perfect hash of the key names: the seed is searched at compile time so that no two keys share a slot.
+     */
+    struct KeyTable{
+        static constexpr std::size_t slots = 64;
+        static constexpr unsigned char empty = 0xFF;
+        bool found{false};
+        std::uint64_t seed{0};
+        std::array<unsigned char, slots> keys{};
+    };
+    constexpr KeyTable makeKeyTable(){
+        KeyTable table;
+        for (std::uint64_t seed = 0; seed < 100000 && !table.found; seed++){
+            table.seed = seed;
+            for (auto& key : table.keys) key = KeyTable::empty;
+            table.found = true;
+            for (std::size_t k = 0; k < configKeyCount && table.found; k++){
+                auto& slot = table.keys[keyHash(configKeyNames[k], seed)%KeyTable::slots];
+                table.found = slot==KeyTable::empty;
+                slot = static_cast<unsigned char>(k);
+            }
+        }
+        return table;
+    }
+    inline constexpr KeyTable keyTable = makeKeyTable();
+    static_assert(keyTable.found, "No perfect hash of the configuration keys was found.");
+}
+
+/**
+ * @return the key of a name, nothing for an unknown name. One hash and one comparison, no allocation.
+ */
+constexpr std::optional<ConfigKey> findConfigKey(std::string_view name){
+    auto k = detail::keyTable.keys[detail::keyHash(name, detail::keyTable.seed)%detail::KeyTable::slots];
+    if (k==detail::KeyTable::empty || configKeyNames[k]!=name) return std::nullopt;
+    return static_cast<ConfigKey>(k);
+}
+
+/**
+ * Parses a whole field as a number with std::from_chars (locale-independent, no allocation). A leading + is accepted,
+ * as well as true and false (1 and -1, the positive/negative convention of the flags).
+ * @return false if the field is not a number.
+ */
+inline bool parseNumber(std::string_view text, double& value){
+    if (text=="true"){
+        value = 1.;
+        return true;
+    }
+    if (text=="false"){
+        value = -1.;
+        return true;
+    }
+    if (!text.empty() && text.front()=='+') text.remove_prefix(1);
+    auto [end, error] = std::from_chars(text.data(), text.data()+text.size(), value);
+    return error==std::errc() && end==text.data()+text.size() && !text.empty();
+}
+
+/**
+ * @return text without its leading and trailing blanks.
+ */
+constexpr std::string_view trimBlanks(std::string_view text){
+    while (!text.empty() && (text.front()==' ' || text.front()=='\t' || text.front()=='\r')) text.remove_prefix(1);
+    while (!text.empty() && (text.back()==' ' || text.back()=='\t' || text.back()=='\r')) text.remove_suffix(1);
+    return text;
+}
+
+/**
+ * @return the name of the engine selected by the engine and tree-parameterization keys.
+ */
+inline std::string engineName(int engine, int treeParameterization){
+    static const char* trees[] = {"binomial-crr", "binomial-jr", "binomial-tian", "binomial-lr"};
+    static const char* others[] = {"trinomial", "crank-nicolson", "monte-carlo", "expected-dividend"};
+    if (engine==0){
+        if (treeParameterization<0 || treeParameterization>3)
+            throw std::invalid_argument("tree-parameterization must be 0 (CRR), 1 (Jarrow-Rudd), 2 (Tian) or 3 (Leisen-Reimer).");
+        return trees[treeParameterization];
+    }
+    if (engine<0 || engine>4)
+        throw std::invalid_argument("engine must be 0 (binomial), 1 (trinomial), 2 (Crank-Nicolson), 3 (Monte Carlo) or "
+                                    "4 (expected dividends).");
+    return others[engine-1];
+}
+
+/**
+ * Values of a key=value input file. Lines are tokenized in place; blank lines and lines starting with # are skipped.
+ * Unknown keys and malformed lines are errors reported with their line number, and missing keys are either reported
+ * (require) or given an explicit default (get), never silently zero.
+ */
+class Config{
+private:
+    std::array<double, configKeyCount> values{};
+    std::bitset<configKeyCount> present;
+public:
+    static Config parse(std::string_view text){
+        Config res;
+        std::size_t lineNumber{0};
+        while (!text.empty()){
+            auto end = text.find('\n');
+            auto line = trimBlanks(text.substr(0, end));
+            text.remove_prefix(end==std::string_view::npos ? text.size() : end+1);
+            lineNumber++;
+            if (line.empty() || line.front()=='#') continue;
+            auto equal = line.find('=');
+            if (equal==std::string_view::npos)
+                throw std::invalid_argument("Line " + std::to_string(lineNumber) + ": expected key=value.");
+            auto name = trimBlanks(line.substr(0, equal));
+            auto key = findConfigKey(name);
+            if (!key) throw std::invalid_argument("Line " + std::to_string(lineNumber) + ": unknown key " +
+                                                  std::string(name) + ".");
+            auto k = static_cast<std::size_t>(*key);
+            if (!parseNumber(trimBlanks(line.substr(equal+1)), res.values[k]))
+                throw std::invalid_argument("Line " + std::to_string(lineNumber) + ": invalid value of " +
+                                            std::string(name) + ".");
+            res.present.set(k);
+        }
+        return res;
+    }
+    /**
+     * Parses a file, mapped in memory.
+     */
+    static Config load(std::string const& path){
+        MappedFile file(path);
+        return parse(file.view());
+    }
+    [[nodiscard]] bool has(ConfigKey key) const {return present.test(static_cast<std::size_t>(key));}
+    /**
+     * @return the value of an optional key, fallback if it is missing.
+     */
+    [[nodiscard]] double get(ConfigKey key, double fallback = 0.) const {
+        return has(key) ? values[static_cast<std::size_t>(key)] : fallback;
+    }
+    /**
+     * @return the value of a mandatory key.
+     */
+    [[nodiscard]] double require(ConfigKey key) const {
+        if (!has(key)) throw std::invalid_argument("Missing key " + std::string(configKeyNames[static_cast<std::size_t>(key)]) + ".");
+        return values[static_cast<std::size_t>(key)];
+    }
+    /**
+     * Checks that all the keys are present, the error lists the missing ones.
+     */
+    void require(std::initializer_list<ConfigKey> keys) const {
+        std::string missing;
+        for (auto key : keys){
+            if (!has(key)) missing += (missing.empty() ? "" : ", ") + std::string(configKeyNames[static_cast<std::size_t>(key)]);
+        }
+        if (!missing.empty()) throw std::invalid_argument("Missing keys: " + missing + ".");
+    }
+};
+
+#endif //ACADIA_INTERVIEW_CONFIGPARSER_H
@@ -0,0 +1,279 @@
+//
+// Cost/accuracy model routing trades to the cheapest adequate engine.
+//
+
+#ifndef ACADIA_INTERVIEW_COSTMODEL_H
+#define ACADIA_INTERVIEW_COSTMODEL_H
+
+#include <fstream>
+#include <map>
+#include <string>
+#include "PricingEngine.h"
+
+/**
+ * Error of an engine relative to S0*sigma*sqrt(T): max(floor, constant/steps^order).
+ */
+struct ErrorModel{
+    double constant{0};
+    double order{1};
+    double floor{0};
+};
+/**
+ * Calibrated cost and accuracy of one engine. The runtime of one price is
+ * overheadMicroseconds + microsecondsPerWork*engine.work(option, steps). Early exercise changes the convergence of
+ * most engines, so European and American options have their own error model.
+ */
+struct EngineCost{
+    double overheadMicroseconds{0};
+    double microsecondsPerWork{0};
+    ErrorModel european;
+    ErrorModel american;
+};
+struct EngineChoice{
+    PricingEngine const* engine{nullptr};
+    unsigned steps{0};
+    double predictedMicroseconds{0};
+    double predictedError{0};
+    bool meetsTolerance{false}; // false when no engine reaches the tolerance within the latency budget
+};
+
+class CostModel{
+private:
+    std::map<std::string, EngineCost> costs;
+public:
+    static constexpr unsigned minSteps = 10;
+    static constexpr unsigned maxSteps = 1u<<13; // bounds the memory of a full lattice
+    static constexpr double safetyFactor = 2.; // errors oscillate between the calibrated step counts
+    // early exercise evaluates the payout at every node: measured 1.05 (trinomial) to 3 (binomial) times the European cost
+    static constexpr double americanCostFactor = 2.;
+    static constexpr double uncalibratedMicrosecondsPerWork = 1e-2;
+    void set(std::string const& engine, EngineCost const& cost){costs[engine] = cost;}
+    /**
+     * @return the cost of the engine, nullptr if it has not been calibrated.
+     */
+    [[nodiscard]] EngineCost const* find(std::string const& engine) const {
+        auto it = costs.find(engine);
+        return it==costs.end() ? nullptr : &it->second;
+    }
+    [[nodiscard]] double predictMicroseconds(PricingEngine const& engine, Option const& o, unsigned steps, bool withGreeks) const {
+        auto const& cost = costs.at(engine.info().name);
+        double prices = withGreeks ? engine.info().pricesPerGreeks : 1;
+        return prices*(cost.overheadMicroseconds + cost.microsecondsPerWork*engine.work(o, steps));
+    }
+    /**
+     * @return predicted runtime of a trade for the schedulers: predictMicroseconds, with early exercise, and for
+     * uncalibrated engines too (work at uncalibratedMicrosecondsPerWork).
+     */
+    [[nodiscard]] double predictJobMicroseconds(PricingEngine const& engine, Option const& o, unsigned steps,
+                                                bool withGreeks) const {
+        auto const* cost = find(engine.info().name);
+        double prices = withGreeks ? engine.info().pricesPerGreeks : 1;
+        double exercise = o.getType()==TradeType::American ? americanCostFactor : 1.;
+        if (!cost) return prices*exercise*uncalibratedMicrosecondsPerWork*engine.work(o, steps);
+        return prices*(cost->overheadMicroseconds + exercise*cost->microsecondsPerWork*engine.work(o, steps));
+    }
+    [[nodiscard]] double predictError(PricingEngine const& engine, Environment const& e, Option const& o, unsigned steps) const {
+        auto const& error = errorModel(costs.at(engine.info().name), o);
+        return safetyFactor*errorScale(e, o)*std::max(error.floor, error.constant/std::pow(steps, error.order));
+    }
+    /**
+     * Picks the engine and number of steps that price the trade within the tolerance at the lowest predicted runtime.
+     * When no engine meets both the tolerance and the latency budget, the most accurate choice within the budget is
+     * returned, or the fastest one if nothing fits the budget.
+     * @param latencyBudgetMicroseconds runtime allowed to price the trade (and its Greeks if withGreeks).
+     * @param tolerance absolute error allowed on the price.
+     */
+    [[nodiscard]] EngineChoice select(EngineRegistry const& registry, Environment const& e, Option const& o,
+                                      double latencyBudgetMicroseconds, double tolerance, bool withGreeks) const {
+        EngineChoice best, mostAccurate, fastest;
+        for (auto const& engine : registry.all()){
+            auto const* cost = find(engine->info().name);
+            if (!engine->info().autoSelectable || !cost) continue;
+            // accuracy-driven choice
+            double scale = errorScale(e, o);
+            auto const& error = errorModel(*cost, o);
+            if (safetyFactor*error.floor*scale <= tolerance){
+                double needed = std::pow(safetyFactor*error.constant*scale/tolerance, 1./error.order);
+                auto steps = static_cast<unsigned>(std::min<double>(std::max<double>(std::ceil(needed), minSteps), maxSteps));
+                EngineChoice choice = makeChoice(*engine, e, o, steps, withGreeks);
+                choice.meetsTolerance = choice.predictedError <= tolerance;
+                if (choice.meetsTolerance && choice.predictedMicroseconds <= latencyBudgetMicroseconds &&
+                    (!best.engine || choice.predictedMicroseconds < best.predictedMicroseconds)){
+                    best = choice;
+                }
+            }
+            // budget-driven fallbacks
+            unsigned affordable = maxAffordableSteps(*engine, o, latencyBudgetMicroseconds, withGreeks);
+            if (affordable>0){
+                EngineChoice choice = makeChoice(*engine, e, o, affordable, withGreeks);
+                if (!mostAccurate.engine || choice.predictedError < mostAccurate.predictedError) mostAccurate = choice;
+            }
+            EngineChoice cheapest = makeChoice(*engine, e, o, minSteps, withGreeks);
+            if (!fastest.engine || cheapest.predictedMicroseconds < fastest.predictedMicroseconds) fastest = cheapest;
+        }
+        if (best.engine) return best;
+        if (mostAccurate.engine) return mostAccurate;
+        if (fastest.engine) return fastest;
+        throw std::runtime_error("No calibrated engine available for selection.");
+    }
+    /**
+     * Writes the model in the key=value format of the input files, one engine.field key per line.
+     */
+    void save(std::string const& path) const {
+        std::ofstream out(path);
+        if (!out) throw std::runtime_error("Couldn't open " + path + " for writing.");
+        out.precision(17);
+        out << "# cost model: runtime [us] = overhead + per-work * work, relative error = max(floor, constant/steps^order)\n";
+        for (auto const& [name, cost] : costs){
+            out << name << ".overhead=" << cost.overheadMicroseconds << "\n"
+                << name << ".per-work=" << cost.microsecondsPerWork << "\n";
+            for (auto const& [style, error] : {std::make_pair("european", cost.european), std::make_pair("american", cost.american)}){
+                out << name << "." << style << "-error-constant=" << error.constant << "\n"
+                    << name << "." << style << "-error-order=" << error.order << "\n"
+                    << name << "." << style << "-error-floor=" << error.floor << "\n";
+            }
+        }
+    }
+    static CostModel load(std::string const& path){
+        std::ifstream in(path);
+        if (!in) throw std::runtime_error("Couldn't open cost model " + path + " for reading.");
+        CostModel model;
+        std::string line;
+        while (std::getline(in, line)){
+            if (line.empty() || line[0]=='#') continue;
+            auto equal = line.find('=');
+            auto dot = line.rfind('.', equal);
+            if (equal==std::string::npos || dot==std::string::npos) throw std::runtime_error("Malformed cost model line: " + line);
+            auto& cost = model.costs[line.substr(0, dot)];
+            auto field = line.substr(dot+1, equal-dot-1);
+            double value = std::stod(line.substr(equal+1));
+            if (field=="overhead") cost.overheadMicroseconds = value;
+            else if (field=="per-work") cost.microsecondsPerWork = value;
+            else if (field=="european-error-constant") cost.european.constant = value;
+            else if (field=="european-error-order") cost.european.order = value;
+            else if (field=="european-error-floor") cost.european.floor = value;
+            else if (field=="american-error-constant") cost.american.constant = value;
+            else if (field=="american-error-order") cost.american.order = value;
+            else if (field=="american-error-floor") cost.american.floor = value;
+            else throw std::runtime_error("Unknown cost model field: " + field);
+        }
+        return model;
+    }
+    /**
+     * Coefficients measured with benchmarks/calibrate_cost_model on a reference machine, used when no calibration
+     * file is available.
+     */
+    static CostModel defaults(){
+        CostModel model;
+        model.set("binomial-crr", {0, 1.6e-2, {0.094, 0.99, 0}, {0.10, 1.03, 0}});
+        model.set("binomial-jr", {0, 1.4e-2, {0.12, 1.07, 1.1e-4}, {0.11, 1.05, 1.1e-4}});
+        model.set("binomial-tian", {0, 1.3e-2, {0.17, 1.16, 0}, {0.085, 1.05, 0}});
+        model.set("binomial-lr", {0, 1.25e-2, {0.017, 1.98, 0}, {0.027, 1.06, 0}});
+        model.set("trinomial", {0, 5.5e-3, {0.049, 1.0, 0}, {0.043, 1.03, 0}});
+        model.set("crank-nicolson", {56, 2.4e-2, {6e-4, 0.5, 3e-5}, {3.8e-3, 0.75, 3.7e-5}});
+        return model;
+    }
+    /**
+     * Measures runtime and error of every selectable engine. European puts are priced against Black-Scholes, American
+     * puts against a fine Crank-Nicolson grid. Runtime is fitted by least squares on the work. The error order is
+     * fitted in log-log scale, then the constant is the largest observed error*steps^order, a conservative bound for
+     * oscillating engines. The floor is the error at the finest step count, kept only where convergence stalled.
+     * @param stepsList increasing numbers of steps to sample.
+     */
+    static CostModel calibrate(EngineRegistry const& registry, std::vector<unsigned> const& stepsList){
+        CostModel model;
+        struct Sample{Environment env; Option option; double reference;};
+        std::vector<Sample> european, american;
+        for (double strike : {55., 60., 66.}){
+            Environment env;
+            env.underlyingT0Price = 60;
+            env.volatility = 0.25;
+            env.riskFreeRate = 0.04;
+            env.q = 0.01;
+            Option e(strike, 365, TradeType::European, CallPut::Put);
+            european.push_back({env, e, myUtils::BSPrice(env, e)});
+            Option a(strike, 365, TradeType::American, CallPut::Put);
+            american.push_back({env, a, CrankNicolsonGrid::build(env, a, DividendSchedule(), 4000, 4000).getPrice()});
+        }
+        for (auto const& engine : registry.all()){
+            if (!engine->info().autoSelectable) continue;
+            double sw{0}, st{0}, sww{0}, swt{0}, samples{0};
+            auto measure = [&](std::vector<Sample> const& trades){
+                std::vector<std::pair<double, double>> errors; // (steps, worst relative error)
+                for (unsigned steps : stepsList){
+                    double worst{0};
+                    for (auto const& sample : trades){
+                        auto start = std::chrono::steady_clock::now();
+                        double price = engine->price(sample.env, sample.option, DividendSchedule(), steps);
+                        double elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now()-start).count();
+                        double w = engine->work(sample.option, steps);
+                        sw += w; st += elapsed; sww += w*w; swt += w*elapsed; samples++;
+                        worst = std::max(worst, std::abs(price - sample.reference)/errorScale(sample.env, sample.option));
+                    }
+                    errors.emplace_back(steps, worst);
+                }
+                return fitError(errors);
+            };
+            EngineCost cost;
+            cost.european = measure(european);
+            cost.american = measure(american);
+            double denominator = samples*sww - sw*sw;
+            cost.microsecondsPerWork = denominator>0 ? std::max((samples*swt - sw*st)/denominator, 0.) : st/std::max(sw, 1.);
+            cost.overheadMicroseconds = std::max((st - cost.microsecondsPerWork*sw)/samples, 0.);
+            model.set(engine->info().name, cost);
+        }
+        return model;
+    }
+private:
+    static double errorScale(Environment const& e, Option const& o){
+        return e.underlyingT0Price*e.volatility*std::sqrt(o.getTimeToMaturity()/365.25);
+    }
+    static ErrorModel const& errorModel(EngineCost const& cost, Option const& o){
+        return o.getType()==TradeType::American ? cost.american : cost.european;
+    }
+    /**
+     * @param errors (steps, relative error) samples, by increasing steps.
+     */
+    static ErrorModel fitError(std::vector<std::pair<double, double>> const& errors){
+        ErrorModel res;
+        double sx{0}, sy{0}, sxx{0}, sxy{0}, n{0};
+        for (std::size_t i = 0; i+1 < errors.size(); i++){
+            double x = std::log(errors[i].first), y = std::log(std::max(errors[i].second, 1e-16));
+            sx += x; sy += y; sxx += x*x; sxy += x*y; n++;
+        }
+        double denominator = n*sxx - sx*sx;
+        double slope = denominator>0 ? (n*sxy - sx*sy)/denominator : -1.;
+        res.order = std::min(std::max(-slope, 0.5), 2.5);
+        for (std::size_t i = 0; i+1 < errors.size(); i++){
+            res.constant = std::max(res.constant, errors[i].second*std::pow(errors[i].first, res.order));
+        }
+        // the finest sample only sets the floor, and only if the error stopped converging there
+        auto const& [steps, error] = errors.back();
+        res.floor = error > res.constant/std::pow(steps, res.order) ? error : 0.;
+        return res;
+    }
+    [[nodiscard]] EngineChoice makeChoice(PricingEngine const& engine, Environment const& e, Option const& o, unsigned steps,
+                                          bool withGreeks) const {
+        EngineChoice choice;
+        choice.engine = &engine;
+        choice.steps = steps;
+        choice.predictedMicroseconds = predictMicroseconds(engine, o, steps, withGreeks);
+        choice.predictedError = predictError(engine, e, o, steps);
+        return choice;
+    }
+    /**
+     * @return the largest number of steps priced within the budget, 0 if not even minSteps fit.
+     */
+    [[nodiscard]] unsigned maxAffordableSteps(PricingEngine const& engine, Option const& o, double budget, bool withGreeks) const {
+        if (predictMicroseconds(engine, o, minSteps, withGreeks) > budget) return 0;
+        unsigned low = minSteps, high = maxSteps;
+        if (predictMicroseconds(engine, o, high, withGreeks) <= budget) return high;
+        while (high-low>1){
+            unsigned mid = low + (high-low)/2;
+            (predictMicroseconds(engine, o, mid, withGreeks) <= budget ? low : high) = mid;
+        }
+        return low;
+    }
+};
+
+#endif //ACADIA_INTERVIEW_COSTMODEL_H
@@ -0,0 +1,229 @@
+//
+// Finite-differences model on a log-spot grid, sharing the build surface of BinomialTree.
+//
+
+#ifndef ACADIA_INTERVIEW_CRANKNICOLSONGRID_H
+#define ACADIA_INTERVIEW_CRANKNICOLSONGRID_H
+
+#include "Objects.h"
+
+/**
+ * Crank-Nicolson finite-differences model object.
+ * The Black-Scholes PDE is solved backward in time on a uniform grid in x = ln(X), X being the dividend-free
+ * geometric Brownian motion the trees are built on. As in the trees, the stock price is S = max(X - payed, 0), where
+ * payed is the cumulative event-based dividend at that time, so dividends only enter the payout and the early
+ * exercise value. Every time step costs one O(M) tridiagonal solve. American options are solved with the
+ * Brennan-Schwartz algorithm: the elimination runs away from the exercise region and the early exercise constraint is
+ * applied during the substitution. The first time steps are Rannacher (implicit) half-steps, to damp the payout kink.
+ */
+class CrankNicolsonGrid{
+private:
+    unsigned N, M;
+    double dt{0}, dx{0}, r{0}, q{0}, sigma{0}, t0underVal{0};
+    Option o;
+    DividendSchedule dividends;
+    std::vector<double> x; // log of the dividend-free underlying at each space node
+    std::vector<double> values; // trade values at time 0
+    double valueAtFirstStep{0}; // trade value at t0underVal, one time step after time 0
+public:
+    static constexpr unsigned defaultSpaceNodes = 400;
+    static constexpr double gridWidthInStdDev = 5.;
+    static constexpr unsigned rannacherSteps = 2;
+    /**
+     * Build a Crank-Nicolson model to price financial Option based on stocks, with one time step per calendar day.
+     * Market assumptions and event-based dividends are the same as in BinomialTree::build.
+     * @param e Market environment. It includes vol, rate, stock price at time t0, number of average dividends payed per year.
+     * @param o Derivative trade.
+     * @return Model object.
+     */
+    static CrankNicolsonGrid build(Environment const& e, Option const& o) {
+        return build(e, o, threadRng());
+    }
+    static CrankNicolsonGrid build(Environment const& e, Option const& o, PhiloxStream& rng) {
+        return build(e, o, sampleDividendStructure(e, o.getTimeToMaturity(), rng));
+    }
+    static CrankNicolsonGrid build(Environment const& e, Option const& o, DividendSchedule const& dividends) {
+        return build(e, o, dividends, o.getTimeToMaturity());
+    }
+    /**
+     * Same as above, with an arbitrary number of time steps and space nodes.
+     * @param steps number of time steps.
+     * @param spaceNodes number of space intervals, rounded up to an even number so that the spot lies on the grid.
+     */
+    static CrankNicolsonGrid build(Environment const& e, Option const& o, DividendSchedule const& dividends,
+                                   unsigned steps, unsigned spaceNodes = defaultSpaceNodes) {
+        if (steps==0) throw std::invalid_argument("The grid must have at least one time step.");
+        if (spaceNodes<4) throw std::invalid_argument("The grid must have at least four space intervals.");
+        CrankNicolsonGrid grid(steps, spaceNodes + spaceNodes%2, dividends);
+        grid.dt = (static_cast<double>(o.getTimeToMaturity())/steps)/365.25;
+        grid.setEnvironment(e, o);
+        grid.setOption(o);
+        return grid;
+    }
+    [[nodiscard]] int getN() const {return N;}
+    [[nodiscard]] unsigned getM() const {return M;}
+    [[nodiscard]] DividendSchedule const& getDividendStructure() const {
+        return dividends;
+    }
+    [[nodiscard]] double getPrice() const {return values[M/2];}
+    /**
+     * Delta, Gamma and Theta read off the grid: no further builds are needed.
+     */
+    [[nodiscard]] double getDelta() const {
+        return firstDerivative()/t0underVal;
+    }
+    [[nodiscard]] double getGamma() const {
+        double secondDerivative = (values[M/2+1] - 2*values[M/2] + values[M/2-1])/(dx*dx);
+        return (secondDerivative - firstDerivative())/(t0underVal*t0underVal);
+    }
+    /**
+     * @return change of the price over one day, as myUtils::computeTheta.
+     */
+    [[nodiscard]] double getTheta() const {
+        return (valueAtFirstStep - getPrice())/(dt*365.25);
+    }
+    /**
+     * @return the underlying stock price at time 0 and space node j.
+     */
+    [[nodiscard]] double getUnderlying(unsigned j) const {
+        return std::exp(x[j]);
+    }
+    [[nodiscard]] double getValue(unsigned j) const {
+        return values[j];
+    }
+private:
+    explicit CrankNicolsonGrid(unsigned n, unsigned m, DividendSchedule ds):
+            N(n),
+            M(m),
+            dividends(std::move(ds)){};
+    /**
+     * @return dividends payed before a time level, see DividendSchedule::payedBefore.
+     */
+    [[nodiscard]] int payedBefore(unsigned level) const {
+        return dividends.payedBefore(level, o.getTimeToMaturity(), N);
+    }
+    [[nodiscard]] double firstDerivative() const {
+        return (values[M/2+1] - values[M/2-1])/(2*dx);
+    }
+    void setEnvironment(Environment const& e, Option const& option){
+        sigma = e.volatility;
+        r = e.riskFreeRate;
+        q = e.q;
+        t0underVal = e.underlyingT0Price;
+        double T = dt*N;
+        double halfWidth = gridWidthInStdDev*sigma*std::sqrt(T);
+        // the grid must also cover the strike
+        halfWidth = std::max(halfWidth, std::abs(std::log(option.getStrike()/t0underVal)) + 4*sigma*std::sqrt(T));
+        dx = 2*halfWidth/M;
+        x.resize(M+1);
+        for (unsigned j = 0; j < M+1; j++){
+            x[j] = std::log(t0underVal) + (static_cast<double>(j) - M/2.)*dx;
+        }
+    }
+    /**
+     * @return the stock price at space node j when payed dividends have been distributed.
+     */
+    [[nodiscard]] double stockPrice(unsigned j, double payed) const {
+        return std::max(std::exp(x[j]) - payed, 0.);
+    }
+    /**
+     * Far-field value: the discounted payout of the expected underlying, and no less than the exercise value when
+     * the option is American. Accurate deep in and out of the money, where the value is linear in the underlying.
+     */
+    [[nodiscard]] double boundaryValue(unsigned j, unsigned level) const {
+        double tau = dt*(N-level);
+        double dividendSize = 0.1*t0underVal;
+        double forward = std::max(std::exp(x[j] + (r-q)*tau) - payedBefore(N)*dividendSize, 0.);
+        double value = std::exp(-r*tau)*o.payout(forward);
+        if (o.getType()==TradeType::American){
+            value = std::max(value, o.payout(stockPrice(j, payedBefore(level)*dividendSize)));
+        }
+        return value;
+    }
+    void setOption(Option const& option){
+        o = option;
+        double dividendSize = 0.1*t0underVal;
+        bool american = o.getType()==TradeType::American;
+        {
+            BTWE_PHASE(Maturity, M+1);
+            values.resize(M+1);
+            for (unsigned j = 0; j < M+1; j++){
+                values[j] = o.payout(stockPrice(j, payedBefore(N)*dividendSize));
+            }
+        }
+        std::vector<double> lower(M+1), diagonal(M+1), upper(M+1), rhs(M+1), exercise(M+1);
+        double nu = r - q - 0.5*sigma*sigma;
+        // spatial operator L V_j = a V_{j-1} + b V_j + c V_{j+1}
+        double a = 0.5*sigma*sigma/(dx*dx) - 0.5*nu/dx;
+        double b = -sigma*sigma/(dx*dx) - r;
+        double c = 0.5*sigma*sigma/(dx*dx) + 0.5*nu/dx;
+        BTWE_PHASE(Induction, std::uint64_t{N}*(M+1));
+        for (auto level = static_cast<long>(N)-1; level >= 0; level--){
+            checkCancellation(level);
+            bool rannacher = N-level <= rannacherSteps;
+            // Rannacher steps are two implicit half-steps, the others one Crank-Nicolson step
+            int subSteps = rannacher ? 2 : 1;
+            double theta = rannacher ? 1. : 0.5;
+            double h = dt/subSteps;
+            for (int s = 0; s < subSteps; s++){
+                // boundaries and exercise values are those of the level reached at the end of the step
+                auto target = static_cast<unsigned>(level);
+                double payed = payedBefore(target)*dividendSize;
+                for (unsigned j = 1; j < M; j++){
+                    lower[j] = -theta*h*a;
+                    diagonal[j] = 1. - theta*h*b;
+                    upper[j] = -theta*h*c;
+                    rhs[j] = values[j] + (1.-theta)*h*(a*values[j-1] + b*values[j] + c*values[j+1]);
+                    exercise[j] = american ? o.payout(stockPrice(j, payed)) : -1.;
+                }
+                values[0] = boundaryValue(0, target);
+                values[M] = boundaryValue(M, target);
+                rhs[1] -= lower[1]*values[0];
+                rhs[M-1] -= upper[M-1]*values[M];
+                if (o.getCallPut()==CallPut::Put){
+                    solveFromTop(lower, diagonal, upper, rhs, exercise);
+                } else {
+                    solveFromBottom(lower, diagonal, upper, rhs, exercise);
+                }
+            }
+            if (level==1) valueAtFirstStep = values[M/2];
+        }
+        if (N==1) valueAtFirstStep = o.payout(stockPrice(M/2, payedBefore(1)*dividendSize));
+    }
+    /**
+     * Thomas algorithm: eliminates the lower diagonal from the bottom, then substitutes from the top (high
+     * underlying values) down. The early exercise constraint is applied during the substitution, which is the
+     * Brennan-Schwartz projection for calls, whose exercise region lies at high underlying values.
+     * Non-exercisable nodes have a negative exercise value.
+     */
+    void solveFromBottom(std::vector<double> const& lower, std::vector<double>& diagonal, std::vector<double> const& upper,
+                         std::vector<double>& rhs, std::vector<double> const& exercise){
+        for (unsigned j = 2; j < M; j++){
+            double w = lower[j]/diagonal[j-1];
+            diagonal[j] -= w*upper[j-1];
+            rhs[j] -= w*rhs[j-1];
+        }
+        values[M-1] = std::max(rhs[M-1]/diagonal[M-1], exercise[M-1]);
+        for (unsigned j = M-2; j > 0; j--){
+            values[j] = std::max((rhs[j] - upper[j]*values[j+1])/diagonal[j], exercise[j]);
+        }
+    }
+    /**
+     * Mirror of solveFromBottom: eliminates the upper diagonal from the top, then substitutes from the bottom (low
+     * underlying values) up. This is the Brennan-Schwartz projection for puts.
+     */
+    void solveFromTop(std::vector<double> const& lower, std::vector<double>& diagonal, std::vector<double> const& upper,
+                      std::vector<double>& rhs, std::vector<double> const& exercise){
+        for (unsigned j = M-2; j > 0; j--){
+            double w = upper[j]/diagonal[j+1];
+            diagonal[j] -= w*lower[j+1];
+            rhs[j] -= w*rhs[j+1];
+        }
+        values[1] = std::max(rhs[1]/diagonal[1], exercise[1]);
+        for (unsigned j = 2; j < M; j++){
+            values[j] = std::max((rhs[j] - lower[j]*values[j-1])/diagonal[j], exercise[j]);
+        }
+    }
+};
+
+#endif //ACADIA_INTERVIEW_CRANKNICOLSONGRID_H
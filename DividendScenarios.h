@@ -0,0 +1,132 @@
+//
+// Expectation over event-based dividend scenarios, priced in parallel on lattices sharing their geometry.
+//
+
+#ifndef ACADIA_INTERVIEW_DIVIDENDSCENARIOS_H
+#define ACADIA_INTERVIEW_DIVIDENDSCENARIOS_H
+
+#include <cstdint>
+#include <utility>
+#include "Objects.h"
+#include "Parallel.h"
+#include "Philox.h"
+
+struct ScenarioSettings{
+    unsigned scenarios{64}; // rounded up to an even number
+    std::uint64_t seed{defaultRngSeed};
+    unsigned threads{0}; // 0 for all the cores
+    bool stratified{true};
+};
+
+/**
+ * A set of dividend schedules, with the way they were drawn.
+ * Stratified sets hold one structure per stratum of the total number of dividends, in stratum order.
+ */
+struct DividendScenarioSet{
+    std::vector<DividendSchedule> structures;
+    bool stratified{false};
+};
+
+/**
+ * Draws the dividend structures of the scenarios of a trade, covering the days 1 to days.
+ * Scenario m draws from the Philox stream (seed, m), so the set does not depend on the number of threads.
+ * A Poisson process is a Poisson number of events spread uniformly over the period, so every scenario first draws the
+ * total number of dividends and then their days. When stratified, the total of scenario m is drawn from the m-th of M
+ * equiprobable strata of its distribution: the total, which drives most of the price variance, is then sampled
+ * almost exactly.
+ * @param e Market environment, only averageDividendsPerYear is used.
+ * @param days last day that may pay a dividend. No dividends are allowed on day 0.
+ * @return scenario set.
+ */
+inline DividendScenarioSet sampleDividendScenarios(Environment const& e, unsigned days, ScenarioSettings const& settings){
+    if (settings.scenarios==0) throw std::invalid_argument("At least one dividend scenario is required.");
+    unsigned count = settings.scenarios + settings.scenarios%2;
+    double mean = days*e.averageDividendsPerYear/365.25;
+    DividendScenarioSet res;
+    res.stratified = settings.stratified;
+    res.structures.resize(count);
+    parallelFor(count, settings.threads, [&](std::size_t m){
+        PhiloxStream rng(settings.seed, static_cast<std::uint32_t>(m));
+        double u = settings.stratified ? (m + rng.uniform())/count : rng.uniform();
+        int total = poissonQuantile(u, mean);
+        std::vector<DividendEvent> events;
+        for (int k = 0; k < total && days>0; k++){
+            events.push_back({1 + std::min(days-1, static_cast<unsigned>(rng.uniform()*days)), 1});
+        }
+        res.structures[m] = DividendSchedule(std::move(events));
+    });
+    return res;
+}
+
+/**
+ * Mean and standard error of the prices of a scenario set. Stratified sets have a single sample per stratum: the
+ * variance is estimated on pairs of neighbouring strata, which slightly overstates it.
+ */
+inline std::pair<double, double> scenarioMeanAndError(std::vector<double> const& prices, bool stratified){
+    auto M = static_cast<double>(prices.size());
+    double mean = std::accumulate(prices.begin(), prices.end(), 0.)/M;
+    double variance{0};
+    if (stratified && prices.size()%2==0){
+        for (std::size_t j = 0; j < prices.size(); j += 2) variance += std::pow(prices[j]-prices[j+1], 2);
+        variance /= M*M;
+    } else if (prices.size()>1) {
+        for (double price : prices) variance += std::pow(price-mean, 2);
+        variance /= M*(M-1);
+    }
+    return {mean, std::sqrt(variance)};
+}
+
+/**
+ * Price averaged over dividend scenarios, on a lattice model exposing the BinomialTree surface and a dividend-free
+ * Geometry (BasicBinomialTree, TrinomialTree). The geometry is computed once and shared by the scenarios, which are
+ * priced in parallel.
+ *
+ * The model exposes the BinomialTree surface itself, getDividendStructure() returning the scenario set: the myUtils
+ * Greeks reprice the bumped trades on the same scenarios (common random numbers), so the Greeks are as smooth as the
+ * ones of a single tree.
+ */
+template<class Model>
+class DividendScenarios{
+private:
+    double price{0}, standardError{0};
+    unsigned N{0};
+    DividendScenarioSet scenarios;
+public:
+    /**
+     * Samples the scenarios and prices the trade on them.
+     * @param steps number of time steps of the lattices, 0 for one step per day.
+     */
+    static DividendScenarios build(Environment const& e, Option const& o, ScenarioSettings const& settings = {},
+                                   unsigned steps = 0){
+        // the scenarios cover the maturity of the trade bumped by Theta
+        auto set = sampleDividendScenarios(e, o.getTimeToMaturity()+1, settings);
+        return build(e, o, set, steps>0 ? steps : o.getTimeToMaturity(), settings.threads);
+    }
+    /**
+     * Prices the trade on the given scenarios.
+     * @param steps number of time steps of the lattices.
+     * @param threads 0 for all the cores.
+     */
+    static DividendScenarios build(Environment const& e, Option const& o, DividendScenarioSet const& set,
+                                   unsigned steps, unsigned threads = 0){
+        if (set.structures.empty()) throw std::invalid_argument("At least one dividend scenario is required.");
+        DividendScenarios model;
+        model.scenarios = set;
+        auto geometry = Model::geometry(e, o, steps);
+        model.N = geometry.steps;
+        std::vector<double> prices(set.structures.size());
+        parallelFor(prices.size(), threads, [&](std::size_t m){
+            prices[m] = Model::build(e, o, set.structures[m], geometry).getPrice();
+        });
+        std::tie(model.price, model.standardError) = scenarioMeanAndError(prices, set.stratified);
+        return model;
+    }
+    [[nodiscard]] double getPrice() const {return price;}
+    [[nodiscard]] double getStandardError() const {return standardError;}
+    [[nodiscard]] int getN() const {return N;}
+    [[nodiscard]] DividendScenarioSet const& getDividendStructure() const {return scenarios;}
+private:
+    DividendScenarios() = default;
+};
+
+#endif //ACADIA_INTERVIEW_DIVIDENDSCENARIOS_H
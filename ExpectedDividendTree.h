@@ -0,0 +1,143 @@
+//
+// Binomial lattice pricing the expectation over Poisson dividends in one deterministic pass.
+//
+
+#ifndef ACADIA_INTERVIEW_EXPECTEDDIVIDENDTREE_H
+#define ACADIA_INTERVIEW_EXPECTEDDIVIDENDTREE_H
+
+#include "Objects.h"
+
+/**
+ * Poisson dividend model of an Environment: dividends of 10% of the initial stock price, averageDividendsPerYear on
+ * average. Counts whose probability is below tailProbability are dropped, which bounds the error on the price by
+ * about tailProbability times the largest payout.
+ */
+struct PoissonDividends{
+    double tailProbability{1e-9};
+};
+
+/**
+ * Binomial tree whose state is augmented with the number of dividends payed so far. Between two levels the count
+ * grows by a Poisson number of dividends, so every node holds the trade value for each count and the price is the
+ * exact expectation over the dividend process, rather than the price of one sampled dividend structure.
+ *
+ * The count dimension is sparse: at level i only the counts up to the (1-tailProbability) quantile of the dividends
+ * payed by then are kept, and a step only adds the few counts a single step can pay. Levels are swept backwards on
+ * two buffers of counts x nodes, so memory stays linear in the number of steps, and the underlying values are
+ * computed from the power table of the dividend-free BasicBinomialTree geometry.
+ * @tparam Parameterization policy of the binomial tree, see TreeParameters.
+ */
+template<class Parameterization>
+class BasicExpectedDividendTree{
+private:
+    double price{0};
+    unsigned N{0}, maxDividends{0};
+    std::size_t states{0};
+    PoissonDividends dividends;
+public:
+    /**
+     * Build the model with one step per calendar day, market assumptions as in BinomialTree::build.
+     */
+    static BasicExpectedDividendTree build(Environment const& e, Option const& o, PoissonDividends const& dividends = {}){
+        return build(e, o, dividends, o.getTimeToMaturity());
+    }
+    /**
+     * Same as above, with an arbitrary number of time steps spanning the life of the option.
+     * @param steps number of time steps, possibly adjusted by the parameterization (see getN()).
+     */
+    static BasicExpectedDividendTree build(Environment const& e, Option const& o, PoissonDividends const& dividends,
+                                           unsigned steps){
+        if (!(dividends.tailProbability>0. && dividends.tailProbability<1.))
+            throw std::invalid_argument("The tail probability must be in (0,1).");
+        BasicExpectedDividendTree model;
+        model.dividends = dividends;
+        model.backwardInduction(e, o, *BasicBinomialTree<Parameterization>::cachedGeometry(e, o, steps));
+        return model;
+    }
+    [[nodiscard]] double getPrice() const {return price;}
+    [[nodiscard]] int getN() const {return N;}
+    /**
+     * @return largest number of dividends kept at maturity.
+     */
+    [[nodiscard]] unsigned getMaxDividends() const {return maxDividends;}
+    /**
+     * @return number of (node, count) states visited, to be compared with the (N+1)(N+2)/2 nodes of a tree.
+     */
+    [[nodiscard]] std::size_t getStates() const {return states;}
+    [[nodiscard]] PoissonDividends const& getDividendStructure() const {return dividends;}
+private:
+    BasicExpectedDividendTree() = default;
+    void backwardInduction(Environment const& e, Option const& o,
+                           typename BasicBinomialTree<Parameterization>::Geometry const& geometry){
+        N = geometry.steps;
+        auto const& upPowers = geometry.upPowers;
+        auto const& downPowers = geometry.downPowers;
+        double p = geometry.parameters.p;
+        double discount = geometry.discount;
+        double dividendSize = 0.1*e.underlyingT0Price;
+        bool american = o.getType()==TradeType::American;
+        double quantile = 1. - dividends.tailProbability;
+
+        // largest count kept at every level, and distribution of the dividends payed by every step
+        auto stepMeans = stepDividendMeans(e, o.getTimeToMaturity(), N);
+        std::vector<unsigned> counts(N+1, 0);
+        std::vector<std::vector<double>> jumps(N+1);
+        double cumulativeMean{0};
+        for (unsigned i = 1; i < N+1; i++){
+            cumulativeMean += stepMeans[i];
+            counts[i] = poissonQuantile(quantile, cumulativeMean);
+            // the tail is shared by the steps, so that at most tailProbability of the paths are truncated
+            jumps[i].resize(poissonQuantile(1. - dividends.tailProbability/N, stepMeans[i])+1);
+            double total{0};
+            for (unsigned k = 0; k < jumps[i].size(); k++){
+                jumps[i][k] = std::exp(k*std::log(std::max(stepMeans[i], 1e-300)) - stepMeans[i] - std::lgamma(k+1.));
+                total += jumps[i][k];
+            }
+            for (auto& probability : jumps[i]) probability /= total; // the dropped tail is renormalized away
+        }
+        maxDividends = counts[N];
+
+        // values[c*(N+1)+j]: trade value at node j of the current level after c dividends
+        std::size_t row = N+1;
+        std::vector<double> values(static_cast<std::size_t>(counts[N]+1)*row), continuation(values.size());
+        auto stock = [&](unsigned i, unsigned j, unsigned c){
+            return std::max(e.underlyingT0Price*upPowers[j]*downPowers[i-j] - c*dividendSize, 0.);
+        };
+        {
+            BTWE_PHASE(Maturity, (counts[N]+1)*row);
+            for (unsigned c = 0; c < counts[N]+1; c++){
+                for (unsigned j = 0; j < N+1; j++) values[c*row+j] = o.payout(stock(N, j, c));
+            }
+        }
+        states = static_cast<std::size_t>(counts[N]+1)*(N+1);
+        BTWE_PHASE(Induction, std::uint64_t{N}*(N+1)/2*(counts[N]+1));
+        for (auto i = static_cast<long>(N)-1; i >= 0; i--){
+            checkCancellation(i);
+            auto next = static_cast<unsigned>(i+1);
+            // continuation of the diffusion, at the counts of the next level
+            for (unsigned c = 0; c < counts[next]+1; c++){
+                double const* v = values.data() + c*row;
+                double* w = continuation.data() + c*row;
+                for (long j = 0; j < i+1; j++) w[j] = discount*(p*v[j+1] + (1.-p)*v[j]);
+            }
+            // expectation over the dividends payed by the step, counts beyond the last one kept are capped
+            auto const& jump = jumps[next];
+            for (unsigned c = 0; c < counts[i]+1; c++){
+                double* v = values.data() + c*row;
+                std::fill_n(v, i+1, 0.);
+                for (unsigned k = 0; k < jump.size(); k++){
+                    double const* w = continuation.data() + std::min(c+k, counts[next])*row;
+                    for (long j = 0; j < i+1; j++) v[j] += jump[k]*w[j];
+                }
+                if (american){
+                    for (long j = 0; j < i+1; j++) v[j] = std::max(v[j], o.payout(stock(i, j, c)));
+                }
+            }
+            states += static_cast<std::size_t>(counts[i]+1)*(i+1);
+        }
+        price = values[0];
+    }
+};
+using ExpectedDividendTree = BasicExpectedDividendTree<CoxRossRubinstein>;
+
+#endif //ACADIA_INTERVIEW_EXPECTEDDIVIDENDTREE_H
@@ -0,0 +1,52 @@
+//
+// Global operator new and delete counting the heap blocks of the pricing phases (instrumentation::countAllocation).
+//
+
+#ifndef ACADIA_INTERVIEW_HEAPCOUNTING_H
+#define ACADIA_INTERVIEW_HEAPCOUNTING_H
+
+#include "Instrumentation.h"
+
+/**
+ * Replaces every form of the global operator new and delete when BTWE_INSTRUMENTATION or BTWE_HEAP_COUNTING is
+ * defined, and defines nothing otherwise. Include it in one translation unit of a program, as main.cpp and the unit
+ * tests do. Every block is counted as requested, whatever container or resource requests it, then passed to the heap
+ * observer if any, and allocated with malloc or aligned_alloc, freed with free.
+ */
+#if defined(BTWE_INSTRUMENTATION) || defined(BTWE_HEAP_COUNTING)
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace instrumentation::detail{
+    inline void* countedNew(std::size_t size, std::size_t alignment){
+        countAllocation(size);
+        if (auto* observer = heapObserver.load(std::memory_order_relaxed)) observer(size);
+        size = size>0 ? size : 1;
+        void* p = alignment>alignof(std::max_align_t)
+                  ? std::aligned_alloc(alignment, (size+alignment-1)/alignment*alignment) // a multiple of the alignment
+                  : std::malloc(size);
+        if (p) return p;
+        throw std::bad_alloc();
+    }
+}
+
+void* operator new(std::size_t size){return instrumentation::detail::countedNew(size, 0);}
+void* operator new[](std::size_t size){return instrumentation::detail::countedNew(size, 0);}
+void* operator new(std::size_t size, std::align_val_t alignment){
+    return instrumentation::detail::countedNew(size, static_cast<std::size_t>(alignment));
+}
+void* operator new[](std::size_t size, std::align_val_t alignment){
+    return instrumentation::detail::countedNew(size, static_cast<std::size_t>(alignment));
+}
+void operator delete(void* p) noexcept {std::free(p);}
+void operator delete[](void* p) noexcept {std::free(p);}
+void operator delete(void* p, std::size_t) noexcept {std::free(p);}
+void operator delete[](void* p, std::size_t) noexcept {std::free(p);}
+void operator delete(void* p, std::align_val_t) noexcept {std::free(p);}
+void operator delete[](void* p, std::align_val_t) noexcept {std::free(p);}
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept {std::free(p);}
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept {std::free(p);}
+#endif
+
+#endif //ACADIA_INTERVIEW_HEAPCOUNTING_H
@@ -0,0 +1,377 @@
+//
+// Per-phase instrumentation of the pricings: wall time, nodes and allocated bytes per engine and phase, and a trace.
+//
+
+#ifndef ACADIA_INTERVIEW_INSTRUMENTATION_H
+#define ACADIA_INTERVIEW_INSTRUMENTATION_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * The pricings record their phases when compiled with BTWE_INSTRUMENTATION defined (CMake option
+ * BTWE_INSTRUMENTATION). Otherwise the macros below expand to nothing and their arguments are not evaluated: the
+ * pricings are the same code as without them, and the reports are empty.
+ *
+ * A phase is a scope of the pricing code, BTWE_PHASE(Induction, nodes): it counts one call, the nodes (or grid points,
+ * or path steps) it processes and its wall time, under the engine of the innermost BTWE_ENGINE_SCOPE of the thread.
+ * The heap blocks requested meanwhile are counted at the allocator, by the operator new of HeapCounting.h, and added
+ * to the innermost phase. Phases nest: the time of a phase includes that of the phases it runs, e.g. greeks includes
+ * the inductions of the bumps.
+ *
+ * Every thread records into its own counters and trace buffer, written by that thread only, with no lock and no
+ * read-modify-write; the reports add up the threads and may be read while pricings run. The record of a thread that
+ * ended is kept for the reports and reused by the next thread, so there are no more records than threads recording at
+ * once.
+ */
+namespace instrumentation{
+    enum class Phase : unsigned char{
+        Geometry, // lattice parameters and power tables
+        Build, // allocation and setup of the lattice storage
+        Underlying, // underlying values and dividends of the levels
+        Maturity, // payoffs at maturity
+        Induction, // backward induction over the levels
+        Greeks, // repricings of the bumps of the Greeks
+        Paths, // Monte Carlo paths
+        Regression, // Longstaff-Schwartz regressions
+        Count
+    };
+    constexpr std::size_t phaseCount = static_cast<std::size_t>(Phase::Count);
+    constexpr std::array<char const*, phaseCount> phaseNames = {
+            "geometry", "build", "underlying", "maturity", "induction", "greeks", "paths", "regression"};
+    constexpr std::size_t maxEngines = 32; // engine 0 stands for phases run outside any engine scope
+    constexpr std::size_t maxTraceEvents = std::size_t{1}<<15; // per thread, later events are dropped
+#ifdef BTWE_INSTRUMENTATION
+    constexpr bool enabled = true;
+#else
+    constexpr bool enabled = false;
+#endif
+
+    struct PhaseStatistics{
+        std::string engine;
+        Phase phase{Phase::Count};
+        std::uint64_t calls{0};
+        std::uint64_t nanoseconds{0};
+        std::uint64_t nodes{0};
+        std::uint64_t bytes{0};
+    };
+
+    namespace detail{
+        using Clock = std::chrono::steady_clock;
+        /**
+         * Counter written by one thread: a relaxed load and store, no locked instruction.
+         */
+        struct Counter{
+            std::atomic<std::uint64_t> value{0};
+            void add(std::uint64_t amount){
+                value.store(value.load(std::memory_order_relaxed)+amount, std::memory_order_relaxed);
+            }
+            [[nodiscard]] std::uint64_t get() const {return value.load(std::memory_order_relaxed);}
+        };
+        struct PhaseCounters{
+            Counter calls, nanoseconds, nodes, bytes;
+        };
+        struct TraceEvent{
+            std::uint64_t start{0}, duration{0}; // nanoseconds since the origin of the registry
+            Phase phase{Phase::Count};
+            unsigned char engine{0};
+        };
+        struct ThreadRecord{
+            std::uint32_t thread{0};
+            std::array<PhaseCounters, maxEngines*phaseCount> counters;
+            std::unique_ptr<TraceEvent[]> events; // allocated on the first event, before eventCount is published
+            std::atomic<std::size_t> eventCount{0}; // published with release, events below it are complete
+            Counter dropped;
+            unsigned char engine{0};
+            PhaseCounters* current{nullptr}; // innermost phase
+            bool tracing{false}; // allocating the trace buffer, which is not pricing memory
+        };
+        /**
+         * Records of the threads, kept after their end for the reports, the records of the ended threads, given to
+         * the next threads, and the engine names.
+         */
+        struct Registry{
+            std::mutex mutex;
+            std::vector<std::unique_ptr<ThreadRecord>> threads;
+            std::vector<ThreadRecord*> idle;
+            std::vector<std::string> engines{"none"};
+            Clock::time_point origin{Clock::now()};
+        };
+        inline Registry& registry(){
+            static Registry res;
+            return res;
+        }
+        /**
+         * @return the record of the calling thread, null before its first phase. Trivially destructible, it can be
+         * read from operator new.
+         */
+        inline ThreadRecord*& activeRecord(){
+            thread_local ThreadRecord* res{nullptr};
+            return res;
+        }
+        /**
+         * Gives the record of a thread back to the registry when the thread ends.
+         */
+        struct ThreadSlot{
+            ThreadSlot() = default;
+            ThreadSlot(ThreadSlot const&) = delete;
+            ThreadSlot& operator=(ThreadSlot const&) = delete;
+            ~ThreadSlot(){
+                auto*& record = activeRecord();
+                auto& r = registry();
+                std::lock_guard<std::mutex> lock(r.mutex);
+                r.idle.push_back(record);
+                record = nullptr;
+            }
+        };
+        /**
+         * @return the record of the calling thread: on its first phase, the record of an ended thread, or a new one.
+         */
+        inline ThreadRecord& threadRecord(){
+            auto*& record = activeRecord();
+            if (!record){
+                thread_local ThreadSlot slot;
+                auto& r = registry();
+                std::lock_guard<std::mutex> lock(r.mutex);
+                if (r.idle.empty()){
+                    r.threads.push_back(std::make_unique<ThreadRecord>());
+                    r.threads.back()->thread = static_cast<std::uint32_t>(r.threads.size());
+                    r.idle.push_back(r.threads.back().get());
+                }
+                record = r.idle.back();
+                r.idle.pop_back();
+            }
+            return *record;
+        }
+        /**
+         * @return the id of an engine name, from a cache of the thread; engines beyond maxEngines share the last id.
+         */
+        inline unsigned char engineId(std::string const& name){
+            thread_local std::unordered_map<std::string, unsigned char> ids;
+            if (auto found = ids.find(name); found!=ids.end()) return found->second;
+            auto& r = registry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            std::size_t id{0};
+            while (id<r.engines.size() && r.engines[id]!=name) id++;
+            if (id==r.engines.size()){
+                if (id<maxEngines) r.engines.push_back(name);
+                else id = maxEngines-1;
+            }
+            return ids[name] = static_cast<unsigned char>(id);
+        }
+        inline std::uint64_t now(){
+            return static_cast<std::uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now()-registry().origin).count());
+        }
+        inline std::vector<ThreadRecord*> threads(std::vector<std::string>* engines = nullptr){
+            auto& r = registry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            std::vector<ThreadRecord*> res;
+            for (auto const& thread : r.threads) res.push_back(thread.get());
+            if (engines) *engines = r.engines;
+            return res;
+        }
+    }
+
+    /**
+     * Scope of a phase, see BTWE_PHASE.
+     */
+    class PhaseTimer{
+    private:
+        detail::ThreadRecord& record;
+        detail::PhaseCounters* counters;
+        detail::PhaseCounters* previous;
+        Phase phase;
+        std::uint64_t start;
+    public:
+        PhaseTimer(Phase phase, std::uint64_t nodes): record(detail::threadRecord()),
+                counters(&record.counters[record.engine*phaseCount + static_cast<std::size_t>(phase)]),
+                previous(record.current), phase(phase){
+            counters->calls.add(1);
+            counters->nodes.add(nodes);
+            record.current = counters;
+            start = detail::now();
+        }
+        PhaseTimer(PhaseTimer const&) = delete;
+        PhaseTimer& operator=(PhaseTimer const&) = delete;
+        ~PhaseTimer(){
+            auto end = detail::now();
+            counters->nanoseconds.add(end-start);
+            record.current = previous;
+            auto count = record.eventCount.load(std::memory_order_relaxed);
+            if (count<maxTraceEvents && !record.events){
+                record.tracing = true;
+                record.events.reset(new (std::nothrow) detail::TraceEvent[maxTraceEvents]);
+                record.tracing = false;
+            }
+            if (count<maxTraceEvents && record.events){
+                record.events[count] = {start, end-start, phase, record.engine};
+                record.eventCount.store(count+1, std::memory_order_release);
+            } else {
+                record.dropped.add(1);
+            }
+        }
+    };
+
+    /**
+     * Makes an engine the engine of the phases run by the thread for the lifetime of the scope, see
+     * BTWE_ENGINE_SCOPE. Scopes nest.
+     */
+    class EngineScope{
+    private:
+        detail::ThreadRecord& record;
+        unsigned char previous;
+    public:
+        explicit EngineScope(std::string const& name): record(detail::threadRecord()), previous(record.engine){
+            record.engine = detail::engineId(name);
+        }
+        EngineScope(EngineScope const&) = delete;
+        EngineScope& operator=(EngineScope const&) = delete;
+        ~EngineScope(){
+            record.engine = previous;
+        }
+    };
+
+    /**
+     * Adds a block of bytes requested by the thread, from the heap or mapped, to its innermost phase, or to the build
+     * phase of its engine outside any phase. Blocks requested outside the phases and engines (parsing, output) are not
+     * pricing memory and are left out. It neither allocates nor locks, so that operator new can call it.
+     */
+    inline void countAllocation(std::size_t bytes) noexcept {
+        if constexpr (!enabled) return;
+        auto* record = detail::activeRecord();
+        if (!record || record->tracing) return;
+        auto* counters = record->current;
+        if (!counters && record->engine!=0)
+            counters = &record->counters[record->engine*phaseCount + static_cast<std::size_t>(Phase::Build)];
+        if (counters) counters->bytes.add(bytes);
+    }
+
+    /**
+     * Called with the size of every block requested through the operator new of HeapCounting.h, e.g. by a test
+     * checking that a code path does not allocate; null for none. It must neither allocate nor throw.
+     */
+    inline std::atomic<void (*)(std::size_t)> heapObserver{nullptr};
+
+    /**
+     * @return the number of thread records: at most the number of threads that recorded at once.
+     */
+    inline std::size_t threadRecords(){
+        return detail::threads().size();
+    }
+
+    /**
+     * @return the totals of every engine and phase that ran, over all the threads.
+     */
+    inline std::vector<PhaseStatistics> phaseStatistics(){
+        std::vector<std::string> engines;
+        auto threads = detail::threads(&engines);
+        std::vector<PhaseStatistics> res;
+        for (std::size_t engine = 0; engine < engines.size(); engine++){
+            for (std::size_t phase = 0; phase < phaseCount; phase++){
+                PhaseStatistics statistics;
+                statistics.engine = engines[engine];
+                statistics.phase = static_cast<Phase>(phase);
+                for (auto const* thread : threads){
+                    auto const& counters = thread->counters[engine*phaseCount + phase];
+                    statistics.calls += counters.calls.get();
+                    statistics.nanoseconds += counters.nanoseconds.get();
+                    statistics.nodes += counters.nodes.get();
+                    statistics.bytes += counters.bytes.get();
+                }
+                if (statistics.calls>0 || statistics.bytes>0) res.push_back(statistics);
+            }
+        }
+        return res;
+    }
+
+    /**
+     * Writes a table of phaseStatistics(): calls, total and mean time, nodes, time per node and allocated memory.
+     */
+    inline void writeSummary(std::ostream& out){
+        out << std::left << std::setw(20) << "engine" << std::setw(12) << "phase" << std::right << std::setw(10)
+            << "calls" << std::setw(12) << "total ms" << std::setw(12) << "mean us" << std::setw(16) << "nodes"
+            << std::setw(10) << "ns/node" << std::setw(12) << "alloc MB" << "\n";
+        auto flags = out.flags();
+        out << std::fixed;
+        for (auto const& s : phaseStatistics()){
+            out << std::left << std::setw(20) << s.engine << std::setw(12) << phaseNames[static_cast<std::size_t>(s.phase)]
+                << std::right << std::setw(10) << s.calls << std::setprecision(3) << std::setw(12) << s.nanoseconds*1e-6
+                << std::setw(12) << (s.calls>0 ? s.nanoseconds*1e-3/s.calls : 0.) << std::setw(16) << s.nodes
+                << std::setprecision(2) << std::setw(10)
+                << (s.nodes>0 ? static_cast<double>(s.nanoseconds)/s.nodes : 0.) << std::setprecision(3)
+                << std::setw(12) << s.bytes/1048576. << "\n";
+        }
+        out.flags(flags);
+    }
+
+    /**
+     * Writes the phases recorded by every thread in the Chrome trace-event format (chrome://tracing, Perfetto): one
+     * complete event per phase, named after the phase, with the engine as category, one track per thread.
+     */
+    inline void writeChromeTrace(std::ostream& out){
+        std::vector<std::string> engines;
+        auto threads = detail::threads(&engines);
+        auto flags = out.flags();
+        out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+        bool first{true};
+        for (auto const* thread : threads){
+            auto count = thread->eventCount.load(std::memory_order_acquire);
+            for (std::size_t k = 0; k < count; k++){
+                auto const& event = thread->events[k];
+                out << (first ? "" : ",") << "\n{\"name\":\"" << phaseNames[static_cast<std::size_t>(event.phase)]
+                    << "\",\"cat\":\"" << engines[event.engine] << "\",\"ph\":\"X\",\"ts\":" << event.start*1e-3
+                    << ",\"dur\":" << event.duration*1e-3 << ",\"pid\":1,\"tid\":" << thread->thread << "}";
+                first = false;
+            }
+        }
+        out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+        out.flags(flags);
+    }
+
+    /**
+     * @return trace events dropped because a thread filled its buffer.
+     */
+    inline std::uint64_t droppedTraceEvents(){
+        std::uint64_t res{0};
+        for (auto const* thread : detail::threads()) res += thread->dropped.get();
+        return res;
+    }
+
+    /**
+     * Clears the counters and the traces. No pricing may run meanwhile.
+     */
+    inline void reset(){
+        for (auto* thread : detail::threads()){
+            for (auto& counters : thread->counters){
+                for (auto* counter : {&counters.calls, &counters.nanoseconds, &counters.nodes, &counters.bytes})
+                    counter->value.store(0, std::memory_order_relaxed);
+            }
+            thread->eventCount.store(0, std::memory_order_release);
+            thread->dropped.value.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+#ifdef BTWE_INSTRUMENTATION
+#define BTWE_CONCAT_IMPL(a, b) a##b
+#define BTWE_CONCAT(a, b) BTWE_CONCAT_IMPL(a, b)
+#define BTWE_PHASE(phase, nodes) \
+    ::instrumentation::PhaseTimer BTWE_CONCAT(btwePhase, __LINE__)(::instrumentation::Phase::phase, (nodes))
+#define BTWE_ENGINE_SCOPE(info) ::instrumentation::EngineScope BTWE_CONCAT(btweEngine, __LINE__)((info).name)
+#else
+#define BTWE_PHASE(phase, nodes) static_cast<void>(0)
+#define BTWE_ENGINE_SCOPE(info) static_cast<void>(0)
+#endif
+
+#endif //ACADIA_INTERVIEW_INSTRUMENTATION_H
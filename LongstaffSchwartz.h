@@ -0,0 +1,223 @@
+//
+// Longstaff-Schwartz Monte Carlo model, an independent cross-check of the lattice models.
+//
+
+#ifndef ACADIA_INTERVIEW_LONGSTAFFSCHWARTZ_H
+#define ACADIA_INTERVIEW_LONGSTAFFSCHWARTZ_H
+
+#include <array>
+#include <cstdint>
+#include "Objects.h"
+#include "Parallel.h"
+#include "Philox.h"
+
+struct MonteCarloSettings{
+    unsigned paths{1u<<16}; // rounded up to whole blocks
+    unsigned steps{50}; // time steps, i.e. exercise dates of an American option
+    std::uint64_t seed{defaultRngSeed};
+    unsigned threads{0}; // 0 for all the cores
+    bool antithetic{true};
+};
+
+/**
+ * Longstaff-Schwartz Monte Carlo model object.
+ * Paths of the dividend-free underlying X are simulated as geometric Brownian motion and, as in the trees, the stock
+ * price is S = max(X - payed, 0). Event-based dividends are either the given dividend structure or sampled on every
+ * path from the Poisson distribution, so the price is the expectation over dividend scenarios that a single tree
+ * build only samples once. American options are valued by regressing the discounted cash flows of in-the-money paths
+ * on (1, S/K, (S/K)^2) at every exercise date.
+ *
+ * Paths are simulated in blocks of blockSize paths. Every block draws from its own Philox stream (seed, block index)
+ * and stores its paths as structure of arrays, one contiguous row per time step, so the inner loops are branch-free
+ * sweeps over contiguous memory that the compiler vectorizes. Blocks are processed in parallel and every reduction
+ * is summed in block order: the result is bit-reproducible for a given seed whatever the number of threads.
+ */
+class LongstaffSchwartz{
+private:
+    double price{0}, standardError{0};
+    unsigned paths{0}, steps{0};
+public:
+    static constexpr unsigned blockSize = 512;
+    /**
+     * Price with event-based dividends sampled on every path from the Poisson distribution.
+     * @param e Market environment. It includes vol, rate, stock price at time t0, number of average dividends payed per year.
+     * @param o Derivative trade.
+     * @param settings number of paths and exercise dates, seed, threads.
+     * @return Model object.
+     */
+    static LongstaffSchwartz build(Environment const& e, Option const& o, MonteCarloSettings const& settings = {}){
+        LongstaffSchwartz model;
+        model.simulate(e, o, settings, nullptr);
+        return model;
+    }
+    /**
+     * Price with the given dividend structure on every path, as BinomialTree::build(e, o, dividends).
+     */
+    static LongstaffSchwartz build(Environment const& e, Option const& o, DividendSchedule const& dividends,
+                                   MonteCarloSettings const& settings = {}){
+        LongstaffSchwartz model;
+        model.simulate(e, o, settings, &dividends);
+        return model;
+    }
+    [[nodiscard]] double getPrice() const {return price;}
+    [[nodiscard]] double getStandardError() const {return standardError;}
+    [[nodiscard]] unsigned getPaths() const {return paths;}
+    [[nodiscard]] int getN() const {return steps;}
+private:
+    LongstaffSchwartz() = default;
+    using Regression = std::array<double, 9>; // normal equations: 6 entries of the symmetric matrix, 3 of the rhs
+    static void basis(double s, double (&phi)[3]){
+        phi[0] = 1.;
+        phi[1] = s;
+        phi[2] = s*s;
+    }
+    /**
+     * Solves the 3x3 normal equations by Gaussian elimination.
+     * @return false if the system is singular, e.g. too few paths are in the money.
+     */
+    static bool solve(Regression const& n, std::array<double, 3>& beta){
+        double a[3][4] = {{n[0], n[1], n[2], n[6]},
+                          {n[1], n[3], n[4], n[7]},
+                          {n[2], n[4], n[5], n[8]}};
+        for (int c = 0; c < 3; c++){
+            int pivot = c;
+            for (int row = c+1; row < 3; row++) if (std::abs(a[row][c]) > std::abs(a[pivot][c])) pivot = row;
+            if (std::abs(a[pivot][c]) < 1e-12*std::max(1., std::abs(n[0]))) return false;
+            for (int k = 0; k < 4; k++) std::swap(a[c][k], a[pivot][k]);
+            for (int row = c+1; row < 3; row++){
+                double w = a[row][c]/a[c][c];
+                for (int k = c; k < 4; k++) a[row][k] -= w*a[c][k];
+            }
+        }
+        for (int c = 2; c >= 0; c--){
+            double v = a[c][3];
+            for (int k = c+1; k < 3; k++) v -= a[c][k]*beta[k];
+            beta[c] = v/a[c][c];
+        }
+        return true;
+    }
+    void simulate(Environment const& e, Option const& o, MonteCarloSettings const& settings,
+                  DividendSchedule const* dividends){
+        if (settings.steps==0) throw std::invalid_argument("The simulation must have at least one time step.");
+        if (settings.paths==0) throw std::invalid_argument("The simulation must have at least one path.");
+        steps = settings.steps;
+        std::size_t blocks = (settings.paths + blockSize - 1)/blockSize;
+        paths = static_cast<unsigned>(blocks*blockSize);
+        unsigned days = o.getTimeToMaturity();
+        double dt = (static_cast<double>(days)/steps)/365.25;
+        double drift = (e.riskFreeRate - e.q - 0.5*e.volatility*e.volatility)*dt;
+        double diffusion = e.volatility*std::sqrt(dt);
+        double discount = std::exp(-e.riskFreeRate*dt);
+        double dividendSize = 0.1*e.underlyingT0Price;
+        bool american = o.getType()==TradeType::American;
+        std::vector<int> fixedCumSum(steps+1, 0);
+        for (unsigned i = 1; dividends && i < steps+1; i++) fixedCumSum[i] = dividends->payedBefore(i, days, steps);
+        auto stepDividendMean = stepDividendMeans(e, days, steps);
+
+        // stock prices, row i holds the price of every path at time level i
+        std::vector<double> stock(static_cast<std::size_t>(steps+1)*paths);
+        {
+            BTWE_PHASE(Paths, std::uint64_t{steps}*paths);
+            parallelFor(blocks, settings.threads, [&](std::size_t b){
+                PhiloxStream rng(settings.seed, static_cast<std::uint32_t>(b));
+                std::size_t first = b*blockSize;
+                unsigned drawn = settings.antithetic ? blockSize/2 : blockSize;
+                std::vector<double> logX(blockSize, std::log(e.underlyingT0Price)), z(blockSize);
+                std::vector<int> payed(blockSize, 0);
+                std::fill_n(stock.begin()+first, blockSize, e.underlyingT0Price);
+                for (unsigned i = 1; i < steps+1; i++){
+                    checkCancellation(i);
+                    for (unsigned k = 0; k < drawn; k += 2){
+                        auto pair = rng.normalPair();
+                        z[k] = pair[0];
+                        z[k+1] = pair[1];
+                    }
+                    if (dividends){
+                        std::fill(payed.begin(), payed.end(), fixedCumSum[i]);
+                    } else if (stepDividendMean[i]>0.) {
+                        for (unsigned k = 0; k < drawn; k++) payed[k] += rng.poisson(stepDividendMean[i]);
+                    }
+                    if (settings.antithetic){
+                        for (unsigned k = 0; k < drawn; k++){
+                            z[drawn+k] = -z[k];
+                            payed[drawn+k] = payed[k];
+                        }
+                    }
+                    double* row = stock.data() + static_cast<std::size_t>(i)*paths + first;
+                    for (unsigned k = 0; k < blockSize; k++) logX[k] += drift + diffusion*z[k];
+                    for (unsigned k = 0; k < blockSize; k++){
+                        row[k] = std::max(std::exp(logX[k]) - payed[k]*dividendSize, 0.);
+                    }
+                }
+            });
+        }
+
+        // cash flows, discounted to the time level being processed
+        std::vector<double> cashFlows(paths);
+        double const* last = stock.data() + static_cast<std::size_t>(steps)*paths;
+        for (std::size_t p = 0; p < paths; p++) cashFlows[p] = o.payout(last[p]);
+        std::vector<Regression> partial(blocks);
+        double strike = o.getStrike();
+        BTWE_PHASE(Regression, std::uint64_t{steps-1}*paths);
+        for (unsigned i = steps-1; i > 0; i--){
+            checkCancellation(i);
+            double const* row = stock.data() + static_cast<std::size_t>(i)*paths;
+            parallelFor(blocks, settings.threads, [&](std::size_t b){
+                Regression n{};
+                for (std::size_t p = b*blockSize; p < (b+1)*blockSize; p++){
+                    cashFlows[p] *= discount;
+                    double exercise = o.payout(row[p]);
+                    if (!american || exercise<=0.) continue;
+                    double phi[3];
+                    basis(row[p]/strike, phi);
+                    n[0] += phi[0]*phi[0]; n[1] += phi[0]*phi[1]; n[2] += phi[0]*phi[2];
+                    n[3] += phi[1]*phi[1]; n[4] += phi[1]*phi[2]; n[5] += phi[2]*phi[2];
+                    n[6] += phi[0]*cashFlows[p]; n[7] += phi[1]*cashFlows[p]; n[8] += phi[2]*cashFlows[p];
+                }
+                partial[b] = n;
+            });
+            if (!american) continue;
+            Regression total{};
+            for (auto const& n : partial) for (int k = 0; k < 9; k++) total[k] += n[k];
+            std::array<double, 3> beta{};
+            if (total[0]<3 || !solve(total, beta)) continue;
+            parallelFor(blocks, settings.threads, [&](std::size_t b){
+                for (std::size_t p = b*blockSize; p < (b+1)*blockSize; p++){
+                    double exercise = o.payout(row[p]);
+                    if (exercise<=0.) continue;
+                    double phi[3];
+                    basis(row[p]/strike, phi);
+                    double continuation = beta[0]*phi[0] + beta[1]*phi[1] + beta[2]*phi[2];
+                    if (exercise>continuation) cashFlows[p] = exercise;
+                }
+            });
+        }
+
+        // mean and standard error; antithetic pairs are averaged first, as they are not independent
+        std::vector<std::array<double, 2>> moments(blocks);
+        parallelFor(blocks, settings.threads, [&](std::size_t b){
+            double sum{0}, sumSq{0};
+            std::size_t first = b*blockSize;
+            unsigned samples = settings.antithetic ? blockSize/2 : blockSize;
+            for (unsigned k = 0; k < samples; k++){
+                double y = settings.antithetic ? 0.5*(cashFlows[first+k] + cashFlows[first+samples+k]) : cashFlows[first+k];
+                y *= discount;
+                sum += y;
+                sumSq += y*y;
+            }
+            moments[b] = {sum, sumSq};
+        });
+        double sum{0}, sumSq{0};
+        for (auto const& m : moments){
+            sum += m[0];
+            sumSq += m[1];
+        }
+        double samples = settings.antithetic ? paths/2. : paths;
+        double mean = sum/samples;
+        double variance = std::max(sumSq/samples - mean*mean, 0.)*samples/std::max(samples-1., 1.);
+        standardError = std::sqrt(variance/samples);
+        price = american ? std::max(mean, o.payout(e.underlyingT0Price)) : mean;
+    }
+};
+
+#endif //ACADIA_INTERVIEW_LONGSTAFFSCHWARTZ_H
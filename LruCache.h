@@ -0,0 +1,121 @@
+//
+// Bounded, thread-safe least-recently-used cache.
+//
+
+#ifndef ACADIA_INTERVIEW_LRUCACHE_H
+#define ACADIA_INTERVIEW_LRUCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+/**
+ * Mixes the hash of a value into a running hash (boost::hash_combine).
+ */
+template<class T>
+void hashCombine(std::size_t& seed, T const& value){
+    seed ^= std::hash<T>{}(value) + 0x9E3779B97F4A7C15ull + (seed<<6) + (seed>>2);
+}
+
+/**
+ * Least-recently-used cache of immutable values, shared with the callers by shared_ptr<const Value>: an evicted value
+ * stays alive as long as a caller holds it. Every entry has a weight (1 by default, e.g. its size in bytes otherwise)
+ * and the total weight is bounded by the capacity; values heavier than the capacity are not cached.
+ * All the methods lock the cache, values are computed outside of the lock.
+ */
+template<class Key, class Value, class Hash = std::hash<Key>>
+class LruCache{
+private:
+    using Entry = std::pair<Key, std::pair<std::shared_ptr<const Value>, std::size_t>>;
+    std::list<Entry> entries; // most recently used first
+    std::unordered_map<Key, typename std::list<Entry>::iterator, Hash> index;
+    std::size_t capacity, weight{0};
+    std::uint64_t hitCount{0}, missCount{0};
+    mutable std::mutex mutex;
+public:
+    explicit LruCache(std::size_t capacity): capacity(capacity){}
+    /**
+     * @return the cached value of key, nullptr (and a miss) if there is none.
+     */
+    std::shared_ptr<const Value> find(Key const& key){
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it==index.end()){
+            missCount++;
+            return nullptr;
+        }
+        hitCount++;
+        entries.splice(entries.begin(), entries, it->second);
+        return it->second->second.first;
+    }
+    /**
+     * Caches value under key, evicting the least recently used entries as needed.
+     */
+    void insert(Key const& key, std::shared_ptr<const Value> value, std::size_t valueWeight = 1){
+        std::lock_guard<std::mutex> lock(mutex);
+        if (valueWeight>capacity) return;
+        auto it = index.find(key);
+        if (it!=index.end()){
+            weight -= it->second->second.second;
+            entries.erase(it->second);
+            index.erase(it);
+        }
+        entries.emplace_front(key, std::make_pair(std::move(value), valueWeight));
+        index.emplace(key, entries.begin());
+        weight += valueWeight;
+        while (weight>capacity){
+            weight -= entries.back().second.second;
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+    /**
+     * @return the cached value of key, computed by make() and cached on a miss. Concurrent misses of the same key may
+     * compute it more than once.
+     * @param weightOf weight of the computed value.
+     */
+    template<class Make, class Weight>
+    std::shared_ptr<const Value> findOrInsert(Key const& key, Make&& make, Weight&& weightOf){
+        if (auto value = find(key)) return value;
+        std::shared_ptr<const Value> value = make();
+        insert(key, value, weightOf(*value));
+        return value;
+    }
+    template<class Make>
+    std::shared_ptr<const Value> findOrInsert(Key const& key, Make&& make){
+        return findOrInsert(key, std::forward<Make>(make), [](Value const&){return std::size_t{1};});
+    }
+    void clear(){
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+        index.clear();
+        weight = 0;
+        hitCount = missCount = 0;
+    }
+    [[nodiscard]] std::size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.size();
+    }
+    [[nodiscard]] std::uint64_t hits() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return hitCount;
+    }
+    [[nodiscard]] std::uint64_t misses() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return missCount;
+    }
+    /**
+     * @return fraction of the lookups that found their value, 0 before the first one.
+     */
+    [[nodiscard]] double hitRate() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return hitCount+missCount>0 ? static_cast<double>(hitCount)/(hitCount+missCount) : 0.;
+    }
+};
+
+#endif //ACADIA_INTERVIEW_LRUCACHE_H
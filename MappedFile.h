@@ -0,0 +1,106 @@
+//
+// Memory mapping of whole files (POSIX).
+//
+
+#ifndef ACADIA_INTERVIEW_MAPPEDFILE_H
+#define ACADIA_INTERVIEW_MAPPEDFILE_H
+
+#include <cstddef>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Maps a file read-only for the lifetime of the object, so it can be tokenized in place with no copy.
+ */
+class MappedFile{
+private:
+    void* address{nullptr};
+    std::size_t size{0};
+public:
+    explicit MappedFile(std::string const& path){
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd<0) throw std::runtime_error("Couldn't open " + path + " for reading.");
+        struct stat status{};
+        if (fstat(fd, &status)!=0){
+            close(fd);
+            throw std::runtime_error("Couldn't read the size of " + path + ".");
+        }
+        size = static_cast<std::size_t>(status.st_size);
+        if (size>0){
+            address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address==MAP_FAILED){
+                close(fd);
+                throw std::runtime_error("Couldn't map " + path + ".");
+            }
+            madvise(address, size, MADV_SEQUENTIAL);
+        }
+        close(fd); // the mapping keeps the file alive
+    }
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+    ~MappedFile(){
+        if (address) munmap(address, size);
+    }
+    [[nodiscard]] char const* data() const {return static_cast<char const*>(address);}
+    [[nodiscard]] std::size_t getSize() const {return size;}
+    [[nodiscard]] std::string_view view() const {return {data(), size};}
+};
+
+/**
+ * Creates (or truncates) a file of a given size, or opens an existing one, and maps it read-write and shared: what is
+ * written to the memory ends up in the file, which other processes can map in turn.
+ */
+class MappedOutputFile{
+private:
+    void* address{nullptr};
+    std::size_t size{0};
+public:
+    MappedOutputFile(std::string const& path, std::size_t size): size(size){
+        if (size==0) throw std::invalid_argument("Cannot map an empty file.");
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd<0) throw std::runtime_error("Couldn't open " + path + " for writing.");
+        if (ftruncate(fd, static_cast<off_t>(size))!=0){
+            close(fd);
+            throw std::runtime_error("Couldn't resize " + path + ".");
+        }
+        address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (address==MAP_FAILED) throw std::runtime_error("Couldn't map " + path + ".");
+    }
+    /**
+     * Maps an existing file read-write and shared, whole, e.g. to fill a part of a file created by another process.
+     */
+    explicit MappedOutputFile(std::string const& path){
+        int fd = open(path.c_str(), O_RDWR);
+        if (fd<0) throw std::runtime_error("Couldn't open " + path + " for writing.");
+        struct stat status{};
+        if (fstat(fd, &status)!=0 || status.st_size==0){
+            close(fd);
+            throw std::runtime_error("Couldn't map " + path + ", empty or unreadable.");
+        }
+        size = static_cast<std::size_t>(status.st_size);
+        address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (address==MAP_FAILED) throw std::runtime_error("Couldn't map " + path + ".");
+    }
+    MappedOutputFile(MappedOutputFile const&) = delete;
+    MappedOutputFile& operator=(MappedOutputFile const&) = delete;
+    ~MappedOutputFile(){
+        munmap(address, size);
+    }
+    [[nodiscard]] char* data() const {return static_cast<char*>(address);}
+    [[nodiscard]] std::size_t getSize() const {return size;}
+    /**
+     * Writes the mapped memory back to the file, synchronously.
+     */
+    void sync() const {
+        if (msync(address, size, MS_SYNC)!=0) throw std::runtime_error("Couldn't write the mapped file back.");
+    }
+};
+
+#endif //ACADIA_INTERVIEW_MAPPEDFILE_H
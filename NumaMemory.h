@@ -0,0 +1,198 @@
+//
+// Huge-page backed memory for large lattices, NUMA topology and thread pinning (Linux).
+//
+
+#ifndef ACADIA_INTERVIEW_NUMAMEMORY_H
+#define ACADIA_INTERVIEW_NUMAMEMORY_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <sched.h>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "Instrumentation.h"
+#include "Parallel.h"
+#include "PricingWorkspace.h"
+
+enum class HugePages{
+    Off, // regular pages from the upstream resource
+    Transparent, // 2MB aligned mappings advised to the transparent huge pages of the kernel
+    Explicit // pages of the hugetlbfs pool (vm.nr_hugepages), transparent ones when the pool is empty
+};
+
+/**
+ * @return the huge pages named off, transparent or explicit.
+ */
+inline HugePages parseHugePages(std::string const& name){
+    if (name=="off") return HugePages::Off;
+    if (name=="transparent") return HugePages::Transparent;
+    if (name=="explicit") return HugePages::Explicit;
+    throw std::invalid_argument("Unknown huge pages " + name + ", expected off, transparent or explicit.");
+}
+
+struct HugePageSettings{
+    HugePages hugePages{HugePages::Transparent};
+    bool firstTouch{true}; // touch every page from the allocating thread, so it lands on that thread's NUMA node
+    std::size_t threshold{std::size_t{2}<<20}; // smaller blocks come from the upstream resource
+};
+
+/**
+ * Memory resource mapping the blocks of at least threshold bytes directly from the kernel, 2MB aligned, so that a
+ * lattice of hundreds of MB is covered by huge pages and its sweeps do not miss the TLB at every 4KB page. With
+ * firstTouch, pages are faulted in by the allocating thread: under the default first-touch policy of Linux they are
+ * placed on the NUMA node of the worker that prices the trade instead of wherever the memory is first written.
+ */
+class HugePageResource : public std::pmr::memory_resource{
+public:
+    static constexpr std::size_t hugePageSize = std::size_t{2}<<20;
+private:
+    HugePageSettings settings;
+    std::pmr::memory_resource* upstream;
+    std::atomic<std::size_t> explicitBytes{0}, transparentBytes{0};
+public:
+    explicit HugePageResource(HugePageSettings settings = {},
+                              std::pmr::memory_resource* upstream = std::pmr::new_delete_resource()):
+            settings(settings), upstream(upstream){}
+    /**
+     * @return bytes mapped so far from the hugetlbfs pool and as transparent huge pages.
+     */
+    [[nodiscard]] std::size_t getExplicitBytes() const {return explicitBytes;}
+    [[nodiscard]] std::size_t getTransparentBytes() const {return transparentBytes;}
+    [[nodiscard]] HugePageSettings const& getSettings() const {return settings;}
+private:
+    [[nodiscard]] bool mapped(std::size_t bytes, std::size_t alignment) const {
+        return settings.hugePages!=HugePages::Off && bytes>=settings.threshold && alignment<=hugePageSize;
+    }
+    static std::size_t roundUp(std::size_t bytes) {return (bytes + hugePageSize - 1)/hugePageSize*hugePageSize;}
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        if (!mapped(bytes, alignment)) return upstream->allocate(bytes, alignment);
+        std::size_t size = roundUp(bytes);
+        instrumentation::countAllocation(size); // mapped, so not seen by operator new
+        void* res{nullptr};
+        if (settings.hugePages==HugePages::Explicit){
+            res = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (res==MAP_FAILED) res = nullptr;
+            else explicitBytes += size;
+        }
+        if (!res){
+            // over-map by one huge page and trim, so that the block is 2MB aligned and THP can back all of it
+            auto* raw = static_cast<char*>(mmap(nullptr, size + hugePageSize, PROT_READ | PROT_WRITE,
+                                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+            if (raw==MAP_FAILED) throw std::bad_alloc();
+            auto address = reinterpret_cast<std::uintptr_t>(raw);
+            auto* aligned = reinterpret_cast<char*>((address + hugePageSize - 1)/hugePageSize*hugePageSize);
+            if (aligned>raw) munmap(raw, aligned-raw);
+            if (aligned+size < raw+size+hugePageSize) munmap(aligned+size, raw+size+hugePageSize-(aligned+size));
+            madvise(aligned, size, MADV_HUGEPAGE); // advisory, ignored where THP is disabled
+            transparentBytes += size;
+            res = aligned;
+        }
+        if (settings.firstTouch){
+            auto pageSize = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+            auto* bytesPtr = static_cast<volatile char*>(res);
+            for (std::size_t offset = 0; offset < size; offset += pageSize) bytesPtr[offset] = 0;
+        }
+        return res;
+    }
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+        if (!mapped(bytes, alignment)) return upstream->deallocate(p, bytes, alignment);
+        munmap(p, roundUp(bytes));
+    }
+    [[nodiscard]] bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override {
+        return this==&other;
+    }
+};
+
+/**
+ * @return the CPUs of every NUMA node, read from sysfs. Machines without NUMA information are a single node holding
+ * all the CPUs.
+ */
+inline std::vector<std::vector<unsigned>> numaNodes(){
+    std::vector<std::vector<unsigned>> res;
+    for (unsigned node = 0;; node++){
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string list;
+        if (!file || !std::getline(file, list)) break;
+        std::vector<unsigned> cpus;
+        std::stringstream ranges(list);
+        std::string range;
+        while (std::getline(ranges, range, ',')){
+            if (range.empty()) continue;
+            auto dash = range.find('-');
+            auto first = static_cast<unsigned>(std::stoul(range.substr(0, dash)));
+            auto last = dash==std::string::npos ? first : static_cast<unsigned>(std::stoul(range.substr(dash+1)));
+            for (unsigned cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+        }
+        if (!cpus.empty()) res.push_back(std::move(cpus));
+    }
+    if (res.empty()){
+        res.emplace_back();
+        for (unsigned cpu = 0; cpu < resolveThreads(0); cpu++) res.back().push_back(cpu);
+    }
+    return res;
+}
+
+/**
+ * Restricts the calling thread to the given CPUs.
+ * @return false if the system refused, e.g. CPUs outside of the cpuset of the process.
+ */
+inline bool pinCurrentThread(std::vector<unsigned> const& cpus){
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (unsigned cpu : cpus) if (cpu<CPU_SETSIZE) CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set)==0;
+}
+
+/**
+ * As parallelFor, but the workers are spread round-robin over the NUMA nodes and pinned to the CPUs of their node
+ * before taking any task, so the memory a task first touches (e.g. its lattices, with a first-touch HugePageResource)
+ * is local to the node computing it. The calling thread takes part and is pinned for the duration of the call only.
+ */
+template<class Task>
+void parallelForPinned(std::size_t count, unsigned threads, Task&& task){
+    auto nodes = numaNodes();
+    threads = static_cast<unsigned>(std::min<std::size_t>(resolveThreads(threads), count));
+    if (threads==0) return;
+    cpu_set_t previous;
+    bool restore = sched_getaffinity(0, sizeof(previous), &previous)==0;
+    std::atomic<unsigned> nextWorker{0};
+    std::atomic<std::size_t> next{0};
+    parallelFor(threads, threads, [&](std::size_t){
+        pinCurrentThread(nodes[nextWorker++%nodes.size()]);
+        for (std::size_t i = next++; i < count; i = next++) task(i);
+    });
+    if (restore) sched_setaffinity(0, sizeof(previous), &previous);
+}
+
+/**
+ * @return the start routine of the worker threads of a pool (WorkStealingPool) pinning thread t to the CPUs of NUMA
+ * node t modulo the number of nodes when pin is set, as parallelForPinned does, and drawing the workspace and the
+ * lattices of the thread from lattices when not null (setThreadLatticeResource), so that the memory first touched by a
+ * worker is local to its node. The other threads keep their resources; lattices must outlive the pool. Empty when
+ * there is nothing to do.
+ */
+inline std::function<void(unsigned)> numaWorkerStart(bool pin, std::pmr::memory_resource* lattices){
+    if (!pin && !lattices) return {};
+    using Nodes = std::vector<std::vector<unsigned>>;
+    auto nodes = std::make_shared<Nodes const>(pin ? numaNodes() : Nodes());
+    return [nodes, lattices](unsigned t){
+        if (!nodes->empty()) pinCurrentThread((*nodes)[t%nodes->size()]);
+        if (lattices){
+            threadWorkspace().setResource(lattices);
+            setThreadLatticeResource(lattices);
+        }
+    };
+}
+
+#endif //ACADIA_INTERVIEW_NUMAMEMORY_H
@@ -5,13 +5,20 @@
 #ifndef ACADIA_INTERVIEW_OBJECTS_H
 #define ACADIA_INTERVIEW_OBJECTS_H
 
+#include <algorithm>
+#include <memory>
 #include <utility>
 #include <vector>
 #include <cmath>
 #include <ostream>
-#include <random>
-
-std::default_random_engine generator;
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include "Cancellation.h"
+#include "Instrumentation.h"
+#include "LruCache.h"
+#include "PricingWorkspace.h"
+#include "Philox.h"
 
 enum class TradeType{
     European,
@@ -39,6 +46,20 @@ inline std::ostream& operator<<(std::ostream& ostream, CallPut v){
 double normalCDF(double x){
     return 0.5*erfc(-x * M_SQRT1_2);
 }
+/**
+ * Quantile of the Poisson distribution, i.e. the smallest k such that P(X<=k) >= u.
+ */
+inline int poissonQuantile(double u, double mean){
+    if (mean<=0.) return 0;
+    double cdf{0};
+    auto last = static_cast<int>(mean + 40.*std::sqrt(mean) + 40.);
+    for (int k = 0; k < last; k++){
+        // the probabilities are computed in log space, exp(-mean) underflows for long dated trades
+        cdf += std::exp(k*std::log(mean) - mean - std::lgamma(k+1.));
+        if (cdf>=u) return k;
+    }
+    return last;
+}
 
 class Option{
 private:
@@ -103,21 +124,277 @@ struct Environment{
         return res;
     }
 };
+/**
+ * Random number context of the calling thread: stream 0 of defaultRngSeed, created on first use. Pricings that do not
+ * receive an explicit context draw from it, so they are reproducible within a thread and never race across threads.
+ */
+inline PhiloxStream& threadRng(){
+    thread_local PhiloxStream rng(defaultRngSeed, 0);
+    return rng;
+}
+/**
+ * Draws the event-based dividend structure of a trade: entry i holds the number of dividends payed on the i-th day.
+ * Dividends are payed according to a Poisson distribution with mean n/365.25. No dividends are allowed on day 0.
+ * @param e Market environment, only averageDividendsPerYear is used.
+ * @param daysToMaturity number of days to sample.
+ * @param rng random number context, e.g. one stream per trade for reproducible batches.
+ * @param log stream the dividend days are reported to, nullptr for none.
+ * @return vector of daysToMaturity+1 dividend counts.
+ */
+inline std::vector<int> sampleDividendStructure(Environment const& e, unsigned daysToMaturity, PhiloxStream& rng,
+                                                std::ostream* log = &std::cout){
+    double dailyMean = e.averageDividendsPerYear/365.25;
+    std::vector<int> dividendStructure(0);
+    dividendStructure.push_back(0);
+    for (unsigned i=1; i<daysToMaturity+1; i++){
+        int noDividendsToday = rng.poisson(dailyMean);
+        dividendStructure.push_back(noDividendsToday);
+        if(noDividendsToday>0 && log){
+            *log<<noDividendsToday << " dividends payed on the " << i << "-th day\n";
+        }
+    }
+    return dividendStructure;
+}
+inline std::vector<int> sampleDividendStructure(Environment const& e, unsigned daysToMaturity){
+    return sampleDividendStructure(e, daysToMaturity, threadRng());
+}
+/**
+ * Maps a daily dividend structure onto the levels of a lattice with an arbitrary number of time steps.
+ * Entry i is the number of dividends payed before level i, i.e. on the days preceding i*days/steps.
+ * With one step per day this is the plain prefix sum shifted by one level. Days beyond the end of the
+ * structure pay no dividend.
+ * @param dividendStructure number of dividends payed on each day.
+ * @param days days spanned by the lattice.
+ * @param steps number of time steps of the lattice.
+ * @return vector of steps+1 cumulative dividend counts.
+ */
+inline std::vector<int> cumulativeDividends(std::vector<int> const& dividendStructure, unsigned days, unsigned steps){
+    std::vector<int> res(steps+1, 0);
+    unsigned long long day{0};
+    int payed{0};
+    for (unsigned i=1; i<steps+1; i++){
+        // days strictly before the time of level i (ceiling division, exact when steps==days)
+        auto lastDay = (static_cast<unsigned long long>(i)*days + steps - 1)/steps;
+        for (; day<lastDay; day++){
+            if (day<dividendStructure.size()) payed += dividendStructure[day];
+        }
+        res[i] = payed;
+    }
+    return res;
+}
+struct DividendEvent{
+    unsigned day{0};
+    int count{0}; // number of dividends payed on that day
+    bool operator==(DividendEvent const& other) const {return day==other.day && count==other.count;}
+};
+/**
+ * Sparse and immutable dividend structure: the days paying dividends in increasing order, with their number of
+ * dividends. The events are held by shared pointer, so copies of a schedule (e.g. the bumped models of the Greeks)
+ * share them, and the dividends payed before any lattice level are found by binary search, with no prefix sum over
+ * the days of the trade. A schedule converts from the daily dividend structure it replaces.
+ */
+class DividendSchedule{
+private:
+    struct Events{
+        std::vector<DividendEvent> events;
+        std::vector<int> payed; // dividends payed up to each event, included
+    };
+    std::shared_ptr<const Events> data;
+public:
+    DividendSchedule() = default; // no dividends
+    /**
+     * @param dividendStructure number of dividends payed on each day, as drawn by sampleDividendStructure.
+     */
+    DividendSchedule(std::vector<int> const& dividendStructure){ // NOLINT: converts implicitly, as the daily vector
+        std::vector<DividendEvent> events;
+        for (unsigned day = 0; day < dividendStructure.size(); day++){
+            if (dividendStructure[day]!=0) events.push_back({day, dividendStructure[day]});
+        }
+        setEvents(std::move(events));
+    }
+    /**
+     * @param events dividend events in any order, events of the same day are merged.
+     */
+    explicit DividendSchedule(std::vector<DividendEvent> events){
+        std::sort(events.begin(), events.end(), [](auto const& a, auto const& b){return a.day<b.day;});
+        std::vector<DividendEvent> merged;
+        for (auto const& event : events){
+            if (!merged.empty() && merged.back().day==event.day) merged.back().count += event.count;
+            else merged.push_back(event);
+        }
+        merged.erase(std::remove_if(merged.begin(), merged.end(), [](auto const& e){return e.count==0;}), merged.end());
+        setEvents(std::move(merged));
+    }
+    [[nodiscard]] std::vector<DividendEvent> const& getEvents() const {
+        static const std::vector<DividendEvent> none;
+        return data ? data->events : none;
+    }
+    [[nodiscard]] int total() const {return data ? data->payed.back() : 0;}
+    /**
+     * Dividends payed before a level of a lattice, i.e. on the days preceding level*days/steps, as
+     * cumulativeDividends. It is constant between the levels following two events.
+     * @param days days spanned by the lattice.
+     * @param steps number of time steps of the lattice.
+     */
+    [[nodiscard]] int payedBefore(unsigned level, unsigned days, unsigned steps) const {
+        if (!data) return 0;
+        auto lastDay = (static_cast<unsigned long long>(level)*days + steps - 1)/steps;
+        auto const& events = data->events;
+        auto next = std::lower_bound(events.begin(), events.end(), lastDay,
+                                     [](DividendEvent const& event, unsigned long long day){return event.day<day;});
+        return next==events.begin() ? 0 : data->payed[next-events.begin()-1];
+    }
+    /**
+     * @return the daily dividend structure of the days 0 to days.
+     */
+    [[nodiscard]] std::vector<int> toDailyStructure(unsigned days) const {
+        std::vector<int> res(days+1, 0);
+        for (auto const& event : getEvents()) if (event.day<=days) res[event.day] = event.count;
+        return res;
+    }
+    [[nodiscard]] std::size_t hash() const {
+        std::size_t res{0};
+        for (auto const& event : getEvents()){
+            hashCombine(res, event.day);
+            hashCombine(res, event.count);
+        }
+        return res;
+    }
+    bool operator==(DividendSchedule const& other) const {return getEvents()==other.getEvents();}
+    bool operator!=(DividendSchedule const& other) const {return !(*this==other);}
+private:
+    void setEvents(std::vector<DividendEvent> events){
+        if (events.empty()) return;
+        auto res = std::make_shared<Events>();
+        res->events = std::move(events);
+        int payed{0};
+        for (auto const& event : res->events) res->payed.push_back(payed += event.count);
+        data = std::move(res);
+    }
+};
+/**
+ * Mean number of dividends payed between two levels of a lattice, consistently with cumulativeDividends.
+ * @return vector of steps+1 means, entry i for the step ending at level i (entry 0 is 0).
+ */
+inline std::vector<double> stepDividendMeans(Environment const& e, unsigned days, unsigned steps){
+    std::vector<double> res(steps+1, 0.);
+    for (unsigned i = 1; i < steps+1; i++){
+        // no dividends on day 0 (see sampleDividendStructure)
+        auto first = std::max(1ull, (static_cast<unsigned long long>(i-1)*days + steps - 1)/steps);
+        auto last = (static_cast<unsigned long long>(i)*days + steps - 1)/steps;
+        if (last>first) res[i] = static_cast<double>(last-first)*e.averageDividendsPerYear/365.25;
+    }
+    return res;
+}
+/**
+ * Up/down factors and risk-neutral probability of the up move of a binomial lattice step.
+ */
+struct TreeParameters{
+    double u{0};
+    double d{0};
+    double p{0};
+};
+/**
+ * Parameterizations of the binomial tree, to be used as policy of BasicBinomialTree.
+ * Every policy exposes:
+ * @dot adjustSteps(steps): the number of steps the tree is actually built with.
+ * @dot compute(e, o, dt, steps): the TreeParameters of a tree with the given time step (fraction of the year).
+ * @dot spotInvariant: whether the TreeParameters do not depend on the spot price and the trade, see NormalizedLattice.
+ */
+struct CoxRossRubinstein{
+    static constexpr bool spotInvariant = true;
+    static unsigned adjustSteps(unsigned steps) {return steps;}
+    static TreeParameters compute(Environment const& e, Option const&, double dt, unsigned){
+        TreeParameters res;
+        res.u = std::exp(e.volatility * std::sqrt(dt));
+        res.d = 1/res.u;
+        res.p = (std::exp((e.riskFreeRate-e.q)*dt) - res.d)/(res.u-res.d);
+        return res;
+    }
+};
+/**
+ * Jarrow-Rudd: the lattice is centered on the risk-neutral drift, so the probability of the up move is close to 1/2.
+ */
+struct JarrowRudd{
+    static constexpr bool spotInvariant = true;
+    static unsigned adjustSteps(unsigned steps) {return steps;}
+    static TreeParameters compute(Environment const& e, Option const&, double dt, unsigned){
+        TreeParameters res;
+        double drift = (e.riskFreeRate - e.q - 0.5*e.volatility*e.volatility)*dt;
+        res.u = std::exp(drift + e.volatility*std::sqrt(dt));
+        res.d = std::exp(drift - e.volatility*std::sqrt(dt));
+        res.p = (std::exp((e.riskFreeRate-e.q)*dt) - res.d)/(res.u-res.d);
+        return res;
+    }
+};
+/**
+ * Tian: matches the first three moments of the lognormal distribution of the underlying over one step.
+ */
+struct Tian{
+    static constexpr bool spotInvariant = true;
+    static unsigned adjustSteps(unsigned steps) {return steps;}
+    static TreeParameters compute(Environment const& e, Option const&, double dt, unsigned){
+        TreeParameters res;
+        double v = std::exp(e.volatility*e.volatility*dt);
+        double growth = std::exp((e.riskFreeRate-e.q)*dt);
+        double root = std::sqrt(v*v + 2*v - 3);
+        res.u = 0.5*growth*v*(v + 1 + root);
+        res.d = 0.5*growth*v*(v + 1 - root);
+        res.p = (growth - res.d)/(res.u-res.d);
+        return res;
+    }
+};
+/**
+ * Leisen-Reimer: the probabilities are the Peizer-Pratt (method 2) inversions of the Black-Scholes d1 and d2, so the
+ * tree is centered on the strike and converges as O(1/N^2) without oscillations. It requires an odd number of steps,
+ * even requests are rounded up.
+ */
+struct LeisenReimer{
+    static constexpr bool spotInvariant = false; // the tree is centered on the strike
+    static unsigned adjustSteps(unsigned steps) {return steps%2 ? steps : steps+1;}
+    static TreeParameters compute(Environment const& e, Option const& o, double dt, unsigned steps){
+        TreeParameters res;
+        double T = dt*steps;
+        double d1 = (std::log(e.underlyingT0Price/o.getStrike()) + (e.riskFreeRate - e.q + 0.5*e.volatility*e.volatility)*T)/
+                    (e.volatility*std::sqrt(T));
+        double d2 = d1 - e.volatility*std::sqrt(T);
+        double growth = std::exp((e.riskFreeRate-e.q)*dt);
+        res.p = peizerPratt(d2, steps);
+        double pBar = peizerPratt(d1, steps);
+        res.u = growth*pBar/res.p;
+        res.d = (growth - res.p*res.u)/(1-res.p);
+        return res;
+    }
+    static double peizerPratt(double z, unsigned n){
+        double a = z/(n + 1./3. + 0.1/(n+1));
+        double h = 0.5*std::sqrt(1 - std::exp(-a*a*(n + 1./6.)));
+        return z<0 ? 0.5 - h : 0.5 + h;
+    }
+};
 struct BinomialTreeNode{
     double underlyingValue{0};
     double tradeValue{0};
 };
 
+template<class Parameterization>
+class NormalizedLattice;
+
 /**
  * Binomial Tree model object.
+ * @tparam Parameterization policy choosing the up/down factors and the risk-neutral probability, see TreeParameters.
  */
-class BinomialTree{
+template<class Parameterization>
+class BasicBinomialTree{
+public:
+    using ParameterizationType = Parameterization;
 private:
-    std::vector<std::vector<BinomialTreeNode>> tree;
-    const unsigned N;
-    double u{0}, d{0}, r{0}, dailyRate{0}, t0underVal{0}, sigma{0}, riskNeutralP{0}, averageDividendsPerYear{0}, q{0}, dailyDividend{0};
+    std::pmr::vector<double> tree{latticeResource()}; // trade values, level i starts at offset i(i+1)/2
+    std::vector<double> payed; // dividends payed before every level, as a fraction of t0underVal
+    unsigned N{0};
+    unsigned days{0}; // days spanned by the tree
+    double u{0}, d{0}, r{0}, dt{0}, t0underVal{0}, sigma{0}, riskNeutralP{0}, averageDividendsPerYear{0}, q{0}, discount{0};
     Option o;
-    std::vector<int> const dividendStructure;
+    DividendSchedule dividends;
 public:
     /**
      * Build a binomial tree model to price financial Option based on stocks. It is grounded on several market assumptions:
@@ -130,43 +407,264 @@ public:
      * @param o Derivative trade.
      * @return Model object.
      */
-    static BinomialTree build(Environment const& e, Option const& o) {
-        // Generate dividend structure
-        std::poisson_distribution<int> dividendDistribution(e.averageDividendsPerYear/365.25);
-        std::vector<int> dividendStructure(0);
-        dividendStructure.push_back(0);
-        for (int i=1; i<o.getTimeToMaturity()+1; i++){
-            int noDividendsToday = dividendDistribution(generator);
-            dividendStructure.push_back(noDividendsToday);
-            if(noDividendsToday>0){ // TODO put this print to log system
-                std::cout<<noDividendsToday << " dividends payed on the " << i << "-th day\n";
-            }
+    static BasicBinomialTree build(Environment const& e, Option const& o) {
+        return build(e, o, threadRng());
+    };
+    /**
+     * Same as above, the dividend structure is drawn from the given random number context.
+     */
+    static BasicBinomialTree build(Environment const& e, Option const& o, PhiloxStream& rng) {
+        return build(e, o, sampleDividendStructure(e, o.getTimeToMaturity(), rng));
+    };
+    static BasicBinomialTree build(Environment const& e, Option const& o, DividendSchedule const& dividends) {
+        return build(e, o, dividends, o.getTimeToMaturity());
+    };
+    /**
+     * Same as above, but the tree spans the life of the option with an arbitrary number of time steps rather than one
+     * step per day. Dividends payed on a given day are applied from the first level following that day.
+     * @param steps number of time steps in the tree, possibly adjusted by the parameterization (see getN()).
+     */
+    static BasicBinomialTree build(Environment const& e, Option const& o, DividendSchedule const& dividends, unsigned steps) {
+        if constexpr (Parameterization::spotInvariant) {
+            // the underlying values are those of the cached normalized lattice, rescaled by the spot price
+            return build(e, o, *NormalizedLattice<Parameterization>::get(e, o, dividends, steps));
+        } else {
+            return build(e, o, dividends, *cachedGeometry(e, o, steps));
+        }
+    };
+    /**
+     * Dividend-free part of a tree: time step, parameters and powers of u and d. Trees of the same trade differing
+     * only by their dividend structure share it (see DividendScenarios).
+     */
+    struct Geometry{
+        unsigned steps{0};
+        double dt{0};
+        double discount{0}; // exp(-r dt)
+        TreeParameters parameters;
+        std::vector<double> upPowers, downPowers;
+    };
+    /**
+     * @param steps number of time steps in the tree, possibly adjusted by the parameterization.
+     * @return the geometry of the trees of the given trade.
+     */
+    static Geometry geometry(Environment const& e, Option const& o, unsigned steps) {
+        if (steps==0) throw std::invalid_argument("The tree must have at least one time step.");
+        BTWE_PHASE(Geometry, steps+1);
+        Geometry res;
+        res.steps = Parameterization::adjustSteps(steps);
+        res.dt = (static_cast<double>(o.getTimeToMaturity())/res.steps)/365.25; // time step as a fraction of the year
+        res.parameters = Parameterization::compute(e, o, res.dt, res.steps);
+        res.discount = std::exp(-e.riskFreeRate*res.dt);
+        // u and d need not be reciprocal, so the powers of both are tabulated once and shared by all the levels
+        res.upPowers.resize(res.steps+1);
+        res.downPowers.resize(res.steps+1);
+        res.upPowers[0] = res.downPowers[0] = 1.;
+        for (unsigned k = 1; k < res.steps+1; k++){
+            res.upPowers[k] = res.upPowers[k-1]*res.parameters.u;
+            res.downPowers[k] = res.downPowers[k-1]*res.parameters.d;
         }
-        BinomialTree tree(o.getTimeToMaturity(), dividendStructure);
-        for (int n=0; n<tree.getN()+1; n++){
-            std::vector<BinomialTreeNode> _n(n+1);
-            tree.tree.push_back(_n);
+        return res;
+    }
+    struct GeometryKey{
+        double volatility{0}, riskFreeRate{0}, q{0};
+        double spot{0}, strike{0}; // 0 for spotInvariant parameterizations
+        unsigned steps{0}, days{0};
+        bool operator==(GeometryKey const& other) const {
+            return volatility==other.volatility && riskFreeRate==other.riskFreeRate && q==other.q &&
+                   spot==other.spot && strike==other.strike && steps==other.steps && days==other.days;
         }
-        tree.setEnvironment(e);
-        tree.setOption(o);
-        return tree;
     };
-    static BinomialTree build(Environment const& e, Option const& o, std::vector<int> const& dividendStructure) {
-        BinomialTree tree(o.getTimeToMaturity(), dividendStructure);
-        for (int n=0; n<tree.getN()+1; n++){
-            std::vector<BinomialTreeNode> _n(n+1);
-            tree.tree.push_back(_n);
+    struct GeometryKeyHash{
+        std::size_t operator()(GeometryKey const& key) const {
+            std::size_t res{0};
+            for (double field : {key.volatility, key.riskFreeRate, key.q, key.spot, key.strike}) hashCombine(res, field);
+            hashCombine(res, key.steps);
+            hashCombine(res, key.days);
+            return res;
         }
-        tree.setEnvironment(e);
-        tree.setOption(o);
+    };
+    using GeometryCache = LruCache<GeometryKey, Geometry, GeometryKeyHash>;
+    static constexpr std::size_t defaultGeometryCacheBytes = std::size_t{64}<<20;
+    /**
+     * Same as geometry(e, o, steps), from the cache of the geometries shared by all the threads. Trades priced on the
+     * same market snapshot, and the bumps of their Greeks, share the parameters and power tables.
+     */
+    static std::shared_ptr<const Geometry> cachedGeometry(Environment const& e, Option const& o, unsigned steps) {
+        if (steps==0) throw std::invalid_argument("The tree must have at least one time step.");
+        GeometryKey key{e.volatility, e.riskFreeRate, e.q, 0., 0., Parameterization::adjustSteps(steps), o.getTimeToMaturity()};
+        if (!Parameterization::spotInvariant){
+            key.spot = e.underlyingT0Price;
+            key.strike = o.getStrike();
+        }
+        return geometryCache().findOrInsert(key, [&](){return std::make_shared<const Geometry>(geometry(e, o, steps));},
+                                            [](Geometry const& g){return 2*sizeof(double)*g.upPowers.size();});
+    }
+    /**
+     * @return geometries shared by all the threads, bounded to defaultGeometryCacheBytes; its counters give the hit rate.
+     */
+    static GeometryCache& geometryCache() {
+        static GeometryCache geometries(defaultGeometryCacheBytes);
+        return geometries;
+    }
+    /**
+     * Same as above, with a geometry computed by geometry(e, o, steps) for the same trade and environment.
+     */
+    static BasicBinomialTree build(Environment const& e, Option const& o, DividendSchedule const& dividends,
+                                   Geometry const& geometry) {
+        BasicBinomialTree tree;
+        tree.assign(e, o, dividends, std::make_shared<const Geometry>(geometry));
+        return tree;
+    };
+    /**
+     * Same as above, the underlying values being those of a normalized lattice of the same trade and environment.
+     */
+    static BasicBinomialTree build(Environment const& e, Option const& o,
+                                   NormalizedLattice<Parameterization> const& lattice) {
+        BasicBinomialTree tree;
+        tree.assign(e, o, lattice);
         return tree;
     };
+    /**
+     * Rebuilds the tree in place for another trade, as build(e, o, dividends, steps). The levels of the tree are
+     * reused, so rebuilding a tree with no more steps than before does not allocate memory.
+     */
+    void rebuild(Environment const& e, Option const& o, DividendSchedule const& dividendSchedule, unsigned steps) {
+        if constexpr (Parameterization::spotInvariant) {
+            assign(e, o, *NormalizedLattice<Parameterization>::get(e, o, dividendSchedule, steps));
+        } else {
+            assign(e, o, dividendSchedule, cachedGeometry(e, o, steps));
+        }
+    }
+    /**
+     * Price of build(e, o, dividends, steps).getPrice(), computed by a backward induction on the buffers of a
+     * workspace with no tree: once the workspace has grown to the largest trade, a pricing does not allocate memory.
+     */
+    static double price(Environment const& e, Option const& o, DividendSchedule const& dividends, unsigned steps,
+                        PricingWorkspace& workspace = threadWorkspace()) {
+        if constexpr (Parameterization::spotInvariant) {
+            return NormalizedLattice<Parameterization>::get(e, o, dividends, steps)->price(e, o, workspace);
+        } else {
+            auto geometry = cachedGeometry(e, o, steps);
+            double* values = workspace.buffer(0, geometry->steps+1);
+            backwardInduction(e, o, *geometry, [&](unsigned i){
+                return static_cast<double>(dividends.payedBefore(i, o.getTimeToMaturity(), geometry->steps))*0.1;
+            }, [values](unsigned){return values;});
+            return values[0];
+        }
+    }
+    /**
+     * Prices of options of the same maturity, as price(e, options[k], dividends, steps) for every k, by one backward
+     * induction over all of them: the lattice and the underlying value of every node are shared by the options.
+     * @param prices receives count prices.
+     */
+    static void priceGroup(Environment const& e, Option const* options, std::size_t count,
+                           DividendSchedule const& dividends, unsigned steps, double* prices,
+                           PricingWorkspace& workspace = threadWorkspace()) {
+        if (count==0) return;
+        for (std::size_t k = 1; k < count; k++){
+            if (options[k].getTimeToMaturity()!=options[0].getTimeToMaturity())
+                throw std::invalid_argument("The options of a group must have the same maturity.");
+        }
+        if constexpr (Parameterization::spotInvariant) {
+            NormalizedLattice<Parameterization>::get(e, options[0], dividends, steps)->priceGroup(e, options, count,
+                                                                                                   prices, workspace);
+        } else {
+            // the geometry depends on the strike
+            for (std::size_t k = 0; k < count; k++) prices[k] = price(e, options[k], dividends, steps, workspace);
+        }
+    }
+    /**
+     * Backward induction computing the underlying value of every node when it is needed, as
+     * S0*max(u^j*d^(i-j) - payed(i), 0), so that no lattice of underlying values is stored nor swept. Levels are
+     * written from maturity to the root, level i to row(i): rows may all be the same buffer of N+1 values, as a level
+     * only reads the nodes j and j+1 of the next one.
+     * @param payed payed(i) returns the dividends payed before level i, as a fraction of the spot price.
+     * @param row row(i) returns the storage of the trade values of level i.
+     */
+    template<class Payed, class Row>
+    static void backwardInduction(Environment const& e, Option const& o, Geometry const& geometry,
+                                  Payed const& payed, Row const& row) {
+        unsigned n = geometry.steps;
+        double const* upPowers = geometry.upPowers.data();
+        double const* downPowers = geometry.downPowers.data();
+        double p = geometry.parameters.p;
+        double discount = geometry.discount;
+        double spot = e.underlyingT0Price;
+        bool american = o.getType()==TradeType::American;
+        {
+            BTWE_PHASE(Maturity, n+1);
+            double* last = row(n);
+            double payedAtMaturity = payed(n);
+            for (unsigned j = 0; j < n+1; j++){
+                last[j] = o.payout(spot*std::max(upPowers[j]*downPowers[n-j]-payedAtMaturity, 0.));
+            }
+        }
+        BTWE_PHASE(Induction, std::uint64_t{n}*(n+1)/2);
+        for (auto i = static_cast<long>(n)-1; i >= 0; i--){
+            checkCancellation(i);
+            double const* next = row(static_cast<unsigned>(i+1));
+            double* level = row(static_cast<unsigned>(i));
+            double payedBefore = payed(static_cast<unsigned>(i));
+            for (long j = 0; j < i+1; j++){
+                double value = discount*(p*next[j+1] + (1.-p)*next[j]);
+                if (american){
+                    value = std::max(value, o.payout(spot*std::max(upPowers[j]*downPowers[i-j]-payedBefore, 0.)));
+                }
+                level[j] = value;
+            }
+        }
+    }
+    /**
+     * Same as above for count options of the same maturity at once, in place in values: node j of option k is
+     * values[j*count+k], so the underlying value of a node is computed once for all the options. The arithmetic of
+     * every option is that of the single-option induction, so the prices are identical.
+     * @param values storage of (N+1)*count trade values; on return values[k] is the price of option k.
+     */
+    template<class Payed>
+    static void backwardInduction(Environment const& e, Option const* options, std::size_t count,
+                                  Geometry const& geometry, Payed const& payed, double* values) {
+        unsigned n = geometry.steps;
+        double const* upPowers = geometry.upPowers.data();
+        double const* downPowers = geometry.downPowers.data();
+        double p = geometry.parameters.p;
+        double discount = geometry.discount;
+        double spot = e.underlyingT0Price;
+        bool anyAmerican{false};
+        for (std::size_t k = 0; k < count; k++) anyAmerican |= options[k].getType()==TradeType::American;
+        {
+            BTWE_PHASE(Maturity, (n+1)*count);
+            double payedAtMaturity = payed(n);
+            for (unsigned j = 0; j < n+1; j++){
+                double underlying = spot*std::max(upPowers[j]*downPowers[n-j]-payedAtMaturity, 0.);
+                for (std::size_t k = 0; k < count; k++) values[j*count+k] = options[k].payout(underlying);
+            }
+        }
+        BTWE_PHASE(Induction, std::uint64_t{n}*(n+1)/2*count);
+        for (auto i = static_cast<long>(n)-1; i >= 0; i--){
+            checkCancellation(i);
+            double payedBefore = payed(static_cast<unsigned>(i));
+            for (long j = 0; j < i+1; j++){
+                double* node = values + j*count;
+                double const* up = node + count;
+                double underlying = anyAmerican ? spot*std::max(upPowers[j]*downPowers[i-j]-payedBefore, 0.) : 0.;
+                for (std::size_t k = 0; k < count; k++){
+                    double value = discount*(p*up[k] + (1.-p)*node[k]);
+                    if (options[k].getType()==TradeType::American){
+                        value = std::max(value, options[k].payout(underlying));
+                    }
+                    node[k] = value;
+                }
+            }
+        }
+    }
     [[nodiscard]] BinomialTreeNode getNode(unsigned t, unsigned timesUp) const {
-        return tree[t][timesUp];
+        auto const& powers = *lattice;
+        double underlying = t0underVal*std::max(powers.upPowers[timesUp]*powers.downPowers[t-timesUp]-payed[t], 0.);
+        return {underlying, tree[offset(t)+timesUp]};
     }
     [[nodiscard]] int getN() const {return N;}
-    [[nodiscard]] const std::vector<int> &getDividendStructure() const {
-        return dividendStructure;
+    [[nodiscard]] DividendSchedule const& getDividendStructure() const {
+        return dividends;
     }
     [[nodiscard]] double getU() const {
         return u;
@@ -174,68 +672,171 @@ public:
     [[nodiscard]] double getD() const {
         return d;
     }
-    [[nodiscard]] double getPrice() const {return tree[0][0].tradeValue;}
+    [[nodiscard]] double getPrice() const {return tree[0];}
 private:
-    explicit BinomialTree(unsigned n, std::vector<int>  ds):
-            N(n),
-            dividendStructure(std::move(ds)){};
-    void setEnvironment(Environment const& e){
-        double volatility = e.volatility;
-        sigma = volatility;
-        //volatility is the annualized volatility
-        u = std::exp(volatility * std::sqrt(1. / 365.25)); // every time step is one day in a year
-        d = 1/u;
+    std::shared_ptr<const Geometry> lattice; // geometry of the tree
+    BasicBinomialTree() = default;
+    [[nodiscard]] static std::size_t offset(unsigned i) {return static_cast<std::size_t>(i)*(i+1)/2;}
+    /**
+     * Prices the trade on the given geometry, keeping the memory of the previous levels.
+     * @param payedBefore payedBefore(i) returns the dividends payed before level i, as a fraction of the spot price.
+     */
+    template<class Payed>
+    void assign(Environment const& e, Option const& option, DividendSchedule const& dividendSchedule,
+                std::shared_ptr<const Geometry> treeGeometry, Payed const& payedBefore){
+        lattice = std::move(treeGeometry);
+        N = lattice->steps;
+        dividends = dividendSchedule;
+        dt = lattice->dt;
+        days = option.getTimeToMaturity();
+        o = option;
+        setEnvironment(e, *lattice);
+        {
+            BTWE_PHASE(Underlying, N+1);
+            payed.resize(N+1);
+            for (unsigned i = 0; i < N+1; i++) payed[i] = payedBefore(i);
+        }
+        {
+            BTWE_PHASE(Build, offset(N+1));
+            tree.resize(offset(N+1));
+        }
+        backwardInduction(e, o, *lattice, [this](unsigned i){return payed[i];},
+                          [this](unsigned i){return tree.data() + offset(i);});
+    }
+    void assign(Environment const& e, Option const& option, DividendSchedule const& dividendSchedule,
+                std::shared_ptr<const Geometry> treeGeometry){
+        unsigned n = treeGeometry->steps;
+        assign(e, option, dividendSchedule, std::move(treeGeometry), [&](unsigned i){
+            return static_cast<double>(dividendSchedule.payedBefore(i, option.getTimeToMaturity(), n))*0.1;
+        });
+    }
+    void assign(Environment const& e, Option const& option, NormalizedLattice<Parameterization> const& normalized){
+        assign(e, option, normalized.getDividendStructure(), normalized.getSharedGeometry(),
+               [&normalized](unsigned i){return normalized.payedBefore(i);});
+    }
+    void setEnvironment(Environment const& e, Geometry const& treeGeometry){
+        sigma = e.volatility; //volatility is the annualized volatility
+        u = treeGeometry.parameters.u;
+        d = treeGeometry.parameters.d;
+        riskNeutralP = treeGeometry.parameters.p;
+        discount = treeGeometry.discount;
         r = e.riskFreeRate; // yearly risk-free rate
-        dailyRate = r/365.25;
         q = e.q;
-        dailyDividend = q/365.25;
         t0underVal = e.underlyingT0Price; // underlying value at time 0. This is in env as is market info.
-        riskNeutralP = (std::exp(dailyRate-dailyDividend) - d)/(u-d);
         averageDividendsPerYear = e.averageDividendsPerYear;
-        simulateUnderlyingDynamics();
     }
-    void setOption(Option const& option){
-        o=option;
-        computeValuesAtMaturity();
-        computeValueAtNodes(); //back-substitution
-    };
-//    void setNode(unsigned t, unsigned timesUp, BinomialTreeNode node){
-//        tree[t][timesUp] = node;
-//    }
-    void simulateUnderlyingDynamics(){
-        double dividendSize = t0underVal*0.1;
-        std::vector<int> dividendCumSum(dividendStructure.size());
-        std::partial_sum(dividendStructure.begin(),dividendStructure.end(),dividendCumSum.begin(),std::plus<int>());
-        double payed{0};
+};
+using BinomialTree = BasicBinomialTree<CoxRossRubinstein>;
 
-        tree[0][0].underlyingValue = t0underVal;
-        for (auto i = 1; i < N+1; i++){ // i is time index here
-            for (auto j = 0; j < i+1; j++){ // j is the number of times the values moved up
-                // this simulation does not depend on the iteration and can be parallelized.
-                // OMP and MPI are good candidates. CUDA makes sense only for huge simulations, as the comm time
-                // host/device is typically important
-                tree[i][j].underlyingValue = std::max(t0underVal*std::pow(u,j)*pow(d,i-j)-static_cast<double>(dividendCumSum[i-1])*dividendSize,0.); // cannot have stocks with negative price
-            }
+/**
+ * Underlying values of a binomial tree divided by the spot price. Dividends are 10% of the spot price, so they scale
+ * with it as well: with a spotInvariant parameterization, the normalized lattice of a volatility, rates, number of
+ * steps, maturity and dividend schedule prices any spot, strike, call/put and exercise style. Spot bumps and trades
+ * on the same underlying rescale a cached lattice (see get()) inside the backward induction instead of regenerating
+ * the underlying values.
+ * The lattice is implicit: it holds the geometry and the dividends payed before every level, O(N) memory, and the
+ * node values are computed by the fused BasicBinomialTree::backwardInduction when they are needed.
+ */
+template<class Parameterization>
+class NormalizedLattice{
+public:
+    using Geometry = typename BasicBinomialTree<Parameterization>::Geometry;
+    struct Key{
+        double volatility{0}, riskFreeRate{0}, q{0};
+        unsigned steps{0}, days{0};
+        DividendSchedule dividends;
+        bool operator==(Key const& other) const {
+            return volatility==other.volatility && riskFreeRate==other.riskFreeRate && q==other.q &&
+                   steps==other.steps && days==other.days && dividends==other.dividends;
         }
-    }
-    void computeValuesAtMaturity(){
-        for (auto j=N;j!=-1;j--){
-            tree[N][j].tradeValue = o.payout(tree[N][j].underlyingValue);
+    };
+    struct KeyHash{
+        std::size_t operator()(Key const& key) const {
+            std::size_t res = key.dividends.hash();
+            hashCombine(res, key.volatility);
+            hashCombine(res, key.riskFreeRate);
+            hashCombine(res, key.q);
+            hashCombine(res, key.steps);
+            hashCombine(res, key.days);
+            return res;
         }
-    }
-    void computeValueAtNodes(){
-        for(auto i = N-1; i!=-1; i--){
-            for (auto j=i;j!=-1;j--){
-                tree[i][j].tradeValue = std::exp(-dailyRate)*(
-                        riskNeutralP*tree[i+1][j+1].tradeValue +
-                        (1.-riskNeutralP)*tree[i+1][j].tradeValue);
-                if(o.getType()==TradeType::American){
-                    double intrinsicValue = o.payout(tree[i][j].underlyingValue);
-                    tree[i][j].tradeValue = std::max(tree[i][j].tradeValue, intrinsicValue);
-                }
-            }
+    };
+    using Cache = LruCache<Key, NormalizedLattice, KeyHash>;
+    static constexpr std::size_t defaultCacheBytes = std::size_t{256}<<20;
+private:
+    std::shared_ptr<const Geometry> geometry;
+    DividendSchedule dividends;
+    std::vector<double> payed; // dividends payed before every level, as a fraction of the spot price
+public:
+    /**
+     * @param steps number of time steps, possibly adjusted by the parameterization.
+     */
+    NormalizedLattice(Environment const& e, Option const& o, DividendSchedule dividendSchedule, unsigned steps):
+            geometry(BasicBinomialTree<Parameterization>::cachedGeometry(e, o, steps)),
+            dividends(std::move(dividendSchedule)){
+        unsigned N = geometry->steps;
+        BTWE_PHASE(Underlying, N+1);
+        payed.resize(N+1);
+        for (unsigned i = 0; i < N+1; i++){
+            payed[i] = static_cast<double>(dividends.payedBefore(i, o.getTimeToMaturity(), N))*0.1;
         }
     }
+    /**
+     * @return the lattice of the trade, from the cache if the parameterization is spotInvariant.
+     */
+    static std::shared_ptr<const NormalizedLattice> get(Environment const& e, Option const& o,
+                                                        DividendSchedule const& dividends, unsigned steps){
+        if (steps==0) throw std::invalid_argument("The tree must have at least one time step.");
+        auto make = [&](){return std::make_shared<const NormalizedLattice>(e, o, dividends, steps);};
+        if constexpr (!Parameterization::spotInvariant) return make();
+        Key key{e.volatility, e.riskFreeRate, e.q, Parameterization::adjustSteps(steps), o.getTimeToMaturity(), dividends};
+        return cache().findOrInsert(key, make, [](NormalizedLattice const& lattice){return lattice.bytes();});
+    }
+    /**
+     * @return lattices shared by all the threads, bounded to defaultCacheBytes.
+     */
+    static Cache& cache(){
+        static Cache lattices(defaultCacheBytes);
+        return lattices;
+    }
+    /**
+     * Prices a trade of the maturity of the lattice by backward induction on the rescaled lattice, as
+     * BasicBinomialTree::getPrice() but with no tree.
+     * @param e Market environment, only the spot price is used.
+     * @param workspace holds the values of the current level.
+     */
+    [[nodiscard]] double price(Environment const& e, Option const& o,
+                               PricingWorkspace& workspace = threadWorkspace()) const {
+        double* values = workspace.buffer(0, geometry->steps+1);
+        BasicBinomialTree<Parameterization>::backwardInduction(e, o, *geometry, [this](unsigned i){return payed[i];},
+                                                               [values](unsigned){return values;});
+        return values[0];
+    }
+    /**
+     * Prices options of the maturity of the lattice by one backward induction over all of them, see
+     * BasicBinomialTree::priceGroup.
+     */
+    void priceGroup(Environment const& e, Option const* options, std::size_t count, double* prices,
+                    PricingWorkspace& workspace = threadWorkspace()) const {
+        double* values = workspace.buffer(0, (geometry->steps+1)*count);
+        BasicBinomialTree<Parameterization>::backwardInduction(e, options, count, *geometry,
+                                                               [this](unsigned i){return payed[i];}, values);
+        std::copy(values, values+count, prices);
+    }
+    /**
+     * @return underlying value of node j of level i divided by the spot price.
+     */
+    [[nodiscard]] double at(unsigned i, unsigned j) const {
+        return std::max(geometry->upPowers[j]*geometry->downPowers[i-j]-payed[i], 0.);
+    }
+    /**
+     * @return dividends payed before level i, as a fraction of the spot price.
+     */
+    [[nodiscard]] double payedBefore(unsigned i) const {return payed[i];}
+    [[nodiscard]] Geometry const& getGeometry() const {return *geometry;}
+    [[nodiscard]] std::shared_ptr<const Geometry> const& getSharedGeometry() const {return geometry;}
+    [[nodiscard]] DividendSchedule const& getDividendStructure() const {return dividends;}
+    [[nodiscard]] std::size_t bytes() const {return payed.size()*sizeof(double);}
 };
 /**
  * myUtils implements the program requirements. It makes explicit use of the classes defined so far
@@ -249,7 +850,8 @@ namespace myUtils{
         return d1;
     }
 
-    double computeDelta(BinomialTree const& model){
+    template<class Parameterization>
+    double computeDelta(BasicBinomialTree<Parameterization> const& model){
         // Hull chap. 11
         auto nodeD = model.getNode(1,0);
         auto nodeU = model.getNode(1,1);
@@ -257,64 +859,154 @@ namespace myUtils{
 
         return(nodeU.tradeValue-nodeD.tradeValue)/(S0* model.getU() - S0*model.getD());
     }
-    double computeDelta(Environment const& env, Option const& opt, BinomialTree const& model){
-        // compute Delta via central finite-differences
-        double h = 0.01; // 1 USd is the typical sensitivity we are interested in
-        auto envM = env.copy();
-        auto envP = env.copy();
-        envM.underlyingT0Price = env.underlyingT0Price-h;
-        envP.underlyingT0Price = env.underlyingT0Price+h;
-        auto pricingModelM = BinomialTree::build(envM,opt,model.getDividendStructure());
-        auto pricingModelP = BinomialTree::build(envP,opt,model.getDividendStructure());
-        double priceP=pricingModelP.getPrice();
-        double priceM=pricingModelM.getPrice();
-        double delta{(priceP-priceM)/(2*h)};
-        return delta;
-    }
-    double computeTheta(Environment const& env, Option const& opt, BinomialTree const& model){
-        // compute Theta via central finite-differences
+    /**
+     * Black-Scholes price of a European option with continuous dividend yield q. Event-based dividends are ignored.
+     */
+    inline double BSPrice(Environment const& env, Option const& opt){
+        double T = opt.getTimeToMaturity()/365.25;
+        double d1 = BSd1(env, opt);
+        double d2 = d1 - env.volatility*std::sqrt(T);
+        double forwardS = env.underlyingT0Price*std::exp(-env.q*T);
+        double discountK = opt.getStrike()*std::exp(-env.riskFreeRate*T);
+        if (opt.getCallPut()==CallPut::Call) return forwardS*normalCDF(d1) - discountK*normalCDF(d2);
+        return discountK*normalCDF(-d2) - forwardS*normalCDF(-d1);
+    }
+
+    // The bumps of the finite-differences Greeks, the single definition used by the compute*FD functions below and by
+    // the grouped and split pricings of PricingEngine: bump 0 is the trade itself, 1 and 2 spot up and down by
+    // spotBump, 3 and 4 one day less and more to maturity, 5 and 6 volatility up and down by relativeBump of it, 7 and 8
+    // rate up and down by relativeBump of it.
+    constexpr unsigned finiteDifferenceBumps = 9;
+    constexpr double spotBump = 0.01; // 1 USd is the typical sensitivity we are interested in
+    constexpr double relativeBump = 0.01; // 0.01% yearly volatility or rate per 1% of it
+
+    inline Environment bumpedEnvironment(Environment const& env, unsigned bump){
+        auto res = env.copy();
+        switch (bump){
+            case 0: case 3: case 4: break;
+            case 1: res.underlyingT0Price = env.underlyingT0Price+spotBump; break;
+            case 2: res.underlyingT0Price = env.underlyingT0Price-spotBump; break;
+            case 5: res.volatility = env.volatility+env.volatility*relativeBump; break;
+            case 6: res.volatility = env.volatility-env.volatility*relativeBump; break;
+            case 7: res.riskFreeRate = env.riskFreeRate+env.riskFreeRate*relativeBump; break;
+            case 8: res.riskFreeRate = env.riskFreeRate-env.riskFreeRate*relativeBump; break;
+            default: throw std::invalid_argument("There are " + std::to_string(finiteDifferenceBumps) + " bumps.");
+        }
+        return res;
+    }
+    inline Option bumpedOption(Option const& opt, unsigned bump){
         // NOTE on the signs: time to maturity and tenor have opposite signs.
-        // This is the reason that lead the - on the option+ and the + in the option-
-        // i.e. to perturb the time amd move it forward, I have to reduce the time to maturity
-        Option oP(opt.getStrike(), opt.getTimeToMaturity()-1, opt.getType(), opt.getCallPut());
-        Option oM(opt.getStrike(), opt.getTimeToMaturity()+1, opt.getType(), opt.getCallPut());
-        auto const& dividendStructure = model.getDividendStructure();
-        auto modelP = BinomialTree::build(env,oP,dividendStructure);
-        auto modelM = BinomialTree::build(env,oM,dividendStructure);
-        return 0.5*(modelP.getPrice() - modelM.getPrice());
-    }
-    double computeGamma(Environment const& env, Option const& opt, BinomialTree const& model){
-        // compute Gamma via central finite-differences
-        double h = 0.01; // 1 USd is the typical sensitivity we are interested in
-        auto envM = env.copy();
-        auto envP = env.copy();
-        envM.underlyingT0Price = env.underlyingT0Price-h;
-        envP.underlyingT0Price = env.underlyingT0Price+h;
-        auto pricingModelM = BinomialTree::build(envM,opt,model.getDividendStructure());
-        auto pricingModelP = BinomialTree::build(envP,opt,model.getDividendStructure());
-        return (pricingModelP.getPrice()+pricingModelM.getPrice()-(2*model.getPrice()))*pow(h,-2);
-    }
-    double computeVega(Environment const& env, Option const& opt, BinomialTree const& model){
-        // compute Vega via central finite-differences
-        double h = env.volatility*0.01; // 0.01% yearly volatility
-        auto envM = env.copy();
-        auto envP = env.copy();
-        envM.volatility = env.volatility-h;
-        envP.volatility = env.volatility+h;
-        auto pricingModelM = BinomialTree::build(envM,opt,model.getDividendStructure());
-        auto pricingModelP = BinomialTree::build(envP,opt,model.getDividendStructure());
-        return (pricingModelP.getPrice()-pricingModelM.getPrice())/(2*h);
-    }
-    double computeRho(Environment const& env, Option const& opt, BinomialTree const& model){
-        // compute Rho via central finite-differences
-        double h = env.riskFreeRate*0.01; // 0.01% yearly rate
-        auto envM = env.copy();
-        auto envP = env.copy();
-        envM.riskFreeRate = env.riskFreeRate-h;
-        envP.riskFreeRate = env.riskFreeRate+h;
-        auto pricingModelM = BinomialTree::build(envM,opt,model.getDividendStructure());
-        auto pricingModelP = BinomialTree::build(envP,opt,model.getDividendStructure());
-        return (pricingModelP.getPrice()-pricingModelM.getPrice())/(2*h);
+        // i.e. to perturb the time and move it forward, I have to reduce the time to maturity
+        if (bump==3) return {opt.getStrike(), opt.getTimeToMaturity()-1, opt.getType(), opt.getCallPut()};
+        if (bump==4) return {opt.getStrike(), opt.getTimeToMaturity()+1, opt.getType(), opt.getCallPut()};
+        return opt;
+    }
+    /**
+     * @return steps of a bumped trade: daily models keep one step per day when the maturity is bumped, other models
+     * keep their number of steps.
+     */
+    inline unsigned bumpedSteps(Option const& opt, unsigned steps, unsigned bump){
+        bool daily = steps==opt.getTimeToMaturity();
+        return daily ? bumpedOption(opt, bump).getTimeToMaturity() : steps;
+    }
+    /**
+     * @return price(env, opt, steps) of bump of the trade.
+     */
+    template<class Price>
+    double priceBumped(Environment const& env, Option const& opt, Price const& price, unsigned steps, unsigned bump){
+        return price(bumpedEnvironment(env, bump), bumpedOption(opt, bump), bumpedSteps(opt, steps, bump));
+    }
+
+    // Central finite differences of the Greeks, from the prices of the bumps above.
+
+    inline double deltaFromBumps(double up, double down){return (up-down)/(2*spotBump);}
+    inline double gammaFromBumps(double base, double up, double down){return (up+down-(2*base))*pow(spotBump,-2);}
+    inline double thetaFromBumps(double shorter, double longer){return 0.5*(shorter-longer);}
+    inline double vegaFromBumps(Environment const& env, double up, double down){
+        return (up-down)/(2*(env.volatility*relativeBump));
+    }
+    inline double rhoFromBumps(Environment const& env, double up, double down){
+        return (up-down)/(2*(env.riskFreeRate*relativeBump));
+    }
+
+    // The finite-differences Greeks below reprice the trade through a price functor, called as
+    // price(Environment const&, Option const&, unsigned steps) and returning the price. Bumped trades are priced with
+    // the given number of steps, except for Theta on daily models, which keep one step per day.
+
+    template<class Price>
+    double computeDeltaFD(Environment const& env, Option const& opt, Price const& price, unsigned steps){
+        double priceP = priceBumped(env, opt, price, steps, 1);
+        double priceM = priceBumped(env, opt, price, steps, 2);
+        return deltaFromBumps(priceP, priceM);
+    }
+    template<class Price>
+    double computeThetaFD(Environment const& env, Option const& opt, Price const& price, unsigned steps){
+        double priceP = priceBumped(env, opt, price, steps, 3);
+        double priceM = priceBumped(env, opt, price, steps, 4);
+        return thetaFromBumps(priceP, priceM);
+    }
+    template<class Price>
+    double computeGammaFD(Environment const& env, Option const& opt, Price const& price, unsigned steps, double basePrice){
+        double priceP = priceBumped(env, opt, price, steps, 1);
+        double priceM = priceBumped(env, opt, price, steps, 2);
+        return gammaFromBumps(basePrice, priceP, priceM);
+    }
+    template<class Price>
+    double computeVegaFD(Environment const& env, Option const& opt, Price const& price, unsigned steps){
+        double priceP = priceBumped(env, opt, price, steps, 5);
+        double priceM = priceBumped(env, opt, price, steps, 6);
+        return vegaFromBumps(env, priceP, priceM);
+    }
+    template<class Price>
+    double computeRhoFD(Environment const& env, Option const& opt, Price const& price, unsigned steps){
+        double priceP = priceBumped(env, opt, price, steps, 7);
+        double priceM = priceBumped(env, opt, price, steps, 8);
+        return rhoFromBumps(env, priceP, priceM);
+    }
+
+    /**
+     * Price functor rebuilding a lattice model exposing the BinomialTree surface:
+     * static build(Environment, Option, dividendStructure, steps) and getPrice(). The dividends are those returned by
+     * the getDividendStructure() of the model, e.g. the scenarios of DividendScenarios.
+     */
+    template<class Model>
+    constexpr bool isBinomialTree = false;
+    template<class Parameterization>
+    constexpr bool isBinomialTree<BasicBinomialTree<Parameterization>> = true;
+
+    template<class Model, class Dividends>
+    auto modelPricer(Dividends const& dividendStructure){
+        return [&dividendStructure](Environment const& e, Option const& o, unsigned steps){
+            if constexpr (isBinomialTree<Model>) {
+                // no tree is built: spot bumps rescale the cached lattice, the values live in the thread workspace
+                return Model::price(e, o, dividendStructure, steps);
+            } else {
+                return Model::build(e,o,dividendStructure,steps).getPrice();
+            }
+        };
+    }
+
+    // Greeks of a lattice model, the bumped models share its dividend structure and number of steps.
+
+    template<class Model>
+    double computeDelta(Environment const& env, Option const& opt, Model const& model){
+        return computeDeltaFD(env, opt, modelPricer<Model>(model.getDividendStructure()), model.getN());
+    }
+    template<class Model>
+    double computeTheta(Environment const& env, Option const& opt, Model const& model){
+        return computeThetaFD(env, opt, modelPricer<Model>(model.getDividendStructure()), model.getN());
+    }
+    template<class Model>
+    double computeGamma(Environment const& env, Option const& opt, Model const& model){
+        return computeGammaFD(env, opt, modelPricer<Model>(model.getDividendStructure()), model.getN(), model.getPrice());
+    }
+    template<class Model>
+    double computeVega(Environment const& env, Option const& opt, Model const& model){
+        return computeVegaFD(env, opt, modelPricer<Model>(model.getDividendStructure()), model.getN());
+    }
+    template<class Model>
+    double computeRho(Environment const& env, Option const& opt, Model const& model){
+        return computeRhoFD(env, opt, modelPricer<Model>(model.getDividendStructure()), model.getN());
     }
 };
 
@@ -0,0 +1,360 @@
+//
+// Minimal fork-join helpers and thread pools on std::thread.
+//
+
+#ifndef ACADIA_INTERVIEW_PARALLEL_H
+#define ACADIA_INTERVIEW_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "Cancellation.h"
+
+/**
+ * @return the number of worker threads to use when the caller asks for 0 (i.e. "all the cores").
+ */
+inline unsigned resolveThreads(unsigned threads){
+    if (threads>0) return threads;
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/**
+ * Runs task(i) for every i in [0, count) on up to `threads` threads (0 for all the cores), the calling thread
+ * included. Indices are handed out dynamically, so the assignment of indices to threads is not deterministic: tasks
+ * must write to disjoint outputs indexed by i. The first exception thrown by a task is rethrown to the caller. Tasks run
+ * in the CancellationScope of the caller.
+ */
+template<class Task>
+void parallelFor(std::size_t count, unsigned threads, Task&& task){
+    threads = static_cast<unsigned>(std::min<std::size_t>(resolveThreads(threads), count));
+    if (threads<=1){
+        for (std::size_t i = 0; i < count; i++) task(i);
+        return;
+    }
+    std::atomic<std::size_t> next{0};
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto const* token = currentCancellation();
+    auto worker = [&](){
+        CancellationScope scope(token);
+        try {
+            for (std::size_t i = next++; i < count; i = next++) task(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error) error = std::current_exception();
+            next = count;
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; t++) pool.emplace_back(worker);
+    worker();
+    for (auto& thread : pool) thread.join();
+    if (error) std::rethrow_exception(error);
+}
+
+/**
+ * Runs task(i) for every i in [0, costs.size()) on up to `threads` threads (0 for all the cores), the calling thread
+ * included, costs[i] being the predicted cost of task i in any unit. Tasks are dealt longest first, each to the thread
+ * with the least cost dealt so far, into per-thread queues; a thread runs its own queue longest first and, once it is
+ * empty, steals the cheapest task of the thread with the most predicted cost left. Long tasks thus start first and
+ * mispredictions are absorbed by stealing. Outputs, exceptions and cancellation are as in parallelFor.
+ * @return number of tasks stolen.
+ */
+template<class Task>
+std::size_t parallelForWeighted(std::vector<double> const& costs, unsigned threads, Task&& task){
+    std::size_t count = costs.size();
+    std::vector<std::size_t> order(count);
+    std::iota(order.begin(), order.end(), std::size_t{0});
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b){return costs[a]>costs[b];});
+    threads = static_cast<unsigned>(std::min<std::size_t>(resolveThreads(threads), count));
+    if (threads<=1){
+        for (auto i : order) task(i);
+        return 0;
+    }
+    struct Queue{
+        std::mutex mutex;
+        std::deque<std::size_t> tasks; // decreasing cost
+        double left{0};
+    };
+    std::vector<Queue> queues(threads);
+    std::vector<double> dealt(threads, 0.);
+    for (auto i : order){
+        auto t = static_cast<std::size_t>(std::min_element(dealt.begin(), dealt.end()) - dealt.begin());
+        queues[t].tasks.push_back(i);
+        queues[t].left += costs[i];
+        dealt[t] += costs[i];
+    }
+    std::atomic<std::size_t> steals{0};
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto take = [&](unsigned t, std::size_t& i){
+        {
+            std::lock_guard<std::mutex> lock(queues[t].mutex);
+            if (!queues[t].tasks.empty()){
+                i = queues[t].tasks.front();
+                queues[t].tasks.pop_front();
+                queues[t].left -= costs[i];
+                return true;
+            }
+        }
+        while (true){
+            unsigned victim = threads;
+            double most{0};
+            for (unsigned v = 0; v < threads; v++){
+                std::lock_guard<std::mutex> lock(queues[v].mutex);
+                if (!queues[v].tasks.empty() && (victim==threads || queues[v].left>most)){
+                    victim = v;
+                    most = queues[v].left;
+                }
+            }
+            if (victim==threads) return false; // tasks are never added: all of them are taken
+            std::lock_guard<std::mutex> lock(queues[victim].mutex);
+            if (queues[victim].tasks.empty()) continue;
+            i = queues[victim].tasks.back();
+            queues[victim].tasks.pop_back();
+            queues[victim].left -= costs[i];
+            steals++;
+            return true;
+        }
+    };
+    auto const* token = currentCancellation();
+    auto worker = [&](unsigned t){
+        CancellationScope scope(token);
+        try {
+            std::size_t i;
+            while (!failed && take(t, i)) task(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error) error = std::current_exception();
+            failed = true;
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; t++) pool.emplace_back(worker, t);
+    worker(0);
+    for (auto& thread : pool) thread.join();
+    if (error) std::rethrow_exception(error);
+    return steals;
+}
+
+/**
+ * Long-lived threads running weighted tasks with the scheduling of parallelForWeighted, for callers that submit their
+ * tasks in successive batches (the batch pipelines). The tasks of a batch are dealt longest first, each to the thread
+ * with the least predicted cost queued and running, into per-thread queues kept longest first; a thread runs its own
+ * queue and, once it is empty, steals the cheapest task of the thread with the most predicted cost queued, whatever
+ * its batch. Threads are thus neither created per batch nor held at the end of a batch by its slowest task while the
+ * tasks of the next one are waiting. The destructor runs the tasks already submitted, then joins the threads.
+ */
+class WorkStealingPool{
+private:
+    struct Batch{
+        std::function<void(std::size_t)> task;
+        CancellationToken const* token{nullptr};
+        std::atomic<std::size_t> left{0};
+        std::atomic<bool> failed{false};
+        std::mutex errorMutex;
+        std::exception_ptr error;
+        std::promise<void> done;
+    };
+    struct Task{
+        double cost{0};
+        std::size_t index{0};
+        std::shared_ptr<Batch> batch;
+    };
+    struct Queue{
+        std::deque<Task> tasks; // decreasing cost
+        double queued{0};
+        double running{0}; // cost of the task being run
+    };
+    std::vector<Queue> queues;
+    std::size_t waiting{0}; // tasks in the queues
+    bool stopping{false};
+    std::mutex mutex;
+    std::condition_variable available;
+    std::atomic<std::size_t> steals{0};
+    std::vector<std::thread> threads;
+public:
+    /**
+     * @param count number of threads, 0 for all the cores.
+     * @param start called by thread t with t before it takes any task, e.g. to pin it (see batchWorkerStart).
+     */
+    explicit WorkStealingPool(unsigned count = 0, std::function<void(unsigned)> start = {}): queues(resolveThreads(count)){
+        for (unsigned t = 0; t < queues.size(); t++){
+            threads.emplace_back([this, t, start]{
+                if (start) start(t);
+                run(t);
+            });
+        }
+    }
+    WorkStealingPool(WorkStealingPool const&) = delete;
+    WorkStealingPool& operator=(WorkStealingPool const&) = delete;
+    ~WorkStealingPool(){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        available.notify_all();
+        for (auto& thread : threads) thread.join();
+    }
+    /**
+     * Queues task(i) for every i in [0, costs.size()), costs[i] being the predicted cost of task i in any unit shared
+     * by all the batches. Tasks run in the CancellationScope of the caller, whose token must outlive them. Once a task
+     * throws, the tasks of its batch that have not started are skipped.
+     * @return the future end of the batch, which holds the first exception thrown by its tasks.
+     */
+    template<class Function>
+    std::future<void> submit(std::vector<double> const& costs, Function task){
+        auto batch = std::make_shared<Batch>();
+        batch->task = std::move(task);
+        batch->token = currentCancellation();
+        batch->left = costs.size();
+        auto res = batch->done.get_future();
+        if (costs.empty()){
+            batch->done.set_value();
+            return res;
+        }
+        std::vector<std::size_t> order(costs.size());
+        std::iota(order.begin(), order.end(), std::size_t{0});
+        std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b){return costs[a]>costs[b];});
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto i : order){
+                auto& queue = *std::min_element(queues.begin(), queues.end(), [](Queue const& a, Queue const& b){
+                    return a.queued+a.running < b.queued+b.running;
+                });
+                auto at = std::find_if(queue.tasks.begin(), queue.tasks.end(), [&](Task const& t){return t.cost<costs[i];});
+                queue.tasks.insert(at, Task{costs[i], i, batch});
+                queue.queued += costs[i];
+                waiting++;
+            }
+        }
+        available.notify_all();
+        return res;
+    }
+    [[nodiscard]] std::size_t size() const {return threads.size();}
+    /**
+     * @return number of tasks stolen so far.
+     */
+    [[nodiscard]] std::size_t stolen() const {return steals;}
+private:
+    /**
+     * Takes the next task of thread t, stolen if its queue is empty. The mutex is held.
+     */
+    Task take(unsigned t){
+        auto* queue = &queues[t];
+        bool own = !queue->tasks.empty();
+        if (!own){
+            for (auto& victim : queues){
+                if (!victim.tasks.empty() && (queue->tasks.empty() || victim.queued>queue->queued)) queue = &victim;
+            }
+            steals++;
+        }
+        auto task = own ? std::move(queue->tasks.front()) : std::move(queue->tasks.back());
+        if (own) queue->tasks.pop_front();
+        else queue->tasks.pop_back();
+        queue->queued -= task.cost;
+        queues[t].running = task.cost;
+        waiting--;
+        return task;
+    }
+    void run(unsigned t){
+        while (true){
+            Task task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                queues[t].running = 0;
+                available.wait(lock, [this]{return stopping || waiting>0;});
+                if (waiting==0) return;
+                task = take(t);
+            }
+            auto& batch = *task.batch;
+            if (!batch.failed){
+                CancellationScope scope(batch.token);
+                try {
+                    batch.task(task.index);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(batch.errorMutex);
+                    if (!batch.error) batch.error = std::current_exception();
+                    batch.failed = true;
+                }
+            }
+            if (--batch.left>0) continue;
+            if (batch.error) batch.done.set_exception(batch.error);
+            else batch.done.set_value();
+        }
+    }
+};
+
+/**
+ * Fixed set of threads running submitted tasks in submission order, for callers that outlive a fork-join (the pricing
+ * server). The destructor runs the tasks already submitted, then joins the threads.
+ */
+class WorkerPool{
+private:
+    std::deque<std::function<void()>> tasks;
+    bool stopping{false};
+    std::mutex mutex;
+    std::condition_variable available;
+    std::vector<std::thread> threads;
+public:
+    /**
+     * @param count number of threads, 0 for all the cores.
+     */
+    explicit WorkerPool(unsigned count = 0){
+        count = resolveThreads(count);
+        for (unsigned t = 0; t < count; t++){
+            threads.emplace_back([this]{
+                while (true){
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        available.wait(lock, [this]{return stopping || !tasks.empty();});
+                        if (tasks.empty()) return;
+                        task = std::move(tasks.front());
+                        tasks.pop_front();
+                    }
+                    task();
+                }
+            });
+        }
+    }
+    WorkerPool(WorkerPool const&) = delete;
+    WorkerPool& operator=(WorkerPool const&) = delete;
+    ~WorkerPool(){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        available.notify_all();
+        for (auto& thread : threads) thread.join();
+    }
+    /**
+     * @return the future result of task(), which holds the exception thrown by the task if any.
+     */
+    template<class Task>
+    std::future<std::invoke_result_t<Task>> submit(Task&& task){
+        auto job = std::make_shared<std::packaged_task<std::invoke_result_t<Task>()>>(std::forward<Task>(task));
+        auto res = job->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.emplace_back([job]{(*job)();});
+        }
+        available.notify_one();
+        return res;
+    }
+    [[nodiscard]] std::size_t size() const {return threads.size();}
+};
+
+#endif //ACADIA_INTERVIEW_PARALLEL_H
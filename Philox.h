@@ -0,0 +1,99 @@
+//
+// Counter-based random numbers (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3", SC11).
+//
+
+#ifndef ACADIA_INTERVIEW_PHILOX_H
+#define ACADIA_INTERVIEW_PHILOX_H
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+constexpr std::uint64_t defaultRngSeed = 20211008;
+
+/**
+ * Philox4x32-10 block cipher used as random number generator: the output is a pure function of a 128 bit counter
+ * and a 64 bit key. Any (key, counter) pair can be evaluated directly, so independent streams are obtained by
+ * giving every stream its own key (or range of counters) without any shared state between threads.
+ */
+struct Philox4x32{
+    using Counter = std::array<std::uint32_t, 4>;
+    using Key = std::array<std::uint32_t, 2>;
+    static Counter generate(Counter counter, Key key){
+        for (int round = 0; round < 10; round++){
+            counter = singleRound(counter, key);
+            key[0] += 0x9E3779B9u;
+            key[1] += 0xBB67AE85u;
+        }
+        return counter;
+    }
+private:
+    static Counter singleRound(Counter const& c, Key const& k){
+        std::uint64_t p0 = static_cast<std::uint64_t>(0xD2511F53u)*c[0];
+        std::uint64_t p1 = static_cast<std::uint64_t>(0xCD9E8D57u)*c[2];
+        return {static_cast<std::uint32_t>(p1>>32) ^ c[1] ^ k[0], static_cast<std::uint32_t>(p1),
+                static_cast<std::uint32_t>(p0>>32) ^ c[3] ^ k[1], static_cast<std::uint32_t>(p0)};
+    }
+};
+
+/**
+ * Sequential view over one Philox stream. The stream is identified by a seed and a stream id, the position in the
+ * stream by a 64 bit counter, so a stream can be restarted or skipped ahead at no cost.
+ */
+class PhiloxStream{
+private:
+    Philox4x32::Key key;
+    std::uint64_t counter{0};
+    std::uint32_t stream{0};
+    Philox4x32::Counter buffer{};
+    unsigned used{4};
+public:
+    PhiloxStream(std::uint64_t seed, std::uint32_t streamId, std::uint64_t position = 0):
+            key{static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed>>32)},
+            counter(position),
+            stream(streamId){}
+    /**
+     * @return next 32 random bits.
+     */
+    std::uint32_t next(){
+        if (used==4){
+            buffer = Philox4x32::generate({static_cast<std::uint32_t>(counter), static_cast<std::uint32_t>(counter>>32),
+                                           stream, 0u}, key);
+            counter++;
+            used = 0;
+        }
+        return buffer[used++];
+    }
+    /**
+     * @return uniform deviate in the open interval (0,1).
+     */
+    double uniform(){
+        return (static_cast<double>(next()) + 0.5)*(1./4294967296.);
+    }
+    /**
+     * @return pair of independent standard normal deviates (Box-Muller).
+     */
+    std::array<double, 2> normalPair(){
+        double radius = std::sqrt(-2.*std::log(uniform()));
+        double angle = 2.*M_PI*uniform();
+        return {radius*std::cos(angle), radius*std::sin(angle)};
+    }
+    /**
+     * Poisson deviate by inversion, suited to the small means of daily dividend events.
+     */
+    int poisson(double mean){
+        if (mean<=0.) return 0;
+        double u = uniform();
+        double p = std::exp(-mean);
+        double cdf = p;
+        int k = 0;
+        while (u>cdf && p>0.){
+            k++;
+            p *= mean/k;
+            cdf += p;
+        }
+        return k;
+    }
+};
+
+#endif //ACADIA_INTERVIEW_PHILOX_H
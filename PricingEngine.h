@@ -0,0 +1,502 @@
+//
+// Common interface of the pricing models, so trades can be routed to any of them.
+//
+
+#ifndef ACADIA_INTERVIEW_PRICINGENGINE_H
+#define ACADIA_INTERVIEW_PRICINGENGINE_H
+
+#include <array>
+#include <chrono>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Objects.h"
+#include "TrinomialTree.h"
+#include "CrankNicolsonGrid.h"
+#include "LongstaffSchwartz.h"
+#include "DividendScenarios.h"
+#include "ExpectedDividendTree.h"
+
+struct Greeks{
+    double delta{0};
+    double gamma{0};
+    double theta{0};
+    double vega{0};
+    double rho{0};
+};
+struct PricingResult{
+    double price{0};
+    double standardError{0}; // 0 for deterministic engines
+    Greeks greeks;
+    std::string engine;
+    unsigned steps{0}; // steps actually used
+    double elapsedMicroseconds{0};
+};
+/**
+ * Metadata describing an engine to the cost model.
+ * @dot convergenceOrder: p in error ~ C/steps^p.
+ * @dot pricesPerGreeks: number of prices computed for the five Greeks, including the base one.
+ */
+struct EngineInfo{
+    std::string name;
+    std::string description;
+    double convergenceOrder{1};
+    unsigned pricesPerGreeks{9};
+    bool deterministic{true};
+    bool autoSelectable{true}; // whether the cost model may route trades to this engine
+};
+
+/**
+ * A pricing engine prices Environment/Option pairs with a given dividend structure and number of steps.
+ * A number of steps equal to 0 selects the default of the engine (see defaultSteps).
+ */
+class PricingEngine{
+public:
+    virtual ~PricingEngine() = default;
+    [[nodiscard]] virtual EngineInfo const& info() const = 0;
+    [[nodiscard]] virtual unsigned defaultSteps(Option const& o) const {return o.getTimeToMaturity();}
+    /**
+     * @return amount of work of one price, in the unit of the engine (lattice nodes, grid points, path steps).
+     * It is the variable the cost model scales the runtime with.
+     */
+    [[nodiscard]] virtual double work(Option const& o, unsigned steps) const = 0;
+    /**
+     * @return the settings of the engine that change its prices, besides the number of steps (e.g. space nodes, paths,
+     * seed), in a canonical text form. Results of two engines with the same name and configuration are interchangeable.
+     */
+    [[nodiscard]] virtual std::string configuration() const {return "";}
+    [[nodiscard]] virtual double price(Environment const& e, Option const& o, DividendSchedule const& dividends,
+                                       unsigned steps) const = 0;
+    /**
+     * Price and Greeks. The default implementation uses the finite-differences Greeks of myUtils.
+     */
+    [[nodiscard]] virtual PricingResult priceWithGreeks(Environment const& e, Option const& o,
+                                                        DividendSchedule const& dividends, unsigned steps) const {
+        BTWE_ENGINE_SCOPE(info());
+        auto start = std::chrono::steady_clock::now();
+        PricingResult res;
+        res.engine = info().name;
+        res.steps = steps>0 ? steps : defaultSteps(o);
+        res.price = price(e, o, dividends, res.steps);
+        res.greeks = finiteDifferenceGreeks(e, o, dividends, res.steps, res.price);
+        res.elapsedMicroseconds = elapsedSince(start);
+        return res;
+    }
+    /**
+     * Prices options of the same maturity on the same environment and dividends, as price() for every option. Engines
+     * that can share work between the options (e.g. one lattice for many strikes) override it.
+     * @param prices receives count prices.
+     */
+    virtual void priceGroup(Environment const& e, Option const* options, std::size_t count,
+                            DividendSchedule const& dividends, unsigned steps, double* prices) const {
+        for (std::size_t k = 0; k < count; k++) prices[k] = price(e, options[k], dividends, steps);
+    }
+    /**
+     * priceWithGreeks() of options of the same maturity on the same environment and dividends.
+     * @param results receives count results.
+     */
+    virtual void priceGroupWithGreeks(Environment const& e, Option const* options, std::size_t count,
+                                      DividendSchedule const& dividends, unsigned steps, PricingResult* results) const {
+        for (std::size_t k = 0; k < count; k++) results[k] = priceWithGreeks(e, options[k], dividends, steps);
+    }
+    /**
+     * Prices of the finite-differences Greeks: the bumps of myUtils (see myUtils::bumpedEnvironment).
+     */
+    static constexpr unsigned finiteDifferenceBumps = myUtils::finiteDifferenceBumps;
+    /**
+     * @return number of bumps of the Greeks of priceWithGreeks() that priceBump() and combineBumps() compute apart, so
+     * that the bumps of one trade can be priced in parallel; 0 for an engine computing its Greeks otherwise.
+     */
+    [[nodiscard]] virtual unsigned bumpCount() const {return finiteDifferenceBumps;}
+    /**
+     * Prices one bump of the finite-differences Greeks of a group (see priceGroup).
+     * @param prices receives count prices.
+     */
+    void priceBump(Environment const& e, Option const* options, std::size_t count, DividendSchedule const& dividends,
+                   unsigned steps, unsigned bump, double* prices) const {
+        if (count==0) return;
+        BTWE_ENGINE_SCOPE(info());
+        unsigned n = steps>0 ? steps : defaultSteps(options[0]);
+        if (bump==0){
+            priceGroup(e, options, count, dividends, n, prices);
+            return;
+        }
+        BTWE_PHASE(Greeks, count);
+        auto env = myUtils::bumpedEnvironment(e, bump);
+        if (bump==3 || bump==4){
+            std::vector<Option> bumped;
+            for (std::size_t k = 0; k < count; k++) bumped.push_back(myUtils::bumpedOption(options[k], bump));
+            priceGroup(env, bumped.data(), count, dividends, myUtils::bumpedSteps(options[0], n, bump), prices);
+            return;
+        }
+        priceGroup(env, options, count, dividends, n, prices);
+    }
+    /**
+     * Price and Greeks of a group from the prices of its bumps, as priceWithGreeks() would compute them. The elapsed
+     * time is left to the caller.
+     * @param bumps prices of bump b of the options, see priceBump.
+     */
+    void combineBumps(Environment const& e, Option const* options, std::size_t count, unsigned steps,
+                      std::array<double const*, finiteDifferenceBumps> const& bumps, PricingResult* results) const {
+        if (count==0) return;
+        unsigned n = steps>0 ? steps : defaultSteps(options[0]);
+        for (std::size_t k = 0; k < count; k++){
+            auto& res = results[k];
+            res.engine = info().name;
+            res.steps = n;
+            res.price = bumps[0][k];
+            res.standardError = 0;
+            res.greeks.delta = myUtils::deltaFromBumps(bumps[1][k], bumps[2][k]);
+            res.greeks.gamma = myUtils::gammaFromBumps(bumps[0][k], bumps[1][k], bumps[2][k]);
+            res.greeks.theta = myUtils::thetaFromBumps(bumps[3][k], bumps[4][k]);
+            res.greeks.vega = myUtils::vegaFromBumps(e, bumps[5][k], bumps[6][k]);
+            res.greeks.rho = myUtils::rhoFromBumps(e, bumps[7][k], bumps[8][k]);
+        }
+    }
+    /**
+     * Price and Greeks averaged over dividend scenarios, with the standard error of the price. Every scenario is priced
+     * with its own bumps, so the Greeks use common random numbers. Scenarios are priced in parallel.
+     */
+    [[nodiscard]] virtual PricingResult priceScenarios(Environment const& e, Option const& o,
+                                                       DividendScenarioSet const& scenarios, unsigned steps) const {
+        if (scenarios.structures.empty()) throw std::invalid_argument("At least one dividend scenario is required.");
+        auto start = std::chrono::steady_clock::now();
+        PricingResult res;
+        res.engine = info().name;
+        res.steps = steps>0 ? steps : defaultSteps(o);
+        std::vector<PricingResult> results(scenarios.structures.size());
+        parallelFor(results.size(), 0, [&](std::size_t m){
+            results[m] = priceWithGreeks(e, o, scenarios.structures[m], res.steps);
+        });
+        std::vector<double> prices;
+        for (auto const& r : results){
+            prices.push_back(r.price);
+            res.greeks.delta += r.greeks.delta/results.size();
+            res.greeks.gamma += r.greeks.gamma/results.size();
+            res.greeks.theta += r.greeks.theta/results.size();
+            res.greeks.vega += r.greeks.vega/results.size();
+            res.greeks.rho += r.greeks.rho/results.size();
+        }
+        std::tie(res.price, res.standardError) = scenarioMeanAndError(prices, scenarios.stratified);
+        res.elapsedMicroseconds = elapsedSince(start);
+        return res;
+    }
+protected:
+    [[nodiscard]] Greeks finiteDifferenceGreeks(Environment const& e, Option const& o,
+                                                DividendSchedule const& dividends, unsigned steps,
+                                                double basePrice) const {
+        BTWE_PHASE(Greeks, 1);
+        auto pricer = [&](Environment const& env, Option const& opt, unsigned n){
+            return price(env, opt, dividends, n);
+        };
+        Greeks greeks;
+        greeks.delta = myUtils::computeDeltaFD(e, o, pricer, steps);
+        greeks.theta = myUtils::computeThetaFD(e, o, pricer, steps);
+        greeks.gamma = myUtils::computeGammaFD(e, o, pricer, steps, basePrice);
+        greeks.vega = myUtils::computeVegaFD(e, o, pricer, steps);
+        greeks.rho = myUtils::computeRhoFD(e, o, pricer, steps);
+        return greeks;
+    }
+    /**
+     * Prices and finite-differences Greeks of a group, every bump being priced for the whole group by priceGroup().
+     * The bumps are those of myUtils, so the results equal those of priceWithGreeks() option by option.
+     */
+    void groupFiniteDifferenceGreeks(Environment const& e, Option const* options, std::size_t count,
+                                     DividendSchedule const& dividends, unsigned steps, PricingResult* results) const {
+        if (count==0) return;
+        BTWE_ENGINE_SCOPE(info());
+        auto start = std::chrono::steady_clock::now();
+        std::vector<double> prices(finiteDifferenceBumps*count);
+        std::array<double const*, finiteDifferenceBumps> bumps{};
+        for (unsigned bump = 0; bump < finiteDifferenceBumps; bump++){
+            priceBump(e, options, count, dividends, steps, bump, prices.data() + bump*count);
+            bumps[bump] = prices.data() + bump*count;
+        }
+        combineBumps(e, options, count, steps, bumps, results);
+        double elapsed = elapsedSince(start)/count;
+        for (std::size_t k = 0; k < count; k++) results[k].elapsedMicroseconds = elapsed;
+    }
+    static double elapsedSince(std::chrono::steady_clock::time_point start){
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now()-start).count();
+    }
+};
+
+/**
+ * Adapter of any lattice model exposing the BinomialTree surface.
+ * @tparam Model lattice model.
+ * @param nodesPerLevelSquared work of a model with N steps is nodesPerLevelSquared*N^2.
+ */
+template<class Model>
+class LatticeEngine : public PricingEngine{
+private:
+    EngineInfo engineInfo;
+    double nodesPerLevelSquared;
+public:
+    LatticeEngine(EngineInfo info, double nodesPerLevelSquared): engineInfo(std::move(info)),
+                                                                 nodesPerLevelSquared(nodesPerLevelSquared){}
+    [[nodiscard]] EngineInfo const& info() const override {return engineInfo;}
+    [[nodiscard]] double work(Option const& o, unsigned steps) const override {
+        double n = steps>0 ? steps : defaultSteps(o);
+        return nodesPerLevelSquared*n*n;
+    }
+    [[nodiscard]] double price(Environment const& e, Option const& o, DividendSchedule const& dividends,
+                               unsigned steps) const override {
+        BTWE_ENGINE_SCOPE(info());
+        return myUtils::modelPricer<Model>(dividends)(e, o, steps>0 ? steps : defaultSteps(o));
+    }
+    /**
+     * Binomial trees price a group by one backward induction over all its options.
+     */
+    void priceGroup(Environment const& e, Option const* options, std::size_t count,
+                    DividendSchedule const& dividends, unsigned steps, double* prices) const override {
+        BTWE_ENGINE_SCOPE(info());
+        if constexpr (myUtils::isBinomialTree<Model>) {
+            if (count>0) Model::priceGroup(e, options, count, dividends, steps>0 ? steps : defaultSteps(options[0]), prices);
+        } else {
+            PricingEngine::priceGroup(e, options, count, dividends, steps, prices);
+        }
+    }
+    void priceGroupWithGreeks(Environment const& e, Option const* options, std::size_t count,
+                              DividendSchedule const& dividends, unsigned steps, PricingResult* results) const override {
+        if constexpr (myUtils::isBinomialTree<Model>) {
+            groupFiniteDifferenceGreeks(e, options, count, dividends, steps, results);
+        } else {
+            PricingEngine::priceGroupWithGreeks(e, options, count, dividends, steps, results);
+        }
+    }
+    /**
+     * The scenarios share the geometry of the lattice, see DividendScenarios.
+     */
+    [[nodiscard]] PricingResult priceScenarios(Environment const& e, Option const& o,
+                                               DividendScenarioSet const& scenarios, unsigned steps) const override {
+        BTWE_ENGINE_SCOPE(info());
+        auto start = std::chrono::steady_clock::now();
+        PricingResult res;
+        res.engine = info().name;
+        auto model = DividendScenarios<Model>::build(e, o, scenarios, steps>0 ? steps : defaultSteps(o));
+        res.steps = model.getN();
+        res.price = model.getPrice();
+        res.standardError = model.getStandardError();
+        res.greeks.delta = myUtils::computeDelta(e, o, model);
+        res.greeks.theta = myUtils::computeTheta(e, o, model);
+        res.greeks.gamma = myUtils::computeGamma(e, o, model);
+        res.greeks.vega = myUtils::computeVega(e, o, model);
+        res.greeks.rho = myUtils::computeRho(e, o, model);
+        res.elapsedMicroseconds = elapsedSince(start);
+        return res;
+    }
+};
+
+/**
+ * Adapter of the expected-dividend tree. It prices the expectation over the Poisson dividends of the environment and
+ * ignores the given dividend structure, so it is not routed to by the cost model.
+ */
+class ExpectedDividendEngine : public PricingEngine{
+private:
+    EngineInfo engineInfo{"expected-dividend", "Binomial tree over the expected Poisson dividends", 1, 9, true, false};
+    PoissonDividends dividends;
+public:
+    explicit ExpectedDividendEngine(PoissonDividends dividends = {}): dividends(dividends){}
+    [[nodiscard]] EngineInfo const& info() const override {return engineInfo;}
+    [[nodiscard]] std::string configuration() const override {
+        std::ostringstream res;
+        res << "tailProbability=" << std::hexfloat << dividends.tailProbability; // exact
+        return res.str();
+    }
+    /**
+     * @return nodes of the tree, each of them holding one value per dividend count.
+     */
+    [[nodiscard]] double work(Option const& o, unsigned steps) const override {
+        double n = steps>0 ? steps : defaultSteps(o);
+        return 0.5*n*n;
+    }
+    [[nodiscard]] double price(Environment const& e, Option const& o, DividendSchedule const&,
+                               unsigned steps) const override {
+        BTWE_ENGINE_SCOPE(info());
+        return ExpectedDividendTree::build(e, o, dividends, steps>0 ? steps : defaultSteps(o)).getPrice();
+    }
+    /**
+     * The price already is the expectation over the dividends: the scenarios are not priced one by one.
+     */
+    [[nodiscard]] PricingResult priceScenarios(Environment const& e, Option const& o, DividendScenarioSet const&,
+                                               unsigned steps) const override {
+        return priceWithGreeks(e, o, {}, steps);
+    }
+};
+
+/**
+ * Adapter of the Crank-Nicolson grid: Delta, Gamma and Theta are read off the grid, only Vega and Rho are bumped.
+ */
+class CrankNicolsonEngine : public PricingEngine{
+private:
+    EngineInfo engineInfo{"crank-nicolson", "Crank-Nicolson grid, Brennan-Schwartz early exercise", 2, 5, true, true};
+    unsigned spaceNodes;
+public:
+    explicit CrankNicolsonEngine(unsigned spaceNodes = CrankNicolsonGrid::defaultSpaceNodes): spaceNodes(spaceNodes){}
+    [[nodiscard]] EngineInfo const& info() const override {return engineInfo;}
+    [[nodiscard]] std::string configuration() const override {return "spaceNodes=" + std::to_string(spaceNodes);}
+    [[nodiscard]] double work(Option const& o, unsigned steps) const override {
+        return static_cast<double>(steps>0 ? steps : defaultSteps(o))*spaceNodes;
+    }
+    [[nodiscard]] unsigned bumpCount() const override {return 0;}
+    [[nodiscard]] double price(Environment const& e, Option const& o, DividendSchedule const& dividends,
+                               unsigned steps) const override {
+        BTWE_ENGINE_SCOPE(info());
+        return CrankNicolsonGrid::build(e, o, dividends, steps>0 ? steps : defaultSteps(o), spaceNodes).getPrice();
+    }
+    [[nodiscard]] PricingResult priceWithGreeks(Environment const& e, Option const& o,
+                                                DividendSchedule const& dividends, unsigned steps) const override {
+        BTWE_ENGINE_SCOPE(info());
+        auto start = std::chrono::steady_clock::now();
+        PricingResult res;
+        res.engine = info().name;
+        res.steps = steps>0 ? steps : defaultSteps(o);
+        auto grid = CrankNicolsonGrid::build(e, o, dividends, res.steps, spaceNodes);
+        res.price = grid.getPrice();
+        res.greeks.delta = grid.getDelta();
+        res.greeks.gamma = grid.getGamma();
+        res.greeks.theta = grid.getTheta();
+        BTWE_PHASE(Greeks, 1);
+        auto pricer = [&](Environment const& env, Option const& opt, unsigned n){
+            return price(env, opt, dividends, n);
+        };
+        res.greeks.vega = myUtils::computeVegaFD(e, o, pricer, res.steps);
+        res.greeks.rho = myUtils::computeRhoFD(e, o, pricer, res.steps);
+        res.elapsedMicroseconds = elapsedSince(start);
+        return res;
+    }
+};
+
+/**
+ * Adapter of the Longstaff-Schwartz model. Steps are exercise dates. Every price uses the same seed, so the bumped
+ * prices of the Greeks share their random numbers. It is a cross-check and is not routed to by the cost model.
+ */
+class MonteCarloEngine : public PricingEngine{
+private:
+    EngineInfo engineInfo{"monte-carlo", "Longstaff-Schwartz Monte Carlo, Philox streams", 0.5, 9, false, false};
+    MonteCarloSettings settings;
+public:
+    explicit MonteCarloEngine(MonteCarloSettings settings = {}): settings(settings){}
+    [[nodiscard]] EngineInfo const& info() const override {return engineInfo;}
+    /**
+     * The number of threads is left out, prices do not depend on it.
+     */
+    [[nodiscard]] std::string configuration() const override {
+        return "paths=" + std::to_string(settings.paths) + ",seed=" + std::to_string(settings.seed) +
+               ",antithetic=" + std::to_string(settings.antithetic);
+    }
+    [[nodiscard]] unsigned defaultSteps(Option const&) const override {return settings.steps;}
+    [[nodiscard]] double work(Option const& o, unsigned steps) const override {
+        return static_cast<double>(steps>0 ? steps : defaultSteps(o))*settings.paths;
+    }
+    [[nodiscard]] unsigned bumpCount() const override {return 0;}
+    [[nodiscard]] double price(Environment const& e, Option const& o, DividendSchedule const& dividends,
+                               unsigned steps) const override {
+        BTWE_ENGINE_SCOPE(info());
+        return simulate(e, o, dividends, steps).getPrice();
+    }
+    [[nodiscard]] PricingResult priceWithGreeks(Environment const& e, Option const& o,
+                                                DividendSchedule const& dividends, unsigned steps) const override {
+        BTWE_ENGINE_SCOPE(info());
+        auto start = std::chrono::steady_clock::now();
+        PricingResult res;
+        res.engine = info().name;
+        res.steps = steps>0 ? steps : defaultSteps(o);
+        auto model = simulate(e, o, dividends, res.steps);
+        res.price = model.getPrice();
+        res.standardError = model.getStandardError();
+        res.greeks = finiteDifferenceGreeks(e, o, dividends, res.steps, res.price);
+        res.elapsedMicroseconds = elapsedSince(start);
+        return res;
+    }
+private:
+    [[nodiscard]] LongstaffSchwartz simulate(Environment const& e, Option const& o,
+                                             DividendSchedule const& dividends, unsigned steps) const {
+        auto s = settings;
+        s.steps = steps>0 ? steps : defaultSteps(o);
+        return LongstaffSchwartz::build(e, o, dividends, s);
+    }
+};
+
+/**
+ * Owns the available engines and finds them by name.
+ */
+class EngineRegistry{
+private:
+    std::vector<std::unique_ptr<PricingEngine>> engines;
+public:
+    PricingEngine& add(std::unique_ptr<PricingEngine> engine){
+        if (find(engine->info().name)) throw std::invalid_argument("Engine " + engine->info().name + " is already registered.");
+        engines.push_back(std::move(engine));
+        return *engines.back();
+    }
+    /**
+     * @return the engine with the given name, nullptr if there is none.
+     */
+    [[nodiscard]] PricingEngine const* find(std::string const& name) const {
+        for (auto const& engine : engines) if (engine->info().name==name) return engine.get();
+        return nullptr;
+    }
+    [[nodiscard]] PricingEngine const& get(std::string const& name) const {
+        auto engine = find(name);
+        if (!engine) throw std::invalid_argument("Unknown pricing engine " + name + ".");
+        return *engine;
+    }
+    [[nodiscard]] std::vector<std::unique_ptr<PricingEngine>> const& all() const {return engines;}
+    /**
+     * @return a registry holding every built-in engine.
+     */
+    static EngineRegistry withBuiltInEngines(){
+        EngineRegistry registry;
+        registry.add(std::make_unique<LatticeEngine<BasicBinomialTree<CoxRossRubinstein>>>(
+                EngineInfo{"binomial-crr", "Cox-Ross-Rubinstein binomial tree", 1}, 0.5));
+        registry.add(std::make_unique<LatticeEngine<BasicBinomialTree<JarrowRudd>>>(
+                EngineInfo{"binomial-jr", "Jarrow-Rudd binomial tree", 1}, 0.5));
+        registry.add(std::make_unique<LatticeEngine<BasicBinomialTree<Tian>>>(
+                EngineInfo{"binomial-tian", "Tian binomial tree", 1}, 0.5));
+        registry.add(std::make_unique<LatticeEngine<BasicBinomialTree<LeisenReimer>>>(
+                EngineInfo{"binomial-lr", "Leisen-Reimer binomial tree", 2}, 0.5));
+        registry.add(std::make_unique<LatticeEngine<TrinomialTree>>(
+                EngineInfo{"trinomial", "Boyle trinomial tree", 1}, 1.));
+        registry.add(std::make_unique<CrankNicolsonEngine>());
+        registry.add(std::make_unique<MonteCarloEngine>());
+        registry.add(std::make_unique<ExpectedDividendEngine>());
+        return registry;
+    }
+};
+
+/**
+ * myUtils Greeks through the engine interface.
+ */
+namespace myUtils{
+    inline auto enginePricer(PricingEngine const& engine, DividendSchedule const& dividends){
+        return [&engine, &dividends](Environment const& e, Option const& o, unsigned steps){
+            return engine.price(e, o, dividends, steps);
+        };
+    }
+    inline double computeDelta(Environment const& env, Option const& opt, PricingEngine const& engine,
+                               DividendSchedule const& dividends, unsigned steps){
+        return computeDeltaFD(env, opt, enginePricer(engine, dividends), steps>0 ? steps : engine.defaultSteps(opt));
+    }
+    inline double computeTheta(Environment const& env, Option const& opt, PricingEngine const& engine,
+                               DividendSchedule const& dividends, unsigned steps){
+        return computeThetaFD(env, opt, enginePricer(engine, dividends), steps>0 ? steps : engine.defaultSteps(opt));
+    }
+    inline double computeGamma(Environment const& env, Option const& opt, PricingEngine const& engine,
+                               DividendSchedule const& dividends, unsigned steps){
+        steps = steps>0 ? steps : engine.defaultSteps(opt);
+        return computeGammaFD(env, opt, enginePricer(engine, dividends), steps,
+                              engine.price(env, opt, dividends, steps));
+    }
+    inline double computeVega(Environment const& env, Option const& opt, PricingEngine const& engine,
+                              DividendSchedule const& dividends, unsigned steps){
+        return computeVegaFD(env, opt, enginePricer(engine, dividends), steps>0 ? steps : engine.defaultSteps(opt));
+    }
+    inline double computeRho(Environment const& env, Option const& opt, PricingEngine const& engine,
+                             DividendSchedule const& dividends, unsigned steps){
+        return computeRhoFD(env, opt, enginePricer(engine, dividends), steps>0 ? steps : engine.defaultSteps(opt));
+    }
+}
+
+#endif //ACADIA_INTERVIEW_PRICINGENGINE_H
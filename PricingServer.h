@@ -0,0 +1,335 @@
+//
+// Long-running pricing server: JSONL requests over a Unix domain socket or the standard streams.
+//
+
+#ifndef ACADIA_INTERVIEW_PRICINGSERVER_H
+#define ACADIA_INTERVIEW_PRICINGSERVER_H
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include "BatchPipeline.h"
+#include "Parallel.h"
+#include "Progressive.h"
+#include "ResultCache.h"
+
+/**
+ * Buffered stream buffer over a file descriptor (a socket or a pipe), which it does not own. Writes do not raise
+ * SIGPIPE when the peer is gone, they fail the stream.
+ */
+class FdStreamBuf : public std::streambuf{
+private:
+    int fd;
+    char input[1<<12];
+    char output[1<<12];
+public:
+    explicit FdStreamBuf(int fd): fd(fd){
+        setg(input, input, input);
+        setp(output, output+sizeof(output));
+    }
+    FdStreamBuf(FdStreamBuf const&) = delete;
+    FdStreamBuf& operator=(FdStreamBuf const&) = delete;
+    ~FdStreamBuf() override {
+        sync();
+    }
+protected:
+    int_type underflow() override {
+        ssize_t count;
+        do count = read(fd, input, sizeof(input)); while (count<0 && errno==EINTR);
+        if (count<=0) return traits_type::eof();
+        setg(input, input, input+count);
+        return traits_type::to_int_type(input[0]);
+    }
+    int_type overflow(int_type c) override {
+        if (sync()!=0) return traits_type::eof();
+        if (!traits_type::eq_int_type(c, traits_type::eof())){
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+    int sync() override {
+        char const* begin = pbase();
+        while (begin<pptr()){
+            auto count = send(fd, begin, static_cast<std::size_t>(pptr()-begin), MSG_NOSIGNAL);
+            if (count<0 && errno==ENOTSOCK) count = write(fd, begin, static_cast<std::size_t>(pptr()-begin));
+            if (count<0 && errno==EINTR) continue;
+            if (count<=0) return -1;
+            begin += count;
+        }
+        setp(output, output+sizeof(output));
+        return 0;
+    }
+};
+
+struct ServerSettings{
+    std::string engine{"binomial-crr"}; // engine of the requests without an engine field
+    unsigned steps{0}; // steps of the requests without a steps field, 0 for the engine default
+    std::uint64_t seed{defaultRngSeed}; // seed of the dividend streams of the requests without dividends
+    unsigned threads{0}; // pricing workers, 0 for all the cores
+    std::size_t cacheCapacity{1u<<16}; // results kept warm
+    std::size_t pipelineDepth{1024}; // requests of a session read ahead of their response
+    bool progressive{false}; // answer every request with its refinements (refinePricing), uncached
+    RefinementSettings refinement;
+};
+
+struct ServerStatistics{
+    std::uint64_t requests{0};
+    std::uint64_t errors{0};
+    std::uint64_t coalesced{0}; // requests answered by an identical request in flight
+    std::uint64_t cacheHits{0}; // requests answered from the result cache
+};
+
+/**
+ * Prices the requests of any number of concurrent sessions on one worker pool, keeping the lattice caches and a
+ * ResultCache warm between requests, so a request pays neither process startup nor cold caches.
+ *
+ * The protocol is the JSONL trade format of the batch mode (see TradeFileReader): a request is one trade object per
+ * line, answered by one result object per line (formatBatchResult), in the order of the requests of the session. Lines
+ * with a market field define environments for the rest of the session and have no response, except an error object
+ * (with an empty id) when the block is invalid. Responses are written as soon as they are ready and in order, so a
+ * client may pipeline its requests or wait for each response.
+ *
+ * A request without a dividends field is priced on the dividend structure drawn from a stream derived from its
+ * content, rather than from its position: identical requests are priced identically whatever the session. An
+ * identical request already in flight is not priced again, it waits for the first one (coalescing).
+ *
+ * With settings.progressive, a request is answered by the lines of its refinements instead (formatRefinement): a
+ * coarse price within microseconds, then finer ones until the last, which has "last":true. Progressive requests are
+ * neither cached nor coalesced, and a session that disconnects cancels the refinements of its requests.
+ */
+class PricingServer{
+private:
+    EngineRegistry const& registry;
+    ServerSettings settings;
+    ResultCache cache;
+    struct InFlight{
+        std::uint64_t check;
+        std::shared_future<PricingResult> result;
+    };
+    std::mutex inFlightMutex;
+    std::unordered_map<std::uint64_t, InFlight> inFlight;
+    std::atomic<std::uint64_t> requestCount{0}, errorCount{0}, coalescedCount{0};
+    std::atomic<bool> stopping{false};
+    std::mutex sessionMutex;
+    std::condition_variable sessionEnded;
+    int listener{-1};
+    std::unordered_set<int> sessions; // connected sockets
+    WorkerPool pool; // last: its tasks use the members above until it is joined
+public:
+    PricingServer(EngineRegistry const& registry, ServerSettings settings = {})
+            : registry(registry), settings(std::move(settings)), cache(cacheSettings(this->settings)),
+              pool(this->settings.threads){
+        (void) registry.get(this->settings.engine); // fails early on an unknown engine
+    }
+    PricingServer(PricingServer const&) = delete;
+    PricingServer& operator=(PricingServer const&) = delete;
+    ~PricingServer(){
+        stop();
+    }
+    /**
+     * Queues the pricing with Greeks of a parsed trade.
+     * @return its future result, shared with the identical requests in flight.
+     */
+    std::shared_future<PricingResult> submit(BatchTrade const& trade){
+        requestCount++;
+        auto const& engine = registry.get(trade.engine.empty() ? settings.engine : trade.engine);
+        auto steps = trade.steps>0 ? trade.steps : settings.steps;
+        steps = steps>0 ? steps : engine.defaultSteps(trade.option);
+        auto dividends = requestDividends(trade);
+        auto key = ResultCache::key(engine, ResultCache::Kind::Greeks, trade.env, trade.option, dividends, steps);
+        std::lock_guard<std::mutex> lock(inFlightMutex);
+        if (auto found = inFlight.find(key.key); found!=inFlight.end() && found->second.check==key.check){
+            coalescedCount++;
+            return found->second.result;
+        }
+        // the task removes itself once its result is cached: later requests find it there
+        std::shared_future<PricingResult> res = pool.submit(
+                [this, &engine, key, env = trade.env, option = trade.option, dividends = std::move(dividends), steps]{
+            auto cleanup = [&]{
+                std::lock_guard<std::mutex> lock(inFlightMutex);
+                if (auto found = inFlight.find(key.key); found!=inFlight.end() && found->second.check==key.check)
+                    inFlight.erase(found);
+            };
+            try {
+                auto result = cache.findOrInsert(key, [&]{return engine.priceWithGreeks(env, option, dividends, steps);});
+                cleanup();
+                return result;
+            } catch (...) {
+                cleanup();
+                throw;
+            }
+        }).share();
+        inFlight.insert_or_assign(key.key, InFlight{key.check, res});
+        return res;
+    }
+    /**
+     * Serves one session: reads requests from in until its end and writes their responses to out. Requests are
+     * priced while the next ones are read, at most pipelineDepth of them ahead of the responses.
+     */
+    void serve(std::istream& in, std::ostream& out){
+        if (settings.progressive){
+            auto statistics = streamRefinements(in, out, TradeFileFormat::Jsonl, pool, settings.pipelineDepth,
+                                                [this](BatchTrade const& trade, auto&& emit){
+                requestCount++;
+                auto const& engine = registry.get(trade.engine.empty() ? settings.engine : trade.engine);
+                refinePricing(engine, trade.env, trade.option, requestDividends(trade),
+                              trade.steps>0 ? trade.steps : settings.steps, settings.refinement, emit);
+            });
+            errorCount += statistics.errors;
+            return;
+        }
+        struct Pending{
+            BatchTrade trade;
+            std::shared_future<PricingResult> result;
+        };
+        BoundedQueue<Pending> pending(settings.pipelineDepth);
+        std::thread writer([&]{
+            while (auto request = pending.pop()){
+                std::string line;
+                if (request->result.valid()){
+                    try {
+                        auto result = request->result.get();
+                        line = formatBatchResult(TradeFileFormat::Jsonl, request->trade, &result, "");
+                    } catch (std::exception const& error) {
+                        errorCount++;
+                        line = formatBatchResult(TradeFileFormat::Jsonl, request->trade, nullptr, error.what());
+                    }
+                } else {
+                    errorCount++;
+                    line = formatBatchResult(TradeFileFormat::Jsonl, request->trade, nullptr, request->trade.error);
+                }
+                out << line << "\n" << std::flush; // a failed stream keeps draining, the session ends with its input
+            }
+        });
+        TradeFileReader reader(in, TradeFileFormat::Jsonl);
+        while (true){
+            Pending request;
+            try {
+                if (!reader.next(request.trade)) break;
+                if (request.trade.error.empty()) request.result = submit(request.trade);
+            } catch (std::exception const& error) {
+                request.trade.error = error.what(); // an invalid environment block (no id), or an unknown engine
+            }
+            pending.push(std::move(request));
+        }
+        pending.close();
+        writer.join();
+    }
+    /**
+     * Accepts sessions on a Unix domain socket, one thread per connection, until stop(). An existing file at path is
+     * replaced, and removed at the end.
+     */
+    void listen(std::string const& path){
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.size()>=sizeof(address.sun_path)) throw std::invalid_argument("Socket path too long: " + path + ".");
+        std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path)-1);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd<0) throw std::runtime_error("Couldn't create a Unix socket.");
+        unlink(path.c_str());
+        if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address))!=0 || ::listen(fd, 64)!=0){
+            close(fd);
+            throw std::runtime_error("Couldn't listen on " + path + ".");
+        }
+        {
+            std::lock_guard<std::mutex> lock(sessionMutex);
+            listener = fd;
+            if (stopping) shutdown(fd, SHUT_RDWR);
+        }
+        while (!stopping){
+            int client = accept(fd, nullptr, nullptr);
+            if (client<0){
+                if (errno==EINTR || errno==ECONNABORTED) continue;
+                break; // stop() shut the socket down
+            }
+            std::lock_guard<std::mutex> lock(sessionMutex);
+            sessions.insert(client);
+            std::thread([this, client]{
+                {
+                    FdStreamBuf buffer(client);
+                    std::istream in(&buffer);
+                    std::ostream out(&buffer);
+                    try {
+                        serve(in, out);
+                    } catch (std::exception const&) {
+                        // the session is dropped, the server goes on
+                    }
+                }
+                std::lock_guard<std::mutex> lock(sessionMutex);
+                sessions.erase(client);
+                close(client);
+                sessionEnded.notify_all();
+            }).detach();
+            if (stopping) shutdown(client, SHUT_RD);
+        }
+        std::unique_lock<std::mutex> lock(sessionMutex);
+        sessionEnded.wait(lock, [this]{return sessions.empty();});
+        listener = -1;
+        close(fd);
+        unlink(path.c_str());
+    }
+    /**
+     * Makes listen() return: the server stops accepting connections, and the open sessions end once their pending
+     * requests are answered. Safe to call from any thread, or a signal handling thread.
+     */
+    void stop(){
+        std::lock_guard<std::mutex> lock(sessionMutex);
+        stopping = true;
+        if (listener>=0) shutdown(listener, SHUT_RDWR);
+        for (int session : sessions) shutdown(session, SHUT_RD);
+    }
+    [[nodiscard]] ServerStatistics statistics() const {
+        ServerStatistics res;
+        res.requests = requestCount;
+        res.errors = errorCount;
+        res.coalesced = coalescedCount;
+        res.cacheHits = cache.hits();
+        return res;
+    }
+    /**
+     * Empties the result cache, e.g. when the market data of the day changes.
+     */
+    void clearCache(){
+        cache.clear();
+    }
+private:
+    /**
+     * @return the settings of the memory tier of the result cache, the server has no file tier.
+     */
+    static ResultCacheSettings cacheSettings(ServerSettings const& settings){
+        ResultCacheSettings res;
+        res.capacity = settings.cacheCapacity;
+        return res;
+    }
+    /**
+     * @return the dividend schedule of a request, or the structure drawn from the stream given by the hash of its
+     * market data and contract.
+     */
+    [[nodiscard]] DividendSchedule requestDividends(BatchTrade const& trade) const {
+        if (!trade.dividends.empty()) return DividendSchedule(trade.dividends);
+        StableHash hash;
+        hash.add(trade.env.underlyingT0Price).add(trade.env.volatility).add(trade.env.riskFreeRate)
+            .add(trade.env.averageDividendsPerYear).add(trade.env.q);
+        hash.add(trade.option.getStrike()).add(trade.option.getTimeToMaturity())
+            .add(static_cast<int>(trade.option.getType())).add(static_cast<int>(trade.option.getCallPut()));
+        PhiloxStream rng(settings.seed, static_cast<std::uint32_t>(hash.getKey() ^ (hash.getKey()>>32)));
+        return sampleDividendStructure(trade.env, trade.option.getTimeToMaturity(), rng, nullptr);
+    }
+};
+
+#endif //ACADIA_INTERVIEW_PRICINGSERVER_H
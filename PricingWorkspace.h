@@ -0,0 +1,118 @@
+//
+// Reusable scratch memory of the pricings, so that a steady-state batch does not touch the heap.
+//
+
+#ifndef ACADIA_INTERVIEW_PRICINGWORKSPACE_H
+#define ACADIA_INTERVIEW_PRICINGWORKSPACE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <vector>
+
+/**
+ * Growable buffers of doubles reused by successive pricings, e.g. the lattice levels of a backward induction and of
+ * the bumped pricings of the Greeks. A buffer only grows, so after the largest pricing of a batch has been seen no
+ * further memory is requested. Memory comes from a std::pmr resource: the default heap, or an arena such as a
+ * std::pmr::monotonic_buffer_resource over a preallocated block.
+ * A workspace is used by one thread at a time; threadWorkspace() gives one to every thread.
+ */
+class PricingWorkspace{
+public:
+    static constexpr std::size_t bufferCount = 2;
+private:
+    std::array<std::pmr::vector<double>, bufferCount> buffers;
+    std::size_t growths{0};
+public:
+    explicit PricingWorkspace(std::pmr::memory_resource* resource = std::pmr::get_default_resource()):
+            buffers{std::pmr::vector<double>(resource), std::pmr::vector<double>(resource)}{}
+    PricingWorkspace(PricingWorkspace const&) = delete;
+    PricingWorkspace& operator=(PricingWorkspace const&) = delete;
+    /**
+     * @return buffer k holding at least size doubles, with unspecified values. It stays valid until the next call for
+     * the same buffer.
+     */
+    double* buffer(std::size_t k, std::size_t size){
+        auto& b = buffers.at(k);
+        if (b.size()<size){
+            growths++;
+            b.resize(size);
+        }
+        return b.data();
+    }
+    /**
+     * Gives the memory back and draws the buffers from resource from now on, e.g. the HugePageResource of a batch,
+     * which must then outlive the workspace or the next call.
+     */
+    void setResource(std::pmr::memory_resource* resource){
+        for (auto& b : buffers){
+            // a pmr vector keeps its resource for life: the buffer is rebuilt on the new one
+            std::destroy_at(&b);
+            ::new (static_cast<void*>(&b)) std::pmr::vector<double>(resource);
+        }
+    }
+    /**
+     * Gives the memory back to the resource.
+     */
+    void release(){
+        for (auto& b : buffers){
+            b.clear();
+            b.shrink_to_fit();
+        }
+    }
+    /**
+     * @return number of times a buffer had to grow, i.e. the pricings that requested memory.
+     */
+    [[nodiscard]] std::size_t getGrowths() const {return growths;}
+    [[nodiscard]] std::size_t bytes() const {
+        std::size_t res{0};
+        for (auto const& b : buffers) res += b.capacity()*sizeof(double);
+        return res;
+    }
+};
+
+namespace detail{
+    inline std::atomic<std::pmr::memory_resource*>& latticeResourceSlot(){
+        static std::atomic<std::pmr::memory_resource*> resource{std::pmr::new_delete_resource()};
+        return resource;
+    }
+    inline std::pmr::memory_resource*& threadLatticeResourceSlot(){
+        thread_local std::pmr::memory_resource* resource{nullptr};
+        return resource;
+    }
+}
+/**
+ * @return resource of the lattice storage of the binomial trees built by the calling thread (their trade values): that
+ * of the thread (setThreadLatticeResource) if any, else that of the process, the heap by default.
+ */
+inline std::pmr::memory_resource* latticeResource(){
+    if (auto* resource = detail::threadLatticeResourceSlot()) return resource;
+    return detail::latticeResourceSlot().load();
+}
+/**
+ * Selects the resource of the lattices built from now on by the threads without one of their own, e.g. a
+ * HugePageResource (NumaMemory.h). It must outlive them.
+ */
+inline void setLatticeResource(std::pmr::memory_resource* resource){
+    detail::latticeResourceSlot() = resource ? resource : std::pmr::new_delete_resource();
+}
+/**
+ * Selects the resource of the lattices built from now on by the calling thread only, null to follow the process
+ * (setLatticeResource), e.g. the HugePageResource of the workers of a batch. It must outlive them.
+ */
+inline void setThreadLatticeResource(std::pmr::memory_resource* resource){
+    detail::threadLatticeResourceSlot() = resource;
+}
+
+/**
+ * Workspace of the calling thread, created on first use. Pricings that do not receive an explicit workspace use it.
+ */
+inline PricingWorkspace& threadWorkspace(){
+    thread_local PricingWorkspace workspace;
+    return workspace;
+}
+
+#endif //ACADIA_INTERVIEW_PRICINGWORKSPACE_H
@@ -0,0 +1,208 @@
+//
+// Progressive refinement: a coarse price first, then finer prices streamed as they finish, with error estimates.
+//
+
+#ifndef ACADIA_INTERVIEW_PROGRESSIVE_H
+#define ACADIA_INTERVIEW_PROGRESSIVE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <vector>
+#include "BatchPipeline.h"
+#include "Cancellation.h"
+#include "Parallel.h"
+
+/**
+ * One result of a progressive pricing: the pricing with Greeks at the steps of its level, and the estimated error of
+ * its price.
+ */
+struct Refinement{
+    PricingResult result;
+    double priceError{0};
+    unsigned level{0}; // 0 for the coarse price
+    bool last{false}; // no finer result follows: full steps reached, or priceError within the tolerance
+};
+
+struct RefinementSettings{
+    unsigned coarseSteps{16}; // steps of the first level at least, unless the full steps are fewer
+    double tolerance{0}; // refinement stops once the price error is within it, 0 to refine up to the full steps
+};
+
+/**
+ * @return the refinement settings of an input file: refined until progressive-tolerance, up to the full steps without
+ * it. The tolerance key selects the engine (CostModel::select) and does not stop the refinement.
+ */
+inline RefinementSettings refinementSettings(Config const& config){
+    RefinementSettings res;
+    res.tolerance = config.get(ConfigKey::ProgressiveTolerance);
+    return res;
+}
+
+/**
+ * @return the steps of the levels of a progressive pricing: steps halved until coarseSteps, coarsest first, so
+ * that every level doubles the steps of the previous one and ends on steps.
+ */
+inline std::vector<unsigned> refinementSteps(unsigned steps, unsigned coarseSteps){
+    if (steps==0) throw std::invalid_argument("A progressive pricing needs at least one step.");
+    std::vector<unsigned> res{steps};
+    while (res.back()/2>=std::max(coarseSteps, 1u)) res.push_back(res.back()/2);
+    std::reverse(res.begin(), res.end());
+    return res;
+}
+
+/**
+ * Prices a trade with Greeks on the levels of refinementSteps and calls emit(Refinement const&) as soon as each level
+ * is priced. The error of the price at n steps is estimated by Richardson extrapolation against the price at n/2
+ * steps, with the convergence order of the engine, and includes the standard error of the stochastic engines; the
+ * coarse level prices n/2 steps without Greeks for its estimate.
+ *
+ * Refinement stops after the level within settings.tolerance, or once the cancellation token of the thread is
+ * cancelled or expired: a level that was started stops within a few induction levels (see checkCancellation). A
+ * cancelled pricing that emitted nothing throws PricingCancelled.
+ * @param steps full steps, 0 for the engine default.
+ * @return the number of levels emitted.
+ */
+template<class Emit>
+unsigned refinePricing(PricingEngine const& engine, Environment const& env, Option const& option,
+                       DividendSchedule const& dividends, unsigned steps, RefinementSettings const& settings,
+                       Emit&& emit){
+    auto levels = refinementSteps(steps>0 ? steps : engine.defaultSteps(option), settings.coarseSteps);
+    double factor = std::pow(2., engine.info().convergenceOrder) - 1;
+    unsigned emitted{0};
+    try {
+        double previous = levels[0]>1 ? engine.price(env, option, dividends, levels[0]/2) : std::numeric_limits<double>::quiet_NaN();
+        for (unsigned level = 0; level < levels.size(); level++){
+            if (auto const* token = currentCancellation()) token->check();
+            Refinement refinement;
+            refinement.result = engine.priceWithGreeks(env, option, dividends, levels[level]);
+            refinement.level = level;
+            double extrapolated = std::isnan(previous) ? 0. : std::abs(refinement.result.price-previous)/factor;
+            refinement.priceError = std::hypot(extrapolated, refinement.result.standardError);
+            refinement.last = level+1==levels.size() || (settings.tolerance>0 && refinement.priceError<=settings.tolerance);
+            previous = refinement.result.price;
+            emit(static_cast<Refinement const&>(refinement));
+            emitted++;
+            if (refinement.last) break;
+        }
+    } catch (PricingCancelled const&) {
+        if (emitted==0) throw;
+    }
+    return emitted;
+}
+
+/**
+ * @return the result line of a refinement: the line of formatBatchResult followed by the level, the price error and
+ * whether it is the last refinement of the trade (CSV columns level,price-error,last, or JSON fields).
+ */
+inline std::string formatRefinement(TradeFileFormat format, BatchTrade const& trade, Refinement const& refinement){
+    auto line = formatBatchResult(format, trade, &refinement.result, "");
+    std::ostringstream fields;
+    fields << std::setprecision(std::numeric_limits<double>::max_digits10);
+    if (format==TradeFileFormat::Csv){
+        fields << "," << refinement.level << "," << refinement.priceError << "," << (refinement.last ? 1 : 0);
+        return line + fields.str();
+    }
+    line.pop_back(); // closing brace
+    fields << ",\"level\":" << refinement.level << ",\"price-error\":" << refinement.priceError << ",\"last\":"
+           << (refinement.last ? "true" : "false") << "}";
+    return line + fields.str();
+}
+
+/**
+ * Streams the refinements of the trades read from in to out: price(trade, emit) runs on the workers of pool for every
+ * trade, in the order of the file, and calls emit(Refinement const&) per level. The lines of a trade are written and
+ * flushed as soon as they are priced, and after those of the previous trades; at most depth trades are read ahead of
+ * the one being written. A trade that fails to parse or to price, and an invalid environment block, are written as
+ * an error line. Once out fails, the refinements still running are cancelled.
+ * @return the number of trades and of error lines.
+ */
+template<class Price>
+BatchStatistics streamRefinements(std::istream& in, std::ostream& out, TradeFileFormat format, WorkerPool& pool,
+                                  std::size_t depth, Price&& price){
+    struct Line{
+        std::string text;
+        bool failed{false};
+    };
+    struct Request{
+        BatchTrade trade;
+        CancellationToken token;
+        std::shared_ptr<BoundedQueue<Line>> lines; // null for a trade that failed to parse
+    };
+    auto errorLine = [format](BatchTrade const& trade, std::string const& error){
+        auto line = formatBatchResult(format, trade, nullptr, error);
+        return format==TradeFileFormat::Csv ? line + ",,," : line;
+    };
+    auto start = std::chrono::steady_clock::now();
+    TradeFileReader reader(in, format);
+    BatchStatistics statistics;
+    BoundedQueue<Request> requests(depth);
+    std::thread writer([&]{
+        while (auto request = requests.pop()){
+            statistics.trades++;
+            if (!request->lines){
+                statistics.errors++;
+                out << errorLine(request->trade, request->trade.error) << "\n" << std::flush;
+                continue;
+            }
+            if (!out) request->token.cancel();
+            while (auto line = request->lines->pop()){
+                statistics.errors += line->failed;
+                out << line->text << "\n" << std::flush;
+                if (!out) request->token.cancel();
+            }
+        }
+    });
+    while (true){
+        Request request;
+        try {
+            if (!reader.next(request.trade)) break;
+        } catch (std::exception const& error) {
+            request.trade.error = error.what(); // an invalid environment block (no id)
+        }
+        if (request.trade.error.empty()){
+            // a trade has fewer levels than the capacity: its worker never waits for the writer
+            request.lines = std::make_shared<BoundedQueue<Line>>(64);
+            pool.submit([&price, &errorLine, format, trade = request.trade, token = request.token, lines = request.lines]{
+                CancellationScope scope(&token);
+                try {
+                    price(static_cast<BatchTrade const&>(trade), [&](Refinement const& refinement){
+                        lines->push({formatRefinement(format, trade, refinement), false});
+                    });
+                } catch (std::exception const& error) {
+                    lines->push({errorLine(trade, error.what()), true});
+                }
+                lines->close();
+            });
+        }
+        requests.push(std::move(request));
+    }
+    requests.close();
+    writer.join();
+    statistics.elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    return statistics;
+}
+
+/**
+ * Progressive batch: prices the trades of a trade file as runBatch does (engine, steps and dividends of every trade),
+ * but streams the refinements of every trade (refinePricing) instead of writing its final result only. The output
+ * follows the format of the input, with the level, price-error and last columns of formatRefinement.
+ */
+inline BatchStatistics runProgressiveBatch(std::istream& in, std::ostream& out, TradeFileFormat format,
+                                           EngineRegistry const& registry, BatchSettings const& settings = {},
+                                           RefinementSettings const& refinement = {}){
+    (void) registry.get(settings.engine); // fails early on an unknown engine
+    WorkerPool pool(settings.threads);
+    if (format==TradeFileFormat::Csv)
+        out << "id,engine,steps,price,standard-error,delta,gamma,theta,vega,rho,error,level,price-error,last\n";
+    return streamRefinements(in, out, format, pool, settings.window, [&](BatchTrade const& trade, auto&& emit){
+        auto const& engine = registry.get(trade.engine.empty() ? settings.engine : trade.engine);
+        refinePricing(engine, trade.env, trade.option, batchDividends(trade, settings.seed),
+                      trade.steps>0 ? trade.steps : settings.steps, refinement, emit);
+    });
+}
+
+#endif //ACADIA_INTERVIEW_PROGRESSIVE_H
@@ -0,0 +1,312 @@
+//
+// Memoized prices and Greeks, keyed by a stable hash of the inputs, with an optional memory-mapped file tier.
+//
+
+#ifndef ACADIA_INTERVIEW_RESULTCACHE_H
+#define ACADIA_INTERVIEW_RESULTCACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+#include "LruCache.h"
+#include "PricingEngine.h"
+
+/**
+ * 128 bit hash of a byte stream, stable across processes, builds and platforms of the same endianness (unlike
+ * std::hash). The key is FNV-1a 64, the check an independent multiply-rotate hash: a cached result is only returned
+ * when both match, so a collision of the keys cannot serve the result of another trade.
+ */
+class StableHash{
+private:
+    std::uint64_t key{0xCBF29CE484222325ull}, check{0x2545F4914F6CDD1Dull};
+public:
+    StableHash& bytes(void const* data, std::size_t size){
+        auto const* p = static_cast<unsigned char const*>(data);
+        for (std::size_t i = 0; i < size; i++){
+            key = (key ^ p[i])*0x100000001B3ull;
+            check = (check ^ p[i])*0xFF51AFD7ED558CCDull;
+            check = (check<<23) | (check>>41);
+        }
+        return *this;
+    }
+    StableHash& add(std::string const& value){
+        add(static_cast<std::uint64_t>(value.size()));
+        return bytes(value.data(), value.size());
+    }
+    StableHash& add(double value){
+        if (value==0.) value = 0.; // -0 and 0 price alike
+        return bytes(&value, sizeof(value));
+    }
+    template<class Integer, class = std::enable_if_t<std::is_integral<Integer>::value>>
+    StableHash& add(Integer value){
+        auto v = static_cast<std::uint64_t>(value);
+        return bytes(&v, sizeof(v));
+    }
+    [[nodiscard]] std::uint64_t getKey() const {return key;}
+    [[nodiscard]] std::uint64_t getCheck() const {return check;}
+};
+
+struct ResultCacheSettings{
+    std::size_t capacity{1u<<16}; // results kept in memory
+    std::string file; // file tier, none if empty
+    std::size_t fileSlots{1u<<16}; // results kept in the file
+};
+
+/**
+ * Cache of PricingResults keyed by everything they depend on: engine name and configuration, number of steps, kind of
+ * result, market environment, trade and dividend structure. Results are looked up in a bounded in-memory LRU tier, then
+ * in the optional file tier, which survives the process: a restarted job finds the results of the previous run.
+ *
+ * The file is a fixed-size open-addressing table of records, mapped in memory; a record is replaced by a newer result
+ * when its probe sequence is full, and every record carries a checksum so a torn write is read as a miss. A file is
+ * meant for one process at a time, within the process the cache is thread-safe. Timings of cached results are the ones
+ * of their first computation.
+ */
+class ResultCache{
+public:
+    enum class Kind : std::uint32_t{Price = 1, Greeks = 2, Scenarios = 3};
+    struct Key{
+        std::uint64_t key{0}, check{0};
+    };
+    explicit ResultCache(ResultCacheSettings const& settings = {}): memory(std::max<std::size_t>(settings.capacity, 1)){
+        if (!settings.file.empty()) openFile(settings.file, settings.fileSlots);
+    }
+    ResultCache(ResultCache const&) = delete;
+    ResultCache& operator=(ResultCache const&) = delete;
+    ~ResultCache(){
+        if (table){
+            msync(table, mappedBytes, MS_SYNC);
+            munmap(table, mappedBytes);
+        }
+        if (fd>=0) close(fd);
+    }
+    /**
+     * @return key of a result of engine on (e, o, dividends) with the given number of steps (already resolved).
+     */
+    static Key key(PricingEngine const& engine, Kind kind, Environment const& e, Option const& o,
+                   DividendSchedule const& dividends, unsigned steps){
+        StableHash hash;
+        addCommon(hash, engine, kind, e, o, steps);
+        addDividends(hash, dividends);
+        return {hash.getKey(), hash.getCheck()};
+    }
+    static Key key(PricingEngine const& engine, Environment const& e, Option const& o,
+                   DividendScenarioSet const& scenarios, unsigned steps){
+        StableHash hash;
+        addCommon(hash, engine, Kind::Scenarios, e, o, steps);
+        hash.add(static_cast<int>(scenarios.stratified)).add(scenarios.structures.size());
+        for (auto const& dividends : scenarios.structures) addDividends(hash, dividends);
+        return {hash.getKey(), hash.getCheck()};
+    }
+    /**
+     * @return the cached result of key, computed by make() and cached on a miss.
+     */
+    template<class Make>
+    PricingResult findOrInsert(Key const& key, Make&& make){
+        if (auto cached = memory.find(key.key); cached && cached->check==key.check){
+            memoryHits++;
+            return cached->result;
+        }
+        PricingResult res;
+        if (readFile(key, res)){
+            fileHits++;
+            memory.insert(key.key, std::make_shared<const Entry>(Entry{key.check, res}));
+            return res;
+        }
+        missCount++;
+        res = make();
+        memory.insert(key.key, std::make_shared<const Entry>(Entry{key.check, res}));
+        writeFile(key, res);
+        return res;
+    }
+    /**
+     * Empties the memory tier and resets the metrics. The file tier is kept.
+     */
+    void clear(){
+        memory.clear();
+        memoryHits = fileHits = missCount = 0;
+    }
+    [[nodiscard]] std::size_t size() const {return memory.size();}
+    [[nodiscard]] std::uint64_t hits() const {return memoryHits + fileHits;}
+    [[nodiscard]] std::uint64_t fileTierHits() const {return fileHits;}
+    [[nodiscard]] std::uint64_t misses() const {return missCount;}
+    /**
+     * @return fraction of the lookups served by either tier, 0 before the first one.
+     */
+    [[nodiscard]] double hitRate() const {
+        double lookups = hits() + misses();
+        return lookups>0 ? hits()/lookups : 0.;
+    }
+    [[nodiscard]] bool hasFileTier() const {return table!=nullptr;}
+private:
+    struct Entry{
+        std::uint64_t check;
+        PricingResult result;
+    };
+    static constexpr char magic[8] = {'B', 'T', 'W', 'E', 'R', 'C', '0', '1'};
+    static constexpr std::size_t probes = 8;
+    struct FileHeader{
+        char magic[8];
+        std::uint64_t slots;
+        std::uint64_t recordSize;
+        std::uint64_t reserved;
+    };
+    struct Record{
+        std::uint64_t key;
+        std::uint64_t check;
+        std::uint32_t steps;
+        std::uint32_t used;
+        double values[7]; // price, standard error, delta, gamma, theta, vega, rho
+        double elapsedMicroseconds;
+        std::uint64_t checksum;
+    };
+    LruCache<std::uint64_t, Entry> memory;
+    std::atomic<std::uint64_t> memoryHits{0}, fileHits{0}, missCount{0};
+    int fd{-1};
+    void* table{nullptr};
+    std::size_t mappedBytes{0}, slots{0};
+    std::mutex fileMutex;
+
+    static void addCommon(StableHash& hash, PricingEngine const& engine, Kind kind, Environment const& e,
+                          Option const& o, unsigned steps){
+        hash.add(engine.info().name).add(engine.configuration()).add(static_cast<std::uint32_t>(kind)).add(steps);
+        hash.add(e.underlyingT0Price).add(e.volatility).add(e.riskFreeRate).add(e.averageDividendsPerYear).add(e.q);
+        hash.add(o.getStrike()).add(o.getTimeToMaturity());
+        hash.add(static_cast<int>(o.getType())).add(static_cast<int>(o.getCallPut()));
+    }
+    static void addDividends(StableHash& hash, DividendSchedule const& dividends){
+        hash.add(dividends.getEvents().size());
+        for (auto const& event : dividends.getEvents()) hash.add(event.day).add(event.count);
+    }
+    static std::uint64_t checksum(Record const& record){
+        return StableHash().bytes(&record, offsetof(Record, checksum)).getKey();
+    }
+    Record* records() const {
+        return reinterpret_cast<Record*>(static_cast<char*>(table) + sizeof(FileHeader));
+    }
+    void openFile(std::string const& path, std::size_t fileSlots){
+        if (fileSlots==0) throw std::invalid_argument("The file tier must have at least one slot.");
+        fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd<0) throw std::runtime_error("Cannot open the result cache file " + path + ".");
+        mappedBytes = sizeof(FileHeader) + fileSlots*sizeof(Record);
+        auto fail = [&](std::string const& what){
+            close(fd);
+            fd = -1;
+            throw std::runtime_error("Cannot " + what + " the result cache file " + path + ".");
+        };
+        struct stat status{};
+        if (fstat(fd, &status)!=0 || static_cast<std::size_t>(status.st_size)!=mappedBytes){
+            if (ftruncate(fd, 0)!=0 || ftruncate(fd, static_cast<off_t>(mappedBytes))!=0) fail("resize");
+        }
+        table = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (table==MAP_FAILED){
+            table = nullptr;
+            fail("map");
+        }
+        slots = fileSlots;
+        auto* header = static_cast<FileHeader*>(table);
+        if (std::memcmp(header->magic, magic, sizeof(magic))!=0 || header->slots!=slots ||
+            header->recordSize!=sizeof(Record)){
+            // new file, or written with another layout: start over
+            std::memset(table, 0, mappedBytes);
+            std::memcpy(header->magic, magic, sizeof(magic));
+            header->slots = slots;
+            header->recordSize = sizeof(Record);
+        }
+    }
+    bool readFile(Key const& key, PricingResult& res){
+        if (!table) return false;
+        std::lock_guard<std::mutex> lock(fileMutex);
+        for (std::size_t k = 0; k < std::min(probes, slots); k++){
+            Record const& record = records()[(key.key + k)%slots];
+            if (!record.used) return false;
+            if (record.key!=key.key || record.check!=key.check || record.checksum!=checksum(record)) continue;
+            res.price = record.values[0];
+            res.standardError = record.values[1];
+            res.greeks = {record.values[2], record.values[3], record.values[4], record.values[5], record.values[6]};
+            res.steps = record.steps;
+            res.elapsedMicroseconds = record.elapsedMicroseconds;
+            return true;
+        }
+        return false;
+    }
+    void writeFile(Key const& key, PricingResult const& res){
+        if (!table) return;
+        std::lock_guard<std::mutex> lock(fileMutex);
+        std::size_t slot = key.key%slots; // replaced when the probe sequence is full
+        for (std::size_t k = 0; k < std::min(probes, slots); k++){
+            Record const& record = records()[(key.key + k)%slots];
+            if (!record.used || (record.key==key.key && record.check==key.check)){
+                slot = (key.key + k)%slots;
+                break;
+            }
+        }
+        Record record{};
+        record.key = key.key;
+        record.check = key.check;
+        record.steps = res.steps;
+        record.used = 1;
+        double values[7] = {res.price, res.standardError, res.greeks.delta, res.greeks.gamma, res.greeks.theta,
+                            res.greeks.vega, res.greeks.rho};
+        std::memcpy(record.values, values, sizeof(values));
+        record.elapsedMicroseconds = res.elapsedMicroseconds;
+        record.checksum = checksum(record);
+        records()[slot] = record;
+    }
+};
+
+/**
+ * Engine memoizing the prices, Greeks and scenario prices of another engine in a ResultCache. The myUtils Greeks and
+ * the cost model use it as any engine, so repeated pricings and their bumps are served from the cache.
+ */
+class CachedEngine : public PricingEngine{
+private:
+    PricingEngine const& engine;
+    ResultCache& cache;
+public:
+    CachedEngine(PricingEngine const& engine, ResultCache& cache): engine(engine), cache(cache){}
+    [[nodiscard]] EngineInfo const& info() const override {return engine.info();}
+    [[nodiscard]] unsigned defaultSteps(Option const& o) const override {return engine.defaultSteps(o);}
+    [[nodiscard]] double work(Option const& o, unsigned steps) const override {return engine.work(o, steps);}
+    [[nodiscard]] std::string configuration() const override {return engine.configuration();}
+    [[nodiscard]] unsigned bumpCount() const override {return 0;} // Greeks are cached whole
+    [[nodiscard]] double price(Environment const& e, Option const& o, DividendSchedule const& dividends,
+                               unsigned steps) const override {
+        steps = steps>0 ? steps : defaultSteps(o);
+        return cache.findOrInsert(ResultCache::key(engine, ResultCache::Kind::Price, e, o, dividends, steps), [&]{
+            PricingResult res;
+            res.price = engine.price(e, o, dividends, steps);
+            res.steps = steps;
+            return res;
+        }).price;
+    }
+    [[nodiscard]] PricingResult priceWithGreeks(Environment const& e, Option const& o,
+                                                DividendSchedule const& dividends, unsigned steps) const override {
+        steps = steps>0 ? steps : defaultSteps(o);
+        auto res = cache.findOrInsert(ResultCache::key(engine, ResultCache::Kind::Greeks, e, o, dividends, steps), [&]{
+            return engine.priceWithGreeks(e, o, dividends, steps);
+        });
+        res.engine = info().name;
+        return res;
+    }
+    [[nodiscard]] PricingResult priceScenarios(Environment const& e, Option const& o,
+                                               DividendScenarioSet const& scenarios, unsigned steps) const override {
+        steps = steps>0 ? steps : defaultSteps(o);
+        auto res = cache.findOrInsert(ResultCache::key(engine, e, o, scenarios, steps), [&]{
+            return engine.priceScenarios(e, o, scenarios, steps);
+        });
+        res.engine = info().name;
+        return res;
+    }
+};
+
+#endif //ACADIA_INTERVIEW_RESULTCACHE_H
@@ -0,0 +1,194 @@
+//
+// Multi-process batch pricing: a coordinator shards a binary trade file across worker processes that fill one shared
+// result file.
+//
+
+#ifndef ACADIA_INTERVIEW_SHARDEDBATCH_H
+#define ACADIA_INTERVIEW_SHARDEDBATCH_H
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <string>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "BinaryTradeFile.h"
+
+/**
+ * A contiguous range of trades [begin, end) of the trade file, priced by one worker. attempt counts from 0.
+ */
+struct Shard{
+    std::size_t index{0};
+    std::size_t begin{0}, end{0};
+    unsigned attempt{0};
+    std::chrono::steady_clock::time_point deadline{std::chrono::steady_clock::time_point::max()}; // of the attempt
+};
+
+/**
+ * Transport of the shards of runShardedBatch. The protocol is that of b-twe --shard: a worker maps the trade file and
+ * the result file created by the coordinator, writes the records of its range and succeeds, or fails (including by
+ * crashing) and its range is given to a new attempt. Workers on another node only need the two files on a shared
+ * file system, so a launcher running the workers in process stands for a remote node in the tests. A worker still
+ * running at the deadline of its shard is stopped and fails, as a hung worker would otherwise hold the batch forever.
+ */
+class ShardLauncher{
+public:
+    virtual ~ShardLauncher() = default;
+    /**
+     * Starts a worker on a shard, without waiting for it.
+     */
+    virtual void launch(Shard const& shard) = 0;
+    /**
+     * Waits for one of the started workers to end.
+     * @return the index of its shard, and whether it succeeded.
+     */
+    virtual std::pair<std::size_t, bool> wait() = 0;
+};
+
+/**
+ * Runs every shard in a child process: fork, then exec of command followed by the begin and end of the shard, e.g.
+ * {"/proc/self/exe", "--shard", "trades.bin", "results.bin"} then "--engine" ... after the range. A worker succeeds
+ * when it exits with status 0; a crash, a signal or another status fails it. A worker past the deadline of its shard
+ * is killed (SIGKILL), which fails it. Only the workers are waited for, so the launcher can live in a process with
+ * children of its own.
+ */
+class ProcessShardLauncher : public ShardLauncher{
+private:
+    struct Worker{
+        std::size_t shard{0};
+        std::chrono::steady_clock::time_point deadline; // max once killed
+    };
+    std::vector<std::string> command, options;
+    std::unordered_map<pid_t, Worker> running;
+    static constexpr std::chrono::milliseconds pollInterval{5}; // between two polls of the running workers
+public:
+    /**
+     * @param command program and first arguments of a worker.
+     * @param options arguments after the range of the shard.
+     */
+    explicit ProcessShardLauncher(std::vector<std::string> command, std::vector<std::string> options = {})
+            : command(std::move(command)), options(std::move(options)){
+        if (this->command.empty()) throw std::invalid_argument("The worker command is empty.");
+    }
+    ~ProcessShardLauncher() override {
+        for (auto const& child : running){
+            kill(child.first, SIGKILL);
+            waitpid(child.first, nullptr, 0);
+        }
+    }
+    void launch(Shard const& shard) override {
+        auto arguments = command;
+        arguments.push_back(std::to_string(shard.begin));
+        arguments.push_back(std::to_string(shard.end));
+        arguments.insert(arguments.end(), options.begin(), options.end());
+        std::vector<char*> argv;
+        for (auto& argument : arguments) argv.push_back(argument.data());
+        argv.push_back(nullptr);
+        pid_t pid = fork();
+        if (pid<0) throw std::runtime_error("Couldn't start a worker process.");
+        if (pid==0){
+            execv(argv[0], argv.data());
+            _exit(127); // exec failed
+        }
+        running[pid] = {shard.index, shard.deadline};
+    }
+    std::pair<std::size_t, bool> wait() override {
+        if (running.empty()) throw std::logic_error("No worker is running.");
+        while (true){
+            // only the workers are polled: the other children of the process are left to their owners
+            auto now = std::chrono::steady_clock::now();
+            auto next = now + pollInterval;
+            for (auto found = running.begin(); found != running.end(); ++found){
+                int status{0};
+                pid_t pid = waitpid(found->first, &status, WNOHANG);
+                if (pid<0 && errno!=EINTR) throw std::runtime_error("Couldn't wait for the worker processes.");
+                if (pid>0){
+                    auto shard = found->second.shard;
+                    running.erase(found);
+                    return {shard, WIFEXITED(status) && WEXITSTATUS(status)==0};
+                }
+                // still running: killed past its deadline, its end is then reaped as a crash
+                if (now>=found->second.deadline){
+                    kill(found->first, SIGKILL);
+                    found->second.deadline = std::chrono::steady_clock::time_point::max();
+                }
+                next = std::min(next, found->second.deadline);
+            }
+            if (next>now) std::this_thread::sleep_for(next-now);
+        }
+    }
+};
+
+struct ShardSettings{
+    std::size_t shards{1}; // ranges of trades, one worker each
+    unsigned retries{2}; // new attempts of a failed shard before the batch fails
+    std::chrono::steady_clock::duration timeout{0}; // of every attempt, after which the worker fails; 0 for none
+};
+
+/**
+ * @return the number of shards of a batch of trades: settings.shards, but not more than the trades (at least one).
+ */
+inline std::size_t shardCount(std::size_t trades, ShardSettings const& settings){
+    return std::min(settings.shards, std::max<std::size_t>(trades, 1));
+}
+
+/**
+ * Coordinator of a sharded batch: creates the binary result file of the trades (records zeroed), splits the trades
+ * into settings.shards contiguous ranges, starts one worker per range with launcher and starts again the failed ones
+ * on their range zeroed again, at most settings.retries times each; an attempt still running after settings.timeout fails as a crash would. Workers
+ * write their records straight into the shared result file, so the results are complete once every shard succeeded,
+ * and equal those of runBinaryBatch.
+ * @return statistics of the batch, errors being the failed trades of the result file.
+ */
+inline BatchStatistics runShardedBatch(BinaryTradeFile const& trades, std::string const& resultPath,
+                                       ShardLauncher& launcher, ShardSettings const& settings){
+    if (settings.shards==0) throw std::invalid_argument("A sharded batch needs at least one shard.");
+    auto start = std::chrono::steady_clock::now();
+    MappedOutputFile file(resultPath, sizeof(BinaryHeader) + trades.size()*sizeof(BinaryResultRecord));
+    createBinaryResultFile(file, trades.size());
+    file.sync();
+    std::vector<Shard> shards;
+    auto launch = [&](Shard& shard){
+        if (settings.timeout>std::chrono::steady_clock::duration::zero())
+            shard.deadline = std::chrono::steady_clock::now() + settings.timeout;
+        launcher.launch(shard);
+    };
+    auto count = shardCount(trades.size(), settings);
+    for (std::size_t k = 0; k < count; k++){
+        shards.push_back({k, k*trades.size()/count, (k+1)*trades.size()/count, 0});
+        launch(shards.back());
+    }
+    for (std::size_t running = count; running>0;){
+        auto [index, succeeded] = launcher.wait();
+        running--;
+        if (succeeded) continue;
+        auto& shard = shards.at(index);
+        if (shard.attempt>=settings.retries){
+            throw std::runtime_error("Shard " + std::to_string(index) + " (trades " + std::to_string(shard.begin) + " to " +
+                                     std::to_string(shard.end) + ") failed " + std::to_string(shard.attempt+1) +
+                                     " times.");
+        }
+        shard.attempt++;
+        // the records left by the failed attempt are cleared before the next one writes them
+        std::memset(static_cast<void*>(file.data() + sizeof(BinaryHeader) + shard.begin*sizeof(BinaryResultRecord)), 0,
+                    (shard.end-shard.begin)*sizeof(BinaryResultRecord));
+        file.sync();
+        launch(shard);
+        running++;
+    }
+    BatchStatistics statistics;
+    statistics.trades = trades.size();
+    auto results = reinterpret_cast<BinaryResultRecord const*>(file.data() + sizeof(BinaryHeader));
+    for (std::size_t k = 0; k < trades.size(); k++) statistics.errors += results[k].failed!=0;
+    statistics.elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    return statistics;
+}
+
+#endif //ACADIA_INTERVIEW_SHARDEDBATCH_H
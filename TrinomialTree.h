@@ -0,0 +1,179 @@
+//
+// Trinomial lattice model, sharing the build surface of BinomialTree.
+//
+
+#ifndef ACADIA_INTERVIEW_TRINOMIALTREE_H
+#define ACADIA_INTERVIEW_TRINOMIALTREE_H
+
+#include "Objects.h"
+
+struct TrinomialTreeNode{
+    double underlyingValue{0};
+    double tradeValue{0};
+};
+
+/**
+ * Trinomial Tree model object (Boyle/Kamrad-Ritchken parameterization).
+ * From every node the underlying moves up by u=exp(sigma*sqrt(2dt)), stays flat or moves down by d=1/u.
+ * Level i holds 2i+1 nodes, sorted from the lowest to the highest underlying value. Levels are stored contiguously
+ * in a single flat vector, level i starting at offset i*i.
+ */
+class TrinomialTree{
+private:
+    std::vector<TrinomialTreeNode> tree;
+    unsigned N;
+    double u{0}, d{0}, r{0}, dt{0}, t0underVal{0}, sigma{0}, pUp{0}, pMid{0}, pDown{0}, q{0};
+    Option o;
+    DividendSchedule dividends;
+    unsigned days{0}; // days spanned by the tree
+public:
+    /**
+     * Build a trinomial tree model to price financial Option based on stocks, with one step per calendar day.
+     * Market assumptions and event-based dividends are the same as in BinomialTree::build.
+     * @param e Market environment. It includes vol, rate, stock price at time t0, number of average dividends payed per year.
+     * @param o Derivative trade.
+     * @return Model object.
+     */
+    static TrinomialTree build(Environment const& e, Option const& o) {
+        return build(e, o, threadRng());
+    }
+    static TrinomialTree build(Environment const& e, Option const& o, PhiloxStream& rng) {
+        return build(e, o, sampleDividendStructure(e, o.getTimeToMaturity(), rng));
+    }
+    static TrinomialTree build(Environment const& e, Option const& o, DividendSchedule const& dividends) {
+        return build(e, o, dividends, o.getTimeToMaturity());
+    }
+    /**
+     * Same as above, with an arbitrary number of time steps spanning the life of the option.
+     * @param steps number of time steps in the tree.
+     */
+    static TrinomialTree build(Environment const& e, Option const& o, DividendSchedule const& dividends, unsigned steps) {
+        return build(e, o, dividends, geometry(e, o, steps));
+    }
+    /**
+     * Dividend-free part of a tree: time step, probabilities and powers of u from u^-N to u^N. Trees of the same
+     * trade differing only by their dividend structure share it (see DividendScenarios).
+     */
+    struct Geometry{
+        unsigned steps{0};
+        double dt{0}, u{0}, pUp{0}, pMid{0}, pDown{0};
+        std::vector<double> powers;
+    };
+    static Geometry geometry(Environment const& e, Option const& o, unsigned steps) {
+        if (steps==0) throw std::invalid_argument("The tree must have at least one time step.");
+        BTWE_PHASE(Geometry, 2*steps+1);
+        Geometry res;
+        res.steps = steps;
+        res.dt = (static_cast<double>(o.getTimeToMaturity())/steps)/365.25;
+        double sigma = e.volatility;
+        res.u = std::exp(sigma * std::sqrt(2.*res.dt));
+        double halfStepGrowth = std::exp(0.5*(e.riskFreeRate-e.q)*res.dt);
+        double halfUp = std::exp(sigma*std::sqrt(0.5*res.dt));
+        double halfDown = 1/halfUp;
+        res.pUp = std::pow((halfStepGrowth - halfDown)/(halfUp - halfDown), 2);
+        res.pDown = std::pow((halfUp - halfStepGrowth)/(halfUp - halfDown), 2);
+        res.pMid = 1. - res.pUp - res.pDown;
+        res.powers.resize(2*steps+1);
+        res.powers[steps] = 1.;
+        double d = 1/res.u;
+        for (unsigned k = 1; k < steps+1; k++){
+            res.powers[steps+k] = res.powers[steps+k-1]*res.u;
+            res.powers[steps-k] = res.powers[steps-k+1]*d;
+        }
+        return res;
+    }
+    /**
+     * Same as above, with a geometry computed by geometry(e, o, steps) for the same trade and environment.
+     */
+    static TrinomialTree build(Environment const& e, Option const& o, DividendSchedule const& dividends,
+                               Geometry const& geometry) {
+        TrinomialTree tree(geometry.steps, dividends);
+        tree.dt = geometry.dt;
+        tree.days = o.getTimeToMaturity();
+        {
+            std::size_t nodes = static_cast<size_t>(geometry.steps+1)*(geometry.steps+1);
+            BTWE_PHASE(Build, nodes);
+            tree.tree.resize(nodes);
+        }
+        tree.setEnvironment(e, geometry);
+        tree.setOption(o);
+        return tree;
+    }
+    /**
+     * @param t time index
+     * @param k node index at level t, 0 is the lowest underlying value and 2t the highest. k-t is the number of
+     * net up moves.
+     */
+    [[nodiscard]] TrinomialTreeNode getNode(unsigned t, unsigned k) const {
+        return tree[offset(t)+k];
+    }
+    [[nodiscard]] int getN() const {return N;}
+    [[nodiscard]] DividendSchedule const& getDividendStructure() const {
+        return dividends;
+    }
+    [[nodiscard]] double getU() const {
+        return u;
+    }
+    [[nodiscard]] double getD() const {
+        return d;
+    }
+    [[nodiscard]] double getPrice() const {return tree[0].tradeValue;}
+private:
+    explicit TrinomialTree(unsigned n, DividendSchedule ds):
+            N(n),
+            dividends(std::move(ds)){};
+    [[nodiscard]] static size_t offset(unsigned t) {
+        return static_cast<size_t>(t)*t;
+    }
+    void setEnvironment(Environment const& e, Geometry const& geometry){
+        sigma = e.volatility;
+        u = geometry.u;
+        d = 1/u;
+        r = e.riskFreeRate;
+        q = e.q;
+        t0underVal = e.underlyingT0Price;
+        pUp = geometry.pUp;
+        pMid = geometry.pMid;
+        pDown = geometry.pDown;
+        simulateUnderlyingDynamics(geometry.powers);
+    }
+    void setOption(Option const& option){
+        o=option;
+        computeValuesAtMaturity();
+        computeValueAtNodes();
+    }
+    void simulateUnderlyingDynamics(std::vector<double> const& powers){
+        BTWE_PHASE(Underlying, offset(N+1));
+        double dividendSize = t0underVal*0.1;
+        for (unsigned i = 0; i < N+1; i++){
+            auto level = tree.begin() + offset(i);
+            double payed = static_cast<double>(dividends.payedBefore(i, days, N))*dividendSize;
+            for (unsigned k = 0; k < 2*i+1; k++){
+                level[k].underlyingValue = std::max(t0underVal*powers[N-i+k]-payed, 0.);
+            }
+        }
+    }
+    void computeValuesAtMaturity(){
+        BTWE_PHASE(Maturity, 2*N+1);
+        auto level = tree.begin() + offset(N);
+        for (unsigned k = 0; k < 2*N+1; k++){
+            level[k].tradeValue = o.payout(level[k].underlyingValue);
+        }
+    }
+    void computeValueAtNodes(){
+        BTWE_PHASE(Induction, offset(N));
+        double discount = std::exp(-r*dt);
+        bool american = o.getType()==TradeType::American;
+        for (auto i = static_cast<long>(N)-1; i >= 0; i--){
+            checkCancellation(i);
+            auto level = tree.begin() + offset(i);
+            auto next = tree.begin() + offset(i+1);
+            for (long k = 0; k < 2*i+1; k++){
+                double continuation = discount*(pUp*next[k+2].tradeValue + pMid*next[k+1].tradeValue + pDown*next[k].tradeValue);
+                level[k].tradeValue = american ? std::max(continuation, o.payout(level[k].underlyingValue)) : continuation;
+            }
+        }
+    }
+};
+
+#endif //ACADIA_INTERVIEW_TRINOMIALTREE_H
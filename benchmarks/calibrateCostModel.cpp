@@ -0,0 +1,46 @@
+//
+// Calibrates the cost/accuracy model of the selectable engines on this machine and writes it in the key=value format
+// read by CostModel::load and by b-twe. Run as: calibrate_cost_model [output-file]
+//
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include "../CostModel.h"
+
+int main(int argc, char* argv[]) {
+    std::string path = argc>1 ? argv[1] : "cost_model.txt";
+    auto registry = EngineRegistry::withBuiltInEngines();
+    auto model = CostModel::calibrate(registry, {25, 50, 100, 200, 400, 800});
+    std::cout << std::setw(16) << "engine" << std::setw(14) << "overhead[us]" << std::setw(12) << "us/work"
+              << std::setw(12) << "EU const" << std::setw(10) << "EU order" << std::setw(12) << "EU floor"
+              << std::setw(12) << "AM const" << std::setw(10) << "AM order" << std::setw(12) << "AM floor" << "\n";
+    for (auto const& engine : registry.all()){
+        auto const* cost = model.find(engine->info().name);
+        if (!cost) continue;
+        std::cout << std::setw(16) << engine->info().name << std::setprecision(4)
+                  << std::setw(14) << cost->overheadMicroseconds << std::setw(12) << cost->microsecondsPerWork;
+        for (auto const& error : {cost->european, cost->american}){
+            std::cout << std::setw(12) << error.constant << std::setw(10) << error.order << std::setw(12) << error.floor;
+        }
+        std::cout << "\n";
+    }
+    // routing of a one-year American put for a few budgets and tolerances
+    Environment env;
+    env.underlyingT0Price = 60;
+    env.volatility = 0.25;
+    env.riskFreeRate = 0.04;
+    Option option(62, 365, TradeType::American, CallPut::Put);
+    std::cout << "\n" << std::setw(14) << "budget[us]" << std::setw(12) << "tolerance" << std::setw(16) << "engine"
+              << std::setw(8) << "steps" << std::setw(14) << "pred. [us]" << std::setw(14) << "pred. error" << "\n";
+    for (double budget : {100., 1000., 10000.}){
+        for (double tolerance : {1e-2, 1e-3, 1e-4}){
+            auto choice = model.select(registry, env, option, budget, tolerance, false);
+            std::cout << std::setw(14) << budget << std::setw(12) << tolerance << std::setw(16) << choice.engine->info().name
+                      << std::setw(8) << choice.steps << std::setw(14) << choice.predictedMicroseconds
+                      << std::setw(14) << choice.predictedError << (choice.meetsTolerance ? "" : " (best effort)") << "\n";
+        }
+    }
+    model.save(path);
+    std::cout << "\nCost model written to " << path << "\n";
+    return 0;
+}
@@ -0,0 +1,41 @@
+//
+// Scaling of the Longstaff-Schwartz Monte Carlo model with the number of threads, on an American put with Poisson
+// dividends. The price must not depend on the number of threads. Run as: mc_benchmark [paths] [max-threads]
+//
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include "../LongstaffSchwartz.h"
+
+int main(int argc, char* argv[]) {
+    MonteCarloSettings settings;
+    settings.paths = argc>1 ? static_cast<unsigned>(std::stoul(argv[1])) : 1u<<18;
+    unsigned maxThreads = argc>2 ? static_cast<unsigned>(std::stoul(argv[2])) : resolveThreads(0);
+    Environment env;
+    env.riskFreeRate = 5e-2;
+    env.underlyingT0Price = 60;
+    env.volatility = 0.2;
+    env.q = 0.01;
+    env.averageDividendsPerYear = 2;
+    Option option(62, 365, TradeType::American, CallPut::Put);
+
+    std::cout << option << ", " << settings.paths << " paths, " << settings.steps << " exercise dates\n";
+    std::cout << std::setw(8) << "threads" << std::setw(14) << "price" << std::setw(12) << "std error"
+              << std::setw(12) << "time [ms]" << std::setw(10) << "speedup" << std::setw(12) << "efficiency" << "\n";
+    double serialTime{0};
+    for (unsigned threads = 1; threads <= maxThreads; threads *= 2){
+        settings.threads = threads;
+        auto start = std::chrono::steady_clock::now();
+        auto model = LongstaffSchwartz::build(env, option, settings);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        if (threads==1) serialTime = elapsed.count();
+        double speedup = serialTime/elapsed.count();
+        std::cout << std::setw(8) << threads << std::setw(14) << std::setprecision(10) << model.getPrice()
+                  << std::setw(12) << std::setprecision(3) << model.getStandardError()
+                  << std::setw(12) << std::setprecision(4) << elapsed.count()
+                  << std::setw(10) << std::setprecision(3) << speedup
+                  << std::setw(12) << speedup/threads << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,96 @@
+//
+// Runtime and dTLB misses of a long-dated daily binomial tree with regular pages, transparent huge pages and explicit
+// huge pages (vm.nr_hugepages). Misses are read from the hardware counters through perf_event_open, "n/a" when the
+// kernel does not allow it (kernel.perf_event_paranoid, containers). Run as: memory_benchmark [days-to-maturity]
+//
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <linux/perf_event.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "../NumaMemory.h"
+#include "../Objects.h"
+
+/**
+ * Data TLB read misses of the calling thread.
+ */
+class DtlbMissCounter{
+private:
+    int fd{-1};
+public:
+    DtlbMissCounter(){
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ<<8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS<<16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+    ~DtlbMissCounter(){if (fd>=0) close(fd);}
+    [[nodiscard]] bool available() const {return fd>=0;}
+    void start(){
+        if (fd<0) return;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    long long stop(){
+        if (fd<0) return -1;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        long long count{0};
+        return read(fd, &count, sizeof(count))==sizeof(count) ? count : -1;
+    }
+};
+
+void report(std::string const& name, HugePages hugePages, Environment const& env, Option const& option,
+            DividendSchedule const& dividends){
+    HugePageResource resource(HugePageSettings{hugePages});
+    setLatticeResource(&resource);
+    DtlbMissCounter misses;
+    int repetitions = 3;
+    double price{0};
+    misses.start();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repetitions; i++){
+        NormalizedLattice<CoxRossRubinstein>::cache().clear(); // every build allocates its lattices
+        price = BinomialTree::build(env, option, dividends, option.getTimeToMaturity()).getPrice();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    long long count = misses.stop();
+    NormalizedLattice<CoxRossRubinstein>::cache().clear();
+    setLatticeResource(nullptr);
+    std::cout << std::setw(14) << name << std::setw(14) << std::setprecision(8) << price
+              << std::setw(14) << std::setprecision(4) << elapsed.count()/repetitions
+              << std::setw(16) << (count>=0 ? std::to_string(count/repetitions) : std::string("n/a"))
+              << std::setw(12) << (resource.getExplicitBytes()>>20)
+              << std::setw(12) << (resource.getTransparentBytes()>>20) << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    unsigned days = argc>1 ? static_cast<unsigned>(std::stoul(argv[1])) : 3650;
+    Environment env;
+    env.riskFreeRate = 5e-2;
+    env.underlyingT0Price = 60;
+    env.volatility = 0.2;
+    env.averageDividendsPerYear = 1;
+    Option option(62, days, TradeType::American, CallPut::Put);
+    std::vector<DividendEvent> events;
+    for (unsigned day = 180; day < days; day += 365) events.push_back({day, 1});
+    DividendSchedule dividends(events);
+
+    auto lattice = static_cast<double>(days+1)*(days+2)/2;
+    std::cout << option << ", daily tree of " << lattice*sizeof(double)/(1<<20) << " MB, " << numaNodes().size()
+              << " NUMA node(s)\n";
+    std::cout << std::setw(14) << "pages" << std::setw(14) << "price" << std::setw(14) << "time [ms]"
+              << std::setw(16) << "dTLB misses" << std::setw(12) << "hugetlb MB" << std::setw(12) << "THP MB" << "\n";
+    report("regular", HugePages::Off, env, option, dividends);
+    report("transparent", HugePages::Transparent, env, option, dividends);
+    report("explicit", HugePages::Explicit, env, option, dividends);
+    return 0;
+}
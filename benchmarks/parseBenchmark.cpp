@@ -0,0 +1,55 @@
+//
+// Throughput of the parsers of the input files: CSV and JSONL trade records through TradeFileReader, and key=value
+// input files through Config. Run as: parse_benchmark [records]
+//
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "../BatchPipeline.h"
+
+void report(std::string const& name, std::string const& text, TradeFileFormat format, std::size_t records){
+    std::istringstream in(text);
+    TradeFileReader reader(in, format);
+    BatchTrade trade;
+    std::size_t trades{0}, errors{0};
+    double strikes{0};
+    auto start = std::chrono::steady_clock::now();
+    while (reader.next(trade)){
+        trades++;
+        errors += !trade.error.empty();
+        strikes += trade.option.getStrike();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (trades!=records || errors>0) std::cerr << name << ": " << trades << " records, " << errors << " errors\n";
+    std::cout << std::setw(8) << name << std::setw(16) << std::setprecision(4) << records/elapsed.count()
+              << std::setw(14) << text.size()/elapsed.count()/(1<<20) << std::setw(16) << strikes/trades << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    std::size_t records = argc>1 ? std::stoul(argv[1]) : 1000000;
+    std::ostringstream csv, jsonl;
+    csv << "id,S-T0-Price,volatility,risk-free-rate,average-dividends-per-year,strike,days-to-maturity,callput,european\n";
+    for (std::size_t k = 0; k < records; k++){
+        csv << "t" << k << "," << 40 + k%20 << ".25,0.2,5e-2,2," << 50 + k%7 << "," << 30 + (k*37)%700 << ","
+            << (k%2 ? 1 : -1) << "," << (k%3 ? -1 : 1) << "\n";
+        jsonl << "{\"id\": \"t" << k << "\", \"S-T0-Price\": " << 40 + k%20 << ".25, \"volatility\": 0.2, "
+              << "\"risk-free-rate\": 5e-2, \"strike\": " << 50 + k%7 << ", \"days-to-maturity\": " << 30 + (k*37)%700
+              << ", \"callput\": " << (k%2 ? "true" : "false") << ", \"european\": false}\n";
+    }
+    std::cout << std::setw(8) << "format" << std::setw(16) << "records/s" << std::setw(14) << "MB/s"
+              << std::setw(16) << "mean strike" << "\n";
+    report("csv", csv.str(), TradeFileFormat::Csv, records);
+    report("jsonl", jsonl.str(), TradeFileFormat::Jsonl, records);
+
+    std::string input = "risk-free-rate=5e-2\nS-T0-Price=60\nvolatility=2e-1\naverage-dividends-per-year=0.\n"
+                        "continuously-yield-dividend=0.\ncallput=-1.\neuropean=-1.\nstrike=60\ndays-to-maturity=365\n";
+    double sum{0};
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t k = 0; k < records; k++) sum += Config::parse(input).get(ConfigKey::Strike);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << std::setw(8) << "config" << std::setw(16) << std::setprecision(4) << records/elapsed.count()
+              << std::setw(14) << input.size()*records/elapsed.count()/(1<<20) << std::setw(16) << sum/records << "\n";
+    return 0;
+}
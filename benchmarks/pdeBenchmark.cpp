@@ -0,0 +1,46 @@
+//
+// Price, Greeks and runtime of the Crank-Nicolson grid against the daily binomial tree on American puts of increasing
+// maturity. The tree Greeks need four further builds (finite-differences), the grid reads them off one build.
+// Run as: pde_benchmark [space-nodes]
+//
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include "../Objects.h"
+#include "../CrankNicolsonGrid.h"
+
+int main(int argc, char* argv[]) {
+    unsigned spaceNodes = argc>1 ? static_cast<unsigned>(std::stoul(argv[1])) : CrankNicolsonGrid::defaultSpaceNodes;
+    Environment env;
+    env.riskFreeRate = 5e-2;
+    env.underlyingT0Price = 60;
+    env.volatility = 0.2;
+    env.q = 0.01;
+    std::cout << std::setw(6) << "years" << std::setw(8) << "engine" << std::setw(12) << "price"
+              << std::setw(12) << "delta" << std::setw(12) << "gamma" << std::setw(14) << "time [ms]" << "\n";
+    for (unsigned years : {1u, 2u, 5u, 10u}){
+        auto days = static_cast<unsigned>(years*365.25);
+        Option option(62, days, TradeType::American, CallPut::Put);
+        std::vector<int> dividendStructure(days+1);
+
+        auto start = std::chrono::steady_clock::now();
+        auto tree = BinomialTree::build(env, option, dividendStructure);
+        double treeDelta = myUtils::computeDelta(env, option, tree);
+        double treeGamma = myUtils::computeGamma(env, option, tree);
+        std::chrono::duration<double, std::milli> treeTime = std::chrono::steady_clock::now() - start;
+
+        start = std::chrono::steady_clock::now();
+        auto grid = CrankNicolsonGrid::build(env, option, dividendStructure, days, spaceNodes);
+        double gridDelta = grid.getDelta();
+        double gridGamma = grid.getGamma();
+        std::chrono::duration<double, std::milli> gridTime = std::chrono::steady_clock::now() - start;
+
+        std::cout << std::setprecision(6)
+                  << std::setw(6) << years << std::setw(8) << "tree" << std::setw(12) << tree.getPrice()
+                  << std::setw(12) << treeDelta << std::setw(12) << treeGamma << std::setw(14) << treeTime.count() << "\n"
+                  << std::setw(6) << years << std::setw(8) << "CN" << std::setw(12) << grid.getPrice()
+                  << std::setw(12) << gridDelta << std::setw(12) << gridGamma << std::setw(14) << gridTime.count() << "\n";
+    }
+    return 0;
+}
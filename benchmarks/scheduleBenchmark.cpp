@@ -0,0 +1,64 @@
+//
+// Scaling of the batch scheduler on a mixed-maturity book: mostly short-dated trades and a few long-dated ones, priced
+// with Greeks by a static split of the trades across the threads and by priceBatchGroups (longest first, work
+// stealing, long-dated trades split into their bumps). Run as: schedule_benchmark [trades] [max-threads]
+//
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include "../BatchPipeline.h"
+
+int main(int argc, char* argv[]) {
+    std::size_t count = argc>1 ? std::stoul(argv[1]) : 400;
+    unsigned maxThreads = argc>2 ? static_cast<unsigned>(std::stoul(argv[2])) : resolveThreads(0);
+    auto registry = EngineRegistry::withBuiltInEngines();
+    // 70% up to a year, 25% up to three years, 5% five to ten years; every trade on its own underlying
+    std::vector<BatchTrade> book(count);
+    PhiloxStream rng(defaultRngSeed, 0);
+    double longDated{0};
+    for (std::size_t k = 0; k < count; k++){
+        auto& trade = book[k];
+        double u = rng.uniform();
+        auto days = static_cast<unsigned>(u<0.7 ? 30 + 335*rng.uniform() : u<0.95 ? 365 + 730*rng.uniform()
+                                                                                  : 1825 + 1825*rng.uniform());
+        longDated += days>=1825;
+        trade.index = k;
+        trade.id = std::to_string(k);
+        trade.env.underlyingT0Price = 40 + 40*rng.uniform();
+        trade.env.volatility = 0.15 + 0.2*rng.uniform();
+        trade.env.riskFreeRate = 0.04;
+        trade.option = Option(trade.env.underlyingT0Price*(0.8 + 0.4*rng.uniform()), days,
+                              k%4 ? TradeType::American : TradeType::European, k%2 ? CallPut::Put : CallPut::Call);
+        trade.dividends = {{days/2, 1}};
+    }
+    BatchSettings settings;
+    auto groups = groupTrades(std::move(book), settings.engine, settings.steps, settings.seed, settings.groupSize);
+    std::cout << count << " trades, " << longDated << " of them five to ten years, " << groups.size() << " groups\n";
+    std::cout << std::setw(8) << "threads" << std::setw(12) << "scheduler" << std::setw(12) << "time [ms]"
+              << std::setw(10) << "speedup" << std::setw(12) << "efficiency" << std::setw(8) << "splits" << "\n";
+    double serialTime{0};
+    for (unsigned threads = 1; threads <= maxThreads; threads *= 2){
+        settings.threads = threads;
+        auto start = std::chrono::steady_clock::now();
+        parallelFor(threads, threads, [&](std::size_t t){
+            std::vector<PricingResult> results;
+            for (std::size_t g = t*groups.size()/threads; g < (t+1)*groups.size()/threads; g++){
+                priceBatchGroup(groups[g], registry, settings.engine, settings.steps, results);
+            }
+        });
+        std::chrono::duration<double, std::milli> staticTime = std::chrono::steady_clock::now() - start;
+        start = std::chrono::steady_clock::now();
+        auto splits = priceBatchGroups(groups, registry, settings, [](BatchTrade const&, PricingResult const*,
+                                                                      std::string const&){});
+        std::chrono::duration<double, std::milli> stealingTime = std::chrono::steady_clock::now() - start;
+        if (threads==1) serialTime = stealingTime.count();
+        for (auto [name, time] : {std::make_pair("static", staticTime.count()), std::make_pair("stealing", stealingTime.count())}){
+            double speedup = serialTime/time;
+            std::cout << std::setw(8) << threads << std::setw(12) << name << std::setw(12) << std::setprecision(4) << time
+                      << std::setw(10) << std::setprecision(3) << speedup << std::setw(12) << speedup/threads
+                      << std::setw(8) << (name==std::string("static") ? 0 : splits) << "\n";
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,60 @@
+//
+// Convergence and timing of the lattice engines (binomial parameterizations and trinomial) against the Black-Scholes price (European) and against a fine
+// reference tree (American). Run as: tree_benchmark [days-to-maturity]
+//
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include "../Objects.h"
+#include "../TrinomialTree.h"
+
+template<class Model>
+void report(std::string const& name, Environment const& env, Option const& opt, unsigned steps, double reference){
+    std::vector<int> dividendStructure(opt.getTimeToMaturity()+1);
+    int repetitions = steps<500 ? 20 : 3;
+    double price{0};
+    int actualSteps{0}; // the parameterization may adjust the number of steps
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repetitions; i++){
+        auto model = Model::build(env, opt, dividendStructure, steps);
+        price = model.getPrice();
+        actualSteps = model.getN();
+    }
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << std::setw(10) << name << std::setw(8) << actualSteps
+              << std::setw(14) << std::setprecision(8) << price
+              << std::setw(14) << std::setprecision(3) << std::abs(price-reference)
+              << std::setw(14) << std::setprecision(4) << elapsed.count()/repetitions << "\n";
+}
+
+void runTable(std::string const& title, Environment const& env, Option const& opt, double reference){
+    std::cout << "\n" << title << " " << opt << ", reference " << std::setprecision(8) << reference << "\n";
+    std::cout << std::setw(10) << "engine" << std::setw(8) << "steps" << std::setw(14) << "price"
+              << std::setw(14) << "abs error" << std::setw(14) << "time [us]" << "\n";
+    for (unsigned steps : {25u, 50u, 100u, 200u, 400u, 800u, 1600u, 3200u}){
+        report<BinomialTree>("CRR", env, opt, steps, reference);
+        report<BasicBinomialTree<JarrowRudd>>("JR", env, opt, steps, reference);
+        report<BasicBinomialTree<Tian>>("Tian", env, opt, steps, reference);
+        report<BasicBinomialTree<LeisenReimer>>("LR", env, opt, steps, reference);
+        report<TrinomialTree>("trinomial", env, opt, steps, reference);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    unsigned days = argc>1 ? static_cast<unsigned>(std::stoul(argv[1])) : 365;
+    Environment env;
+    env.riskFreeRate = 5e-2;
+    env.underlyingT0Price = 60;
+    env.volatility = 0.2;
+    env.q = 0.01;
+
+    Option european(62, days, TradeType::European, CallPut::Call);
+    runTable("European", env, european, myUtils::BSPrice(env, european));
+
+    Option american(62, days, TradeType::American, CallPut::Put);
+    std::vector<int> dividendStructure(days+1);
+    double reference = TrinomialTree::build(env, american, dividendStructure, 4000).getPrice();
+    runTable("American", env, american, reference);
+    return 0;
+}
@@ -13,69 +13,314 @@
  */
 #include <iostream>
 #include "Objects.h"
+#include "CostModel.h"
+#include "BatchPipeline.h"
+#include "BinaryTradeFile.h"
+#include "PricingServer.h"
+#include "ShardedBatch.h"
+#include "Progressive.h"
+#include "HeapCounting.h"
 
 #include <iostream>
 #include <fstream>
-#include <algorithm>
-#include <map>
 
-int main(int argc, char* argv[]) {
-    std::cout << "B-TWE Version 0.1 alpha, \nwritten by Eric Mandolesi, 2021. \nLicense GPL-2.0\n";
+/**
+ * Prices the trade with the given engine and prints price and Greeks.
+ * @param steps number of time steps, 0 for the engine default (one step per day for the lattice models).
+ * @param scenarios number of dividend scenarios averaged, 0 to price the single dividend structure drawn from rng.
+ * @param refinement prints the levels of a progressive pricing as they finish, and the last one, when not null.
+ */
+void priceAndReport(PricingEngine const& engine, Environment const& myenv, Option const& myopt, unsigned steps,
+                    PhiloxStream& rng, unsigned scenarios, std::uint64_t seed,
+                    RefinementSettings const* refinement = nullptr){
     // *************************************************************
-    // INPUT SECTION
+    // BUILD MODEL SECTION
     // *************************************************************
-    if(argc<2)throw std::runtime_error("This program must be called with config file argument.");
-    std::map<std::string,double> data;
-    // std::ifstream is RAII, i.e. no need to call close
-    std::ifstream cFile (argv[1]);
-    if (cFile.is_open())
-    {
-        std::string line;
-        while(getline(cFile, line)){
-            line.erase(std::remove_if(line.begin(), line.end(), isspace),
-                       line.end());
-            if(line[0] == '#' || line.empty())
-                continue;
-            auto delimiterPos = line.find("=");
-            auto name = line.substr(0, delimiterPos);
-            auto value = line.substr(delimiterPos + 1);
-            data[name] = stod(value);
+
+    PricingResult result;
+    if (scenarios>0){
+        // expectation over dividend scenarios, scenario m drawn from the stream (seed, m)
+        ScenarioSettings settings;
+        settings.scenarios = scenarios;
+        settings.seed = seed;
+        auto set = sampleDividendScenarios(myenv, myopt.getTimeToMaturity()+1, settings);
+        result = engine.priceScenarios(myenv, myopt, set, steps);
+    } else {
+        auto dividendStructure = sampleDividendStructure(myenv, myopt.getTimeToMaturity(), rng);
+        if (refinement){
+            refinePricing(engine, myenv, myopt, dividendStructure, steps, *refinement, [&](Refinement const& level){
+                std::cout << "Level " << level.level << " (" << level.result.steps << " steps): " << level.result.price
+                          << " USD, error " << level.priceError << " USD\n" << std::flush;
+                result = level.result;
+            });
+        } else {
+            result = engine.priceWithGreeks(myenv, myopt, dividendStructure, steps);
         }
+    }
 
+    // *************************************************************
+    // OUTPUT SECTION
+    // *************************************************************
+
+    std::cout << "Option fair price at time0 (today): " << result.price << " USD.\n";
+    if (!engine.info().deterministic || scenarios>0) std::cout << "Standard error = " << result.standardError << "\n";
+    std::cout << "Delta = " << result.greeks.delta <<"\n";
+    std::cout << "Theta = " << result.greeks.theta <<"\n";
+    std::cout << "Gamma = " << result.greeks.gamma <<"\n";
+    std::cout << "Vega  = " << result.greeks.vega <<"\n";
+    std::cout << "Rho   = " << result.greeks.rho <<"\n";
+}
+
+/**
+ * Reads an option of the batch modes into settings.
+ * @return false if arg is not a batch option.
+ */
+bool parseBatchOption(std::string const& arg, std::string const& value, BatchSettings& settings){
+    if (arg=="--engine") settings.engine = value;
+    else if (arg=="--steps") settings.steps = static_cast<unsigned>(std::stoul(value));
+    else if (arg=="--threads") settings.threads = static_cast<unsigned>(std::stoul(value));
+    else if (arg=="--rng-seed") settings.seed = std::stoull(value);
+    else if (arg=="--group-size") settings.groupSize = std::max<std::size_t>(std::stoul(value), 1);
+    else if (arg=="--cost-model") settings.costModel = std::make_shared<CostModel const>(CostModel::load(value));
+    else if (arg=="--huge-pages") settings.hugePages = parseHugePages(value);
+    else if (arg=="--pin"){
+        if (value!="on" && value!="off") throw std::invalid_argument("--pin must be on or off.");
+        settings.pin = value=="on";
     }
-    else {
-        std::cerr << "Couldn't open config file for reading.\n";
+    else return false;
+    return true;
+}
+
+/**
+ * Writes the phase summary of the pricings to the standard error and their Chrome trace to path, if not empty.
+ */
+void writeProfile(std::string const& path){
+    if (path.empty()) return;
+    instrumentation::writeSummary(std::cerr);
+    std::ofstream trace(path);
+    if (!trace.is_open()) throw std::runtime_error("Couldn't open trace file " + path + " for writing.");
+    instrumentation::writeChromeTrace(trace);
+    if (auto dropped = instrumentation::droppedTraceEvents()) std::cerr << dropped << " trace events dropped.\n";
+}
+
+/**
+ * Reads an option of the progressive modes (--coarse-steps, --tolerance) into settings.
+ * @return false if arg is not a progressive option.
+ */
+bool parseRefinementOption(std::string const& arg, std::string const& value, RefinementSettings& settings){
+    if (arg=="--coarse-steps") settings.coarseSteps = static_cast<unsigned>(std::stoul(value));
+    else if (arg=="--tolerance") settings.tolerance = std::stod(value);
+    else return false;
+    return true;
+}
+
+/**
+ * Batch mode: b-twe --batch trades.csv|trades.jsonl|trades.bin [results-file] [--engine name] [--steps n] [--threads n]
+ * [--rng-seed seed] [--group-size n] [--cost-model file] [--pin on|off] [--huge-pages off|transparent|explicit]. The
+ * groups of trades are scheduled by the runtime predicted by the calibrated cost model of the file
+ * (benchmarks/calibrate_cost_model), by the default one without it. --pin on pins the workers round-robin to the NUMA
+ * nodes, and --huge-pages maps their large lattices on huge pages (BatchWorkers); both are off by default. Results go
+ * to the standard output when no results file is given; a binary trade file (see --convert) gives a binary results
+ * file, which is then mandatory. A binary trade file can be priced by worker processes with [--shards n] [--retries n]
+ * [--shard-timeout seconds], every worker on one thread unless --threads is given; a worker still running after the
+ * timeout is killed and retried. A text trade file can be priced progressively with
+ * [--progressive] [--coarse-steps n] [--tolerance x]: every trade is written at every level of refinement (see
+ * runProgressiveBatch). With [--profile trace.json], a build with BTWE_INSTRUMENTATION writes the time,
+ * nodes and memory of every engine and pricing phase to the standard error, and the phases as a Chrome trace.
+ */
+int runBatchMode(int argc, char* argv[]){
+    if (argc<3) throw std::runtime_error("The batch mode must be called with a trade file argument.");
+    std::string tradeFile = argv[2];
+    std::string resultFile;
+    BatchSettings settings;
+    ShardSettings sharding;
+    sharding.shards = 0;
+    std::vector<std::string> workerOptions;
+    bool progressive{false};
+    RefinementSettings refinement;
+    std::string profile;
+    for (int k = 3; k < argc; k++){
+        std::string arg = argv[k];
+        if (arg.rfind("--", 0)!=0){
+            resultFile = arg;
+            continue;
+        }
+        if (arg=="--progressive"){
+            progressive = true;
+            continue;
+        }
+        if (k+1>=argc) throw std::invalid_argument("Missing value of " + arg + ".");
+        std::string value = argv[++k];
+        if (arg=="--profile") profile = value;
+        else if (arg=="--shards") sharding.shards = std::stoul(value);
+        else if (arg=="--retries") sharding.retries = static_cast<unsigned>(std::stoul(value));
+        else if (arg=="--shard-timeout")
+            sharding.timeout = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(std::stod(value)));
+        else if (parseRefinementOption(arg, value, refinement)) progressive = true;
+        else if (parseBatchOption(arg, value, settings)) workerOptions.insert(workerOptions.end(), {arg, value});
+        else throw std::invalid_argument("Unknown option " + arg + ".");
     }
-    Environment myenv;
-    myenv.riskFreeRate = data["risk-free-rate"];
-    myenv.underlyingT0Price = data["S-T0-Price"];
-    myenv.volatility = data["volatility"];
-    myenv.averageDividendsPerYear = data["average-dividends-per-year"];
-    myenv.q=data["continuously-yield-dividend"];
-    CallPut callPut;
-    TradeType type;
-    (data["callput"]>0.)?callPut=CallPut::Call:callPut=CallPut::Put;
-    (data["european"]>0.)?type=TradeType::European:type=TradeType::American;
-    Option myopt(data["strike"], static_cast<int>(data["days-to-maturity"]), type, callPut);
+    if (!profile.empty() && !instrumentation::enabled)
+        throw std::invalid_argument("--profile needs a build configured with -DBTWE_INSTRUMENTATION=ON.");
+    if (!profile.empty() && sharding.shards>0)
+        throw std::invalid_argument("--profile records the pricings of this process, it cannot be used with --shards.");
+    auto registry = EngineRegistry::withBuiltInEngines();
+    (void) registry.get(settings.engine); // fails early on an unknown engine
+    if (isBinaryTradeFile(tradeFile)){
+        if (resultFile.empty()) throw std::invalid_argument("A binary trade file needs a binary results file argument.");
+        if (progressive) throw std::invalid_argument("The progressive mode needs a CSV or JSONL trade file.");
+        if (sharding.shards>0){
+            if (settings.threads==0) workerOptions.insert(workerOptions.end(), {"--threads", "1"});
+            ProcessShardLauncher launcher({"/proc/self/exe", "--shard", tradeFile, resultFile}, workerOptions);
+            auto statistics = runShardedBatch(BinaryTradeFile(tradeFile), resultFile, launcher, sharding);
+            std::cerr << statistics.trades << " trades priced by " << shardCount(statistics.trades, sharding) << " shards in "
+                      << statistics.elapsedSeconds << " s, " << statistics.errors << " errors.\n";
+            return statistics.errors>0 ? 1 : 0;
+        }
+        auto statistics = runBinaryBatch(BinaryTradeFile(tradeFile), resultFile, registry, settings);
+        std::cerr << statistics.trades << " trades priced in " << statistics.elapsedSeconds << " s, "
+                  << statistics.errors << " errors.\n";
+        writeProfile(profile);
+        return statistics.errors>0 ? 1 : 0;
+    }
+    std::ifstream in(tradeFile);
+    if (!in.is_open()) throw std::runtime_error("Couldn't open trade file " + tradeFile + " for reading.");
+    std::ofstream file;
+    if (!resultFile.empty()){
+        file.open(resultFile);
+        if (!file.is_open()) throw std::runtime_error("Couldn't open result file " + resultFile + " for writing.");
+    }
+    auto& out = resultFile.empty() ? std::cout : static_cast<std::ostream&>(file);
+    auto format = TradeFileReader::formatOf(tradeFile);
+    auto statistics = progressive ? runProgressiveBatch(in, out, format, registry, settings, refinement)
+                                  : runBatch(in, out, format, registry, settings);
+    std::cerr << statistics.trades << " trades priced in " << statistics.elapsedSeconds << " s, "
+              << statistics.errors << " errors.\n";
+    writeProfile(profile);
+    return statistics.errors>0 ? 1 : 0;
+}
 
-    std::cout << "Input option: " << myopt<<"\n";
+/**
+ * Worker of a sharded batch: b-twe --shard trades.bin results.bin begin end [batch options] prices trades [begin, end)
+ * into the result file created by the coordinator. Failed trades are results, the status is 0 unless the worker fails.
+ */
+int runShardMode(int argc, char* argv[]){
+    if (argc<6) throw std::runtime_error("The shard mode must be called with trade file, result file, begin and end.");
+    BatchSettings settings;
+    for (int k = 6; k < argc; k += 2){
+        if (k+1>=argc) throw std::invalid_argument(std::string("Missing value of ") + argv[k] + ".");
+        if (!parseBatchOption(argv[k], argv[k+1], settings)) throw std::invalid_argument(std::string("Unknown option ") + argv[k] + ".");
+    }
+    auto registry = EngineRegistry::withBuiltInEngines();
+    runShard(BinaryTradeFile(argv[2]), argv[3], std::stoul(argv[4]), std::stoul(argv[5]), registry, settings);
+    return 0;
+}
 
-    // *************************************************************
-    // BUILD MODEL SECTION
-    // *************************************************************
+/**
+ * Conversion mode: b-twe --convert data.txt|trades.csv|trades.jsonl trades.bin writes a binary trade file.
+ */
+int runConvertMode(int argc, char* argv[]){
+    if (argc!=4) throw std::runtime_error("The conversion mode must be called with an input and an output file argument.");
+    auto count = convertToBinary(argv[2], argv[3]);
+    std::cerr << count << " trades written to " << argv[3] << ".\n";
+    return 0;
+}
 
-    BinomialTree model = BinomialTree::build(myenv, myopt);
+/**
+ * Server mode: b-twe --serve [socket-path] [--engine name] [--steps n] [--threads n] [--rng-seed seed]
+ * [--cache-capacity n] [--progressive] [--coarse-steps n] [--tolerance x]. Listens on a Unix domain socket, or serves a
+ * single session on the standard input and output when no socket path is given. Progressive servers answer every
+ * request with its refinements.
+ */
+int runServeMode(int argc, char* argv[]){
+    std::string socketPath;
+    ServerSettings settings;
+    for (int k = 2; k < argc; k++){
+        std::string arg = argv[k];
+        if (arg.rfind("--", 0)!=0){
+            socketPath = arg;
+            continue;
+        }
+        if (arg=="--progressive"){
+            settings.progressive = true;
+            continue;
+        }
+        if (k+1>=argc) throw std::invalid_argument("Missing value of " + arg + ".");
+        std::string value = argv[++k];
+        if (parseRefinementOption(arg, value, settings.refinement)) settings.progressive = true;
+        else if (arg=="--engine") settings.engine = value;
+        else if (arg=="--steps") settings.steps = static_cast<unsigned>(std::stoul(value));
+        else if (arg=="--threads") settings.threads = static_cast<unsigned>(std::stoul(value));
+        else if (arg=="--rng-seed") settings.seed = std::stoull(value);
+        else if (arg=="--cache-capacity") settings.cacheCapacity = std::stoul(value);
+        else throw std::invalid_argument("Unknown option " + arg + ".");
+    }
+    auto registry = EngineRegistry::withBuiltInEngines();
+    PricingServer server(registry, settings);
+    if (socketPath.empty()){
+        server.serve(std::cin, std::cout);
+    } else {
+        std::cerr << "Listening on " << socketPath << ".\n";
+        server.listen(socketPath);
+    }
+    auto statistics = server.statistics();
+    std::cerr << statistics.requests << " requests, " << statistics.coalesced << " coalesced, " << statistics.cacheHits
+              << " cache hits, " << statistics.errors << " errors.\n";
+    return 0;
+}
 
+int main(int argc, char* argv[]) {
+    if (argc>1 && std::string(argv[1])=="--batch") return runBatchMode(argc, argv);
+    if (argc>1 && std::string(argv[1])=="--convert") return runConvertMode(argc, argv);
+    if (argc>1 && std::string(argv[1])=="--serve") return runServeMode(argc, argv);
+    if (argc>1 && std::string(argv[1])=="--shard") return runShardMode(argc, argv);
+    std::cout << "B-TWE Version 0.1 alpha, \nwritten by Eric Mandolesi, 2021. \nLicense GPL-2.0\n";
     // *************************************************************
-    // OUTPUT SECTION
+    // INPUT SECTION
     // *************************************************************
+    if(argc<2)throw std::runtime_error("This program must be called with config file argument.");
+    // the file is mapped and tokenized in place; unknown keys, malformed lines and missing market or trade keys fail
+    auto config = Config::load(argv[1]);
+    config.require({ConfigKey::RiskFreeRate, ConfigKey::SpotPrice, ConfigKey::Volatility,
+                    ConfigKey::AverageDividendsPerYear, ConfigKey::DividendYield, ConfigKey::CallPut,
+                    ConfigKey::European, ConfigKey::Strike, ConfigKey::DaysToMaturity});
+    Environment myenv;
+    myenv.riskFreeRate = config.get(ConfigKey::RiskFreeRate);
+    myenv.underlyingT0Price = config.get(ConfigKey::SpotPrice);
+    myenv.volatility = config.get(ConfigKey::Volatility);
+    myenv.averageDividendsPerYear = config.get(ConfigKey::AverageDividendsPerYear);
+    myenv.q=config.get(ConfigKey::DividendYield);
+    CallPut callPut;
+    TradeType type;
+    (config.get(ConfigKey::CallPut)>0.)?callPut=CallPut::Call:callPut=CallPut::Put;
+    (config.get(ConfigKey::European)>0.)?type=TradeType::European:type=TradeType::American;
+    Option myopt(config.get(ConfigKey::Strike), static_cast<int>(config.get(ConfigKey::DaysToMaturity)), type, callPut);
 
-    std::cout << "Option fair price at time0 (today): " << model.getPrice() << " USD.\n";
-    std::cout << "Delta = " << myUtils::computeDelta(myenv,myopt,model) <<"\n";
-    std::cout << "Theta = " << myUtils::computeTheta(myenv,myopt,model) <<"\n";
-    std::cout << "Gamma = " << myUtils::computeGamma(myenv,myopt,model) <<"\n";
-    std::cout << "Vega  = " << myUtils::computeVega(myenv,myopt,model) <<"\n";
-    std::cout << "Rho   = " << myUtils::computeRho(myenv,myopt,model) <<"\n";
+    std::cout << "Input option: " << myopt<<"\n";
+
+    // optional keys, missing ones default to 0: daily steps and Cox-Ross-Rubinstein tree
+    auto registry = EngineRegistry::withBuiltInEngines();
+    auto steps = static_cast<unsigned>(config.get(ConfigKey::Steps));
+    PricingEngine const* engine = &registry.get(engineName(static_cast<int>(config.get(ConfigKey::Engine)),
+                                                           static_cast<int>(config.get(ConfigKey::TreeParameterization))));
+    if (config.get(ConfigKey::Tolerance)>0.){
+        // route the trade to the cheapest engine meeting the tolerance within the latency budget
+        auto costModel = argc>2 ? CostModel::load(argv[2]) : CostModel::defaults();
+        double budget = config.get(ConfigKey::LatencyBudget)>0. ? config.get(ConfigKey::LatencyBudget) : 1e6;
+        auto choice = costModel.select(registry, myenv, myopt, budget, config.get(ConfigKey::Tolerance), true);
+        engine = choice.engine;
+        steps = choice.steps;
+        std::cout << "Selected engine: " << engine->info().name << " with " << steps << " steps"
+                  << (choice.meetsTolerance ? "" : " (tolerance not reachable within the latency budget)") << "\n";
+    }
+    // event-based dividends are drawn from (rng-seed, rng-stream): the same input always gives the same price
+    auto seed = static_cast<std::uint64_t>(config.get(ConfigKey::RngSeed, defaultRngSeed));
+    PhiloxStream rng(seed, static_cast<std::uint32_t>(config.get(ConfigKey::RngStream)));
+    // progressive=1: coarse price first, refined until progressive-tolerance if any; tolerance only selects the engine
+    auto refinement = refinementSettings(config);
+    priceAndReport(*engine, myenv, myopt, steps, rng, static_cast<unsigned>(config.get(ConfigKey::DividendScenarios)), seed,
+                   config.get(ConfigKey::Progressive)>0. ? &refinement : nullptr);
 
     return 0;
 }
@@ -4,6 +4,36 @@
 #define CATCH_CONFIG_MAIN
 #include "catch.hpp"
 #include "../Objects.h"
+#include "../TrinomialTree.h"
+#include "../CrankNicolsonGrid.h"
+#include "../LongstaffSchwartz.h"
+#include "../CostModel.h"
+#include "../DividendScenarios.h"
+#include "../ExpectedDividendTree.h"
+#include "../ResultCache.h"
+#include "../NumaMemory.h"
+#include "../BatchPipeline.h"
+#include "../ConfigParser.h"
+#include "../BinaryTradeFile.h"
+#include "../PricingServer.h"
+#include "../AsyncPricer.h"
+#include "../ShardedBatch.h"
+#include "../Progressive.h"
+#include "../Instrumentation.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <future>
+#include <new>
+
+#define BTWE_HEAP_COUNTING
+#include "../HeapCounting.h"
+
+// Every heap allocation of the test binary is counted, through the operator new of HeapCounting.h, so that tests can
+// check allocation-free code paths.
+static std::atomic<std::size_t> heapAllocations{0};
+static void countHeapAllocation(std::size_t){heapAllocations++;}
+static bool const observingHeap = (instrumentation::heapObserver = &countHeapAllocation, true);
 
 TEST_CASE("Options price tests", "[American][European][Call][Put]"){
     SECTION( "Option object functionality" ) {
@@ -175,3 +205,1967 @@ TEST_CASE("Greek tests", "[Greeks]"){
     }
 }
 
+
+TEST_CASE("Trinomial tree tests", "[Trinomial]"){
+    Environment env;
+    env.riskFreeRate = 5e-2;
+    env.underlyingT0Price = 60;
+    env.volatility = 0.10;
+    env.averageDividendsPerYear = 0;
+    SECTION( "Can price European Options" ) {
+        Option call(60, 365, TradeType::European, CallPut::Call);
+        Option put(60, 365, TradeType::European, CallPut::Put);
+        std::vector<int> dividendStructure(call.getTimeToMaturity());
+        auto callModel = TrinomialTree::build(env, call, dividendStructure);
+        auto putModel = TrinomialTree::build(env, put, dividendStructure);
+        REQUIRE(std::abs(callModel.getPrice() - myUtils::BSPrice(env, call)) < 1e-3);
+        REQUIRE(std::abs(putModel.getPrice() - myUtils::BSPrice(env, put)) < 1e-3);
+    }
+    SECTION( "Agrees with the binomial tree on an American Put" ) {
+        Option option(60, 365, TradeType::American, CallPut::Put);
+        std::vector<int> dividendStructure(option.getTimeToMaturity());
+        auto trinomial = TrinomialTree::build(env, option, dividendStructure);
+        auto binomial = BinomialTree::build(env, option, dividendStructure, 2000);
+        REQUIRE(std::abs(trinomial.getPrice() - binomial.getPrice()) < 2e-3);
+    }
+    SECTION( "Dividends are applied correctly" ){
+        Option option(60, 365, TradeType::American, CallPut::Put);
+        std::vector<int> dividendStructure(option.getTimeToMaturity());
+        dividendStructure[0] = 1;
+        auto model = TrinomialTree::build(env, option, dividendStructure);
+        double dividend = 0.1*env.underlyingT0Price;
+        REQUIRE(std::abs(model.getNode(0,0).underlyingValue - env.underlyingT0Price) < 1e-10);
+        REQUIRE(std::abs(model.getNode(1,2).underlyingValue - (env.underlyingT0Price*model.getU() - dividend)) < 1e-10);
+        REQUIRE(std::abs(model.getNode(2,2).underlyingValue - (env.underlyingT0Price - dividend)) < 1e-10);
+    }
+    SECTION( "Finite-differences Greeks work on the trinomial tree" ){
+        Option option(60, 365, TradeType::European, CallPut::Call);
+        std::vector<int> dividendStructure(option.getTimeToMaturity());
+        auto model = TrinomialTree::build(env, option, dividendStructure, 500);
+        auto delta = myUtils::computeDelta(env, option, model);
+        REQUIRE(std::abs(delta - normalCDF(myUtils::BSd1(env, option))) < 1e-2);
+        REQUIRE(myUtils::computeGamma(env, option, model) > 0.);
+        REQUIRE(myUtils::computeTheta(env, option, model) < 0.);
+    }
+}
+
+TEST_CASE("Lattice time steps", "[Steps]"){
+    SECTION( "Daily dividends are mapped onto coarse levels" ){
+        std::vector<int> dividendStructure{0,1,0,0,2,0,0,0,1};
+        auto cumSum = cumulativeDividends(dividendStructure, 8, 4); // one level every two days
+        REQUIRE(cumSum == std::vector<int>{0,1,1,3,3});
+        auto daily = cumulativeDividends(dividendStructure, 8, 8);
+        REQUIRE(daily == std::vector<int>{0,0,1,1,1,3,3,3,3});
+    }
+    SECTION( "Binomial tree converges with the number of steps" ){
+        Environment env;
+        env.riskFreeRate = 5e-2;
+        env.underlyingT0Price = 60;
+        env.volatility = 0.10;
+        Option option(60, 365, TradeType::European, CallPut::Call);
+        std::vector<int> dividendStructure(option.getTimeToMaturity());
+        auto coarse = BinomialTree::build(env, option, dividendStructure, 50);
+        auto fine = BinomialTree::build(env, option, dividendStructure, 1000);
+        double bs = myUtils::BSPrice(env, option);
+        REQUIRE(std::abs(fine.getPrice() - bs) < std::abs(coarse.getPrice() - bs));
+        REQUIRE(std::abs(fine.getPrice() - bs) < 5e-3);
+    }
+}
+
+TEST_CASE("Tree parameterizations", "[Parameterization]"){
+    Environment env;
+    env.riskFreeRate = 5e-2;
+    env.underlyingT0Price = 60;
+    env.volatility = 0.2;
+    env.q = 0.01;
+    Option call(62, 365, TradeType::European, CallPut::Call);
+    Option put(58, 365, TradeType::European, CallPut::Put);
+    std::vector<int> dividendStructure(call.getTimeToMaturity());
+    SECTION( "Leisen-Reimer converges fast" ){
+        auto callModel = BasicBinomialTree<LeisenReimer>::build(env, call, dividendStructure, 101);
+        auto putModel = BasicBinomialTree<LeisenReimer>::build(env, put, dividendStructure, 101);
+        REQUIRE(std::abs(callModel.getPrice() - myUtils::BSPrice(env, call)) < 1e-4);
+        REQUIRE(std::abs(putModel.getPrice() - myUtils::BSPrice(env, put)) < 1e-4);
+        auto fineCall = BasicBinomialTree<LeisenReimer>::build(env, call, dividendStructure, 201);
+        auto finePut = BasicBinomialTree<LeisenReimer>::build(env, put, dividendStructure, 201);
+        REQUIRE(std::abs(fineCall.getPrice() - myUtils::BSPrice(env, call)) < 1e-5);
+        REQUIRE(std::abs(finePut.getPrice() - myUtils::BSPrice(env, put)) < 1e-5);
+        // O(1/N^2): doubling the steps divides the error by about 4
+        double ratio = (callModel.getPrice() - myUtils::BSPrice(env, call))/(fineCall.getPrice() - myUtils::BSPrice(env, call));
+        REQUIRE(ratio > 3.5);
+        REQUIRE(ratio < 4.5);
+    }
+    SECTION( "Leisen-Reimer uses an odd number of steps" ){
+        auto model = BasicBinomialTree<LeisenReimer>::build(env, call, dividendStructure, 100);
+        REQUIRE(model.getN() == 101);
+    }
+    SECTION( "Jarrow-Rudd and Tian converge to Black-Scholes" ){
+        auto jr = BasicBinomialTree<JarrowRudd>::build(env, call, dividendStructure, 1000);
+        auto tian = BasicBinomialTree<Tian>::build(env, call, dividendStructure, 1000);
+        REQUIRE(std::abs(jr.getPrice() - myUtils::BSPrice(env, call)) < 5e-3);
+        REQUIRE(std::abs(tian.getPrice() - myUtils::BSPrice(env, call)) < 5e-3);
+    }
+    SECTION( "Non symmetric trees apply dividends correctly" ){
+        std::vector<int> withDividend(dividendStructure);
+        withDividend[0] = 1;
+        auto model = BasicBinomialTree<Tian>::build(env, call, withDividend);
+        REQUIRE(std::abs(model.getU()*model.getD() - 1) > 1e-6);
+        double underlyingPriceT2UD = env.underlyingT0Price * model.getU() * model.getD() - 0.1*env.underlyingT0Price;
+        REQUIRE(std::abs(model.getNode(2,1).underlyingValue - underlyingPriceT2UD) < 1e-10);
+    }
+    SECTION( "Greeks work with every parameterization" ){
+        auto model = BasicBinomialTree<LeisenReimer>::build(env, call, dividendStructure, 201);
+        auto deltaA = std::exp(-env.q)*normalCDF(myUtils::BSd1(env, call));
+        REQUIRE(std::abs(myUtils::computeDelta(model) - deltaA) < 1e-2);
+        REQUIRE(std::abs(myUtils::computeDelta(env, call, model) - deltaA) < 1e-3);
+    }
+}
+
+TEST_CASE("Crank-Nicolson grid tests", "[CrankNicolson]"){
+    Environment env;
+    env.riskFreeRate = 5e-2;
+    env.underlyingT0Price = 60;
+    env.volatility = 0.2;
+    env.q = 0.01;
+    SECTION( "Can price European Options" ){
+        for (auto callPut : {CallPut::Call, CallPut::Put}){
+            Option option(62, 365, TradeType::European, callPut);
+            std::vector<int> dividendStructure(option.getTimeToMaturity());
+            auto model = CrankNicolsonGrid::build(env, option, dividendStructure);
+            REQUIRE(std::abs(model.getPrice() - myUtils::BSPrice(env, option)) < 1e-3);
+        }
+    }
+    SECTION( "Grid Greeks match Black-Scholes" ){
+        Option option(62, 365, TradeType::European, CallPut::Call);
+        std::vector<int> dividendStructure(option.getTimeToMaturity());
+        auto model = CrankNicolsonGrid::build(env, option, dividendStructure);
+        double T = option.getTimeToMaturity()/365.25;
+        double d1 = myUtils::BSd1(env, option);
+        double gamma = std::exp(-env.q*T)*std::exp(-0.5*d1*d1)/std::sqrt(2*M_PI)/(env.underlyingT0Price*env.volatility*std::sqrt(T));
+        REQUIRE(std::abs(model.getDelta() - std::exp(-env.q*T)*normalCDF(d1)) < 1e-3);
+        REQUIRE(std::abs(model.getGamma() - gamma) < 1e-4);
+        REQUIRE(model.getTheta() < 0.);
+    }
+    SECTION( "Brennan-Schwartz agrees with the binomial tree on American Options" ){
+        for (auto callPut : {CallPut::Call, CallPut::Put}){
+            env.q = 0.08; // early exercise of the call is optimal
+            Option option(62, 365, TradeType::American, callPut);
+            std::vector<int> dividendStructure(option.getTimeToMaturity());
+            auto grid = CrankNicolsonGrid::build(env, option, dividendStructure);
+            auto tree = BinomialTree::build(env, option, dividendStructure, 2000);
+            REQUIRE(std::abs(grid.getPrice() - tree.getPrice()) < 2e-3);
+            Option european(62, 365, TradeType::European, callPut);
+            REQUIRE(grid.getPrice() > myUtils::BSPrice(env, european));
+        }
+    }
+    SECTION( "Event-based dividends are applied as in the trees" ){
+        Option option(62, 365, TradeType::American, CallPut::Put);
+        std::vector<int> dividendStructure(option.getTimeToMaturity());
+        dividendStructure[100] = 1;
+        dividendStructure[200] = 1;
+        auto grid = CrankNicolsonGrid::build(env, option, dividendStructure, 365, 800);
+        auto tree = BinomialTree::build(env, option, dividendStructure);
+        REQUIRE(std::abs(grid.getPrice() - tree.getPrice()) < 5e-3);
+    }
+}
+
+TEST_CASE("Monte Carlo cross-check", "[MonteCarlo]"){
+    Environment env;
+    env.riskFreeRate = 5e-2;
+    env.underlyingT0Price = 60;
+    env.volatility = 0.2;
+    env.q = 0.01;
+    MonteCarloSettings settings;
+    settings.paths = 1u<<15;
+    SECTION( "Philox matches the Random123 known answers" ){
+        auto zero = Philox4x32::generate({0,0,0,0}, {0,0});
+        REQUIRE(zero == Philox4x32::Counter{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8});
+        auto pi = Philox4x32::generate({0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}, {0xa4093822, 0x299f31d0});
+        REQUIRE(pi == Philox4x32::Counter{0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1});
+    }
+    SECTION( "European put agrees with Black-Scholes within 4 standard errors" ){
+        Option option(62, 365, TradeType::European, CallPut::Put);
+        auto model = LongstaffSchwartz::build(env, option, std::vector<int>(option.getTimeToMaturity()), settings);
+        REQUIRE(model.getStandardError() > 0.);
+        REQUIRE(std::abs(model.getPrice() - myUtils::BSPrice(env, option)) < 4*model.getStandardError());
+    }
+    SECTION( "American put agrees with the lattice models" ){
+        Option option(62, 365, TradeType::American, CallPut::Put);
+        std::vector<int> dividendStructure(option.getTimeToMaturity());
+        dividendStructure[100] = 1;
+        auto model = LongstaffSchwartz::build(env, option, dividendStructure, settings);
+        auto grid = CrankNicolsonGrid::build(env, option, dividendStructure);
+        // 50 exercise dates and a sub-optimal exercise rule bias the estimate low
+        REQUIRE(std::abs(model.getPrice() - grid.getPrice()) < 4*model.getStandardError() + 0.03);
+    }
+    SECTION( "Results are reproducible for any number of threads" ){
+        env.averageDividendsPerYear = 2;
+        Option option(62, 365, TradeType::American, CallPut::Put);
+        settings.threads = 1;
+        auto serial = LongstaffSchwartz::build(env, option, settings);
+        settings.threads = 4;
+        auto parallel = LongstaffSchwartz::build(env, option, settings);
+        REQUIRE(serial.getPrice() == parallel.getPrice());
+        REQUIRE(serial.getStandardError() == parallel.getStandardError());
+        settings.seed++;
+        REQUIRE(LongstaffSchwartz::build(env, option, settings).getPrice() != serial.getPrice());
+    }
+}
+
+TEST_CASE("Pricing engine interface", "[Engines]"){
+    Environment env;
+    env.riskFreeRate = 5e-2;
+    env.underlyingT0Price = 60;
+    env.volatility = 0.2;
+    env.q = 0.01;
+    auto registry = EngineRegistry::withBuiltInEngines();
+    Option option(62, 365, TradeType::American, CallPut::Put);
+    std::vector<int> dividendStructure(option.getTimeToMaturity());
+    SECTION( "Engines agree with the models they wrap" ){
+        auto const& engine = registry.get("binomial-crr");
+        auto model = BinomialTree::build(env, option, dividendStructure);
+        REQUIRE(engine.price(env, option, dividendStructure, 0) == model.getPrice());
+        REQUIRE(myUtils::computeDelta(env, option, engine, dividendStructure, 0) == myUtils::computeDelta(env, option, model));
+        REQUIRE(myUtils::computeGamma(env, option, engine, dividendStructure, 0) == myUtils::computeGamma(env, option, model));
+        REQUIRE(myUtils::computeTheta(env, option, engine, dividendStructure, 0) == myUtils::computeTheta(env, option, model));
+        REQUIRE(myUtils::computeVega(env, option, engine, dividendStructure, 0) == myUtils::computeVega(env, option, model));
+        REQUIRE(myUtils::computeRho(env, option, engine, dividendStructure, 0) == myUtils::computeRho(env, option, model));
+        REQUIRE_THROWS(registry.get("no-such-engine"));
+    }
+    SECTION( "Every engine prices and computes Greeks" ){
+        auto reference = registry.get("crank-nicolson").priceWithGreeks(env, option, dividendStructure, 0);
+        for (auto const& engine : registry.all()){
+            auto result = engine->priceWithGreeks(env, option, dividendStructure, engine->info().deterministic ? 500 : 0);
+            REQUIRE(result.engine == engine->info().name);
+            REQUIRE(std::abs(result.price - reference.price) < 0.02 + 4*result.standardError);
+            REQUIRE(std::abs(result.greeks.delta - reference.greeks.delta) < 0.05);
+            REQUIRE(result.greeks.vega > 0.);
+            REQUIRE(result.greeks.rho < 0.);
+        }
+    }
+    SECTION( "Cost model meets the tolerance within the budget" ){
+        auto costModel = CostModel::defaults();
+        for (double tolerance : {1e-2, 1e-3}){
+            auto choice = costModel.select(registry, env, option, 1e5, tolerance, false);
+            REQUIRE(choice.meetsTolerance);
+            REQUIRE(choice.engine->info().autoSelectable);
+            REQUIRE(choice.predictedMicroseconds <= 1e5);
+            double price = choice.engine->price(env, option, dividendStructure, choice.steps);
+            double reference = CrankNicolsonGrid::build(env, option, dividendStructure, 2000, 2000).getPrice();
+            REQUIRE(std::abs(price - reference) < tolerance);
+        }
+        auto tight = costModel.select(registry, env, option, 10, 1e-6, false);
+        REQUIRE_FALSE(tight.meetsTolerance);
+    }
+    SECTION( "Cost model survives a save/load round trip" ){
+        auto costModel = CostModel::defaults();
+        costModel.save("cost_model_test.txt");
+        auto loaded = CostModel::load("cost_model_test.txt");
+        std::remove("cost_model_test.txt");
+        auto const* cost = loaded.find("binomial-lr");
+        REQUIRE(cost != nullptr);
+        REQUIRE(cost->european.order == costModel.find("binomial-lr")->european.order);
+        REQUIRE(cost->microsecondsPerWork == costModel.find("binomial-lr")->microsecondsPerWork);
+    }
+}
+
+TEST_CASE("Reproducible random numbers", "[Random]"){
+    Environment env;
+    env.riskFreeRate = 5e-2;
+    env.underlyingT0Price = 60;
+    env.volatility = 0.2;
+    env.averageDividendsPerYear = 12;
+    SECTION( "A stream always draws the same dividend structure" ){
+        PhiloxStream first(7, 3), second(7, 3), other(7, 4);
+        auto structure = sampleDividendStructure(env, 365, first);
+        REQUIRE(structure == sampleDividendStructure(env, 365, second));
+        REQUIRE(structure != sampleDividendStructure(env, 365, other));
+        REQUIRE(structure[0] == 0);
+        int total = std::accumulate(structure.begin(), structure.end(), 0);
+        REQUIRE(total > 0);
+        REQUIRE(total < 36); // 12 expected
+    }
+    SECTION( "Batch prices do not depend on the number of threads" ){
+        std::vector<Option> trades;
+        for (int i = 0; i < 16; i++) trades.emplace_back(50 + i, 90 + 10*i, TradeType::American, CallPut::Put);
+        auto priceBatch = [&](unsigned threads){
+            std::vector<double> prices(trades.size());
+            parallelFor(trades.size(), threads, [&](std::size_t i){
+                PhiloxStream rng(1234, static_cast<std::uint32_t>(i)); // one stream per trade
+                prices[i] = BinomialTree::build(env, trades[i], rng).getPrice();
+            });
+            return prices;
+        };
+        REQUIRE(priceBatch(1) == priceBatch(4));
+    }
+    SECTION( "Default builds are reproducible on every thread" ){
+        Option option(60, 365, TradeType::American, CallPut::Put);
+        auto firstPrice = [&](){
+            threadRng() = PhiloxStream(defaultRngSeed, 0);
+            return BinomialTree::build(env, option).getPrice();
+        };
+        double price = firstPrice();
+        double otherThread{0};
+        std::thread([&](){otherThread = firstPrice();}).join();
+        REQUIRE(price == otherThread);
+    }
+}
+
+TEST_CASE("Dividend scenarios", "[Dividends]"){
+    Environment env;
+    env.riskFreeRate = 5e-2;
+    env.underlyingT0Price = 60;
+    env.volatility = 0.2;
+    env.averageDividendsPerYear = 2;
+    Option option(60, 365, TradeType::American, CallPut::Put);
+    SECTION( "Trees sharing a geometry are the trees built from scratch" ){
+        std::vector<int> ds(366, 0);
+        ds[100] = 1;
+        auto binomial = BinomialTree::build(env, option, ds, 200);
+        REQUIRE(binomial.getPrice() == BinomialTree::build(env, option, ds, BinomialTree::geometry(env, option, 200)).getPrice());
+        auto trinomial = TrinomialTree::build(env, option, ds, 200);
+        REQUIRE(trinomial.getPrice() == TrinomialTree::build(env, option, ds, TrinomialTree::geometry(env, option, 200)).getPrice());
+    }
+    SECTION( "Without dividends every scenario is the dividend-free tree" ){
+        auto noDividends = env.copy();
+        noDividends.averageDividendsPerYear = 0;
+        auto model = DividendScenarios<BinomialTree>::build(noDividends, option, ScenarioSettings{8}, 100);
+        REQUIRE(model.getPrice() == Approx(BinomialTree::build(noDividends, option, std::vector<int>{0}, 100).getPrice()));
+        REQUIRE(model.getStandardError() == 0);
+    }
+    SECTION( "Stratified totals reduce the standard error" ){
+        ScenarioSettings settings{64};
+        auto reference = DividendScenarios<BinomialTree>::build(env, option, ScenarioSettings{2048}, 100);
+        auto stratified = DividendScenarios<BinomialTree>::build(env, option, settings, 100);
+        settings.stratified = false;
+        auto plain = DividendScenarios<BinomialTree>::build(env, option, settings, 100);
+        REQUIRE(stratified.getStandardError() < 0.5*plain.getStandardError());
+        REQUIRE(std::abs(stratified.getPrice()-reference.getPrice()) < 4*stratified.getStandardError());
+        REQUIRE(std::abs(plain.getPrice()-reference.getPrice()) < 4*plain.getStandardError());
+        // the expectation over scenarios is above the dividend-free put
+        auto noDividends = env.copy();
+        noDividends.averageDividendsPerYear = 0;
+        REQUIRE(reference.getPrice() > BinomialTree::build(noDividends, option, std::vector<int>{0}, 100).getPrice());
+    }
+    SECTION( "Scenarios do not depend on the number of threads" ){
+        ScenarioSettings settings{32};
+        settings.threads = 1;
+        auto serial = sampleDividendScenarios(env, 366, settings);
+        settings.threads = 4;
+        REQUIRE(serial.structures == sampleDividendScenarios(env, 366, settings).structures);
+        REQUIRE(DividendScenarios<TrinomialTree>::build(env, option, serial, 100, 1).getPrice() ==
+                DividendScenarios<TrinomialTree>::build(env, option, serial, 100, 4).getPrice());
+    }
+    SECTION( "Greeks reprice the same scenarios" ){
+        auto model = DividendScenarios<BinomialTree>::build(env, option, ScenarioSettings{32}, 100);
+        auto single = BinomialTree::build(env, option, std::vector<int>{0}, 100);
+        // common random numbers: the finite differences are as smooth as the ones of a single tree
+        double delta = myUtils::computeDelta(env, option, model);
+        REQUIRE(delta > -1);
+        REQUIRE(delta < myUtils::computeDelta(env, option, single)); // dividends push the put in the money
+        REQUIRE(myUtils::computeVega(env, option, model) > 0);
+        REQUIRE(myUtils::computeGamma(env, option, model) > 0);
+        // the engines average the same scenarios
+        auto registry = EngineRegistry::withBuiltInEngines();
+        auto const& set = model.getDividendStructure();
+        auto lattice = registry.get("binomial-crr").priceScenarios(env, option, set, 100);
+        REQUIRE(lattice.price == Approx(model.getPrice()));
+        REQUIRE(lattice.greeks.delta == Approx(delta));
+        auto grid = registry.get("crank-nicolson").priceScenarios(env, option, set, 100);
+        REQUIRE(grid.price == Approx(model.getPrice()).epsilon(1e-2));
+        REQUIRE(grid.standardError > 0);
+    }
+}
+
+TEST_CASE("Expected-dividend tree", "[Dividends]"){
+    Environment env;
+    env.riskFreeRate = 5e-2;
+    env.underlyingT0Price = 60;
+    env.volatility = 0.2;
+    env.averageDividendsPerYear = 2;
+    Option american(60, 365, TradeType::American, CallPut::Put);
+    Option european(60, 365, TradeType::European, CallPut::Call);
+    SECTION( "Without dividends it is the binomial tree" ){
+        auto noDividends = env.copy();
+        noDividends.averageDividendsPerYear = 0;
+        for (auto const& option : {american, european}){
+            auto model = ExpectedDividendTree::build(noDividends, option);
+            REQUIRE(model.getPrice() == Approx(BinomialTree::build(noDividends, option, std::vector<int>{0}).getPrice()));
+            REQUIRE(model.getMaxDividends() == 0);
+        }
+    }
+    SECTION( "Price is the expectation over dividend scenarios" ){
+        auto model = ExpectedDividendTree::build(env, european, PoissonDividends{}, 100);
+        auto scenarios = DividendScenarios<BinomialTree>::build(env, european, ScenarioSettings{4096}, 100);
+        REQUIRE(std::abs(model.getPrice() - scenarios.getPrice()) < 4*scenarios.getStandardError());
+        // a tree built on a known dividend structure exercises with hindsight of the future dividends
+        model = ExpectedDividendTree::build(env, american, PoissonDividends{}, 100);
+        scenarios = DividendScenarios<BinomialTree>::build(env, american, ScenarioSettings{1024}, 100);
+        REQUIRE(model.getPrice() < scenarios.getPrice());
+    }
+    SECTION( "Truncation of the counts and sparsity" ){
+        auto model = ExpectedDividendTree::build(env, american);
+        auto exact = ExpectedDividendTree::build(env, american, PoissonDividends{1e-14});
+        REQUIRE(model.getPrice() == Approx(exact.getPrice()).margin(1e-6));
+        REQUIRE(model.getMaxDividends() < exact.getMaxDividends());
+        // counts are only kept where they are likely, i.e. fewer states than a dense count dimension
+        double nodes = 0.5*(model.getN()+1.)*(model.getN()+2.);
+        REQUIRE(model.getStates() < (model.getMaxDividends()+1)*nodes);
+        REQUIRE_THROWS(ExpectedDividendTree::build(env, american, PoissonDividends{0}));
+    }
+    SECTION( "Greeks are deterministic finite differences" ){
+        auto model = ExpectedDividendTree::build(env, american, PoissonDividends{}, 200);
+        auto engine = EngineRegistry::withBuiltInEngines().get("expected-dividend").priceWithGreeks(env, american, {}, 200);
+        REQUIRE(engine.price == model.getPrice());
+        REQUIRE(engine.greeks.delta == myUtils::computeDelta(env, american, model));
+        REQUIRE(engine.greeks.delta < 0);
+        REQUIRE(engine.greeks.delta > -1);
+        REQUIRE(engine.greeks.gamma > 0);
+        REQUIRE(engine.greeks.vega > 0);
+    }
+}
+
+TEST_CASE("Dividend schedule", "[Dividends]"){
+    Environment env;
+    env.riskFreeRate = 5e-2;
+    env.underlyingT0Price = 60;
+    env.volatility = 0.2;
+    env.averageDividendsPerYear = 12;
+    SECTION( "Levels pay the dividends of the daily structure" ){
+        PhiloxStream rng(11, 0);
+        for (unsigned days : {1u, 30u, 365u, 10958u}){
+            auto structure = sampleDividendStructure(env, days, rng);
+            DividendSchedule schedule(structure);
+            REQUIRE(schedule.toDailyStructure(days) == structure);
+            REQUIRE(schedule.total() == std::accumulate(structure.begin(), structure.end(), 0));
+            for (unsigned steps : {1u, 7u, days, 2*days+3}){
+                auto cumSum = cumulativeDividends(structure, days, steps);
+                for (unsigned i = 0; i < steps+1; i++) REQUIRE(schedule.payedBefore(i, days, steps) == cumSum[i]);
+            }
+        }
+    }
+    SECTION( "Events are sorted and merged" ){
+        DividendSchedule schedule(std::vector<DividendEvent>{{30, 1}, {10, 2}, {30, 1}, {20, 0}});
+        REQUIRE(schedule.getEvents() == std::vector<DividendEvent>{{10, 2}, {30, 2}});
+        REQUIRE(schedule == DividendSchedule(std::vector<int>{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                                              0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2}));
+        REQUIRE(DividendSchedule().total() == 0);
+        REQUIRE(DividendSchedule(std::vector<int>(365, 0)).getEvents().empty());
+    }
+    SECTION( "Models and their Greeks share the events" ){
+        Option option(60, 10958, TradeType::American, CallPut::Put);
+        DividendSchedule schedule(std::vector<DividendEvent>{{400, 1}, {5000, 2}});
+        auto tree = BinomialTree::build(env, option, schedule, 200);
+        REQUIRE(tree.getDividendStructure().getEvents().data() == schedule.getEvents().data());
+        REQUIRE(tree.getPrice() == BinomialTree::build(env, option, schedule.toDailyStructure(10958), 200).getPrice());
+        auto grid = CrankNicolsonGrid::build(env, option, schedule, 200);
+        REQUIRE(grid.getDividendStructure().getEvents().data() == schedule.getEvents().data());
+    }
+}
+
+TEST_CASE("Normalized lattice", "[Lattice]"){
+    Environment env;
+    env.riskFreeRate = 5e-2;
+    env.underlyingT0Price = 60;
+    env.volatility = 0.2;
+    env.q = 0.01;
+    DividendSchedule dividends(std::vector<DividendEvent>{{100, 1}, {250, 2}});
+    SECTION( "One lattice prices every spot, strike and style" ){
+        NormalizedLattice<CoxRossRubinstein> lattice(env, Option(60, 365, TradeType::American, CallPut::Put), dividends, 365);
+        for (double spot : {50., 60., 75.}){
+            auto bumped = env.copy();
+            bumped.underlyingT0Price = spot;
+            for (auto type : {TradeType::European, TradeType::American}){
+                for (auto callPut : {CallPut::Call, CallPut::Put}){
+                    Option option(62, 365, type, callPut);
+                    REQUIRE(lattice.price(bumped, option) == BinomialTree::build(bumped, option, dividends).getPrice());
+                    REQUIRE(lattice.price(bumped, option) ==
+                            BinomialTree::build(bumped, option, dividends, BinomialTree::geometry(bumped, option, 365)).getPrice());
+                }
+            }
+        }
+        Option option(62, 365, TradeType::American, CallPut::Put);
+        NormalizedLattice<JarrowRudd> jr(env, option, dividends, 200);
+        REQUIRE(jr.price(env, option) == BasicBinomialTree<JarrowRudd>::build(env, option, dividends, 200).getPrice());
+    }
+    SECTION( "Spot bumps of the Greeks hit the cache" ){
+        auto& cache = NormalizedLattice<CoxRossRubinstein>::cache();
+        cache.clear();
+        Option option(62, 365, TradeType::American, CallPut::Put);
+        auto model = BinomialTree::build(env, option, dividends);
+        REQUIRE(cache.misses() == 1);
+        double delta = myUtils::computeDelta(env, option, model);
+        double gamma = myUtils::computeGamma(env, option, model);
+        REQUIRE(cache.misses() == 1);
+        REQUIRE(cache.hits() == 4);
+        // the bumped prices are those of rebuilt trees
+        auto rebuild = [&](Environment const& e, Option const& o, unsigned steps){
+            return BinomialTree::build(e, o, dividends, BinomialTree::geometry(e, o, steps)).getPrice();
+        };
+        REQUIRE(delta == myUtils::computeDeltaFD(env, option, rebuild, 365));
+        REQUIRE(gamma == myUtils::computeGammaFD(env, option, rebuild, 365, model.getPrice()));
+        // another trade on the same underlying reuses the lattice
+        BinomialTree::build(env, Option(55, 365, TradeType::European, CallPut::Call), dividends);
+        REQUIRE(cache.hits() == 5);
+        REQUIRE(cache.size() == 1);
+    }
+}
+
+TEST_CASE("Lattice parameter cache", "[Lattice]"){
+    Environment env;
+    env.riskFreeRate = 5e-2;
+    env.underlyingT0Price = 60;
+    env.volatility = 0.2;
+    SECTION( "Least recently used entries are evicted" ){
+        LruCache<int, double> cache(2);
+        auto value = [](double v){return [v](){return std::make_shared<const double>(v);};};
+        cache.findOrInsert(1, value(1.));
+        cache.findOrInsert(2, value(2.));
+        REQUIRE(*cache.findOrInsert(1, value(-1.)) == 1.); // hit, 1 becomes the most recently used
+        cache.findOrInsert(3, value(3.)); // evicts 2
+        REQUIRE(cache.size() == 2);
+        REQUIRE(cache.find(2) == nullptr);
+        REQUIRE(*cache.find(1) == 1.);
+        REQUIRE(cache.hits() == 2);
+        REQUIRE(cache.misses() == 4);
+        REQUIRE(cache.hitRate() == Approx(1./3));
+        cache.insert(4, std::make_shared<const double>(4.), 3); // heavier than the capacity
+        REQUIRE(cache.find(4) == nullptr);
+    }
+    SECTION( "Trades on the same market snapshot share the parameters" ){
+        auto& cache = BinomialTree::geometryCache();
+        cache.clear();
+        auto geometry = BinomialTree::cachedGeometry(env, Option(60, 365, TradeType::American, CallPut::Put), 200);
+        REQUIRE(BinomialTree::cachedGeometry(env, Option(70, 365, TradeType::European, CallPut::Call), 200) == geometry);
+        REQUIRE(BinomialTree::cachedGeometry(env, Option(60, 364, TradeType::American, CallPut::Put), 200) != geometry);
+        REQUIRE(cache.hits() == 1);
+        REQUIRE(cache.misses() == 2);
+        auto fresh = BinomialTree::geometry(env, Option(60, 365, TradeType::American, CallPut::Put), 200);
+        REQUIRE(geometry->upPowers == fresh.upPowers);
+        REQUIRE(geometry->parameters.p == fresh.parameters.p);
+        // Leisen-Reimer trees depend on spot and strike
+        using LR = BasicBinomialTree<LeisenReimer>;
+        auto lr = LR::cachedGeometry(env, Option(60, 365, TradeType::American, CallPut::Put), 200);
+        REQUIRE(LR::cachedGeometry(env, Option(70, 365, TradeType::American, CallPut::Put), 200) != lr);
+        REQUIRE(LR::cachedGeometry(env, Option(60, 365, TradeType::American, CallPut::Put), 200) == lr);
+    }
+    SECTION( "The cache is shared by concurrent pricings" ){
+        std::vector<double> prices(64), reference(64);
+        auto price = [&](std::size_t i){
+            Option option(50 + i%8, 365, TradeType::American, CallPut::Put);
+            auto e = env.copy();
+            e.volatility = 0.1 + 0.05*(i%4);
+            return BasicBinomialTree<Tian>::build(e, option, DividendSchedule(), 100).getPrice();
+        };
+        for (std::size_t i = 0; i < prices.size(); i++) reference[i] = price(i);
+        parallelFor(prices.size(), 4, [&](std::size_t i){prices[i] = price(i);});
+        REQUIRE(prices == reference);
+        REQUIRE(NormalizedLattice<Tian>::cache().hitRate() > 0.5); // 4 volatilities, i.e. 4 lattices
+    }
+}
+
+TEST_CASE("Result cache", "[Engine]"){
+    Environment env;
+    env.riskFreeRate = 5e-2;
+    env.volatility = 0.2;
+    env.underlyingT0Price = 50;
+    env.averageDividendsPerYear = 2;
+    Option option(50, 365, TradeType::American, CallPut::Put);
+    DividendSchedule dividends(std::vector<DividendEvent>{{90, 1}, {270, 1}});
+    auto registry = EngineRegistry::withBuiltInEngines();
+    auto const& crr = registry.get("binomial-crr");
+    SECTION( "Repeated pricings are served from memory" ){
+        ResultCache cache;
+        CachedEngine engine(crr, cache);
+        auto computed = crr.priceWithGreeks(env, option, dividends, 200);
+        auto first = engine.priceWithGreeks(env, option, dividends, 200);
+        auto second = engine.priceWithGreeks(env, option, dividends, 200);
+        REQUIRE(cache.misses() == 1);
+        REQUIRE(cache.hits() == 1);
+        REQUIRE(first.price == computed.price);
+        REQUIRE(second.price == computed.price);
+        REQUIRE(second.greeks.delta == computed.greeks.delta);
+        REQUIRE(second.greeks.rho == computed.greeks.rho);
+        REQUIRE(second.engine == "binomial-crr");
+        // the myUtils Greeks reprice the bumps through the cache
+        double delta = myUtils::computeDelta(env, option, engine, dividends, 200);
+        auto misses = cache.misses();
+        REQUIRE(myUtils::computeDelta(env, option, engine, dividends, 200) == delta);
+        REQUIRE(cache.misses() == misses);
+        REQUIRE(cache.hitRate() > 0.);
+    }
+    SECTION( "Keys cover every input" ){
+        auto key = ResultCache::key(crr, ResultCache::Kind::Price, env, option, dividends, 200);
+        auto same = ResultCache::key(crr, ResultCache::Kind::Price, env.copy(), Option(50, 365, TradeType::American, CallPut::Put),
+                                     DividendSchedule(std::vector<DividendEvent>{{270, 1}, {90, 1}}), 200);
+        REQUIRE(same.key == key.key);
+        REQUIRE(same.check == key.check);
+        auto differs = [&](ResultCache::Key const& other){return other.key!=key.key && other.check!=key.check;};
+        auto bumped = env.copy();
+        bumped.volatility += 1e-9;
+        REQUIRE(differs(ResultCache::key(crr, ResultCache::Kind::Price, bumped, option, dividends, 200)));
+        REQUIRE(differs(ResultCache::key(crr, ResultCache::Kind::Price, env, option, dividends, 201)));
+        REQUIRE(differs(ResultCache::key(crr, ResultCache::Kind::Greeks, env, option, dividends, 200)));
+        REQUIRE(differs(ResultCache::key(crr, ResultCache::Kind::Price, env, option, DividendSchedule(), 200)));
+        REQUIRE(differs(ResultCache::key(crr, ResultCache::Kind::Price, env,
+                                         Option(50, 365, TradeType::European, CallPut::Put), dividends, 200)));
+        REQUIRE(differs(ResultCache::key(registry.get("binomial-jr"), ResultCache::Kind::Price, env, option, dividends, 200)));
+        // engine settings are part of the key
+        CrankNicolsonEngine coarse(100), fine(200);
+        REQUIRE(ResultCache::key(coarse, ResultCache::Kind::Price, env, option, dividends, 200).key !=
+                ResultCache::key(fine, ResultCache::Kind::Price, env, option, dividends, 200).key);
+        MonteCarloSettings settings;
+        auto seeded = settings;
+        seeded.seed++;
+        auto threaded = settings;
+        threaded.threads = 3;
+        auto mcKey = ResultCache::key(MonteCarloEngine(settings), ResultCache::Kind::Price, env, option, dividends, 20).key;
+        REQUIRE(ResultCache::key(MonteCarloEngine(seeded), ResultCache::Kind::Price, env, option, dividends, 20).key != mcKey);
+        REQUIRE(ResultCache::key(MonteCarloEngine(threaded), ResultCache::Kind::Price, env, option, dividends, 20).key == mcKey);
+    }
+    SECTION( "The memory tier is bounded" ){
+        ResultCacheSettings small;
+        small.capacity = 2;
+        ResultCache cache(small);
+        CachedEngine engine(crr, cache);
+        for (unsigned steps : {50, 60, 70, 50}) (void) engine.price(env, option, dividends, steps);
+        REQUIRE(cache.size() == 2);
+        REQUIRE(cache.misses() == 4);
+    }
+    SECTION( "The file tier survives the cache" ){
+        std::string file = "result_cache_test.bin";
+        std::remove(file.c_str());
+        ResultCacheSettings settings;
+        settings.file = file;
+        settings.fileSlots = 64;
+        PricingResult computed;
+        {
+            ResultCache cache(settings);
+            REQUIRE(cache.hasFileTier());
+            computed = CachedEngine(crr, cache).priceWithGreeks(env, option, dividends, 100);
+            REQUIRE(cache.misses() == 1);
+        }
+        {
+            ResultCache cache(settings);
+            auto restored = CachedEngine(crr, cache).priceWithGreeks(env, option, dividends, 100);
+            REQUIRE(cache.fileTierHits() == 1);
+            REQUIRE(cache.misses() == 0);
+            REQUIRE(restored.price == computed.price);
+            REQUIRE(restored.greeks.gamma == computed.greeks.gamma);
+            REQUIRE(restored.steps == 100);
+        }
+        {
+            settings.fileSlots = 32; // another layout starts over
+            ResultCache cache(settings);
+            (void) CachedEngine(crr, cache).priceWithGreeks(env, option, dividends, 100);
+            REQUIRE(cache.misses() == 1);
+        }
+        std::remove(file.c_str());
+    }
+}
+
+TEST_CASE("Pricing workspace", "[Lattice]"){
+    Environment env;
+    env.riskFreeRate = 5e-2;
+    env.volatility = 0.2;
+    env.underlyingT0Price = 50;
+    env.averageDividendsPerYear = 2;
+    std::vector<Option> batch;
+    for (unsigned k = 0; k < 8; k++){
+        batch.emplace_back(45 + 2*k, 180 + 30*(k%3), k%2 ? TradeType::American : TradeType::European,
+                           k%4<2 ? CallPut::Put : CallPut::Call);
+    }
+    DividendSchedule dividends(std::vector<DividendEvent>{{60, 1}, {150, 2}});
+    SECTION( "Workspace prices match the trees" ){
+        PricingWorkspace workspace;
+        for (auto const& option : batch){
+            REQUIRE(BinomialTree::price(env, option, dividends, 150, workspace) ==
+                    BinomialTree::build(env, option, dividends, 150).getPrice());
+            using LR = BasicBinomialTree<LeisenReimer>;
+            REQUIRE(LR::price(env, option, dividends, 149, workspace) ==
+                    LR::build(env, option, dividends, 149).getPrice());
+        }
+        REQUIRE(workspace.getGrowths() == 1); // the largest level is the first one
+        workspace.release();
+        REQUIRE(workspace.bytes() == 0);
+    }
+    SECTION( "Trees are rebuilt in place" ){
+        auto tree = BinomialTree::build(env, batch[0], dividends, 200);
+        for (auto const& option : batch){
+            tree.rebuild(env, option, dividends, 100);
+            REQUIRE(tree.getN() == 100);
+            REQUIRE(tree.getPrice() == BinomialTree::build(env, option, dividends, 100).getPrice());
+        }
+        tree = BinomialTree::build(env, batch[1], dividends, 50); // trees are assignable
+        REQUIRE(tree.getN() == 50);
+    }
+    SECTION( "Workspaces can draw from an arena" ){
+        std::vector<std::byte> block(1<<16);
+        std::pmr::monotonic_buffer_resource arena(block.data(), block.size(), std::pmr::null_memory_resource());
+        PricingWorkspace workspace(&arena);
+        REQUIRE(BinomialTree::price(env, batch[0], dividends, 365, workspace) ==
+                BinomialTree::build(env, batch[0], dividends, 365).getPrice());
+    }
+    SECTION( "A steady-state batch does not allocate" ){
+        using LR = BasicBinomialTree<LeisenReimer>;
+        auto tree = BinomialTree::build(env, batch[0], dividends, 120);
+        auto run = [&](){
+            double total{0};
+            for (auto const& option : batch){
+                tree.rebuild(env, option, dividends, 120);
+                total += tree.getPrice();
+                total += myUtils::computeDelta(env, option, tree);
+                total += myUtils::computeGamma(env, option, tree);
+                total += myUtils::computeTheta(env, option, tree);
+                total += myUtils::computeVega(env, option, tree);
+                total += myUtils::computeRho(env, option, tree);
+                auto pricer = myUtils::modelPricer<LR>(dividends);
+                total += myUtils::computeDeltaFD(env, option, pricer, 121);
+                total += myUtils::computeVegaFD(env, option, pricer, 121);
+            }
+            return total;
+        };
+        double warm = run();
+        auto before = heapAllocations.load();
+        double steady = run();
+        auto allocations = heapAllocations.load() - before;
+        REQUIRE(allocations == 0);
+        REQUIRE(steady == warm);
+    }
+}
+
+TEST_CASE("Huge-page lattice memory", "[Lattice]"){
+    Environment env;
+    env.riskFreeRate = 5e-2;
+    env.volatility = 0.2;
+    env.underlyingT0Price = 50;
+    env.averageDividendsPerYear = 2;
+    Option option(50, 1500, TradeType::American, CallPut::Put);
+    DividendSchedule dividends(std::vector<DividendEvent>{{200, 1}, {900, 1}});
+    SECTION( "Large blocks are mapped 2MB aligned, small ones come from upstream" ){
+        HugePageResource resource;
+        void* small = resource.allocate(64, alignof(double));
+        REQUIRE(resource.getTransparentBytes() == 0);
+        resource.deallocate(small, 64, alignof(double));
+        std::size_t bytes = 3*HugePageResource::hugePageSize + 1;
+        auto* large = static_cast<double*>(resource.allocate(bytes, alignof(double)));
+        REQUIRE(reinterpret_cast<std::uintptr_t>(large)%HugePageResource::hugePageSize == 0);
+        REQUIRE(resource.getTransparentBytes() == 4*HugePageResource::hugePageSize);
+        large[bytes/sizeof(double)-1] = 1.;
+        resource.deallocate(large, bytes, alignof(double));
+    }
+    SECTION( "Explicit huge pages fall back to transparent ones" ){
+        HugePageResource resource(HugePageSettings{HugePages::Explicit});
+        void* block = resource.allocate(HugePageResource::hugePageSize, alignof(double));
+        REQUIRE(resource.getExplicitBytes() + resource.getTransparentBytes() == HugePageResource::hugePageSize);
+        resource.deallocate(block, HugePageResource::hugePageSize, alignof(double));
+    }
+    SECTION( "Trees built on huge pages price as on the heap" ){
+        double reference = BinomialTree::build(env, option, dividends, 1500).getPrice();
+        HugePageResource resource;
+        setLatticeResource(&resource);
+        NormalizedLattice<CoxRossRubinstein>::cache().clear();
+        double price = BinomialTree::build(env, option, dividends, 1500).getPrice();
+        NormalizedLattice<CoxRossRubinstein>::cache().clear();
+        setLatticeResource(nullptr);
+        REQUIRE(price == reference);
+        REQUIRE(resource.getTransparentBytes() > 0);
+        REQUIRE(latticeResource() == std::pmr::new_delete_resource());
+    }
+    SECTION( "Pinned workers cover every task once" ){
+        auto nodes = numaNodes();
+        REQUIRE(!nodes.empty());
+        REQUIRE(!nodes[0].empty());
+        cpu_set_t before, after;
+        REQUIRE(sched_getaffinity(0, sizeof(before), &before) == 0);
+        std::vector<int> done(100, 0);
+        parallelForPinned(done.size(), 4, [&](std::size_t i){done[i]++;});
+        REQUIRE(std::count(done.begin(), done.end(), 1) == 100);
+        REQUIRE(sched_getaffinity(0, sizeof(after), &after) == 0);
+        REQUIRE(CPU_EQUAL(&before, &after));
+    }
+    SECTION( "Pinned batch workers on huge pages price as the default ones" ){
+        auto registry = EngineRegistry::withBuiltInEngines();
+        std::ostringstream csv;
+        csv << "id,S-T0-Price,volatility,risk-free-rate,strike,days-to-maturity,callput,european,engine,dividends\n";
+        for (int k = 0; k < 12; k++) csv << "t" << k << ",50,0.2,0.05," << 45+k << "," << 100+200*k << ",-1,-1,,200:1\n";
+        std::istringstream in(csv.str());
+        TradeFileReader reader(in, TradeFileFormat::Csv);
+        std::vector<BatchTrade> trades;
+        for (BatchTrade trade; reader.next(trade);) trades.push_back(trade);
+        BatchSettings settings;
+        settings.threads = 3;
+        settings.groupSize = 1;
+        auto groups = groupTrades(std::move(trades), settings.engine, settings.steps, settings.seed, settings.groupSize);
+        std::mutex mutex;
+        std::vector<double> reference(12), prices(12);
+        priceBatchGroups(groups, registry, settings, [&](BatchTrade const& trade, PricingResult const* result,
+                                                         std::string const&){
+            std::lock_guard<std::mutex> lock(mutex);
+            reference[trade.index] = result ? result->price : -1.;
+        });
+        settings.pin = true;
+        settings.hugePages = HugePages::Transparent;
+        auto nodes = numaNodes();
+        std::vector<bool> onHugePages, onOneNode, onHeap;
+        priceBatchGroups(groups, registry, settings, [&](BatchTrade const& trade, PricingResult const* result,
+                                                         std::string const&){
+            cpu_set_t mask;
+            sched_getaffinity(0, sizeof(mask), &mask);
+            bool oneNode = std::any_of(nodes.begin(), nodes.end(), [&](std::vector<unsigned> const& cpus){
+                return CPU_COUNT(&mask) == static_cast<int>(cpus.size()) &&
+                       std::all_of(cpus.begin(), cpus.end(), [&](unsigned cpu){return CPU_ISSET(cpu, &mask);});
+            });
+            // a thread other than the workers keeps the lattice resource of the process
+            std::pmr::memory_resource* other{nullptr};
+            std::thread([&]{other = latticeResource();}).join();
+            std::lock_guard<std::mutex> lock(mutex);
+            prices[trade.index] = result ? result->price : -1.;
+            onHugePages.push_back(dynamic_cast<HugePageResource*>(latticeResource()) != nullptr);
+            onOneNode.push_back(oneNode);
+            onHeap.push_back(other == std::pmr::new_delete_resource());
+        });
+        REQUIRE(prices == reference);
+        REQUIRE(std::count(onHugePages.begin(), onHugePages.end(), true) == 12);
+        REQUIRE(std::count(onOneNode.begin(), onOneNode.end(), true) == 12);
+        REQUIRE(std::count(onHeap.begin(), onHeap.end(), true) == 12);
+        REQUIRE(latticeResource() == std::pmr::new_delete_resource());
+        // batches ending in any order leave the lattice resource of the process alone
+        auto first = std::make_unique<BatchWorkers>(settings);
+        BatchWorkers second(settings);
+        first.reset();
+        REQUIRE(latticeResource() == std::pmr::new_delete_resource());
+    }
+}
+
+TEST_CASE("Fused lattice induction", "[Lattice]"){
+    Environment env;
+    env.riskFreeRate = 5e-2;
+    env.volatility = 0.25;
+    env.underlyingT0Price = 40;
+    Option option(42, 300, TradeType::American, CallPut::Put);
+    DividendSchedule dividends(std::vector<DividendEvent>{{50, 1}, {200, 3}});
+    using Jr = BasicBinomialTree<JarrowRudd>;
+    auto geometry = Jr::geometry(env, option, 300);
+    // reference: the underlying values are generated first, then read back by the induction
+    unsigned N = geometry.steps;
+    std::vector<std::vector<double>> stock(N+1), value(N+1);
+    for (unsigned i = 0; i < N+1; i++){
+        double payed = dividends.payedBefore(i, 300, N)*0.1;
+        for (unsigned j = 0; j < i+1; j++){
+            stock[i].push_back(env.underlyingT0Price*std::max(std::pow(geometry.parameters.u, j)*
+                                                              std::pow(geometry.parameters.d, i-j)-payed, 0.));
+        }
+        value[i].resize(i+1);
+    }
+    for (unsigned j = 0; j < N+1; j++) value[N][j] = option.payout(stock[N][j]);
+    for (auto i = static_cast<int>(N)-1; i >= 0; i--){
+        for (int j = 0; j < i+1; j++){
+            double continuation = geometry.discount*(geometry.parameters.p*value[i+1][j+1] +
+                                                     (1.-geometry.parameters.p)*value[i+1][j]);
+            value[i][j] = std::max(continuation, option.payout(stock[i][j]));
+        }
+    }
+    auto tree = Jr::build(env, option, dividends, 300);
+    REQUIRE(tree.getPrice() == Approx(value[0][0]).epsilon(1e-12));
+    REQUIRE(Jr::price(env, option, dividends, 300) == tree.getPrice());
+    for (unsigned i : {0u, 49u, 50u, 199u, 200u, 300u}){
+        for (unsigned j = 0; j < i+1; j += 7){
+            REQUIRE(tree.getNode(i, j).underlyingValue == Approx(stock[i][j]).epsilon(1e-12));
+            REQUIRE(tree.getNode(i, j).tradeValue == Approx(value[i][j]).epsilon(1e-10));
+        }
+    }
+}
+
+TEST_CASE("Batch pipeline", "[Batch]"){
+    auto registry = EngineRegistry::withBuiltInEngines();
+    SECTION( "Bounded queues drain after closing" ){
+        BoundedQueue<int> queue(2);
+        REQUIRE(queue.push(1));
+        REQUIRE(queue.push(2));
+        std::thread producer([&]{queue.push(3);}); // blocks until a slot is free
+        REQUIRE(*queue.pop() == 1);
+        producer.join();
+        queue.close();
+        REQUIRE(!queue.push(4));
+        REQUIRE(*queue.pop() == 2);
+        REQUIRE(*queue.pop() == 3);
+        REQUIRE(!queue.pop());
+    }
+    SECTION( "Results are written in input order whatever the number of workers" ){
+        std::ostringstream file;
+        file << "id,S-T0-Price,volatility,risk-free-rate,average-dividends-per-year,strike,days-to-maturity,callput,european\n";
+        for (int k = 0; k < 200; k++){
+            file << "t" << k << "," << 40 + k%20 << ",0.2,0.05,2," << 50 << "," << 30 + (k*37)%200 << ","
+                 << (k%2 ? 1 : -1) << "," << (k%3 ? -1 : 1) << "\n";
+            if (k==57) file << "# a comment\nbroken,row\n";
+        }
+        BatchSettings settings;
+        settings.steps = 50;
+        settings.window = 8;
+        settings.queueCapacity = 4;
+        auto run = [&](unsigned threads, std::string& output){
+            settings.threads = threads;
+            std::istringstream in(file.str());
+            std::ostringstream out;
+            auto statistics = runBatch(in, out, TradeFileFormat::Csv, registry, settings);
+            output = out.str();
+            return statistics;
+        };
+        std::string serial, parallel;
+        auto statistics = run(1, serial);
+        REQUIRE(run(4, parallel).trades == 201);
+        REQUIRE(statistics.trades == 201);
+        REQUIRE(statistics.errors == 1);
+        REQUIRE(parallel == serial);
+        std::istringstream lines(parallel);
+        std::string line;
+        std::getline(lines, line);
+        REQUIRE(line.rfind("id,engine,steps,price", 0) == 0);
+        std::vector<std::string> ids;
+        while (std::getline(lines, line)) ids.push_back(line.substr(0, line.find(',')));
+        REQUIRE(ids.size() == 201);
+        REQUIRE(ids[0] == "t0");
+        REQUIRE(ids[58] == "broken");
+        REQUIRE(ids[59] == "t58");
+        REQUIRE(ids[200] == "t199");
+    }
+    SECTION( "JSONL trades price as the engines" ){
+        std::istringstream in(R"({"id": "x", "S-T0-Price": 60, "volatility": 0.2, "risk-free-rate": 0.05, "strike": 60, "days-to-maturity": 365, "callput": -1, "european": false, "engine": "binomial-lr", "steps": 101}
+{"id": "y", "S-T0-Price": 60}
+)");
+        std::ostringstream out;
+        auto statistics = runBatch(in, out, TradeFileFormat::Jsonl, registry);
+        REQUIRE(statistics.trades == 2);
+        REQUIRE(statistics.errors == 1);
+        Environment env;
+        env.underlyingT0Price = 60;
+        env.volatility = 0.2;
+        env.riskFreeRate = 0.05;
+        Option option(60, 365, TradeType::American, CallPut::Put);
+        auto expected = registry.get("binomial-lr").priceWithGreeks(env, option, DividendSchedule(), 101);
+        std::ostringstream price;
+        price << std::setprecision(std::numeric_limits<double>::max_digits10) << "\"price\":" << expected.price << ",";
+        auto output = out.str();
+        REQUIRE(output.find(price.str()) != std::string::npos);
+        REQUIRE(output.find("{\"id\":\"y\",\"error\":") != std::string::npos);
+        REQUIRE(TradeFileReader::formatOf("book.jsonl") == TradeFileFormat::Jsonl);
+        REQUIRE(TradeFileReader::formatOf("book.csv") == TradeFileFormat::Csv);
+    }
+}
+
+TEST_CASE("Config parser", "[Config]"){
+    SECTION( "Every key hashes to its own slot" ){
+        for (std::size_t k = 0; k < configKeyCount; k++){
+            REQUIRE(findConfigKey(configKeyNames[k]) == static_cast<ConfigKey>(k));
+        }
+        REQUIRE(!findConfigKey("strikes"));
+        REQUIRE(!findConfigKey(""));
+        static_assert(findConfigKey("strike") == ConfigKey::Strike);
+    }
+    SECTION( "Numbers are parsed as by stod" ){
+        double value{0};
+        for (std::string text : {"5e-2", "60", "-1.", "0.", "+2.5", "1e6", ".5"}){
+            REQUIRE(parseNumber(text, value));
+            REQUIRE(value == std::stod(text));
+        }
+        REQUIRE(parseNumber("false", value));
+        REQUIRE(value == -1.);
+        REQUIRE(!parseNumber("", value));
+        REQUIRE(!parseNumber("60USD", value));
+        REQUIRE(!parseNumber("sixty", value));
+    }
+    SECTION( "Input files report unknown and missing keys" ){
+        auto config = Config::parse("# market\r\n risk-free-rate = 5e-2\r\n\nS-T0-Price=60\nstrike=\t62\n");
+        REQUIRE(config.require(ConfigKey::RiskFreeRate) == 5e-2);
+        REQUIRE(config.get(ConfigKey::Strike) == 62);
+        REQUIRE(config.get(ConfigKey::RngSeed, 7) == 7);
+        REQUIRE(!config.has(ConfigKey::Volatility));
+        REQUIRE_THROWS_AS(config.require(ConfigKey::Volatility), std::invalid_argument);
+        REQUIRE_THROWS_WITH(config.require({ConfigKey::SpotPrice, ConfigKey::Volatility, ConfigKey::DaysToMaturity}),
+                            "Missing keys: volatility, days-to-maturity.");
+        REQUIRE_THROWS_WITH(Config::parse("strike=60\nstrik=60\n"), "Line 2: unknown key strik.");
+        REQUIRE_THROWS_WITH(Config::parse("strike 60\n"), "Line 1: expected key=value.");
+        REQUIRE_THROWS_WITH(Config::parse("strike=6O\n"), "Line 1: invalid value of strike.");
+        // the tolerance of the engine selection and that of the progressive refinement are set apart
+        auto progressive = Config::parse("tolerance=1e-3\nprogressive=1\nprogressive-tolerance=0.05\n");
+        REQUIRE(progressive.get(ConfigKey::Tolerance) == 1e-3);
+        REQUIRE(progressive.get(ConfigKey::ProgressiveTolerance) == 0.05);
+    }
+    SECTION( "Trade records are read without allocating" ){
+        std::ostringstream file;
+        file << "id,S-T0-Price,volatility,risk-free-rate,strike,days-to-maturity,callput,european\n";
+        for (int k = 0; k < 1000; k++) file << "t" << k%100 << ",60,0.2,0.05," << 50 + k%10 << ",365,-1,-1\n";
+        std::istringstream in(file.str());
+        TradeFileReader reader(in, TradeFileFormat::Csv);
+        BatchTrade trade;
+        REQUIRE(reader.next(trade));
+        auto before = heapAllocations.load();
+        double strikes{0};
+        while (reader.next(trade)) strikes += trade.option.getStrike();
+        REQUIRE(heapAllocations.load() == before);
+        REQUIRE(strikes == 100*545. - 50.);
+        std::istringstream unknown("id,spot\nx,60\n");
+        TradeFileReader badHeader(unknown, TradeFileFormat::Csv);
+        REQUIRE_THROWS_WITH(badHeader.next(trade), "Unknown field spot in the CSV header.");
+        std::istringstream escaped(R"({"id": "a\"b", "S-T0-Price": 60, "tolerance": 1})");
+        TradeFileReader json(escaped, TradeFileFormat::Jsonl);
+        REQUIRE(json.next(trade));
+        REQUIRE(trade.id == "a\"b");
+        REQUIRE(trade.error == "tolerance is not a field of a trade.");
+    }
+}
+
+TEST_CASE("Binary trade files", "[Binary]"){
+    auto registry = EngineRegistry::withBuiltInEngines();
+    std::string csv = "binary_test_trades.csv", trades = "binary_test_trades.bin", results = "binary_test_results.bin";
+    {
+        std::ofstream file(csv);
+        file << "id,S-T0-Price,volatility,risk-free-rate,average-dividends-per-year,strike,days-to-maturity,callput,european,engine,dividends\n";
+        for (int k = 0; k < 40; k++){
+            file << "t" << k << "," << 50 + k%20 << ",0.2,0.05,2,55," << 30 + (k*37)%300 << "," << (k%2 ? 1 : -1)
+                 << "," << (k%3 ? -1 : 1) << "," << (k%4 ? "" : "binomial-lr") << "," << (k%5 ? "" : "20:1 90:2") << "\n";
+        }
+    }
+    SECTION( "Converted trades price as the text batch" ){
+        REQUIRE(convertToBinary(csv, trades) == 40);
+        REQUIRE(isBinaryTradeFile(trades));
+        REQUIRE(!isBinaryTradeFile(csv));
+        BinaryTradeFile file(trades);
+        REQUIRE(file.size() == 40);
+        REQUIRE(file[5].dividendCount == 2);
+        BatchTrade trade;
+        file.read(5, trade);
+        REQUIRE(trade.id == "t5");
+        REQUIRE(trade.dividends == std::vector<DividendEvent>{{20, 1}, {90, 2}});
+        BatchSettings settings;
+        settings.steps = 60;
+        settings.threads = 3;
+        auto statistics = runBinaryBatch(file, results, registry, settings);
+        REQUIRE(statistics.trades == 40);
+        REQUIRE(statistics.errors == 0);
+
+        std::ifstream in(csv);
+        std::ostringstream out;
+        runBatch(in, out, TradeFileFormat::Csv, registry, settings);
+        std::istringstream lines(out.str());
+        std::string line;
+        std::getline(lines, line);
+        BinaryResultFile output(results);
+        REQUIRE(output.size() == 40);
+        for (std::size_t k = 0; k < output.size(); k++){
+            REQUIRE(std::getline(lines, line));
+            std::ostringstream expected;
+            expected << std::setprecision(std::numeric_limits<double>::max_digits10) << output[k].id << ","
+                     << output[k].engine << "," << output[k].steps << "," << output[k].price << ",";
+            REQUIRE(line.rfind(expected.str(), 0) == 0);
+        }
+    }
+    SECTION( "Single-trade input files convert, invalid files are rejected" ){
+        std::string input = "binary_test_data.txt";
+        {
+            std::ofstream file(input);
+            file << "risk-free-rate=5e-2\nS-T0-Price=60\nvolatility=2e-1\naverage-dividends-per-year=0.\n"
+                 << "continuously-yield-dividend=0.\ncallput=-1.\neuropean=-1.\nstrike=60\ndays-to-maturity=365\n"
+                 << "engine=0\n";
+        }
+        REQUIRE(convertToBinary(input, trades) == 1);
+        std::remove(input.c_str());
+        BinaryTradeFile file(trades);
+        REQUIRE(file[0].strike == 60);
+        REQUIRE(file[0].daysToMaturity == 365);
+        REQUIRE(std::string(file[0].engine) == "binomial-crr");
+        REQUIRE_THROWS_AS(BinaryTradeFile(csv), std::invalid_argument);
+        REQUIRE_THROWS_AS(BinaryResultFile(trades), std::invalid_argument);
+        {
+            std::ofstream file(csv);
+            file << "id,S-T0-Price\nabcdefghijklmnopqrstuvwxyz,60\n";
+        }
+        REQUIRE_THROWS_AS(convertToBinary(csv, trades), std::invalid_argument);
+    }
+    SECTION( "Corrupt headers and unpriceable records are rejected" ){
+        REQUIRE(convertToBinary(csv, trades) == 40);
+        auto patch = [&](std::size_t offset, auto value){
+            std::fstream file(trades, std::ios::in | std::ios::out | std::ios::binary);
+            file.seekp(static_cast<std::streamoff>(offset));
+            file.write(reinterpret_cast<char const*>(&value), sizeof(value));
+        };
+        BinaryHeader header{};
+        {
+            std::ifstream file(trades, std::ios::binary);
+            file.read(reinterpret_cast<char*>(&header), sizeof(header));
+        }
+        // counts whose sections wrap around the end of the address space pass a bound computed by multiplication
+        patch(offsetof(BinaryHeader, recordCount), (std::uint64_t{1}<<57) + 40);
+        REQUIRE_THROWS_WITH(BinaryTradeFile(trades), trades + " is truncated.");
+        patch(offsetof(BinaryHeader, recordCount), header.recordCount);
+        patch(offsetof(BinaryHeader, dividendCount), (std::uint64_t{1}<<61) + header.dividendCount);
+        REQUIRE_THROWS_WITH(BinaryTradeFile(trades), trades + " is truncated.");
+        patch(offsetof(BinaryHeader, dividendCount), header.dividendCount);
+        patch(offsetof(BinaryHeader, dividendOffset), header.dividendOffset - 8);
+        REQUIRE_THROWS_WITH(BinaryTradeFile(trades), trades + " has a misplaced dividend section.");
+        patch(offsetof(BinaryHeader, dividendOffset), header.dividendOffset);
+
+        auto record = [](std::size_t k){return sizeof(BinaryHeader) + k*sizeof(BinaryTradeRecord);};
+        patch(record(3) + offsetof(BinaryTradeRecord, daysToMaturity), std::uint32_t{0});
+        patch(record(7) + offsetof(BinaryTradeRecord, strike), -1.);
+        patch(record(8) + offsetof(BinaryTradeRecord, spot), 0.);
+        BinaryTradeFile file(trades);
+        BatchTrade trade;
+        file.read(3, trade);
+        REQUIRE(trade.error == "days-to-maturity must be positive.");
+        file.read(7, trade);
+        REQUIRE(trade.error == "strike must be positive.");
+        file.read(8, trade);
+        REQUIRE(trade.error == "S-T0-Price must be positive.");
+        file.read(9, trade);
+        REQUIRE(trade.error.empty());
+        BatchSettings settings;
+        settings.steps = 30;
+        settings.threads = 2;
+        REQUIRE(runBinaryBatch(file, results, registry, settings).errors == 3);
+        BinaryResultFile output(results);
+        REQUIRE(output[3].failed == 1);
+        REQUIRE(std::string(output[3].error) == "days-to-maturity must be positive.");
+        REQUIRE(output[4].failed == 0);
+    }
+    std::remove(csv.c_str());
+    std::remove(trades.c_str());
+    std::remove(results.c_str());
+}
+
+TEST_CASE("Environment blocks and trade groups", "[Batch]"){
+    auto registry = EngineRegistry::withBuiltInEngines();
+    Environment env;
+    env.underlyingT0Price = 60;
+    env.volatility = 0.25;
+    env.riskFreeRate = 0.04;
+    env.averageDividendsPerYear = 2;
+    DividendSchedule dividends(std::vector<DividendEvent>{{30, 1}, {200, 1}});
+    SECTION( "A group prices as its options one by one" ){
+        std::vector<Option> options;
+        for (int k = 0; k < 12; k++){
+            options.emplace_back(50 + 2*k, 250, k%3 ? TradeType::American : TradeType::European,
+                                 k%2 ? CallPut::Call : CallPut::Put);
+        }
+        for (auto const& name : {"binomial-crr", "binomial-jr", "binomial-tian", "binomial-lr", "trinomial"}){
+            auto const& engine = registry.get(name);
+            std::vector<PricingResult> results(options.size());
+            engine.priceGroupWithGreeks(env, options.data(), options.size(), dividends, 120, results.data());
+            for (std::size_t k = 0; k < options.size(); k++){
+                auto expected = engine.priceWithGreeks(env, options[k], dividends, 120);
+                REQUIRE(results[k].price == expected.price);
+                REQUIRE(results[k].steps == expected.steps);
+                REQUIRE(results[k].greeks.delta == expected.greeks.delta);
+                REQUIRE(results[k].greeks.gamma == expected.greeks.gamma);
+                REQUIRE(results[k].greeks.theta == expected.greeks.theta);
+                REQUIRE(results[k].greeks.vega == expected.greeks.vega);
+                REQUIRE(results[k].greeks.rho == expected.greeks.rho);
+            }
+        }
+        std::vector<Option> mixed{Option(60, 250, TradeType::American, CallPut::Put),
+                                  Option(60, 251, TradeType::American, CallPut::Put)};
+        std::vector<double> prices(2);
+        REQUIRE_THROWS_AS(BinomialTree::priceGroup(env, mixed.data(), 2, dividends, 100, prices.data()),
+                          std::invalid_argument);
+    }
+    SECTION( "Trades reference named environments and are grouped by them" ){
+        std::istringstream csv(
+                "@market,S-T0-Price,volatility,risk-free-rate,average-dividends-per-year\n"
+                "ACME,60,0.25,0.04,2\n"
+                "INIT,45,0.3,0.04,0\n"
+                "@id,environment,strike,days-to-maturity,callput,european,dividends\n"
+                "a,ACME,55,250,-1,-1,30:1 200:1\n"
+                "b,INIT,40,90,1,-1,\n"
+                "c,ACME,65,250,1,-1,30:1 200:1\n"
+                "d,NONE,65,250,1,-1,\n"
+                "e,ACME,60,250,-1,1,30:1 200:1\n");
+        TradeFileReader reader(csv, TradeFileFormat::Csv);
+        std::vector<BatchTrade> trades;
+        BatchTrade trade;
+        while (reader.next(trade)) trades.push_back(trade);
+        REQUIRE(trades.size() == 5);
+        REQUIRE(reader.getEnvironments().size() == 2);
+        REQUIRE(trades[0].environment == 0);
+        REQUIRE(trades[1].environment == 1);
+        REQUIRE(trades[1].env.underlyingT0Price == 45);
+        REQUIRE(trades[3].error == "Unknown environment NONE.");
+        REQUIRE(trades[4].index == 4);
+        auto groups = groupTrades(std::move(trades), "binomial-crr", 0, defaultRngSeed, 64);
+        REQUIRE(groups.size() == 3);
+        REQUIRE(groups[0].trades.size() == 3);
+        REQUIRE(groups[0].trades[2].id == "e");
+        REQUIRE(groups[0].dividends == dividends);
+        REQUIRE(groups[2].trades[0].id == "d");
+        std::vector<PricingResult> results;
+        priceBatchGroup(groups[0], registry, "binomial-crr", 0, results);
+        auto expected = registry.get("binomial-crr").priceWithGreeks(env, Option(65, 250, TradeType::American, CallPut::Call),
+                                                                     dividends, 0);
+        REQUIRE(results[1].price == expected.price);
+        REQUIRE(results[1].greeks.vega == expected.greeks.vega);
+    }
+    SECTION( "Environment blocks are checked" ){
+        auto run = [&](std::string const& text){
+            std::istringstream in(text);
+            std::ostringstream out;
+            return runBatch(in, out, TradeFileFormat::Jsonl, registry);
+        };
+        REQUIRE_THROWS_WITH(run("{\"market\": \"X\", \"S-T0-Price\": 60}\n"), "Environment X: missing volatility.");
+        REQUIRE_THROWS_WITH(run("{\"market\": \"X\", \"S-T0-Price\": 60, \"volatility\": 0.2, \"risk-free-rate\": 0.05}\n"
+                                "{\"market\": \"X\", \"S-T0-Price\": 60, \"volatility\": 0.2, \"risk-free-rate\": 0.05}\n"),
+                            "Environment X: defined twice.");
+        std::istringstream in("{\"market\": \"X\", \"S-T0-Price\": 60, \"volatility\": 0.2, \"risk-free-rate\": 0.05}\n"
+                              "{\"id\": \"t\", \"environment\": \"X\", \"volatility\": 0.3, \"strike\": 60, \"days-to-maturity\": 30}\n");
+        TradeFileReader reader(in, TradeFileFormat::Jsonl);
+        BatchTrade trade;
+        REQUIRE(reader.next(trade));
+        REQUIRE(trade.error == "volatility is given by environment X.");
+    }
+    SECTION( "Binary files keep the environments" ){
+        std::string csv = "environment_test_trades.csv", trades = "environment_test_trades.bin";
+        {
+            std::ofstream file(csv);
+            file << "@market,S-T0-Price,volatility,risk-free-rate\nACME,60,0.25,0.04\n"
+                 << "@id,environment,strike,days-to-maturity\na,ACME,55,250\nb,,,\n";
+        }
+        REQUIRE_THROWS_AS(convertToBinary(csv, trades), std::invalid_argument);
+        {
+            std::ofstream file(csv);
+            file << "@market,S-T0-Price,volatility,risk-free-rate\nACME,60,0.25,0.04\nINIT,45,0.3,0.04\n"
+                 << "@id,environment,strike,days-to-maturity\na,INIT,55,250\nb,ACME,50,90\n";
+        }
+        REQUIRE(convertToBinary(csv, trades) == 2);
+        BinaryTradeFile file(trades);
+        REQUIRE(file.environmentCount() == 2);
+        REQUIRE(std::string(file.environment(1).name) == "INIT");
+        REQUIRE(file[1].environment == 0);
+        BatchTrade trade;
+        file.read(0, trade);
+        REQUIRE(trade.env.underlyingT0Price == 45);
+        REQUIRE(trade.environment == 1);
+        std::remove(csv.c_str());
+        std::remove(trades.c_str());
+    }
+}
+
+TEST_CASE("Pricing server", "[Server]"){
+    auto registry = EngineRegistry::withBuiltInEngines();
+    ServerSettings settings;
+    settings.steps = 150;
+    settings.threads = 2;
+    auto lines = [](std::string const& text){
+        std::vector<std::string> res;
+        std::istringstream in(text);
+        for (std::string line; std::getline(in, line);) res.push_back(line);
+        return res;
+    };
+    std::string acme = R"({"market": "ACME", "S-T0-Price": 60, "volatility": 0.25, "risk-free-rate": 0.04})";
+    std::string put = R"({"id": "put", "environment": "ACME", "strike": 55, "days-to-maturity": 250, "callput": -1, )"
+                      R"("european": -1, "dividends": "30:1 200:1"})";
+    SECTION( "Responses come in the order of the requests" ){
+        PricingServer server(registry, settings);
+        std::istringstream in(acme + "\n" + put + "\n" +
+                              R"({"id": "bad", "environment": "NONE", "strike": 55, "days-to-maturity": 250})" "\n" +
+                              R"({"market": "BAD", "S-T0-Price": 60})" "\n" +
+                              R"({"id": "call", "engine": "trinomial", "S-T0-Price": 60, "volatility": 0.25, )"
+                              R"("risk-free-rate": 0.04, "strike": 65, "days-to-maturity": 90, "callput": 1})" "\n");
+        std::ostringstream out;
+        server.serve(in, out);
+        auto responses = lines(out.str());
+        REQUIRE(responses.size() == 4);
+        Environment env;
+        env.underlyingT0Price = 60;
+        env.volatility = 0.25;
+        env.riskFreeRate = 0.04;
+        BatchTrade trade;
+        trade.id = "put";
+        auto expected = registry.get("binomial-crr").priceWithGreeks(env, Option(55, 250, TradeType::American, CallPut::Put),
+                                                                     DividendSchedule(std::vector<DividendEvent>{{30, 1}, {200, 1}}), 150);
+        REQUIRE(responses[0] == formatBatchResult(TradeFileFormat::Jsonl, trade, &expected, ""));
+        REQUIRE(responses[1] == R"({"id":"bad","error":"Unknown environment NONE."})");
+        REQUIRE(responses[2].rfind(R"({"id":"","error":"Environment BAD)", 0) == 0);
+        REQUIRE(responses[3].find(R"("id":"call","engine":"trinomial","steps":150)") != std::string::npos);
+        REQUIRE(server.statistics().requests == 2);
+        REQUIRE(server.statistics().errors == 2);
+    }
+    SECTION( "Identical requests are priced once" ){
+        PricingServer server(registry, settings);
+        std::string requests = acme + "\n";
+        for (int k = 0; k < 8; k++) requests += put + "\n";
+        std::istringstream in(requests);
+        std::ostringstream out;
+        server.serve(in, out);
+        auto responses = lines(out.str());
+        REQUIRE(responses.size() == 8);
+        for (auto const& response : responses) REQUIRE(response == responses[0]);
+        auto statistics = server.statistics();
+        REQUIRE(statistics.requests == 8);
+        REQUIRE(statistics.coalesced + statistics.cacheHits == 7);
+        // a new session finds the result warm
+        std::istringstream again(acme + "\n" + put + "\n");
+        std::ostringstream second;
+        server.serve(again, second);
+        REQUIRE(second.str() == responses[0] + "\n");
+        REQUIRE(server.statistics().coalesced + server.statistics().cacheHits == 8);
+    }
+    SECTION( "Dividends drawn from the content of a request" ){
+        std::string trade = R"({"id": "t", "S-T0-Price": 60, "volatility": 0.25, "risk-free-rate": 0.04, )"
+                            R"("average-dividends-per-year": 3, "strike": 60, "days-to-maturity": 400})";
+        std::string other = R"({"id": "o", "S-T0-Price": 50, "volatility": 0.2, "risk-free-rate": 0.04, )"
+                            R"("average-dividends-per-year": 3, "strike": 60, "days-to-maturity": 300})";
+        std::istringstream first(trade + "\n"), second(other + "\n" + other + "\n" + trade + "\n");
+        std::ostringstream firstOut, secondOut;
+        PricingServer(registry, settings).serve(first, firstOut);
+        PricingServer(registry, settings).serve(second, secondOut);
+        REQUIRE(lines(secondOut.str())[2] + "\n" == firstOut.str());
+    }
+    SECTION( "Concurrent clients over a Unix socket" ){
+        std::string path = "server_test.sock";
+        PricingServer server(registry, settings);
+        std::thread listener([&]{server.listen(path);});
+        // no assertion on the client threads: Catch2 assertions are not thread-safe, the replies are checked below
+        struct Reply{
+            std::string error, text;
+        };
+        auto client = [&](std::string const& requests){
+            Reply res;
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path)-1);
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            for (int attempt = 0; connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address))!=0; attempt++){
+                if (attempt==500){
+                    close(fd);
+                    res.error = "cannot connect";
+                    return res;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            if (write(fd, requests.data(), requests.size())!=static_cast<ssize_t>(requests.size()))
+                res.error = "short write";
+            shutdown(fd, SHUT_WR);
+            char buffer[256];
+            for (ssize_t count; (count = read(fd, buffer, sizeof(buffer)))>0;) res.text.append(buffer, count);
+            close(fd);
+            return res;
+        };
+        Reply other;
+        std::thread second([&]{other = client(acme + "\n" + put + "\n" + put + "\n");});
+        auto first = client(acme + "\n" + put + "\n");
+        second.join();
+        server.stop();
+        listener.join();
+        REQUIRE(first.error.empty());
+        REQUIRE(other.error.empty());
+        auto responses = lines(first.text);
+        REQUIRE(responses.size() == 1);
+        REQUIRE(lines(other.text) == std::vector<std::string>{responses[0], responses[0]});
+        REQUIRE(responses[0].rfind(R"({"id":"put","engine":"binomial-crr","steps":150,)", 0) == 0);
+        REQUIRE(server.statistics().requests == 3);
+        std::ifstream removed(path);
+        REQUIRE(!removed.is_open());
+    }
+}
+
+TEST_CASE("Asynchronous pricing", "[Async]"){
+    auto registry = EngineRegistry::withBuiltInEngines();
+    Environment env;
+    env.underlyingT0Price = 60;
+    env.volatility = 0.25;
+    env.riskFreeRate = 0.04;
+    DividendSchedule dividends(std::vector<DividendEvent>{{30, 1}, {200, 1}});
+    Option put(55, 250, TradeType::American, CallPut::Put);
+    AsyncPricer pricer(1);
+    auto const& crr = registry.get("binomial-crr");
+    PricingJob huge{env, Option(60, 3650, TradeType::American, CallPut::Put), dividends, 200000};
+    SECTION( "Results are those of the synchronous engines" ){
+        for (auto const& name : {"binomial-crr", "trinomial", "crank-nicolson", "monte-carlo", "expected-dividend"}){
+            auto const& engine = registry.get(name);
+            auto ticket = pricer.submit(engine, {env, put, dividends, 100});
+            auto result = ticket.result.get();
+            auto expected = engine.priceWithGreeks(env, put, dividends, 100);
+            REQUIRE(result.price == expected.price);
+            REQUIRE(result.greeks.delta == expected.greeks.delta);
+            REQUIRE(result.greeks.rho == expected.greeks.rho);
+        }
+        auto price = pricer.submit(crr, {env, put, dividends, 0, false}).result.get();
+        REQUIRE(price.price == crr.price(env, put, dividends, 0));
+        REQUIRE(price.steps == 250);
+    }
+    // An induction of steps levels with a cancellation point per level, as the lattice engines have: it records the
+    // last level it reached, and stops at level gate until resumed, so that the tests cancel it at a known level.
+    struct GatedEngine : PricingEngine{
+        EngineInfo engineInfo{"gated", "test induction", 1, 9, true, false};
+        long gate{40};
+        mutable std::atomic<long> reached{-1};
+        mutable std::promise<void> started;
+        std::shared_future<void> resume;
+        [[nodiscard]] EngineInfo const& info() const override {return engineInfo;}
+        [[nodiscard]] double work(Option const&, unsigned steps) const override {return steps;}
+        [[nodiscard]] double price(Environment const&, Option const&, DividendSchedule const&,
+                                   unsigned steps) const override {
+            for (long level = 0; level < static_cast<long>(steps); level++){
+                checkCancellation(level);
+                reached = level;
+                if (level==gate){
+                    started.set_value();
+                    resume.wait();
+                }
+            }
+            return 1.;
+        }
+    };
+    PricingJob gated{env, put, dividends, 1000000, false};
+    SECTION( "A cancelled job stops and frees its worker" ){
+        GatedEngine engine;
+        std::promise<void> resume;
+        engine.resume = resume.get_future().share();
+        auto started = engine.started.get_future();
+        auto ticket = pricer.submit(engine, gated);
+        auto next = pricer.submit(crr, {env, put, dividends, 100});
+        started.wait();
+        ticket.cancel();
+        resume.set_value();
+        try {
+            ticket.result.get();
+            FAIL("The job was not cancelled.");
+        } catch (PricingCancelled const& cancelled) {
+            REQUIRE(!cancelled.deadlineExpired());
+        }
+        // stopped at the first cancellation point after the cancel
+        REQUIRE(engine.reached >= engine.gate);
+        REQUIRE(engine.reached < engine.gate + static_cast<long>(cancellationInterval));
+        REQUIRE(next.result.get().price == crr.price(env, put, dividends, 100));
+    }
+    SECTION( "Deadlines" ){
+        GatedEngine engine;
+        std::promise<void> resume;
+        engine.resume = resume.get_future().share();
+        auto started = engine.started.get_future();
+        auto expiring = pricer.submit(engine, gated, std::chrono::milliseconds(50));
+        auto queued = pricer.submit(crr, huge, std::chrono::milliseconds(50));
+        // on a loaded machine the job may expire before its worker takes it, it then never reaches the gate
+        while (started.wait_for(std::chrono::milliseconds(1))!=std::future_status::ready &&
+               expiring.result.wait_for(std::chrono::seconds(0))!=std::future_status::ready){}
+        while (!expiring.token.expired() || !queued.token.expired()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        resume.set_value();
+        try {
+            expiring.result.get();
+            FAIL("The deadline was not enforced.");
+        } catch (PricingCancelled const& cancelled) {
+            REQUIRE(cancelled.deadlineExpired());
+        }
+        REQUIRE(engine.reached < engine.gate + static_cast<long>(cancellationInterval));
+        // expired while the worker was busy: never started
+        try {
+            queued.result.get();
+            FAIL("The deadline was not enforced.");
+        } catch (PricingCancelled const& cancelled) {
+            REQUIRE(cancelled.deadlineExpired());
+        }
+        auto relaxed = pricer.submit(crr, {env, put, dividends, 100}, std::chrono::seconds(60));
+        REQUIRE(relaxed.result.get().price == crr.price(env, put, dividends, 100));
+    }
+    SECTION( "Cancellation reaches the workers of parallel engines" ){
+        MonteCarloSettings settings;
+        settings.paths = 1u<<14;
+        settings.threads = 2;
+        MonteCarloEngine engine(settings);
+        CancellationToken token;
+        token.cancel();
+        CancellationScope scope(&token);
+        REQUIRE_THROWS_AS(engine.price(env, put, dividends, 2000), PricingCancelled);
+    }
+    SECTION( "Cancellation points cost nothing outside a scope" ){
+        REQUIRE(currentCancellation() == nullptr);
+        CancellationToken token;
+        {
+            CancellationScope scope(&token);
+            REQUIRE(currentCancellation() == &token);
+            token.cancel();
+            REQUIRE_NOTHROW(checkCancellation(1));
+            REQUIRE_THROWS_AS(checkCancellation(cancellationInterval), PricingCancelled);
+        }
+        REQUIRE(currentCancellation() == nullptr);
+        REQUIRE_NOTHROW(crr.price(env, put, dividends, 100));
+    }
+}
+
+TEST_CASE("Work-stealing scheduler", "[Schedule]"){
+    SECTION( "Longest first, every task once" ){
+        std::vector<double> costs{1, 5, 3, 5, 0, 2};
+        std::vector<std::size_t> order;
+        REQUIRE(parallelForWeighted(costs, 1, [&](std::size_t i){order.push_back(i);}) == 0);
+        REQUIRE(order == std::vector<std::size_t>{1, 3, 2, 5, 0, 4});
+        std::vector<std::atomic<int>> runs(1000);
+        std::vector<double> many(runs.size());
+        for (std::size_t i = 0; i < many.size(); i++) many[i] = static_cast<double>((i*7919)%101);
+        parallelForWeighted(many, 4, [&](std::size_t i){runs[i]++;});
+        for (auto const& count : runs) REQUIRE(count == 1);
+        REQUIRE_THROWS_AS(parallelForWeighted(many, 4, [](std::size_t i){
+            if (i==17) throw std::runtime_error("task");
+        }), std::runtime_error);
+    }
+    SECTION( "Idle threads steal mispredicted work" ){
+        std::vector<double> costs(16, 1.);
+        std::atomic<int> done{0};
+        auto steals = parallelForWeighted(costs, 2, [&](std::size_t i){
+            if (i==0) std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            done++;
+        });
+        REQUIRE(done == 16);
+        REQUIRE(steals > 0);
+    }
+    SECTION( "Long-dated trades are split into their bumps" ){
+        auto registry = EngineRegistry::withBuiltInEngines();
+        std::ostringstream csv;
+        csv << "id,S-T0-Price,volatility,risk-free-rate,strike,days-to-maturity,callput,european,engine,dividends\n"
+            << "long,60,0.25,0.04,60,2500,-1,-1,binomial-crr,400:1\n"
+            << "longtri,60,0.25,0.04,60,1500,-1,-1,trinomial,400:1\n";
+        for (int k = 0; k < 20; k++) csv << "s" << k << ",60,0.25,0.04," << 50+k << "," << 30+10*k << ",-1,1,,\n";
+        csv << "bad,60,0.25,0.04,60,100,-1,-1,no-such-engine,\n";
+        std::istringstream in(csv.str());
+        TradeFileReader reader(in, TradeFileFormat::Csv);
+        std::vector<BatchTrade> trades;
+        for (BatchTrade trade; reader.next(trade);) trades.push_back(trade);
+        BatchSettings settings;
+        settings.threads = 4;
+        auto groups = groupTrades(std::move(trades), settings.engine, settings.steps, settings.seed, settings.groupSize);
+        std::vector<std::optional<PricingResult>> results(groups.size()*64);
+        std::vector<std::string> errors(results.size());
+        std::mutex mutex;
+        auto splits = priceBatchGroups(groups, registry, settings, [&](BatchTrade const& trade, PricingResult const* result,
+                                                                       std::string const& error){
+            std::lock_guard<std::mutex> lock(mutex);
+            if (result) results[trade.index] = *result;
+            errors[trade.index] = error;
+        });
+        REQUIRE(splits == 2);
+        for (auto const& group : groups){
+            for (auto const& trade : group.trades){
+                if (trade.id=="bad"){
+                    REQUIRE(!results[trade.index]);
+                    REQUIRE(errors[trade.index] == "Unknown pricing engine no-such-engine.");
+                    continue;
+                }
+                auto expected = priceBatchTrade(trade, group.dividends, registry, settings.engine, settings.steps);
+                REQUIRE(results[trade.index]);
+                REQUIRE(results[trade.index]->price == expected.price);
+                REQUIRE(results[trade.index]->steps == expected.steps);
+                REQUIRE(results[trade.index]->engine == expected.engine);
+                REQUIRE(results[trade.index]->greeks.delta == expected.greeks.delta);
+                REQUIRE(results[trade.index]->greeks.gamma == expected.greeks.gamma);
+                REQUIRE(results[trade.index]->greeks.theta == expected.greeks.theta);
+                REQUIRE(results[trade.index]->greeks.vega == expected.greeks.vega);
+                REQUIRE(results[trade.index]->greeks.rho == expected.greeks.rho);
+            }
+        }
+        settings.threads = 1;
+        REQUIRE(priceBatchGroups(groups, registry, settings, [](BatchTrade const&, PricingResult const*,
+                                                                std::string const&){}) == 0);
+        // a calibrated model where the trinomial tree is cheap: only the long binomial trade is worth splitting
+        auto model = std::make_shared<CostModel>();
+        model->set("binomial-crr", EngineCost{1, 1e-1, {}, {}});
+        model->set("trinomial", EngineCost{1, 1e-9, {}, {}});
+        settings.costModel = model;
+        settings.threads = 4;
+        REQUIRE(priceBatchGroups(groups, registry, settings, [](BatchTrade const&, PricingResult const*,
+                                                                std::string const&){}) == 1);
+    }
+    SECTION( "Persistent threads steal across batches" ){
+        WorkStealingPool pool(2);
+        REQUIRE(pool.size() == 2);
+        std::promise<void> release;
+        auto released = release.get_future().share();
+        std::atomic<int> done{0};
+        auto slow = pool.submit({10., 1.}, [&](std::size_t i){
+            if (i==0) released.wait();
+            done++;
+        });
+        auto next = pool.submit(std::vector<double>(8, 1.), [&](std::size_t){done++;});
+        // the next batch is priced by the other thread while the slow task of the first one is running
+        REQUIRE(next.wait_for(std::chrono::seconds(60)) == std::future_status::ready);
+        REQUIRE(slow.wait_for(std::chrono::seconds(0)) != std::future_status::ready);
+        release.set_value();
+        slow.get();
+        next.get();
+        REQUIRE(done == 10);
+        auto failing = pool.submit({1., 1., 1.}, [](std::size_t i){
+            if (i==1) throw std::runtime_error("task");
+        });
+        REQUIRE_THROWS_AS(failing.get(), std::runtime_error);
+        REQUIRE_NOTHROW(pool.submit({}, [](std::size_t){}).get());
+        REQUIRE_NOTHROW(pool.submit({1.}, [&](std::size_t){done++;}).get());
+        REQUIRE(done == 11);
+    }
+}
+
+TEST_CASE("Sharded batch", "[Shard]"){
+    auto registry = EngineRegistry::withBuiltInEngines();
+    std::string csv = "shard_test_trades.csv", trades = "shard_test_trades.bin";
+    std::string expected = "shard_test_expected.bin", results = "shard_test_results.bin";
+    {
+        std::ofstream file(csv);
+        file << "id,S-T0-Price,volatility,risk-free-rate,average-dividends-per-year,strike,days-to-maturity,callput,engine\n";
+        for (int k = 0; k < 23; k++){
+            file << "t" << k << "," << 50 + k%20 << ",0.2,0.05,2,55," << 30 + (k*37)%300 << "," << (k%2 ? 1 : -1) << ","
+                 << (k==11 ? "no-such-engine" : "") << "\n";
+        }
+    }
+    REQUIRE(convertToBinary(csv, trades) == 23);
+    BinaryTradeFile file(trades);
+    BatchSettings settings;
+    settings.steps = 40;
+    settings.threads = 1;
+    REQUIRE(runBinaryBatch(file, expected, registry, settings).errors == 1);
+    auto sameResults = [&]{
+        BinaryResultFile a(expected), b(results);
+        REQUIRE(b.size() == a.size());
+        for (std::size_t k = 0; k < a.size(); k++)
+            REQUIRE(std::memcmp(&a[k], &b[k], sizeof(BinaryResultRecord)) == 0);
+    };
+    // stands for a remote node: runs the shards in process, the first attempt of crashShard writes garbage and fails
+    struct LocalLauncher : ShardLauncher{
+        BinaryTradeFile const& trades;
+        std::string path;
+        EngineRegistry const& registry;
+        BatchSettings settings;
+        std::size_t crashShard;
+        std::vector<std::pair<std::size_t, bool>> ended;
+        std::vector<Shard> launched;
+        std::vector<bool> retriedZeroed; // whether every retry found its range zeroed
+        LocalLauncher(BinaryTradeFile const& trades, std::string path, EngineRegistry const& registry,
+                      BatchSettings settings, std::size_t crashShard)
+                : trades(trades), path(std::move(path)), registry(registry), settings(settings), crashShard(crashShard){}
+        void launch(Shard const& shard) override {
+            launched.push_back(shard);
+            if (shard.attempt>0){
+                BinaryResultFile results(path);
+                bool zeroed{true};
+                for (auto k = shard.begin; k < shard.end; k++){
+                    auto const* bytes = reinterpret_cast<unsigned char const*>(&results[k]);
+                    zeroed = zeroed && std::all_of(bytes, bytes+sizeof(BinaryResultRecord), [](unsigned char b){return b==0;});
+                }
+                retriedZeroed.push_back(zeroed);
+            }
+            if (shard.index==crashShard && (shard.attempt==0 || crashShard==0)){
+                MappedOutputFile file(path);
+                std::memset(file.data() + sizeof(BinaryHeader) + shard.begin*sizeof(BinaryResultRecord), 0x5a,
+                            (shard.end-shard.begin)*sizeof(BinaryResultRecord));
+                ended.emplace_back(shard.index, false);
+                return;
+            }
+            runShard(trades, path, shard.begin, shard.end, registry, settings);
+            ended.emplace_back(shard.index, true);
+        }
+        std::pair<std::size_t, bool> wait() override {
+            auto res = ended.front();
+            ended.erase(ended.begin());
+            return res;
+        }
+    };
+    SECTION( "A crashed shard is retried, the results are those of one process" ){
+        LocalLauncher launcher(file, results, registry, settings, 2);
+        ShardSettings sharding;
+        sharding.shards = 4;
+        auto statistics = runShardedBatch(file, results, launcher, sharding);
+        REQUIRE(statistics.trades == 23);
+        REQUIRE(statistics.errors == 1);
+        REQUIRE(launcher.launched.size() == 5);
+        REQUIRE(launcher.launched[1].begin == 5);
+        REQUIRE(launcher.launched[1].end == 11);
+        REQUIRE(launcher.launched[4].index == 2);
+        REQUIRE(launcher.launched[4].attempt == 1);
+        REQUIRE(launcher.launched[4].deadline == std::chrono::steady_clock::time_point::max());
+        REQUIRE(launcher.retriedZeroed == std::vector<bool>{true});
+        REQUIRE(shardCount(23, sharding) == 4);
+        sharding.shards = 40;
+        REQUIRE(shardCount(23, sharding) == 23);
+        sameResults();
+    }
+    SECTION( "A shard failing every attempt fails the batch" ){
+        LocalLauncher launcher(file, results, registry, settings, 0);
+        ShardSettings sharding;
+        sharding.shards = 3;
+        sharding.retries = 1;
+        REQUIRE_THROWS_WITH(runShardedBatch(file, results, launcher, sharding), "Shard 0 (trades 0 to 7) failed 2 times.");
+        REQUIRE(launcher.launched[0].deadline == std::chrono::steady_clock::time_point::max());
+        sharding.timeout = std::chrono::seconds(60);
+        LocalLauncher timed(file, results, registry, settings, 1);
+        auto before = std::chrono::steady_clock::now();
+        runShardedBatch(file, results, timed, sharding);
+        for (auto const& shard : timed.launched) REQUIRE(shard.deadline >= before + sharding.timeout);
+        REQUIRE_THROWS_AS(runShard(file, results, 20, 24, registry, settings), std::invalid_argument);
+    }
+#ifdef BTWE_EXECUTABLE
+    SECTION( "Worker processes" ){
+        ProcessShardLauncher launcher({BTWE_EXECUTABLE, "--shard", trades, results},
+                                      {"--steps", "40", "--threads", "1"});
+        ShardSettings sharding;
+        sharding.shards = 3;
+        auto statistics = runShardedBatch(file, results, launcher, sharding);
+        REQUIRE(statistics.errors == 1);
+        sameResults();
+        // a child of the process that is not a worker keeps its exit status for its owner
+        pid_t other = fork();
+        if (other==0) _exit(7);
+        REQUIRE(runShardedBatch(file, results, launcher, sharding).errors == 1);
+        int status{0};
+        REQUIRE(waitpid(other, &status, 0) == other);
+        REQUIRE(WIFEXITED(status));
+        REQUIRE(WEXITSTATUS(status) == 7);
+        ProcessShardLauncher failing({"/bin/false"});
+        REQUIRE_THROWS_AS(runShardedBatch(file, results, failing, sharding), std::runtime_error);
+        // sleeps for its begin and end in seconds: hangs until killed at the deadline of every attempt
+        ProcessShardLauncher hanging({"/bin/sleep"});
+        sharding.shards = 1;
+        sharding.retries = 1;
+        sharding.timeout = std::chrono::milliseconds(100);
+        REQUIRE_THROWS_WITH(runShardedBatch(file, results, hanging, sharding), "Shard 0 (trades 0 to 23) failed 2 times.");
+    }
+#endif
+    std::remove(csv.c_str());
+    std::remove(trades.c_str());
+    std::remove(expected.c_str());
+    std::remove(results.c_str());
+}
+
+TEST_CASE("Progressive refinement", "[Progressive]"){
+    auto registry = EngineRegistry::withBuiltInEngines();
+    Environment env;
+    env.underlyingT0Price = 60;
+    env.volatility = 0.25;
+    env.riskFreeRate = 0.04;
+    DividendSchedule dividends(std::vector<DividendEvent>{{30, 1}, {200, 1}});
+    Option put(55, 250, TradeType::American, CallPut::Put);
+    auto const& crr = registry.get("binomial-crr");
+    auto lines = [](std::string const& text){
+        std::vector<std::string> res;
+        std::istringstream in(text);
+        for (std::string line; std::getline(in, line);) res.push_back(line);
+        return res;
+    };
+    SECTION( "Levels double their steps up to the full steps" ){
+        REQUIRE(refinementSteps(365, 16) == std::vector<unsigned>{22, 45, 91, 182, 365});
+        REQUIRE(refinementSteps(10, 16) == std::vector<unsigned>{10});
+        REQUIRE(refinementSteps(1, 0) == std::vector<unsigned>{1});
+        REQUIRE_THROWS_AS(refinementSteps(0, 16), std::invalid_argument);
+    }
+    SECTION( "The last level is the full pricing, the errors shrink" ){
+        std::vector<Refinement> levels;
+        REQUIRE(refinePricing(crr, env, put, dividends, 0, {}, [&](Refinement const& r){levels.push_back(r);}) == 4);
+        auto full = crr.priceWithGreeks(env, put, dividends, 0);
+        REQUIRE(levels.back().last);
+        REQUIRE(levels.back().result.steps == 250);
+        REQUIRE(levels.back().result.price == full.price);
+        REQUIRE(levels.back().result.greeks.delta == full.greeks.delta);
+        REQUIRE(levels.back().result.greeks.rho == full.greeks.rho);
+        for (unsigned k = 0; k < levels.size(); k++){
+            REQUIRE(levels[k].level == k);
+            REQUIRE(levels[k].last == (k+1==levels.size()));
+            REQUIRE(levels[k].priceError > 0);
+        }
+        REQUIRE(levels[0].result.steps == 31);
+        REQUIRE(levels.back().priceError < levels[0].priceError);
+        // the estimate bounds the error of the coarse price
+        REQUIRE(std::abs(levels[0].result.price-full.price) < 3*levels[0].priceError);
+    }
+    SECTION( "Refinement stops within the tolerance or once cancelled" ){
+        RefinementSettings settings;
+        settings.tolerance = 0.05;
+        std::vector<Refinement> levels;
+        auto count = refinePricing(crr, env, put, dividends, 4000, settings, [&](Refinement const& r){levels.push_back(r);});
+        REQUIRE(count < refinementSteps(4000, 16).size());
+        REQUIRE(levels.back().last);
+        REQUIRE(levels.back().priceError <= 0.05);
+        for (unsigned k = 0; k+1 < levels.size(); k++) REQUIRE(levels[k].priceError > 0.05);
+
+        // in an input file, progressive-tolerance stops the refinement; tolerance, which selects the engine, does not
+        auto full = refinementSteps(1000, 16).size();
+        auto refined = [&](std::string const& input){
+            return refinePricing(crr, env, put, dividends, 1000, refinementSettings(Config::parse(input)),
+                                 [](Refinement const&){});
+        };
+        REQUIRE(refined("progressive=1\nprogressive-tolerance=0.05\n") < full);
+        REQUIRE(refined("progressive=1\ntolerance=0.05\n") == full);
+
+        CancellationToken token;
+        CancellationScope scope(&token);
+        levels.clear();
+        REQUIRE(refinePricing(crr, env, put, dividends, 4000, {}, [&](Refinement const& r){
+            levels.push_back(r);
+            token.cancel();
+        }) == 1);
+        REQUIRE(!levels[0].last);
+        REQUIRE_THROWS_AS(refinePricing(crr, env, put, dividends, 4000, {}, [](Refinement const&){}), PricingCancelled);
+    }
+    SECTION( "Batch refinements end on the batch results" ){
+        std::ostringstream file;
+        for (int k = 0; k < 12; k++){
+            file << R"({"id": "t)" << k << R"(", "S-T0-Price": )" << 50 + k << R"(, "volatility": 0.2, "risk-free-rate": 0.05, )"
+                 << R"("average-dividends-per-year": 2, "strike": 55, "days-to-maturity": )" << 30 + 37*k
+                 << (k==5 ? R"(, "engine": "trinomial")" : "") << (k==7 ? R"(, "engine": "none")" : "") << "}\n";
+        }
+        BatchSettings settings;
+        settings.threads = 3;
+        std::istringstream batchIn(file.str()), progressiveIn(file.str());
+        std::ostringstream batchOut, progressiveOut;
+        runBatch(batchIn, batchOut, TradeFileFormat::Jsonl, registry, settings);
+        auto statistics = runProgressiveBatch(progressiveIn, progressiveOut, TradeFileFormat::Jsonl, registry, settings);
+        REQUIRE(statistics.trades == 12);
+        REQUIRE(statistics.errors == 1);
+        auto results = lines(batchOut.str());
+        auto refinements = lines(progressiveOut.str());
+        std::size_t trade{0};
+        for (auto const& line : refinements){
+            auto id = "{\"id\":\"t" + std::to_string(trade) + "\"";
+            REQUIRE(line.rfind(id, 0) == 0);
+            if (line.find("\"last\":false}")!=std::string::npos) continue;
+            auto expected = results[trade];
+            if (trade!=7){
+                REQUIRE(line.rfind(expected.substr(0, expected.size()-1) + ",\"level\":", 0) == 0);
+                REQUIRE(line.find("\"last\":true}") != std::string::npos);
+            } else {
+                REQUIRE(line == expected);
+            }
+            trade++;
+        }
+        REQUIRE(trade == 12);
+    }
+    SECTION( "Progressive server" ){
+        ServerSettings settings;
+        settings.threads = 2;
+        settings.progressive = true;
+        settings.refinement.tolerance = 0.02;
+        PricingServer server(registry, settings);
+        std::istringstream in(R"({"id": "a", "S-T0-Price": 60, "volatility": 0.25, "risk-free-rate": 0.04, )"
+                              R"("strike": 60, "days-to-maturity": 400, "dividends": "30:1"})" "\n"
+                              R"({"id": "b", "engine": "none", "S-T0-Price": 60, "volatility": 0.25, "risk-free-rate": 0.04, )"
+                              R"("strike": 60, "days-to-maturity": 40})" "\n"
+                              R"({"id": "c", "S-T0-Price": 60, "volatility": 0.25, "risk-free-rate": 0.04, )"
+                              R"("strike": 65, "days-to-maturity": 30, "dividends": "10:1"})" "\n");
+        std::ostringstream out;
+        server.serve(in, out);
+        auto responses = lines(out.str());
+        REQUIRE(responses.size() >= 4);
+        REQUIRE(responses[0].rfind(R"({"id":"a","engine":"binomial-crr","steps":25,)", 0) == 0);
+        REQUIRE(responses[0].find(R"("level":0,)") != std::string::npos);
+        std::size_t b = 0;
+        while (responses[b].rfind(R"({"id":"b")", 0)!=0) b++;
+        REQUIRE(responses[b-1].find(R"("last":true})") != std::string::npos);
+        REQUIRE(responses[b] == R"({"id":"b","error":"Unknown pricing engine none."})");
+        REQUIRE(responses.back().rfind(R"({"id":"c")", 0) == 0);
+        REQUIRE(responses.back().find(R"("last":true})") != std::string::npos);
+        REQUIRE(server.statistics().requests == 3);
+        REQUIRE(server.statistics().errors == 1);
+    }
+}
+
+TEST_CASE("Phase instrumentation", "[Instrumentation]"){
+    auto registry = EngineRegistry::withBuiltInEngines();
+    Environment env;
+    env.underlyingT0Price = 60;
+    env.volatility = 0.25;
+    env.riskFreeRate = 0.04;
+    DividendSchedule dividends(std::vector<DividendEvent>{{30, 1}, {200, 1}});
+    Option put(55, 250, TradeType::American, CallPut::Put);
+    auto const& crr = registry.get("binomial-crr");
+    auto const& trinomial = registry.get("trinomial");
+    instrumentation::reset();
+    auto result = crr.priceWithGreeks(env, put, dividends, 100);
+    std::thread([&]{(void) trinomial.price(env, put, dividends, 50);}).join();
+    std::vector<Option> strikes{put, Option(60, 250, TradeType::American, CallPut::Put), Option(65, 250, TradeType::European, CallPut::Call)};
+    std::vector<PricingResult> results(strikes.size());
+    crr.priceGroupWithGreeks(env, strikes.data(), strikes.size(), dividends, 80, results.data());
+    REQUIRE(result.price > 0);
+    auto find = [](std::string const& engine, instrumentation::Phase phase){
+        for (auto const& s : instrumentation::phaseStatistics()) if (s.engine==engine && s.phase==phase) return s;
+        return instrumentation::PhaseStatistics{};
+    };
+    std::ostringstream summary, trace;
+    instrumentation::writeSummary(summary);
+    instrumentation::writeChromeTrace(trace);
+    REQUIRE(trace.str().rfind("{\"traceEvents\":[", 0) == 0);
+    if (!instrumentation::enabled){
+        REQUIRE(instrumentation::phaseStatistics().empty());
+        REQUIRE(trace.str().find("\"ph\"") == std::string::npos);
+        return;
+    }
+    SECTION( "Phases are counted per engine" ){
+        using instrumentation::Phase;
+        auto induction = find("binomial-crr", Phase::Induction);
+        auto maturity = find("binomial-crr", Phase::Maturity);
+        REQUIRE(induction.calls >= 11);
+        REQUIRE(maturity.calls == induction.calls);
+        // 11 inductions of 100 steps for the Greeks of one option, 9 of 80 steps for the three options of the group
+        REQUIRE(induction.nodes == 11*100*101/2 + 9*3*80*81/2);
+        REQUIRE(induction.nanoseconds > 0);
+        auto greeks = find("binomial-crr", Phase::Greeks);
+        REQUIRE(greeks.calls == 1 + 8);
+        REQUIRE(greeks.nodes == 1 + 8*3);
+        // a greeks phase lasts at least as long as the inductions of the bumps it runs, all but the two base prices
+        auto const& record = *instrumentation::detail::activeRecord();
+        std::vector<instrumentation::detail::TraceEvent> events(record.events.get(),
+                                                                record.events.get() + record.eventCount.load());
+        std::size_t nested{0};
+        for (auto const& outer : events){
+            if (outer.phase!=Phase::Greeks) continue;
+            std::uint64_t inner{0};
+            for (auto const& event : events){
+                if (event.phase!=Phase::Induction || event.start<outer.start ||
+                    event.start+event.duration>outer.start+outer.duration) continue;
+                inner += event.duration;
+                nested++;
+            }
+            REQUIRE(inner > 0);
+            REQUIRE(outer.duration >= inner);
+        }
+        REQUIRE(nested == induction.calls - 2);
+        // the trinomial tree ran on another thread
+        REQUIRE(find("trinomial", Phase::Build).calls == 1);
+        REQUIRE(find("trinomial", Phase::Build).bytes >= 51*51*sizeof(TrinomialTreeNode));
+        REQUIRE(find("trinomial", Phase::Underlying).nodes == 51*51);
+        REQUIRE(find("trinomial", Phase::Maturity).nodes == 101);
+        REQUIRE(find("trinomial", Phase::Induction).nodes == 50*50);
+        REQUIRE(find("none", Phase::Induction).calls == 0);
+    }
+    SECTION( "Heap blocks are counted at the allocator" ){
+        using instrumentation::Phase;
+        instrumentation::reset();
+        {
+            BTWE_PHASE(Paths, 0);
+            std::vector<double> buffer;
+            buffer.reserve(1000);
+            buffer.resize(500); // within the capacity: no new block
+            buffer.reserve(800);
+        }
+        REQUIRE(find("none", Phase::Paths).bytes == 1000*sizeof(double));
+        MonteCarloSettings settings;
+        settings.paths = 1024;
+        settings.steps = 20;
+        settings.threads = 1;
+        (void) MonteCarloEngine(settings).price(env, put, dividends, 20);
+        // the paths, outside any phase, and the buffers of the blocks, which no estimate covered
+        REQUIRE(find("monte-carlo", Phase::Build).bytes >= 21*1024*sizeof(double));
+        REQUIRE(find("monte-carlo", Phase::Paths).bytes > 0);
+    }
+    SECTION( "Records of ended threads are reused" ){
+        using instrumentation::Phase;
+        auto records = instrumentation::threadRecords();
+        for (int k = 0; k < 50; k++) parallelFor(4, 4, [](std::size_t){BTWE_PHASE(Paths, 1);});
+        REQUIRE(find("none", Phase::Paths).calls == 200);
+        REQUIRE(instrumentation::threadRecords() <= records + 3);
+    }
+    SECTION( "Summary and Chrome trace" ){
+        REQUIRE(summary.str().find("binomial-crr") != std::string::npos);
+        REQUIRE(summary.str().find("induction") != std::string::npos);
+        auto text = trace.str();
+        REQUIRE(text.find(R"({"name":"induction","cat":"trinomial","ph":"X","ts":)") != std::string::npos);
+        REQUIRE(text.find(R"("name":"greeks","cat":"binomial-crr")") != std::string::npos);
+        std::string end = "\n],\"displayTimeUnit\":\"ns\"}\n";
+        REQUIRE(text.substr(text.size()-end.size()) == end);
+        REQUIRE(instrumentation::droppedTraceEvents() == 0);
+        instrumentation::reset();
+        REQUIRE(instrumentation::phaseStatistics().empty());
+    }
+}